@@ -3,6 +3,7 @@
 
 #include "id_cache.hpp"
 #include <cstdint>
+#include <algorithm>
 #include <limits>
 #include <unordered_map>
 #include <vector>
@@ -40,6 +41,17 @@ public:
     return it->second;
   }
 
+  void remove(AstNodeIndex node_index) {
+    m_nodes.erase(std::remove(m_nodes.begin(), m_nodes.end(), node_index), m_nodes.end());
+    for (auto it = m_map.begin(); it != m_map.end();) {
+      if (it->second == node_index) {
+        it = m_map.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
   const std::vector<AstNodeIndex>& get_nodes() const { return m_nodes;}
 
 private:
@@ -52,15 +64,18 @@ struct AstNode {
   enum class Kind {
     None, Type, Value, 
     I8Type, I16Type, I32Type, U8Type, U16Type, U32Type, F32Type, F64Type, 
-    StructType, UnionType,
+    F32x4Type, F32x8Type, I32x4Type,
+    StructType, UnionType, ArrayType, SliceType,
     FunType, FunTypeWithNamedParams, LocalVariable, GlobalVariable, StringLiteral, CharLiteral,
     I8Literal, I16Literal, I32Literal, U8Literal, U16Literal, U32Literal, 
     F32Literal, F64Literal,
     AssignExpr, EqualExpr, GreatExpr, GreatOrEqualExpr, LessExpr, LessOrEqualExpr, 
-    ParenthExpr, NegExpr,
+    AddExpr, SubExpr, MulExpr, DivExpr,
+    ParenthExpr, NegExpr, FieldExpr, CallExpr, VectorExpr, LaneExpr, ShuffleExpr,
+    IndexExpr, SliceExpr, LengthExpr, NewExpr, SpawnExpr, JoinExpr,
     StructField, UnionField,
     Function, Struct, Union, BlockScope, GlobalScope,
-    VariableDeclStmt, BlockStmt, FunctionDeclStmt, StructDeclStmt, UnionDeclStmt, IfElseStmt, WhileStmt, ExprStmt, ReturnStmt,
+    VariableDeclStmt, BlockStmt, FunctionDeclStmt, StructDeclStmt, UnionDeclStmt, IfElseStmt, WhileStmt, RegionStmt, ExprStmt, ReturnStmt,
   };
   enum class StatementKind {};
 
@@ -84,6 +99,7 @@ struct AstNode {
       case AstNode::Kind::UnionDeclStmt:
       case AstNode::Kind::IfElseStmt:
       case AstNode::Kind::WhileStmt:
+      case AstNode::Kind::RegionStmt:
       case AstNode::Kind::ExprStmt:
       case AstNode::Kind::ReturnStmt:
         return true;
@@ -102,6 +118,21 @@ struct AstNode {
       case AstNode::Kind::GreatOrEqualExpr:
       case AstNode::Kind::LessExpr:
       case AstNode::Kind::LessOrEqualExpr:
+      case AstNode::Kind::AddExpr:
+      case AstNode::Kind::SubExpr:
+      case AstNode::Kind::MulExpr:
+      case AstNode::Kind::DivExpr:
+      case AstNode::Kind::FieldExpr:
+      case AstNode::Kind::CallExpr:
+      case AstNode::Kind::VectorExpr:
+      case AstNode::Kind::LaneExpr:
+      case AstNode::Kind::ShuffleExpr:
+      case AstNode::Kind::IndexExpr:
+      case AstNode::Kind::SliceExpr:
+      case AstNode::Kind::LengthExpr:
+      case AstNode::Kind::NewExpr:
+      case AstNode::Kind::SpawnExpr:
+      case AstNode::Kind::JoinExpr:
         return true;
       default:
         return false;
@@ -135,8 +166,13 @@ struct AstNode {
       case AstNode::Kind::U32Type: 
       case AstNode::Kind::F32Type:
       case AstNode::Kind::F64Type:
+      case AstNode::Kind::F32x4Type:
+      case AstNode::Kind::F32x8Type:
+      case AstNode::Kind::I32x4Type:
       case AstNode::Kind::StructType:
       case AstNode::Kind::UnionType:
+      case AstNode::Kind::ArrayType:
+      case AstNode::Kind::SliceType:
       case AstNode::Kind::FunType:
         return true;
       default: 
@@ -180,11 +216,19 @@ struct AstNode {
       case AstNode::Kind::Function:
       case AstNode::Kind::Struct:
       case AstNode::Kind::Union:
+      case AstNode::Kind::BlockScope:
+      case AstNode::Kind::GlobalScope:
         delete scope.dict;
         break;
       case AstNode::Kind::BlockStmt:
         delete block_stmt.stmts;
         break;
+      case AstNode::Kind::CallExpr:
+        delete call_expr.args;
+        break;
+      case AstNode::Kind::VectorExpr:
+        delete vector_expr.args;
+        break;
       default:
         break;
     }
@@ -277,12 +321,87 @@ struct StructOrUnion {
     UnaryExpr parenth_expr;
     UnaryExpr neg_expr;
 
+    struct {
+      AstNodeIndex expr;
+      AstNodeIndex field;
+    } field_expr;
+
+    struct {
+      AstNodeIndex function;
+      std::vector<AstNodeIndex>* args;
+
+      void add_arg(AstNodeIndex node_idx) {
+        if (!args) args = new std::vector<AstNodeIndex>();
+        args->emplace_back(node_idx);
+      }
+    } call_expr;
+
+    // f32x4(x) sets every lane to x, f32x4(a, b, c, d) one lane each
+    struct {
+      Value value;
+      std::vector<AstNodeIndex>* args;
+
+      void add_arg(AstNodeIndex node_idx) {
+        if (!args) args = new std::vector<AstNodeIndex>();
+        args->emplace_back(node_idx);
+      }
+    } vector_expr;
+
+    // v[lane], the lane is a constant
+    struct {
+      AstNodeIndex expr;
+      uint32_t lane;
+    } lane_expr;
+
+    // shuffle(v, ...), lane i of the result is lane (lanes >> 4 * i & 15) of
+    // v, count lanes are given
+    struct {
+      AstNodeIndex expr;
+      uint32_t lanes;
+      uint32_t count;
+    } shuffle_expr;
+
+    // a[i], the element of an array or slice; check_expr turns indexing a
+    // vector by a literal into a LaneExpr
+    struct {
+      AstNodeIndex expr;
+      AstNodeIndex index;
+    } index_expr;
+
+    // a[low:high], the elements low up to high of an array or slice; the
+    // type is the SliceType given while checking
+    struct {
+      Value value;
+      AstNodeIndex expr;
+      AstNodeIndex low;
+      AstNodeIndex high;
+    } slice_expr;
+
+    // a.len of an array or slice
+    UnaryExpr length_expr;
+
+    // new [T; n], n zeroed elements allocated in the innermost region; the
+    // type is a SliceType of T
+    struct {
+      Value value;
+      AstNodeIndex length;
+    } new_expr;
+
+    // spawn f(args), starts the CallExpr as a task and is its i32 handle
+    UnaryExpr spawn_expr;
+    // join(task), waits for the task and is its i32 result
+    UnaryExpr join_expr;
+
     BinaryExpr assign_expr;
     BinaryExpr equal_expr;
     BinaryExpr great_expr;
     BinaryExpr great__or_equal_expr;
     BinaryExpr less_expr;
     BinaryExpr less_or_equal_expr;
+    BinaryExpr add_expr;
+    BinaryExpr sub_expr;
+    BinaryExpr mul_expr;
+    BinaryExpr div_expr;
     StringLiteral string_literal;
     CharLiteral char_literal;
     NumberLiteral<int8_t> i8_literal;
@@ -292,6 +411,8 @@ struct StructOrUnion {
     NumberLiteral<uint8_t> u8_literal;
     NumberLiteral<uint16_t> u16_literal;
     NumberLiteral<uint32_t> u32_literal;
+    NumberLiteral<float> f32_literal;
+    NumberLiteral<double> f64_literal;
 
     FunType fun_type;
     FunTypeWithNamedParams fun_type_with_named_params;
@@ -300,6 +421,12 @@ struct StructOrUnion {
       AstNodeIndex struct_scope;
     } struct_type;
 
+    // [element; length] of scalar elements, slices [element] have no length
+    struct {
+      AstNodeIndex element;
+      uint32_t length;
+    } array_type;
+
     struct {
       Value value;
       IdIndex name;
@@ -321,6 +448,7 @@ struct StructOrUnion {
     struct {
       Scope scope;
       AstNodeIndex function_type_with_named_params;
+      AstNodeIndex block_stmt;
     } function;
 
         StructOrUnion struc;
@@ -341,6 +469,10 @@ struct StructOrUnion {
       }
     } block_stmt;
 
+    struct {
+      AstNodeIndex expr;
+    } expr_stmt;
+
     struct {
       AstNodeIndex expr;
     } return_stmt;
@@ -356,6 +488,11 @@ struct StructOrUnion {
       AstNodeIndex stmt;
     } while_stmt;
 
+    // region block, what new allocates in the block is freed when it ends
+    struct {
+      AstNodeIndex stmt;
+    } region_stmt;
+
   };
 };
 
@@ -0,0 +1,416 @@
+#include "ast_dce.hpp"
+#include "ast_types.hpp"
+
+AstDceStats AstDce::run(AstNodeIndex global_scope, const std::vector<AstNodeIndex>& roots) {
+  m_stats = AstDceStats{};
+  m_live_functions.clear();
+  m_live_structs.clear();
+  for (auto root : roots) mark_function(root);
+  while (!m_worklist.empty()) {
+    const auto function = m_worklist.back();
+    m_worklist.pop_back();
+    mark_uses(function);
+  }
+
+  for (auto function : m_live_functions) {
+    while (remove_unused_variables(function)) {}
+  }
+
+  // structs may have lost their last user with the removed variables
+  m_live_structs.clear();
+  for (auto function : m_live_functions) mark_uses(function);
+
+  auto* dict = m_ast[global_scope].scope.dict;
+  if (!dict) return m_stats;
+  const auto nodes = dict->get_nodes();
+  for (auto node : nodes) {
+    const auto kind = m_ast[node].kind;
+    if (kind == AstNode::Kind::Function && !m_live_functions.count(node)) {
+      dict->remove(node);
+      remove_function(node);
+      ++m_stats.functions_removed;
+    } else if (kind == AstNode::Kind::Struct && !m_live_structs.count(node)) {
+      dict->remove(node);
+      remove_struct(node);
+      ++m_stats.structs_removed;
+    }
+  }
+  return m_stats;
+}
+
+void AstDce::mark_function(AstNodeIndex function) {
+  if (m_live_functions.insert(function).second) m_worklist.emplace_back(function);
+}
+
+void AstDce::mark_type(AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex || m_ast[type].kind != AstNode::Kind::StructType) return;
+  const auto struc = m_ast[type].struct_type.struct_scope;
+  if (!m_live_structs.insert(struc).second) return;
+  if (const auto* dict = m_ast[struc].scope.dict) {
+    for (auto field : dict->get_nodes()) mark_type(m_ast[field].struct_field.value.type);
+  }
+}
+
+void AstDce::mark_uses(AstNodeIndex node) {
+  if (node == UndefinedAstNodeIndex) return;
+  const auto& n = m_ast[node];
+  switch (n.kind) {
+    case AstNode::Kind::Function: {
+      const auto& fun_type = m_ast[n.function.function_type_with_named_params].fun_type_with_named_params.fun_type;
+      mark_type(fun_type.return_type);
+      if (fun_type.param_types) {
+        for (auto type : *fun_type.param_types) mark_type(type);
+      }
+      mark_uses(n.function.block_stmt);
+      break;
+    }
+    case AstNode::Kind::BlockStmt:
+      if (n.block_stmt.stmts) {
+        for (auto stmt : *n.block_stmt.stmts) mark_uses(stmt);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt:
+      mark_type(m_ast[n.variable_decl_stmt.variable].local_variable.value.type);
+      mark_uses(n.variable_decl_stmt.init_expr);
+      break;
+    case AstNode::Kind::ExprStmt:
+      mark_uses(n.expr_stmt.expr);
+      break;
+    case AstNode::Kind::ReturnStmt:
+      mark_uses(n.return_stmt.expr);
+      break;
+    case AstNode::Kind::IfElseStmt:
+      mark_uses(n.if_else_stmt.expr);
+      mark_uses(n.if_else_stmt.stmt);
+      mark_uses(n.if_else_stmt.else_stmt);
+      break;
+    case AstNode::Kind::WhileStmt:
+      mark_uses(n.while_stmt.expr);
+      mark_uses(n.while_stmt.stmt);
+      break;
+    case AstNode::Kind::RegionStmt:
+      mark_uses(n.region_stmt.stmt);
+      break;
+    case AstNode::Kind::CallExpr:
+      mark_function(n.call_expr.function);
+      if (n.call_expr.args) {
+        for (auto arg : *n.call_expr.args) mark_uses(arg);
+      }
+      break;
+    case AstNode::Kind::FieldExpr:
+      mark_uses(n.field_expr.expr);
+      break;
+    case AstNode::Kind::VectorExpr:
+      for (auto arg : *n.vector_expr.args) mark_uses(arg);
+      break;
+    case AstNode::Kind::LaneExpr:
+      mark_uses(n.lane_expr.expr);
+      break;
+    case AstNode::Kind::ShuffleExpr:
+      mark_uses(n.shuffle_expr.expr);
+      break;
+    case AstNode::Kind::SliceExpr:
+      mark_uses(n.slice_expr.expr);
+      mark_uses(n.slice_expr.low);
+      mark_uses(n.slice_expr.high);
+      break;
+    case AstNode::Kind::LengthExpr:
+      mark_uses(n.length_expr.expr);
+      break;
+    case AstNode::Kind::NewExpr:
+      mark_uses(n.new_expr.length);
+      break;
+    case AstNode::Kind::SpawnExpr:
+      mark_uses(n.spawn_expr.expr);
+      break;
+    case AstNode::Kind::JoinExpr:
+      mark_uses(n.join_expr.expr);
+      break;
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      mark_uses(n.parenth_expr.expr);
+      break;
+    default:
+      if (n.is_expr()) {
+        mark_uses(n.add_expr.left);
+        mark_uses(n.add_expr.right);
+      }
+      break;
+  }
+}
+
+bool AstDce::remove_unused_variables(AstNodeIndex function) {
+  m_variables.clear();
+  collect_variables(m_ast[function].function.block_stmt, UndefinedAstNodeIndex);
+
+  bool changed = false;
+  for (auto& [variable, info] : m_variables) {
+    if (!info.has_decl || info.reads) continue;
+    for (auto& [stmt, block] : info.defs) {
+      auto& stmts = *m_ast[block].block_stmt.stmts;
+      stmts.erase(std::remove(stmts.begin(), stmts.end(), stmt), stmts.end());
+      remove_stmt(stmt);
+    }
+    ++m_stats.variables_removed;
+    changed = true;
+  }
+  return changed;
+}
+
+void AstDce::collect_variables(AstNodeIndex stmt, AstNodeIndex parent_block) {
+  if (stmt == UndefinedAstNodeIndex) return;
+  const auto& n = m_ast[stmt];
+  switch (n.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (n.block_stmt.stmts) {
+        for (auto child : *n.block_stmt.stmts) collect_variables(child, stmt);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      auto& info = m_variables[n.variable_decl_stmt.variable];
+      info.has_decl = true;
+      info.defs.emplace_back(stmt, parent_block);
+      const auto init = n.variable_decl_stmt.init_expr;
+      if (parent_block == UndefinedAstNodeIndex || (init != UndefinedAstNodeIndex && !is_pure(init))) ++info.reads;
+      if (init != UndefinedAstNodeIndex) collect_reads(init);
+      break;
+    }
+    case AstNode::Kind::ExprStmt: {
+      const auto& expr = m_ast[n.expr_stmt.expr];
+      if (expr.kind == AstNode::Kind::AssignExpr && parent_block != UndefinedAstNodeIndex
+          && m_ast[expr.assign_expr.left].kind == AstNode::Kind::LocalVariable && is_pure(expr.assign_expr.right)) {
+        m_variables[expr.assign_expr.left].defs.emplace_back(stmt, parent_block);
+        collect_reads(expr.assign_expr.right);
+      } else {
+        collect_reads(n.expr_stmt.expr);
+      }
+      break;
+    }
+    case AstNode::Kind::ReturnStmt:
+      collect_reads(n.return_stmt.expr);
+      break;
+    case AstNode::Kind::IfElseStmt:
+      collect_reads(n.if_else_stmt.expr);
+      collect_variables(n.if_else_stmt.stmt, UndefinedAstNodeIndex);
+      collect_variables(n.if_else_stmt.else_stmt, UndefinedAstNodeIndex);
+      break;
+    case AstNode::Kind::WhileStmt:
+      collect_reads(n.while_stmt.expr);
+      collect_variables(n.while_stmt.stmt, UndefinedAstNodeIndex);
+      break;
+    case AstNode::Kind::RegionStmt:
+      collect_variables(n.region_stmt.stmt, UndefinedAstNodeIndex);
+      break;
+    default:
+      break;
+  }
+}
+
+void AstDce::collect_reads(AstNodeIndex expr) {
+  if (expr == UndefinedAstNodeIndex) return;
+  const auto& n = m_ast[expr];
+  switch (n.kind) {
+    case AstNode::Kind::LocalVariable:
+      ++m_variables[expr].reads;
+      break;
+    case AstNode::Kind::CallExpr:
+      if (n.call_expr.args) {
+        for (auto arg : *n.call_expr.args) collect_reads(arg);
+      }
+      break;
+    case AstNode::Kind::FieldExpr:
+      collect_reads(n.field_expr.expr);
+      break;
+    case AstNode::Kind::VectorExpr:
+      for (auto arg : *n.vector_expr.args) collect_reads(arg);
+      break;
+    case AstNode::Kind::LaneExpr:
+      collect_reads(n.lane_expr.expr);
+      break;
+    case AstNode::Kind::ShuffleExpr:
+      collect_reads(n.shuffle_expr.expr);
+      break;
+    case AstNode::Kind::SliceExpr:
+      collect_reads(n.slice_expr.expr);
+      collect_reads(n.slice_expr.low);
+      collect_reads(n.slice_expr.high);
+      break;
+    case AstNode::Kind::LengthExpr:
+      collect_reads(n.length_expr.expr);
+      break;
+    case AstNode::Kind::NewExpr:
+      collect_reads(n.new_expr.length);
+      break;
+    case AstNode::Kind::SpawnExpr:
+      collect_reads(n.spawn_expr.expr);
+      break;
+    case AstNode::Kind::JoinExpr:
+      collect_reads(n.join_expr.expr);
+      break;
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      collect_reads(n.parenth_expr.expr);
+      break;
+    default:
+      // the target of a nested assignment counts as read, it stays
+      if (n.is_expr()) {
+        collect_reads(n.add_expr.left);
+        collect_reads(n.add_expr.right);
+      }
+      break;
+  }
+}
+
+bool AstDce::is_pure(AstNodeIndex expr) const {
+  const auto& n = m_ast[expr];
+  switch (n.kind) {
+    case AstNode::Kind::CallExpr:
+    case AstNode::Kind::AssignExpr:
+    case AstNode::Kind::NewExpr:
+    case AstNode::Kind::SpawnExpr:
+    case AstNode::Kind::JoinExpr:
+    // indices are checked against the length
+    case AstNode::Kind::IndexExpr:
+    case AstNode::Kind::SliceExpr:
+      return false;
+    case AstNode::Kind::DivExpr:
+      // integers trap on a zero divisor
+      if (!ir_is_float(ir_element_type(ast_expr_type(m_ast, expr)))) return false;
+      return is_pure(n.div_expr.left) && is_pure(n.div_expr.right);
+    case AstNode::Kind::FieldExpr:
+      return is_pure(n.field_expr.expr);
+    case AstNode::Kind::VectorExpr:
+      return std::all_of(n.vector_expr.args->begin(), n.vector_expr.args->end(),
+                         [this](AstNodeIndex arg) { return is_pure(arg); });
+    case AstNode::Kind::LaneExpr:
+      return is_pure(n.lane_expr.expr);
+    case AstNode::Kind::ShuffleExpr:
+      return is_pure(n.shuffle_expr.expr);
+    case AstNode::Kind::LengthExpr:
+      return is_pure(n.length_expr.expr);
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      return is_pure(n.parenth_expr.expr);
+    default:
+      if (n.is_expr()) return is_pure(n.add_expr.left) && is_pure(n.add_expr.right);
+      return true;
+  }
+}
+
+void AstDce::remove_function(AstNodeIndex function) {
+  const auto& n = m_ast[function].function;
+  remove_stmt(n.block_stmt);
+  if (n.scope.dict) {
+    for (auto node : n.scope.dict->get_nodes()) {
+      if (m_ast[node].kind == AstNode::Kind::LocalVariable) remove_node(node);
+    }
+  }
+  remove_node(n.function_type_with_named_params);
+  remove_node(function);
+}
+
+void AstDce::remove_struct(AstNodeIndex struc) {
+  if (const auto* dict = m_ast[struc].scope.dict) {
+    for (auto field : dict->get_nodes()) remove_node(field);
+  }
+  remove_node(struc);
+}
+
+// statements own their expressions and declared variables; variables,
+// functions and struct fields referenced from expressions are not owned
+void AstDce::remove_stmt(AstNodeIndex stmt) {
+  if (stmt == UndefinedAstNodeIndex) return;
+  const auto& n = m_ast[stmt];
+  switch (n.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (n.block_stmt.stmts) {
+        for (auto child : *n.block_stmt.stmts) remove_stmt(child);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt:
+      remove_expr(n.variable_decl_stmt.init_expr);
+      remove_node(n.variable_decl_stmt.variable);
+      break;
+    case AstNode::Kind::ExprStmt:
+      remove_expr(n.expr_stmt.expr);
+      break;
+    case AstNode::Kind::ReturnStmt:
+      remove_expr(n.return_stmt.expr);
+      break;
+    case AstNode::Kind::IfElseStmt:
+      remove_expr(n.if_else_stmt.expr);
+      remove_stmt(n.if_else_stmt.stmt);
+      remove_stmt(n.if_else_stmt.else_stmt);
+      break;
+    case AstNode::Kind::WhileStmt:
+      remove_expr(n.while_stmt.expr);
+      remove_stmt(n.while_stmt.stmt);
+      break;
+    case AstNode::Kind::RegionStmt:
+      remove_stmt(n.region_stmt.stmt);
+      break;
+    default:
+      break;
+  }
+  remove_node(stmt);
+}
+
+void AstDce::remove_expr(AstNodeIndex expr) {
+  if (expr == UndefinedAstNodeIndex) return;
+  const auto& n = m_ast[expr];
+  switch (n.kind) {
+    case AstNode::Kind::LocalVariable:
+    case AstNode::Kind::GlobalVariable:
+      return;
+    case AstNode::Kind::CallExpr:
+      if (n.call_expr.args) {
+        for (auto arg : *n.call_expr.args) remove_expr(arg);
+      }
+      break;
+    case AstNode::Kind::FieldExpr:
+      remove_expr(n.field_expr.expr);
+      break;
+    case AstNode::Kind::VectorExpr:
+      for (auto arg : *n.vector_expr.args) remove_expr(arg);
+      break;
+    case AstNode::Kind::LaneExpr:
+      remove_expr(n.lane_expr.expr);
+      break;
+    case AstNode::Kind::ShuffleExpr:
+      remove_expr(n.shuffle_expr.expr);
+      break;
+    case AstNode::Kind::SliceExpr:
+      remove_expr(n.slice_expr.expr);
+      remove_expr(n.slice_expr.low);
+      remove_expr(n.slice_expr.high);
+      break;
+    case AstNode::Kind::LengthExpr:
+      remove_expr(n.length_expr.expr);
+      break;
+    case AstNode::Kind::NewExpr:
+      remove_expr(n.new_expr.length);
+      break;
+    case AstNode::Kind::SpawnExpr:
+      remove_expr(n.spawn_expr.expr);
+      break;
+    case AstNode::Kind::JoinExpr:
+      remove_expr(n.join_expr.expr);
+      break;
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      remove_expr(n.parenth_expr.expr);
+      break;
+    default:
+      if (n.is_expr()) {
+        remove_expr(n.add_expr.left);
+        remove_expr(n.add_expr.right);
+      }
+      break;
+  }
+  remove_node(expr);
+}
+
+void AstDce::remove_node(AstNodeIndex node) {
+  m_ast.remove(node);
+  ++m_stats.nodes_removed;
+}
@@ -0,0 +1,64 @@
+#ifndef AST_DCE_HPP
+#define AST_DCE_HPP
+
+#include "ast.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct AstDceStats {
+  uint32_t functions_removed = 0;
+  uint32_t structs_removed = 0;
+  uint32_t variables_removed = 0;
+  uint32_t nodes_removed = 0;
+};
+
+// Dead declaration elimination on the Ast, run before lowering so that later
+// phases never see the removed code. Functions not reachable through calls
+// from the roots and structs not used by any remaining function are dropped
+// from the global scope. Inside the remaining functions, locals that are
+// never read lose their declaration and every `x = expr;` statement storing
+// to them, as long as the initializers have no calls, nested assignments,
+// integer divisions or indexing, which may trap.
+class AstDce {
+public:
+  AstDce(Ast& ast) : m_ast(ast) {}
+  AstDce(const AstDce&) = delete;
+  AstDce(AstDce&&) = delete;
+  AstDce& operator=(const AstDce&) = delete;
+  AstDce& operator=(AstDce&&) = delete;
+
+  AstDceStats run(AstNodeIndex global_scope, const std::vector<AstNodeIndex>& roots);
+
+private:
+  struct Variable {
+    uint32_t reads = 0;
+    // statements defining the variable together with their BlockStmt
+    std::vector<std::pair<AstNodeIndex, AstNodeIndex>> defs;
+    bool has_decl = false;
+  };
+
+  Ast& m_ast;
+  AstDceStats m_stats;
+  std::unordered_set<AstNodeIndex> m_live_functions;
+  std::unordered_set<AstNodeIndex> m_live_structs;
+  std::vector<AstNodeIndex> m_worklist;
+  std::unordered_map<AstNodeIndex, Variable> m_variables;
+
+  void mark_function(AstNodeIndex function);
+  void mark_type(AstNodeIndex type);
+  void mark_uses(AstNodeIndex node);
+  bool remove_unused_variables(AstNodeIndex function);
+  void collect_variables(AstNodeIndex stmt, AstNodeIndex parent_block);
+  void collect_reads(AstNodeIndex expr);
+  bool is_pure(AstNodeIndex expr) const;
+
+  void remove_function(AstNodeIndex function);
+  void remove_struct(AstNodeIndex struc);
+  void remove_stmt(AstNodeIndex stmt);
+  void remove_expr(AstNodeIndex expr);
+  void remove_node(AstNodeIndex node);
+};
+
+#endif  // AST_DCE_HPP
@@ -0,0 +1,91 @@
+#include "ast_types.hpp"
+#include "lowering.hpp"
+
+IrType ast_value_type(const Ast& ast, AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex) return IrType::Void;
+  return Lowering::to_ir_type(ast[type].kind);
+}
+
+uint32_t ast_type_size(const Ast& ast, AstNodeIndex type) {
+  if (ast[type].kind == AstNode::Kind::ArrayType) {
+    return ast[type].array_type.length * ast_type_size(ast, ast[type].array_type.element);
+  }
+  if (ast[type].kind != AstNode::Kind::StructType) return ir_type_size(ast_value_type(ast, type));
+
+  const auto* dict = ast[ast[type].struct_type.struct_scope].scope.dict;
+  uint32_t size = 0;
+  if (dict) {
+    for (auto field : dict->get_nodes()) {
+      const auto& field_node = ast[field].struct_field;
+      size = std::max(size, field_node.offset + ast_type_size(ast, field_node.value.type));
+    }
+  }
+  return size;
+}
+
+AstNodeIndex ast_sequence_type(const Ast& ast, AstNodeIndex expr) {
+  while (ast[expr].kind == AstNode::Kind::ParenthExpr) expr = ast[expr].parenth_expr.expr;
+  auto type = UndefinedAstNodeIndex;
+  if (ast[expr].kind == AstNode::Kind::LocalVariable) type = ast[expr].local_variable.value.type;
+  if (ast[expr].kind == AstNode::Kind::SliceExpr) type = ast[expr].slice_expr.value.type;
+  if (ast[expr].kind == AstNode::Kind::NewExpr) type = ast[expr].new_expr.value.type;
+  if (type == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  const auto kind = ast[type].kind;
+  return kind == AstNode::Kind::ArrayType || kind == AstNode::Kind::SliceType ? type : UndefinedAstNodeIndex;
+}
+
+IrType ast_expr_type(const Ast& ast, AstNodeIndex expr) {
+  const auto& node = ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal:
+    case AstNode::Kind::CharLiteral:
+      return IrType::I8;
+    case AstNode::Kind::I16Literal: return IrType::I16;
+    case AstNode::Kind::U8Literal: return IrType::U8;
+    case AstNode::Kind::U16Literal: return IrType::U16;
+    case AstNode::Kind::U32Literal: return IrType::U32;
+    case AstNode::Kind::F32Literal: return IrType::F32;
+    case AstNode::Kind::F64Literal: return IrType::F64;
+    case AstNode::Kind::LocalVariable: {
+      const auto type = ast_value_type(ast, node.local_variable.value.type);
+      return type == IrType::Void ? IrType::I32 : type;
+    }
+    case AstNode::Kind::FieldExpr: {
+      const auto type = ast_value_type(ast, ast[node.field_expr.field].struct_field.value.type);
+      return type == IrType::Void ? IrType::I32 : type;
+    }
+    case AstNode::Kind::CallExpr: {
+      const auto& fun_type = ast[ast[node.call_expr.function].function.function_type_with_named_params];
+      return ast_value_type(ast, fun_type.fun_type_with_named_params.fun_type.return_type);
+    }
+    case AstNode::Kind::EqualExpr:
+    case AstNode::Kind::GreatExpr:
+    case AstNode::Kind::GreatOrEqualExpr:
+    case AstNode::Kind::LessExpr:
+    case AstNode::Kind::LessOrEqualExpr: {
+      const auto type = ast_expr_type(ast, node.equal_expr.left);
+      return ir_is_vector(type) ? type : IrType::Bool;
+    }
+    case AstNode::Kind::VectorExpr:
+      return ast_value_type(ast, node.vector_expr.value.type);
+    case AstNode::Kind::LaneExpr:
+      return ir_element_type(ast_expr_type(ast, node.lane_expr.expr));
+    case AstNode::Kind::ShuffleExpr:
+      return ast_expr_type(ast, node.shuffle_expr.expr);
+    case AstNode::Kind::IndexExpr: {
+      const auto type = ast_sequence_type(ast, node.index_expr.expr);
+      return type == UndefinedAstNodeIndex ? IrType::I32 : ast_value_type(ast, ast[type].array_type.element);
+    }
+    case AstNode::Kind::AssignExpr:
+    case AstNode::Kind::AddExpr:
+    case AstNode::Kind::SubExpr:
+    case AstNode::Kind::MulExpr:
+    case AstNode::Kind::DivExpr:
+      return ast_expr_type(ast, node.add_expr.left);
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      return ast_expr_type(ast, node.parenth_expr.expr);
+    default:
+      return IrType::I32;
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef AST_TYPES_HPP
+#define AST_TYPES_HPP
+
+#include "ast.hpp"
+#include "ir.hpp"
+#include <cstdint>
+
+// Types of Ast values as the bytecode compilers see them.
+
+// the primitive type a type node stands for, Void for structs and absent types
+IrType ast_value_type(const Ast& ast, AstNodeIndex type);
+
+uint32_t ast_type_size(const Ast& ast, AstNodeIndex type);
+
+// the ArrayType or SliceType of an expression that names elements: an
+// array or slice variable or a slice of one; UndefinedAstNodeIndex for
+// other expressions
+AstNodeIndex ast_sequence_type(const Ast& ast, AstNodeIndex expr);
+
+// the type of the value an expression evaluates to; reads of struct typed
+// values and unsupported expressions evaluate to an i32 zero
+IrType ast_expr_type(const Ast& ast, AstNodeIndex expr);
+
+#endif  // AST_TYPES_HPP
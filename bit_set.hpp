@@ -0,0 +1,86 @@
+#ifndef BIT_SET_HPP
+#define BIT_SET_HPP
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Word level operations on dense bit sets. Sets are stored as arrays of
+// 64 bit words whose length is a multiple of four, so every step of the
+// loops below covers 256 bits: one AVX2 register when the compiler targets
+// it, otherwise four words the optimizer can keep in SSE registers.
+
+static const uint32_t BitSetLaneWords = 4;
+
+inline uint32_t bits_words(uint32_t bit_count) {
+  const uint32_t words = (bit_count + 63) / 64;
+  return (words + BitSetLaneWords - 1) / BitSetLaneWords * BitSetLaneWords;
+}
+
+inline bool bits_test(const uint64_t* bits, uint32_t bit) {
+  return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+inline void bits_set(uint64_t* bits, uint32_t bit) {
+  bits[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+inline void bits_reset(uint64_t* bits, uint32_t bit) {
+  bits[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+}
+
+// dst |= src
+inline void bits_or(uint64_t* dst, const uint64_t* src, uint32_t words) {
+  for (uint32_t i = 0; i < words; i += BitSetLaneWords) {
+#if defined(__AVX2__)
+    const auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    const auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(d, s));
+#else
+    dst[i] |= src[i];
+    dst[i + 1] |= src[i + 1];
+    dst[i + 2] |= src[i + 2];
+    dst[i + 3] |= src[i + 3];
+#endif
+  }
+}
+
+// dst = gen | (src & ~kill), returns whether dst changed
+inline bool bits_transfer(uint64_t* dst, const uint64_t* gen, const uint64_t* src, const uint64_t* kill, uint32_t words) {
+#if defined(__AVX2__)
+  auto diff = _mm256_setzero_si256();
+  for (uint32_t i = 0; i < words; i += BitSetLaneWords) {
+    const auto g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gen + i));
+    const auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    const auto k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kill + i));
+    const auto old = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    const auto value = _mm256_or_si256(g, _mm256_andnot_si256(k, s));
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(value, old));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), value);
+  }
+  return !_mm256_testz_si256(diff, diff);
+#else
+  uint64_t diff = 0;
+  for (uint32_t i = 0; i < words; i += BitSetLaneWords) {
+    for (uint32_t lane = 0; lane < BitSetLaneWords; ++lane) {
+      const auto value = gen[i + lane] | (src[i + lane] & ~kill[i + lane]);
+      diff |= value ^ dst[i + lane];
+      dst[i + lane] = value;
+    }
+  }
+  return diff != 0;
+#endif
+}
+
+template <typename Fn>
+inline void bits_for_each(const uint64_t* bits, uint32_t words, Fn fn) {
+  for (uint32_t i = 0; i < words; ++i) {
+    for (auto word = bits[i]; word; word &= word - 1) {
+      fn(i * 64 + static_cast<uint32_t>(__builtin_ctzll(word)));
+    }
+  }
+}
+
+#endif  // BIT_SET_HPP
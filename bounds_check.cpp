@@ -0,0 +1,165 @@
+#include "bounds_check.hpp"
+#include "dominators.hpp"
+#include <limits>
+
+namespace {
+
+bool is_i32_const(const IrInstr& instr) {
+  return instr.kind == IrInstr::Kind::Const && instr.type == IrType::I32;
+}
+
+}  // namespace
+
+BoundsCheckStats BoundsCheckElimination::run() {
+  BoundsCheckStats stats;
+  auto& instrs = m_function.instrs;
+  if (m_function.blocks.empty()) return stats;
+
+  DominatorTree tree(m_function);
+  m_tree = &tree;
+  find_edge_facts();
+  m_visiting.assign(instrs.size(), false);
+
+  // checks that held so far, popped when their block's subtree is left
+  std::vector<Fact> checked;
+  struct Frame {
+    IrBlockIndex block;
+    uint32_t next_child;
+    uint32_t checked_size;
+  };
+  std::vector<Frame> stack;
+
+  auto is_redundant = [&](const IrInstr& check) {
+    const auto index = check.operands[0];
+    const auto length = check.operands[1];
+    const auto& index_instr = instrs[index];
+    const auto& length_instr = instrs[length];
+    if (is_i32_const(index_instr) && is_i32_const(length_instr)) {
+      return index_instr.constant.i >= 0 && index_instr.constant.i < length_instr.constant.i;
+    }
+    for (const auto& fact : checked) {
+      if (fact.index == index && is_within(fact.bound, length)) return true;
+    }
+    return is_bounded(index, length, check.block) && is_not_negative(index);
+  };
+
+  auto enter = [&](IrBlockIndex block) {
+    stack.push_back(Frame{block, 0, static_cast<uint32_t>(checked.size())});
+    auto& block_instrs = m_function.blocks[block].instrs;
+    for (auto index : block_instrs) {
+      auto& instr = instrs[index];
+      if (instr.kind != IrInstr::Kind::BoundsCheck) continue;
+      ++stats.checks;
+      if (is_redundant(instr)) {
+        instr.kind = IrInstr::Kind::None;
+        instr.operands.clear();
+        instr.block = UndefinedIrBlockIndex;
+        ++stats.removed;
+      } else {
+        checked.push_back(Fact{instr.operands[0], instr.operands[1]});
+      }
+    }
+    block_instrs.erase(
+      std::remove_if(block_instrs.begin(), block_instrs.end(),
+        [&instrs](IrValueIndex index) { return instrs[index].kind == IrInstr::Kind::None; }),
+      block_instrs.end());
+  };
+
+  enter(0);
+  while (!stack.empty()) {
+    auto& frame = stack.back();
+    const auto& children = tree.children(frame.block);
+    if (frame.next_child < children.size()) {
+      enter(children[frame.next_child++]);
+      continue;
+    }
+    checked.resize(frame.checked_size);
+    stack.pop_back();
+  }
+  m_tree = nullptr;
+  return stats;
+}
+
+void BoundsCheckElimination::find_edge_facts() {
+  const auto& instrs = m_function.instrs;
+  m_edge_facts.assign(m_function.blocks.size(), Fact{});
+  for (IrBlockIndex block = 0; block < m_function.blocks.size(); ++block) {
+    const auto& preds = m_function.blocks[block].preds;
+    if (preds.size() != 1 || !m_tree->is_reachable(block)) continue;
+    const auto terminator = m_function.terminator(preds[0]);
+    if (terminator == UndefinedIrValueIndex || instrs[terminator].kind != IrInstr::Kind::Branch) continue;
+    const auto& branch = instrs[terminator];
+    // both edges may lead here when the branch was folded into a jump
+    if (branch.targets[0] == branch.targets[1]) continue;
+    const auto& cond = instrs[branch.operands[0]];
+    if (!cond.is_compare() || instrs[cond.operands[0]].type != IrType::I32) continue;
+    const bool taken = branch.targets[0] == block;
+    const auto left = cond.operands[0];
+    const auto right = cond.operands[1];
+    // left < right if taken, right <= left otherwise, and the mirrored forms
+    if ((cond.kind == IrInstr::Kind::Less && taken) || (cond.kind == IrInstr::Kind::GreatOrEqual && !taken)) {
+      m_edge_facts[block] = Fact{left, right};
+    } else if ((cond.kind == IrInstr::Kind::Great && taken) ||
+               (cond.kind == IrInstr::Kind::LessOrEqual && !taken)) {
+      m_edge_facts[block] = Fact{right, left};
+    }
+  }
+}
+
+bool BoundsCheckElimination::is_within(IrValueIndex bound, IrValueIndex length) const {
+  if (bound == length) return true;
+  const auto& bound_instr = m_function.instrs[bound];
+  const auto& length_instr = m_function.instrs[length];
+  return is_i32_const(bound_instr) && is_i32_const(length_instr) && bound_instr.constant.i >= 0 &&
+         bound_instr.constant.i <= length_instr.constant.i;
+}
+
+bool BoundsCheckElimination::is_bounded(IrValueIndex index, IrValueIndex length, IrBlockIndex block) const {
+  for (; block != UndefinedIrBlockIndex; block = m_tree->idom(block)) {
+    const auto& fact = m_edge_facts[block];
+    if (fact.index == index && is_within(fact.bound, length)) return true;
+    if (block == 0) break;
+  }
+  return false;
+}
+
+bool BoundsCheckElimination::can_step(IrValueIndex index, int64_t step, IrBlockIndex block) const {
+  for (; block != UndefinedIrBlockIndex; block = m_tree->idom(block)) {
+    const auto& fact = m_edge_facts[block];
+    if (fact.index == index) {
+      // index < bound <= max, so index + 1 <= max
+      if (step <= 1) return true;
+      const auto& bound = m_function.instrs[fact.bound];
+      if (is_i32_const(bound) && bound.constant.i - 1 + step <= std::numeric_limits<int32_t>::max()) return true;
+    }
+    if (block == 0) break;
+  }
+  return false;
+}
+
+bool BoundsCheckElimination::is_not_negative(IrValueIndex value) {
+  const auto& instr = m_function.instrs[value];
+  if (instr.type != IrType::I32) return false;
+  if (m_visiting[value]) return true;
+  switch (instr.kind) {
+    case IrInstr::Kind::Const:
+      return instr.constant.i >= 0;
+    case IrInstr::Kind::Phi: {
+      m_visiting[value] = true;
+      bool result = true;
+      for (auto operand : instr.operands) result = result && is_not_negative(operand);
+      m_visiting[value] = false;
+      return result;
+    }
+    case IrInstr::Kind::Add:
+      for (uint32_t i = 0; i < 2; ++i) {
+        const auto& step = m_function.instrs[instr.operands[1 - i]];
+        if (!is_i32_const(step) || step.constant.i < 0) continue;
+        const auto operand = instr.operands[i];
+        if (can_step(operand, step.constant.i, instr.block) && is_not_negative(operand)) return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
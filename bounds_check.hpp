@@ -0,0 +1,60 @@
+#ifndef BOUNDS_CHECK_HPP
+#define BOUNDS_CHECK_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+class DominatorTree;
+
+struct BoundsCheckStats {
+  uint32_t checks = 0;
+  uint32_t removed = 0;
+};
+
+// Removes BoundsCheck instructions whose index is known to be below the
+// length. That is the case for constants, for an index an earlier check
+// that dominates this one already held to the same or a smaller length,
+// and for an index that cannot be negative while a dominating branch
+// found it less than the length, the usual while (i < a.len) loop. An
+// index is not negative if it is a constant that is not, a phi of such
+// indices or one plus an index that some dominating branch found less
+// than anything, which keeps the increment of a loop counter from
+// overflowing. Runs after Gvn, which gives equal lengths one value.
+class BoundsCheckElimination {
+public:
+  BoundsCheckElimination(IrFunction& function) : m_function(function) {}
+  BoundsCheckElimination(const BoundsCheckElimination&) = delete;
+  BoundsCheckElimination(BoundsCheckElimination&&) = delete;
+  BoundsCheckElimination& operator=(const BoundsCheckElimination&) = delete;
+  BoundsCheckElimination& operator=(BoundsCheckElimination&&) = delete;
+
+  BoundsCheckStats run();
+
+private:
+  // index < bound, signed for branches and unsigned for checks
+  struct Fact {
+    IrValueIndex index = UndefinedIrValueIndex;
+    IrValueIndex bound = UndefinedIrValueIndex;
+  };
+
+  IrFunction& m_function;
+  const DominatorTree* m_tree = nullptr;
+  // what the branch into a block with a single predecessor found
+  std::vector<Fact> m_edge_facts;
+  // values whose sign is being found, assumed not negative meanwhile
+  std::vector<bool> m_visiting;
+
+  void find_edge_facts();
+  // whether the length bound is known to be at most length
+  bool is_within(IrValueIndex bound, IrValueIndex length) const;
+  // some branch dominating block found index less than a bound within
+  // length
+  bool is_bounded(IrValueIndex index, IrValueIndex length, IrBlockIndex block) const;
+  // index + step cannot overflow in block as a dominating branch found
+  // index less than something
+  bool can_step(IrValueIndex index, int64_t step, IrBlockIndex block) const;
+  bool is_not_negative(IrValueIndex value);
+};
+
+#endif  // BOUNDS_CHECK_HPP
@@ -0,0 +1,103 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Instruction set of the stack machine in vm.hpp. An instruction is an
+// opcode byte followed by its immediates in host byte order:
+//   Const          4 byte value, 8 bytes for ConstF64
+//   LoadLocal      2 byte slot, pushes the slot
+//   StoreLocal     2 byte slot, pops into the slot
+//   LoadField      4 byte offset from the first local, pushes the field
+//   StoreField     4 byte offset from the first local, pops into the field
+//   Jump           4 byte code offset
+//   JumpIfFalse    4 byte code offset, pops the condition
+//   Call           4 byte function index, the arguments are on the stack
+// Arithmetic and comparisons pop their operands and push the result, typed
+// instructions exist for every primitive width and keep integer results
+// wrapped to it. Comparisons push 0 or 1.
+#define BYTECODE_TYPED_OPCODES(X, T) \
+  X(Const##T) X(Add##T) X(Sub##T) X(Mul##T) X(Div##T) X(Neg##T) \
+  X(Equal##T) X(Great##T) X(GreatOrEqual##T) X(Less##T) X(LessOrEqual##T) \
+  X(LoadField##T) X(StoreField##T)
+
+#define BYTECODE_OPCODES(X) \
+  X(Nop) X(Pop) X(Dup) X(LoadLocal) X(StoreLocal) \
+  X(Jump) X(JumpIfFalse) X(Call) X(Return) X(ReturnVoid) \
+  BYTECODE_TYPED_OPCODES(X, I8) BYTECODE_TYPED_OPCODES(X, I16) BYTECODE_TYPED_OPCODES(X, I32) \
+  BYTECODE_TYPED_OPCODES(X, U8) BYTECODE_TYPED_OPCODES(X, U16) BYTECODE_TYPED_OPCODES(X, U32) \
+  BYTECODE_TYPED_OPCODES(X, F32) BYTECODE_TYPED_OPCODES(X, F64)
+
+enum class Opcode : uint8_t {
+#define BYTECODE_ENUM(name) name,
+  BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+  Count,
+};
+
+// the position of an instruction inside the group of each width
+enum class TypedOp : uint8_t {
+  Const, Add, Sub, Mul, Div, Neg,
+  Equal, Great, GreatOrEqual, Less, LessOrEqual,
+  LoadField, StoreField,
+  Count,
+};
+
+static_assert(static_cast<uint8_t>(Opcode::ConstI16) - static_cast<uint8_t>(Opcode::ConstI8)
+  == static_cast<uint8_t>(TypedOp::Count), "typed opcode groups must match TypedOp");
+
+// the typed instruction for values of type, Bool shares the U8 group
+inline Opcode typed_opcode(TypedOp op, IrType type) {
+  const auto first = static_cast<uint8_t>(Opcode::ConstI8);
+  if (type == IrType::Bool) type = IrType::U8;
+  const auto group = static_cast<uint8_t>(type) - static_cast<uint8_t>(IrType::I8);
+  return static_cast<Opcode>(first + group * static_cast<uint8_t>(TypedOp::Count) + static_cast<uint8_t>(op));
+}
+
+inline const char* opcode_name(Opcode opcode) {
+  static const char* names[] = {
+#define BYTECODE_NAME(name) #name,
+    BYTECODE_OPCODES(BYTECODE_NAME)
+#undef BYTECODE_NAME
+  };
+  return names[static_cast<uint8_t>(opcode)];
+}
+
+template <typename T>
+inline T read_immediate(const uint8_t* code) {
+  T value;
+  memcpy(&value, code, sizeof(T));
+  return value;
+}
+
+struct BytecodeFunction {
+  IdIndex name = UndefinedIdIndex;
+  IrType return_type = IrType::Void;
+  uint32_t params = 0;
+  // 8 byte slots including the parameters and struct storage
+  uint32_t locals = 0;
+  uint32_t max_stack = 0;
+  std::vector<uint8_t> code;
+
+  void emit(Opcode opcode) { code.emplace_back(static_cast<uint8_t>(opcode)); }
+
+  template <typename T>
+  void emit_immediate(T value) {
+    const auto size = code.size();
+    code.resize(size + sizeof(T));
+    memcpy(code.data() + size, &value, sizeof(T));
+  }
+
+  template <typename T>
+  void patch_immediate(uint32_t offset, T value) { memcpy(code.data() + offset, &value, sizeof(T)); }
+};
+
+struct BytecodeModule {
+  std::vector<BytecodeFunction> functions;
+};
+
+#endif  // BYTECODE_HPP
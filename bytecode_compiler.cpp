@@ -0,0 +1,321 @@
+#include "bytecode_compiler.hpp"
+#include "ast_types.hpp"
+
+void BytecodeCompiler::compile_module(AstNodeIndex global_scope) {
+  const auto* dict = m_ast[global_scope].scope.dict;
+  if (!dict) return;
+
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) function_index(node_idx);
+  }
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) compile_function(node_idx);
+  }
+}
+
+uint32_t BytecodeCompiler::function_index(AstNodeIndex function) {
+  auto it = m_function_indices.find(function);
+  if (it != m_function_indices.end()) return it->second;
+
+  const uint32_t index = m_module.functions.size();
+  m_module.functions.emplace_back();
+  auto& bytecode_function = m_module.functions.back();
+  const auto& function_node = m_ast[function].function;
+  bytecode_function.name = function_node.scope.name;
+  const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params;
+  bytecode_function.return_type = ast_value_type(m_ast, fun_type.fun_type.return_type);
+  bytecode_function.params = fun_type.names ? fun_type.names->size() : 0;
+  m_function_indices.emplace(function, index);
+  // the module may have grown under the function being compiled
+  if (m_function) m_function = &m_module.functions[m_function_index];
+  return index;
+}
+
+BytecodeFunction& BytecodeCompiler::compile_function(AstNodeIndex function) {
+  const auto& function_node = m_ast[function];
+  m_function_index = function_index(function);
+  m_function = &m_module.functions[m_function_index];
+  m_function->code.clear();
+  m_function->locals = 0;
+  m_function->max_stack = 0;
+  m_slots.clear();
+  m_depth = 0;
+
+  // parameters always take one slot, they arrive on the operand stack
+  const auto& fun_type = m_ast[function_node.function.function_type_with_named_params].fun_type_with_named_params;
+  if (fun_type.names) {
+    for (auto name : *fun_type.names) {
+      const auto variable = function_node.function.scope.dict
+        ? function_node.function.scope.dict->find(name) : UndefinedAstNodeIndex;
+      if (variable != UndefinedAstNodeIndex) m_slots[variable] = m_function->locals;
+      ++m_function->locals;
+    }
+  }
+
+  if (function_node.function.block_stmt != UndefinedAstNodeIndex) {
+    compile_stmt(function_node.function.block_stmt);
+  }
+
+  if (m_function->return_type == IrType::Void) {
+    emit(Opcode::ReturnVoid, 0);
+  } else {
+    emit_zero(m_function->return_type);
+    emit(Opcode::Return, -1);
+  }
+  return *m_function;
+}
+
+uint32_t BytecodeCompiler::allocate_slot(AstNodeIndex variable) {
+  const auto type = m_ast[variable].local_variable.value.type;
+  const auto slots = m_ast[type].kind == AstNode::Kind::StructType ? std::max<uint32_t>(1, (ast_type_size(m_ast, type) + 7) / 8) : 1;
+  const auto slot = m_function->locals;
+  m_function->locals += slots;
+  m_slots[variable] = slot;
+  return slot;
+}
+
+// byte offset of a field of a struct local from the first local slot
+bool BytecodeCompiler::field_offset(AstNodeIndex expr, uint32_t& offset) const {
+  const auto& node = m_ast[expr];
+  if (node.kind != AstNode::Kind::FieldExpr) return false;
+  const auto base = node.field_expr.expr;
+  if (m_ast[base].kind == AstNode::Kind::LocalVariable) {
+    auto it = m_slots.find(base);
+    if (it == m_slots.end()) return false;
+    offset = it->second * 8;
+  } else if (!field_offset(base, offset)) {
+    return false;
+  }
+  offset += m_ast[node.field_expr.field].struct_field.offset;
+  return true;
+}
+
+void BytecodeCompiler::emit(Opcode opcode, int32_t stack_effect) {
+  m_function->emit(opcode);
+  m_depth += stack_effect;
+  m_function->max_stack = std::max(m_function->max_stack, m_depth);
+}
+
+void BytecodeCompiler::emit_typed(TypedOp op, IrType type, int32_t stack_effect) {
+  emit(typed_opcode(op, type), stack_effect);
+}
+
+void BytecodeCompiler::emit_zero(IrType type) {
+  if (type == IrType::Void) return;
+  emit_typed(TypedOp::Const, type, 1);
+  if (type == IrType::F64) {
+    m_function->emit_immediate<double>(0);
+  } else {
+    m_function->emit_immediate<int32_t>(0);
+  }
+}
+
+uint32_t BytecodeCompiler::emit_jump(Opcode opcode) {
+  emit(opcode, opcode == Opcode::JumpIfFalse ? -1 : 0);
+  const uint32_t immediate = m_function->code.size();
+  m_function->emit_immediate<uint32_t>(0);
+  return immediate;
+}
+
+void BytecodeCompiler::patch_jump(uint32_t immediate) {
+  m_function->patch_immediate<uint32_t>(immediate, m_function->code.size());
+}
+
+void BytecodeCompiler::compile_stmt(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt];
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (node.block_stmt.stmts) {
+        for (auto child : *node.block_stmt.stmts) compile_stmt(child);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      const auto slot = allocate_slot(variable);
+      const auto type = ast_value_type(m_ast, m_ast[variable].local_variable.value.type);
+      // struct storage starts zeroed with the frame
+      if (type == IrType::Void) break;
+      if (node.variable_decl_stmt.init_expr != UndefinedAstNodeIndex) {
+        compile_expr(node.variable_decl_stmt.init_expr);
+      } else {
+        emit_zero(type);
+      }
+      emit(Opcode::StoreLocal, -1);
+      m_function->emit_immediate<uint16_t>(slot);
+      break;
+    }
+    case AstNode::Kind::ExprStmt: {
+      const auto expr = node.expr_stmt.expr;
+      if (m_ast[expr].kind == AstNode::Kind::AssignExpr) {
+        compile_assign(expr, false);
+        break;
+      }
+      compile_expr(expr);
+      if (ast_expr_type(m_ast, expr) != IrType::Void) emit(Opcode::Pop, -1);
+      break;
+    }
+    case AstNode::Kind::ReturnStmt: {
+      const auto expr = node.return_stmt.expr;
+      if (expr != UndefinedAstNodeIndex) {
+        compile_expr(expr);
+        if (m_function->return_type == IrType::Void && ast_expr_type(m_ast, expr) != IrType::Void) emit(Opcode::Pop, -1);
+      } else {
+        emit_zero(m_function->return_type);
+      }
+      if (m_function->return_type == IrType::Void) {
+        emit(Opcode::ReturnVoid, 0);
+      } else {
+        emit(Opcode::Return, -1);
+      }
+      break;
+    }
+    case AstNode::Kind::IfElseStmt: {
+      compile_expr(node.if_else_stmt.expr);
+      const auto to_else = emit_jump(Opcode::JumpIfFalse);
+      compile_stmt(node.if_else_stmt.stmt);
+      if (node.if_else_stmt.else_stmt == UndefinedAstNodeIndex) {
+        patch_jump(to_else);
+        break;
+      }
+      const auto to_end = emit_jump(Opcode::Jump);
+      patch_jump(to_else);
+      compile_stmt(node.if_else_stmt.else_stmt);
+      patch_jump(to_end);
+      break;
+    }
+    case AstNode::Kind::WhileStmt: {
+      const uint32_t header = m_function->code.size();
+      compile_expr(node.while_stmt.expr);
+      const auto to_exit = emit_jump(Opcode::JumpIfFalse);
+      compile_stmt(node.while_stmt.stmt);
+      emit(Opcode::Jump, 0);
+      m_function->emit_immediate<uint32_t>(header);
+      patch_jump(to_exit);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void BytecodeCompiler::compile_expr(AstNodeIndex expr) {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal:
+    case AstNode::Kind::I16Literal:
+    case AstNode::Kind::I32Literal:
+    case AstNode::Kind::U8Literal:
+    case AstNode::Kind::U16Literal:
+    case AstNode::Kind::U32Literal:
+    case AstNode::Kind::CharLiteral: {
+      int32_t value = 0;
+      switch (node.kind) {
+        case AstNode::Kind::I8Literal: value = node.i8_literal.literal_value; break;
+        case AstNode::Kind::I16Literal: value = node.i16_literal.literal_value; break;
+        case AstNode::Kind::I32Literal: value = node.i32_literal.literal_value; break;
+        case AstNode::Kind::U8Literal: value = node.u8_literal.literal_value; break;
+        case AstNode::Kind::U16Literal: value = node.u16_literal.literal_value; break;
+        case AstNode::Kind::U32Literal: value = node.u32_literal.literal_value; break;
+        default: value = node.char_literal.chr; break;
+      }
+      emit_typed(TypedOp::Const, ast_expr_type(m_ast, expr), 1);
+      m_function->emit_immediate<int32_t>(value);
+      break;
+    }
+    case AstNode::Kind::F32Literal:
+      emit_typed(TypedOp::Const, IrType::F32, 1);
+      m_function->emit_immediate<float>(node.f32_literal.literal_value);
+      break;
+    case AstNode::Kind::F64Literal:
+      emit_typed(TypedOp::Const, IrType::F64, 1);
+      m_function->emit_immediate<double>(node.f64_literal.literal_value);
+      break;
+    case AstNode::Kind::LocalVariable: {
+      auto it = m_slots.find(expr);
+      if (it == m_slots.end() || ast_value_type(m_ast, node.local_variable.value.type) == IrType::Void) {
+        emit_zero(IrType::I32);
+        break;
+      }
+      emit(Opcode::LoadLocal, 1);
+      m_function->emit_immediate<uint16_t>(it->second);
+      break;
+    }
+    case AstNode::Kind::FieldExpr: {
+      uint32_t offset = 0;
+      const auto type = ast_value_type(m_ast, m_ast[node.field_expr.field].struct_field.value.type);
+      if (type == IrType::Void || !field_offset(expr, offset)) {
+        emit_zero(IrType::I32);
+        break;
+      }
+      emit_typed(TypedOp::LoadField, type, 1);
+      m_function->emit_immediate<uint32_t>(offset);
+      break;
+    }
+    case AstNode::Kind::CallExpr: {
+      const auto callee = function_index(node.call_expr.function);
+      uint32_t args = 0;
+      if (node.call_expr.args) {
+        for (auto arg : *node.call_expr.args) compile_expr(arg);
+        args = node.call_expr.args->size();
+      }
+      const auto& callee_function = m_module.functions[callee];
+      const int32_t result = callee_function.return_type == IrType::Void ? 0 : 1;
+      emit(Opcode::Call, result - static_cast<int32_t>(args));
+      m_function->emit_immediate<uint32_t>(callee);
+      break;
+    }
+    case AstNode::Kind::AssignExpr:
+      compile_assign(expr, true);
+      break;
+    case AstNode::Kind::ParenthExpr:
+      compile_expr(node.parenth_expr.expr);
+      break;
+    case AstNode::Kind::NegExpr:
+      compile_expr(node.neg_expr.expr);
+      emit_typed(TypedOp::Neg, ast_expr_type(m_ast, node.neg_expr.expr), 0);
+      break;
+    case AstNode::Kind::AddExpr: compile_binary(TypedOp::Add, node.add_expr); break;
+    case AstNode::Kind::SubExpr: compile_binary(TypedOp::Sub, node.sub_expr); break;
+    case AstNode::Kind::MulExpr: compile_binary(TypedOp::Mul, node.mul_expr); break;
+    case AstNode::Kind::DivExpr: compile_binary(TypedOp::Div, node.div_expr); break;
+    case AstNode::Kind::EqualExpr: compile_binary(TypedOp::Equal, node.equal_expr); break;
+    case AstNode::Kind::GreatExpr: compile_binary(TypedOp::Great, node.great_expr); break;
+    case AstNode::Kind::GreatOrEqualExpr: compile_binary(TypedOp::GreatOrEqual, node.great__or_equal_expr); break;
+    case AstNode::Kind::LessExpr: compile_binary(TypedOp::Less, node.less_expr); break;
+    case AstNode::Kind::LessOrEqualExpr: compile_binary(TypedOp::LessOrEqual, node.less_or_equal_expr); break;
+    default:
+      emit_zero(IrType::I32);
+      break;
+  }
+}
+
+void BytecodeCompiler::compile_assign(AstNodeIndex expr, bool keep_value) {
+  const auto& node = m_ast[expr].assign_expr;
+  const auto& left = m_ast[node.left];
+  compile_expr(node.right);
+  if (keep_value) emit(Opcode::Dup, 1);
+
+  if (left.kind == AstNode::Kind::LocalVariable) {
+    auto it = m_slots.find(node.left);
+    if (it != m_slots.end() && ast_value_type(m_ast, left.local_variable.value.type) != IrType::Void) {
+      emit(Opcode::StoreLocal, -1);
+      m_function->emit_immediate<uint16_t>(it->second);
+      return;
+    }
+  } else if (left.kind == AstNode::Kind::FieldExpr) {
+    uint32_t offset = 0;
+    const auto type = ast_value_type(m_ast, m_ast[left.field_expr.field].struct_field.value.type);
+    if (type != IrType::Void && field_offset(node.left, offset)) {
+      emit_typed(TypedOp::StoreField, type, -1);
+      m_function->emit_immediate<uint32_t>(offset);
+      return;
+    }
+  }
+  emit(Opcode::Pop, -1);
+}
+
+void BytecodeCompiler::compile_binary(TypedOp op, const AstNode::BinaryExpr& expr) {
+  compile_expr(expr.left);
+  compile_expr(expr.right);
+  emit_typed(op, ast_expr_type(m_ast, expr.left), -1);
+}
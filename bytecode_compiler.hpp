@@ -0,0 +1,54 @@
+#ifndef BYTECODE_COMPILER_HPP
+#define BYTECODE_COMPILER_HPP
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include <cstdint>
+#include <unordered_map>
+
+// Translates functions of the Ast into stack bytecode. Parameters take the
+// first local slots, every declared local gets its own slot and struct
+// locals are stored inline in as many slots as they need, so fields are
+// addressed by a constant offset from the first local. Like Lowering,
+// expressions the machine cannot represent evaluate to an i32 zero.
+class BytecodeCompiler {
+public:
+  BytecodeCompiler(const Ast& ast, BytecodeModule& module) : m_ast(ast), m_module(module) {}
+  BytecodeCompiler(const BytecodeCompiler&) = delete;
+  BytecodeCompiler(BytecodeCompiler&&) = delete;
+  BytecodeCompiler& operator=(const BytecodeCompiler&) = delete;
+  BytecodeCompiler& operator=(BytecodeCompiler&&) = delete;
+
+  // compiles every function declared in the given global scope
+  void compile_module(AstNodeIndex global_scope);
+  BytecodeFunction& compile_function(AstNodeIndex function);
+  // position of the function in BytecodeModule::functions, declaring it
+  // without code the first time
+  uint32_t function_index(AstNodeIndex function);
+
+private:
+  const Ast& m_ast;
+  BytecodeModule& m_module;
+  BytecodeFunction* m_function = nullptr;
+  uint32_t m_function_index = 0;
+  std::unordered_map<AstNodeIndex, uint32_t> m_function_indices;
+  // LocalVariable nodes to their first slot
+  std::unordered_map<AstNodeIndex, uint32_t> m_slots;
+  uint32_t m_depth = 0;
+
+  uint32_t allocate_slot(AstNodeIndex variable);
+  bool field_offset(AstNodeIndex expr, uint32_t& offset) const;
+
+  void emit(Opcode opcode, int32_t stack_effect);
+  void emit_typed(TypedOp op, IrType type, int32_t stack_effect);
+  void emit_zero(IrType type);
+  uint32_t emit_jump(Opcode opcode);
+  void patch_jump(uint32_t immediate);
+
+  void compile_stmt(AstNodeIndex stmt);
+  void compile_expr(AstNodeIndex expr);
+  void compile_assign(AstNodeIndex expr, bool keep_value);
+  void compile_binary(TypedOp op, const AstNode::BinaryExpr& expr);
+};
+
+#endif  // BYTECODE_COMPILER_HPP
@@ -0,0 +1,568 @@
+#include "c_backend.hpp"
+#include "ast_types.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const char Prelude[] =
+  "#include <math.h>\n"
+  "#include <stddef.h>\n"
+  "#include <stdint.h>\n"
+  "\n"
+  "/* integer arithmetic wraps at the width of the type, division truncates\n"
+  "   like 64 bit division of the operands */\n"
+  "#define SL_INT_OPS(T, S) \\\n"
+  "  static inline T sl_add_##S(T a, T b) { return (T)((uint32_t)a + (uint32_t)b); } \\\n"
+  "  static inline T sl_sub_##S(T a, T b) { return (T)((uint32_t)a - (uint32_t)b); } \\\n"
+  "  static inline T sl_mul_##S(T a, T b) { return (T)((uint32_t)a * (uint32_t)b); } \\\n"
+  "  static inline T sl_div_##S(T a, T b) { return (T)((int64_t)a / (int64_t)b); } \\\n"
+  "  static inline T sl_neg_##S(T a) { return (T)(0u - (uint32_t)a); }\n"
+  "SL_INT_OPS(int8_t, i8)\n"
+  "SL_INT_OPS(int16_t, i16)\n"
+  "SL_INT_OPS(int32_t, i32)\n"
+  "SL_INT_OPS(uint8_t, u8)\n"
+  "SL_INT_OPS(uint16_t, u16)\n"
+  "SL_INT_OPS(uint32_t, u32)\n";
+
+static const char* c_type(IrType type) {
+  switch (type) {
+    case IrType::I8: return "int8_t";
+    case IrType::I16: return "int16_t";
+    case IrType::U8: return "uint8_t";
+    case IrType::U16: return "uint16_t";
+    case IrType::U32: return "uint32_t";
+    case IrType::F32: return "float";
+    case IrType::F64: return "double";
+    case IrType::Void: return "void";
+    default: return "int32_t";
+  }
+}
+
+// suffix of the integer helpers of the prelude, comparisons count as i32
+static const char* helper_suffix(IrType type) {
+  switch (type) {
+    case IrType::I8: return "i8";
+    case IrType::I16: return "i16";
+    case IrType::U8: return "u8";
+    case IrType::U16: return "u16";
+    case IrType::U32: return "u32";
+    default: return "i32";
+  }
+}
+
+void CBackend::flush() {
+  if (m_used) m_out.write(m_buffer, m_used);
+  m_used = 0;
+}
+
+// write() that does not fit the buffer
+void CBackend::flush_for(const char* str, size_t length) {
+  flush();
+  if (length > BufferSize) {
+    m_out.write(str, length);
+    return;
+  }
+  std::memcpy(m_buffer, str, length);
+  m_used = length;
+}
+
+void CBackend::write(IdIndex name) {
+  const auto& id = m_id_cache.get(name);
+  write(id.str, id.length);
+}
+
+void CBackend::write_int(int64_t value) {
+  char digits[24];
+  const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  write(digits, result.ptr - digits);
+}
+
+void CBackend::write_line_start() {
+  for (uint32_t i = 0; i < m_indent; ++i) write("  ", 2);
+}
+
+bool CBackend::emit_module(AstNodeIndex global_scope) {
+  m_unsupported = false;
+  write(Prelude, sizeof(Prelude) - 1);
+  const auto* dict = m_ast[global_scope].scope.dict;
+  if (!dict) return true;
+
+  std::vector<AstNodeIndex> functions;
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Struct) emit_struct(node_idx);
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) functions.emplace_back(node_idx);
+  }
+  // structs are defined before the first prototype that could use them
+  std::vector<AstNodeIndex> structs;
+  for (auto function : functions) collect_structs(function, structs);
+  for (auto struc : structs) emit_struct(struc);
+
+  write("\n");
+  for (auto function : functions) {
+    emit_prototype(function);
+    write(";\n");
+  }
+  for (auto function : functions) emit_function(function);
+  return !m_unsupported;
+}
+
+// Struct nodes of the struct types a function or statement mentions
+void CBackend::collect_structs(AstNodeIndex node, std::vector<AstNodeIndex>& structs) {
+  if (node == UndefinedAstNodeIndex) return;
+  const auto& ast_node = m_ast[node];
+  switch (ast_node.kind) {
+    case AstNode::Kind::StructType:
+      structs.emplace_back(ast_node.struct_type.struct_scope);
+      break;
+    case AstNode::Kind::Function: {
+      const auto& fun_type = m_ast[ast_node.function.function_type_with_named_params].fun_type_with_named_params.fun_type;
+      collect_structs(fun_type.return_type, structs);
+      if (fun_type.param_types) {
+        for (auto type : *fun_type.param_types) collect_structs(type, structs);
+      }
+      collect_structs(ast_node.function.block_stmt, structs);
+      break;
+    }
+    case AstNode::Kind::BlockStmt:
+      if (ast_node.block_stmt.stmts) {
+        for (auto stmt : *ast_node.block_stmt.stmts) collect_structs(stmt, structs);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt:
+      collect_structs(m_ast[ast_node.variable_decl_stmt.variable].local_variable.value.type, structs);
+      break;
+    case AstNode::Kind::IfElseStmt:
+      collect_structs(ast_node.if_else_stmt.stmt, structs);
+      collect_structs(ast_node.if_else_stmt.else_stmt, structs);
+      break;
+    case AstNode::Kind::WhileStmt:
+      collect_structs(ast_node.while_stmt.stmt, structs);
+      break;
+    default:
+      break;
+  }
+}
+
+void CBackend::emit_struct_name(AstNodeIndex struc) {
+  write("struct ");
+  const auto name = m_ast[struc].scope.name;
+  if (name != UndefinedIdIndex) {
+    write(name);
+  } else {
+    write("sl_struct");
+    write_int(struc);
+  }
+}
+
+// defines the struct after the structs of its fields, with explicit padding
+// up to every field offset
+void CBackend::emit_struct(AstNodeIndex struc) {
+  if (!m_structs.emplace(struc).second) return;
+  std::vector<AstNodeIndex> fields;
+  if (const auto* dict = m_ast[struc].scope.dict) {
+    for (auto field : dict->get_nodes()) {
+      if (m_ast[field].kind != AstNode::Kind::StructField) continue;
+      fields.emplace_back(field);
+      const auto type = m_ast[field].struct_field.value.type;
+      if (m_ast[type].kind == AstNode::Kind::StructType) emit_struct(m_ast[type].struct_type.struct_scope);
+    }
+  }
+  std::stable_sort(fields.begin(), fields.end(), [&](AstNodeIndex a, AstNodeIndex b) {
+    return m_ast[a].struct_field.offset < m_ast[b].struct_field.offset;
+  });
+
+  write("\n");
+  emit_struct_name(struc);
+  write(" {\n");
+  uint32_t end = 0;
+  for (auto field : fields) {
+    const auto& field_node = m_ast[field].struct_field;
+    if (field_node.offset > end) {
+      write("  uint8_t sl_pad");
+      write_int(end);
+      write("[");
+      write_int(field_node.offset - end);
+      write("];\n");
+    }
+    write("  ");
+    emit_type(field_node.value.type);
+    write(" ");
+    write(field_node.name);
+    write(";\n");
+    end = std::max(end, field_node.offset + ast_type_size(m_ast, field_node.value.type));
+  }
+  // C has no empty structs
+  if (fields.empty()) write("  uint8_t sl_empty;\n");
+  write("};\n");
+  for (auto field : fields) {
+    write("_Static_assert(offsetof(");
+    emit_struct_name(struc);
+    write(", ");
+    write(m_ast[field].struct_field.name);
+    write(") == ");
+    write_int(m_ast[field].struct_field.offset);
+    write(", \"field offset\");\n");
+  }
+}
+
+void CBackend::emit_type(AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex) {
+    write("void");
+  } else if (m_ast[type].kind == AstNode::Kind::StructType) {
+    emit_struct_name(m_ast[type].struct_type.struct_scope);
+  } else if (m_ast[type].kind == AstNode::Kind::ArrayType || m_ast[type].kind == AstNode::Kind::SliceType ||
+             ir_is_vector(ast_value_type(m_ast, type))) {
+    m_unsupported = true;
+    write("void");
+  } else {
+    // unions and function types are not values yet, they read as i32
+    const auto ir_type = ast_value_type(m_ast, type);
+    write_str(c_type(ir_type == IrType::Void ? IrType::I32 : ir_type));
+  }
+}
+
+void CBackend::emit_prototype(AstNodeIndex function) {
+  const auto& function_node = m_ast[function].function;
+  const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params;
+  emit_type(fun_type.fun_type.return_type);
+  write(" ");
+  write(function_node.scope.name);
+  write("(");
+  const auto params = fun_type.names ? fun_type.names->size() : 0;
+  for (size_t i = 0; i < params; ++i) {
+    if (i) write(", ");
+    const auto* types = fun_type.fun_type.param_types;
+    emit_type(types && i < types->size() ? (*types)[i] : UndefinedAstNodeIndex);
+    write(" ");
+    write((*fun_type.names)[i]);
+  }
+  if (!params) write("void");
+  write(")");
+}
+
+void CBackend::emit_function(AstNodeIndex function) {
+  const auto& function_node = m_ast[function].function;
+  if (function_node.block_stmt == UndefinedAstNodeIndex) return;
+  const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params;
+  m_return_type = ast_value_type(m_ast, fun_type.fun_type.return_type);
+
+  write("\n");
+  emit_prototype(function);
+  write(" {\n");
+  m_indent = 1;
+  const auto& block = m_ast[function_node.block_stmt];
+  auto last = function_node.block_stmt;
+  if (block.kind == AstNode::Kind::BlockStmt) {
+    if (block.block_stmt.stmts) {
+      for (auto stmt : *block.block_stmt.stmts) emit_stmt(stmt);
+      if (!block.block_stmt.stmts->empty()) last = block.block_stmt.stmts->back();
+    }
+  } else {
+    emit_stmt(function_node.block_stmt);
+  }
+  // falling off the end returns zero like in the other backends
+  if (m_return_type != IrType::Void && m_ast[last].kind != AstNode::Kind::ReturnStmt) {
+    write("  return 0;\n");
+  }
+  write("}\n");
+  m_indent = 0;
+}
+
+// a statement in braces, so declarations in branches and loop bodies are
+// valid C
+void CBackend::emit_body(AstNodeIndex stmt) {
+  write("{\n");
+  ++m_indent;
+  if (m_ast[stmt].kind == AstNode::Kind::BlockStmt) {
+    if (m_ast[stmt].block_stmt.stmts) {
+      for (auto child : *m_ast[stmt].block_stmt.stmts) emit_stmt(child);
+    }
+  } else {
+    emit_stmt(stmt);
+  }
+  --m_indent;
+  write_line_start();
+  write("}");
+}
+
+void CBackend::emit_stmt(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt];
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      write_line_start();
+      emit_body(stmt);
+      write("\n");
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      const auto& local = m_ast[variable].local_variable;
+      const auto type = ast_value_type(m_ast, local.value.type);
+      write_line_start();
+      emit_type(local.value.type);
+      write(" ");
+      write(local.name);
+      // struct storage starts zeroed
+      if (local.value.type != UndefinedAstNodeIndex && m_ast[local.value.type].kind == AstNode::Kind::StructType) {
+        write(" = {0};\n");
+        break;
+      }
+      write(" = ");
+      if (node.variable_decl_stmt.init_expr != UndefinedAstNodeIndex) {
+        emit_converted(node.variable_decl_stmt.init_expr, type);
+      } else {
+        write("0");
+      }
+      write(";\n");
+      break;
+    }
+    case AstNode::Kind::ExprStmt: {
+      const auto expr = node.expr_stmt.expr;
+      write_line_start();
+      const auto& expr_node = m_ast[expr];
+      if (expr_node.kind == AstNode::Kind::AssignExpr && is_place(expr_node.assign_expr.left)) {
+        emit_expr(expr_node.assign_expr.left);
+        write(" = ");
+        emit_converted(expr_node.assign_expr.right, ast_expr_type(m_ast, expr_node.assign_expr.left));
+      } else if (expr_node.kind == AstNode::Kind::CallExpr) {
+        emit_expr(expr);
+      } else {
+        write("(void)");
+        emit_expr(expr);
+      }
+      write(";\n");
+      break;
+    }
+    case AstNode::Kind::ReturnStmt: {
+      const auto expr = node.return_stmt.expr;
+      write_line_start();
+      if (m_return_type == IrType::Void) {
+        if (expr != UndefinedAstNodeIndex) {
+          write("(void)");
+          emit_expr(expr);
+          write("; ");
+        }
+        write("return;\n");
+        break;
+      }
+      write("return ");
+      if (expr != UndefinedAstNodeIndex) {
+        emit_converted(expr, m_return_type);
+      } else {
+        write("0");
+      }
+      write(";\n");
+      break;
+    }
+    case AstNode::Kind::IfElseStmt:
+      write_line_start();
+      write("if (");
+      emit_expr(node.if_else_stmt.expr);
+      write(") ");
+      emit_body(node.if_else_stmt.stmt);
+      if (node.if_else_stmt.else_stmt != UndefinedAstNodeIndex) {
+        write(" else ");
+        emit_body(node.if_else_stmt.else_stmt);
+      }
+      write("\n");
+      break;
+    case AstNode::Kind::WhileStmt:
+      write_line_start();
+      write("while (");
+      emit_expr(node.while_stmt.expr);
+      write(") ");
+      emit_body(node.while_stmt.stmt);
+      write("\n");
+      break;
+    default:
+      m_unsupported = true;
+      break;
+  }
+}
+
+// locals and fields of locals, the expressions C can assign to
+bool CBackend::is_place(AstNodeIndex expr) const {
+  const auto& node = m_ast[expr];
+  if (node.kind == AstNode::Kind::LocalVariable) return true;
+  return node.kind == AstNode::Kind::FieldExpr && is_place(node.field_expr.expr);
+}
+
+void CBackend::emit_converted(AstNodeIndex expr, IrType type) {
+  const auto from = ast_expr_type(m_ast, expr);
+  if (type == IrType::Void || from == type || (from == IrType::Bool && type == IrType::I32)) {
+    emit_expr(expr);
+    return;
+  }
+  write("((");
+  write_str(c_type(type));
+  write(")");
+  emit_expr(expr);
+  write(")");
+}
+
+void CBackend::emit_int(IrType type, int64_t value) {
+  if (type == IrType::U32) {
+    write_int(value);
+    write("u");
+    return;
+  }
+  const bool narrow = type != IrType::I32;
+  if (narrow) {
+    write("((");
+    write_str(c_type(type));
+    write(")");
+  }
+  // -2147483648 would be the negation of a long
+  if (value == INT32_MIN) {
+    write("INT32_MIN");
+  } else if (value < 0) {
+    write("(");
+    write_int(value);
+    write(")");
+  } else {
+    write_int(value);
+  }
+  if (narrow) write(")");
+}
+
+// floats are written in hexadecimal, which is exact
+void CBackend::emit_float(IrType type, double value) {
+  if (std::isnan(value)) {
+    write_str(type == IrType::F32 ? "NAN" : "((double)NAN)");
+    return;
+  }
+  if (std::isinf(value)) {
+    if (value < 0) write("(-");
+    write_str(type == IrType::F32 ? "INFINITY" : "((double)INFINITY)");
+    if (value < 0) write(")");
+    return;
+  }
+  char digits[40];
+  const int length = std::snprintf(digits, sizeof(digits), "%a%s", value, type == IrType::F32 ? "f" : "");
+  if (value < 0) write("(");
+  write(digits, length);
+  if (value < 0) write(")");
+}
+
+void CBackend::emit_arithmetic(const char* op, const AstNode::BinaryExpr& expr) {
+  const auto type = ast_expr_type(m_ast, expr.left);
+  if (ir_is_float(type)) {
+    write("(");
+    emit_expr(expr.left);
+    write(" ");
+    write_str(op);
+    write(" ");
+    emit_converted(expr.right, type);
+    write(")");
+    return;
+  }
+  write("sl_");
+  write_str(op[0] == '+' ? "add" : op[0] == '-' ? "sub" : op[0] == '*' ? "mul" : "div");
+  write("_");
+  write_str(helper_suffix(type));
+  write("(");
+  emit_expr(expr.left);
+  write(", ");
+  emit_expr(expr.right);
+  write(")");
+}
+
+void CBackend::emit_compare(const char* op, const AstNode::BinaryExpr& expr) {
+  write("(");
+  emit_expr(expr.left);
+  write(" ");
+  write_str(op);
+  write(" ");
+  emit_converted(expr.right, ast_expr_type(m_ast, expr.left));
+  write(")");
+}
+
+void CBackend::emit_expr(AstNodeIndex expr) {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal: emit_int(IrType::I8, node.i8_literal.literal_value); break;
+    case AstNode::Kind::CharLiteral: emit_int(IrType::I8, node.char_literal.chr); break;
+    case AstNode::Kind::I16Literal: emit_int(IrType::I16, node.i16_literal.literal_value); break;
+    case AstNode::Kind::I32Literal: emit_int(IrType::I32, node.i32_literal.literal_value); break;
+    case AstNode::Kind::U8Literal: emit_int(IrType::U8, node.u8_literal.literal_value); break;
+    case AstNode::Kind::U16Literal: emit_int(IrType::U16, node.u16_literal.literal_value); break;
+    case AstNode::Kind::U32Literal: emit_int(IrType::U32, node.u32_literal.literal_value); break;
+    case AstNode::Kind::F32Literal: emit_float(IrType::F32, node.f32_literal.literal_value); break;
+    case AstNode::Kind::F64Literal: emit_float(IrType::F64, node.f64_literal.literal_value); break;
+    case AstNode::Kind::LocalVariable:
+      write(node.local_variable.name);
+      break;
+    case AstNode::Kind::FieldExpr:
+      if (!is_place(node.field_expr.expr)) {
+        m_unsupported = true;
+        write("0");
+        break;
+      }
+      emit_expr(node.field_expr.expr);
+      write(".");
+      write(m_ast[node.field_expr.field].struct_field.name);
+      break;
+    case AstNode::Kind::CallExpr: {
+      const auto& function_node = m_ast[node.call_expr.function].function;
+      const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params.fun_type;
+      write(function_node.scope.name);
+      write("(");
+      if (node.call_expr.args) {
+        for (size_t i = 0; i < node.call_expr.args->size(); ++i) {
+          if (i) write(", ");
+          const auto param_type = fun_type.param_types && i < fun_type.param_types->size()
+            ? ast_value_type(m_ast, (*fun_type.param_types)[i]) : IrType::Void;
+          emit_converted((*node.call_expr.args)[i], param_type);
+        }
+      }
+      write(")");
+      break;
+    }
+    case AstNode::Kind::AssignExpr:
+      if (!is_place(node.assign_expr.left)) {
+        m_unsupported = true;
+        emit_expr(node.assign_expr.right);
+        break;
+      }
+      write("(");
+      emit_expr(node.assign_expr.left);
+      write(" = ");
+      emit_converted(node.assign_expr.right, ast_expr_type(m_ast, node.assign_expr.left));
+      write(")");
+      break;
+    case AstNode::Kind::ParenthExpr:
+      write("(");
+      emit_expr(node.parenth_expr.expr);
+      write(")");
+      break;
+    case AstNode::Kind::NegExpr: {
+      const auto type = ast_expr_type(m_ast, node.neg_expr.expr);
+      if (ir_is_float(type)) {
+        write("(-");
+        emit_expr(node.neg_expr.expr);
+        write(")");
+        break;
+      }
+      write("sl_neg_");
+      write_str(helper_suffix(type));
+      write("(");
+      emit_expr(node.neg_expr.expr);
+      write(")");
+      break;
+    }
+    case AstNode::Kind::AddExpr: emit_arithmetic("+", node.add_expr); break;
+    case AstNode::Kind::SubExpr: emit_arithmetic("-", node.sub_expr); break;
+    case AstNode::Kind::MulExpr: emit_arithmetic("*", node.mul_expr); break;
+    case AstNode::Kind::DivExpr: emit_arithmetic("/", node.div_expr); break;
+    case AstNode::Kind::EqualExpr: emit_compare("==", node.equal_expr); break;
+    case AstNode::Kind::GreatExpr: emit_compare(">", node.great_expr); break;
+    case AstNode::Kind::GreatOrEqualExpr: emit_compare(">=", node.great__or_equal_expr); break;
+    case AstNode::Kind::LessExpr: emit_compare("<", node.less_expr); break;
+    case AstNode::Kind::LessOrEqualExpr: emit_compare("<=", node.less_or_equal_expr); break;
+    default:
+      m_unsupported = true;
+      write("0");
+      break;
+  }
+}
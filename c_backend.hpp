@@ -0,0 +1,93 @@
+#ifndef C_BACKEND_HPP
+#define C_BACKEND_HPP
+
+#include "ast.hpp"
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <unordered_set>
+#include <vector>
+
+// Translates a module of the Ast into C11, so any C compiler can build an
+// optimized native binary from it. Integer types map to <stdint.h> types,
+// structs become C structs whose field offsets are checked against the
+// computed layout with static asserts, and functions become external C
+// functions of the same name. Integer arithmetic goes through small inline
+// helpers that wrap at the width of the type and divide like ir_fold, so
+// the translation behaves like the other backends; division by zero is
+// left to C. Arrays, slices, vectors, new, spawn and join and regions have
+// no translation: a module using them fails instead of becoming C that
+// computes something else.
+//
+// Output is streamed through a fixed buffer: every function is written as
+// soon as it is translated and nothing of the module is kept in memory.
+class CBackend {
+public:
+  CBackend(const Ast& ast, const IdCache& id_cache, std::ostream& out)
+    : m_ast(ast), m_id_cache(id_cache), m_out(out) {}
+  CBackend(const CBackend&) = delete;
+  CBackend(CBackend&&) = delete;
+  CBackend& operator=(const CBackend&) = delete;
+  CBackend& operator=(CBackend&&) = delete;
+  ~CBackend() { flush(); }
+
+  // translates every function declared in the given global scope and the
+  // structs they use, false if any of them uses a node kind that has no
+  // translation, leaving the output incomplete
+  bool emit_module(AstNodeIndex global_scope);
+  // hands the buffered output to the stream
+  void flush();
+
+private:
+  static const size_t BufferSize = 64 * 1024;
+
+  const Ast& m_ast;
+  const IdCache& m_id_cache;
+  std::ostream& m_out;
+  char m_buffer[BufferSize];
+  size_t m_used = 0;
+  // Struct nodes whose definition was written
+  std::unordered_set<AstNodeIndex> m_structs;
+  IrType m_return_type = IrType::Void;
+  uint32_t m_indent = 0;
+  // a node without translation was met
+  bool m_unsupported = false;
+
+  void write(const char* str, size_t length) {
+    if (m_used + length > BufferSize) {
+      flush_for(str, length);
+      return;
+    }
+    std::memcpy(m_buffer + m_used, str, length);
+    m_used += length;
+  }
+  // literals are measured at compile time
+  template <size_t N>
+  void write(const char (&str)[N]) { write(str, N - 1); }
+  void write_str(const char* str) { write(str, std::strlen(str)); }
+  void flush_for(const char* str, size_t length);
+  void write(IdIndex name);
+  void write_int(int64_t value);
+  void write_line_start();
+
+  void collect_structs(AstNodeIndex node, std::vector<AstNodeIndex>& structs);
+  void emit_struct(AstNodeIndex struc);
+  void emit_struct_name(AstNodeIndex struc);
+  void emit_type(AstNodeIndex type);
+  void emit_prototype(AstNodeIndex function);
+  void emit_function(AstNodeIndex function);
+  void emit_stmt(AstNodeIndex stmt);
+  void emit_body(AstNodeIndex stmt);
+  void emit_expr(AstNodeIndex expr);
+  void emit_converted(AstNodeIndex expr, IrType type);
+  void emit_int(IrType type, int64_t value);
+  void emit_float(IrType type, double value);
+  void emit_arithmetic(const char* op, const AstNode::BinaryExpr& expr);
+  void emit_compare(const char* op, const AstNode::BinaryExpr& expr);
+  bool is_place(AstNodeIndex expr) const;
+};
+
+#endif  // C_BACKEND_HPP
@@ -0,0 +1,1416 @@
+#include "codegen.hpp"
+#include "region.hpp"
+#include "task.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const X86Reg IntArgumentRegisters[] = {
+  X86Reg::Rdi, X86Reg::Rsi, X86Reg::Rdx, X86Reg::Rcx, X86Reg::R8, X86Reg::R9,
+};
+static const uint32_t IntArgumentCount = 6;
+static const uint32_t FloatArgumentCount = 8;
+static const X86Reg CalleeSaved[] = {X86Reg::Rbx, X86Reg::R12, X86Reg::R13, X86Reg::R14, X86Reg::R15};
+
+static X86Operand reg(X86Reg r) { return X86Operand::make_reg(r); }
+static X86Operand mem(const X86Mem& m) { return X86Operand::make_mem(m); }
+static X86Operand imm(int64_t value) { return X86Operand::make_imm(value); }
+
+// integers live in 32 bit registers, only pointers need all 64 bits
+static uint32_t register_size(IrType type) {
+  if (type == IrType::Ptr || type == IrType::F64) return 8;
+  return 4;
+}
+
+// floats and vectors live in xmm registers
+static bool is_xmm(IrType type) { return ir_is_float(type) || ir_is_vector(type); }
+
+// 32 byte vectors take all of a ymm register
+static bool is_wide(IrType type) { return ir_type_size(type) == 32 && ir_is_vector(type); }
+
+static X86Reg scratch(IrType type) { return is_xmm(type) ? X86XmmScratch : X86GprScratch; }
+
+static bool is_supported(IrType type) { return type != IrType::Void; }
+
+static uint32_t round_up(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// vector arguments are only passed in registers
+static bool passes_vector_in_memory(const IrFunction& function, const std::vector<IrValueIndex>& values) {
+  uint32_t floats = 0;
+  for (auto value : values) {
+    const auto type = function.instrs[value].type;
+    if (is_xmm(type) && floats++ >= FloatArgumentCount && ir_is_vector(type)) return true;
+  }
+  return false;
+}
+
+bool X86Code::link() {
+  for (const auto& call : calls) {
+    if (call.function >= entries.size() || entries[call.function] == UndefinedCodeOffset) return false;
+    const auto rel = static_cast<uint32_t>(static_cast<int32_t>(entries[call.function]) - static_cast<int32_t>(call.offset + 4));
+    for (uint32_t i = 0; i < 4; ++i) bytes[call.offset + i] = static_cast<uint8_t>(rel >> (8 * i));
+  }
+  return true;
+}
+
+bool X86CodeGen::compile_module(X86Code& code) {
+  for (uint32_t function = 0; function < m_module.functions.size(); ++function) {
+    if (!compile(function, code)) return false;
+  }
+  return code.link();
+}
+
+bool X86CodeGen::compile(uint32_t function_index, X86Code& code) {
+  const auto& function = m_module.functions[function_index];
+  bool vectors = false;
+  bool wide = false;
+  for (const auto& instr : function.instrs) {
+    if (!ir_is_vector(instr.type)) continue;
+    vectors = true;
+    if (!is_wide(instr.type)) continue;
+    wide = true;
+    if (instr.kind == IrInstr::Kind::Shuffle && !__builtin_cpu_supports("avx2")) return false;
+  }
+  if (vectors && !__builtin_cpu_supports("sse4.1")) return false;
+  if (wide && !__builtin_cpu_supports("avx")) return false;
+  if (passes_vector_in_memory(function, function.params)) return false;
+
+  LinearScan scan(function);
+  const auto alloc_stats = scan.run();
+  X86Assembler assembler;
+  assembler.set_vex(wide);
+  m_function = &function;
+  m_scan = &scan;
+  m_asm = &assembler;
+  m_calls.clear();
+  m_constants.clear();
+  m_fused = false;
+  m_pool = assembler.new_label();
+  m_trap = assembler.new_label();
+  m_traps = false;
+  m_runtime_calls = false;
+
+  std::vector<IrBlockIndex> order;
+  for (IrBlockIndex block = 0; block < function.blocks.size(); ++block) {
+    if (scan.block_from(block) != UndefinedPosition) order.emplace_back(block);
+  }
+  std::sort(order.begin(), order.end(), [&scan](IrBlockIndex a, IrBlockIndex b) {
+    return scan.block_from(a) < scan.block_from(b);
+  });
+
+  // frame: saved registers, spill slots, then struct storage
+  m_use_counts.assign(function.instrs.size(), 0);
+  m_slot_offsets.assign(function.instrs.size(), 0);
+  m_saved_registers.clear();
+  for (auto r : CalleeSaved) {
+    if (scan.used_registers() & (1u << static_cast<uint8_t>(r))) m_saved_registers.emplace_back(r);
+  }
+  // vector spill slots are 16 byte aligned like rbp
+  const uint32_t saved_size = 8 * m_saved_registers.size();
+  m_spill_base = -static_cast<int32_t>(vectors ? round_up(saved_size, 16) : saved_size);
+  uint32_t frame = -m_spill_base + 8 * alloc_stats.spill_slots;
+  for (auto block : order) {
+    for (auto index : function.blocks[block].instrs) {
+      const auto& instr = function.instrs[index];
+      for (auto operand : instr.operands) ++m_use_counts[operand];
+      if (instr.kind != IrInstr::Kind::StackSlot) continue;
+      frame = round_up(frame + instr.index, instr.index >= 16 ? 16 : 8);
+      m_slot_offsets[index] = -static_cast<int32_t>(frame);
+    }
+  }
+  m_frame_size = round_up(frame, 16) - saved_size;
+
+  std::vector<RegAllocMove> positioned;
+  for (const auto& move : scan.moves()) {
+    if (move.position != UndefinedPosition && !is_remat(move.value)) positioned.emplace_back(move);
+  }
+  std::sort(positioned.begin(), positioned.end(), [](const RegAllocMove& a, const RegAllocMove& b) {
+    return a.position < b.position;
+  });
+
+  m_block_labels.assign(function.blocks.size(), 0);
+  for (auto block : order) m_block_labels[block] = assembler.new_label();
+
+  prologue();
+
+  struct Stub {
+    X86Label label;
+    std::vector<Move> moves;
+    IrBlockIndex target;
+  };
+  std::vector<Stub> stubs;
+  uint32_t next_move = 0;
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const auto block = order[i];
+    const auto next = i + 1 < order.size() ? order[i + 1] : UndefinedIrBlockIndex;
+    assembler.bind(m_block_labels[block]);
+    const auto& instrs = function.blocks[block].instrs;
+    for (uint32_t j = 0; j < instrs.size(); ++j) {
+      const auto index = instrs[j];
+      const auto& instr = function.instrs[index];
+      const auto position = scan.position(index);
+      while (next_move < positioned.size() && positioned[next_move].position <= position) {
+        const auto group = positioned[next_move].position;
+        std::vector<Move> moves;
+        for (; next_move < positioned.size() && positioned[next_move].position == group; ++next_move) {
+          const auto& allocated = positioned[next_move];
+          Move move{allocated.to, allocated.from};
+          move.type = function.instrs[allocated.value].type;
+          moves.emplace_back(move);
+        }
+        parallel_move(std::move(moves));
+      }
+      ++m_stats.instructions;
+
+      switch (instr.kind) {
+        case IrInstr::Kind::Jump:
+          parallel_move(edge_moves(block, instr.targets[0]));
+          if (instr.targets[0] != next) assembler.jmp(m_block_labels[instr.targets[0]]);
+          break;
+        case IrInstr::Kind::Branch: {
+          if (instr.targets[0] == instr.targets[1]) {
+            parallel_move(edge_moves(block, instr.targets[0]));
+            if (instr.targets[0] != next) assembler.jmp(m_block_labels[instr.targets[0]]);
+            break;
+          }
+          // edges with moves go through a stub, so both successors see
+          // their own locations
+          X86Label labels[2];
+          bool direct[2];
+          for (uint32_t t = 0; t < 2; ++t) {
+            auto moves = edge_moves(block, instr.targets[t]);
+            direct[t] = moves.empty();
+            labels[t] = m_block_labels[instr.targets[t]];
+            if (!direct[t]) {
+              labels[t] = assembler.new_label();
+              stubs.push_back({labels[t], std::move(moves), instr.targets[t]});
+            }
+          }
+          X86Condition condition = X86Condition::NotEqual;
+          if (m_fused) {
+            condition = m_fused_condition;
+            m_fused = false;
+          } else {
+            const auto cond = use(instr.operands[0], position, X86GprScratch);
+            if (cond.is_imm()) {
+              assembler.jmp(labels[cond.imm ? 0 : 1]);
+              break;
+            }
+            if (cond.is_reg()) {
+              assembler.test(4, cond.reg, cond.reg);
+            } else {
+              assembler.alu(X86Alu::Cmp, 1, cond, imm(0));
+            }
+          }
+          if (direct[1] && instr.targets[1] == next) {
+            assembler.jcc(condition, labels[0]);
+          } else if (direct[0] && instr.targets[0] == next) {
+            assembler.jcc(x86_negate(condition), labels[1]);
+          } else {
+            assembler.jcc(condition, labels[0]);
+            assembler.jmp(labels[1]);
+          }
+          break;
+        }
+        case IrInstr::Kind::Return:
+          select_return(index);
+          break;
+        default: {
+          // a compare whose only use is the branch right after it leaves
+          // its result in the flags
+          const auto branch = j + 1 < instrs.size() ? instrs[j + 1] : UndefinedIrValueIndex;
+          m_fused = instr.is_compare() && branch != UndefinedIrValueIndex && m_use_counts[index] == 1
+            && function.instrs[branch].kind == IrInstr::Kind::Branch && function.instrs[branch].operands[0] == index
+            && !(ir_is_float(function.instrs[instr.operands[0]].type) && instr.kind == IrInstr::Kind::Equal);
+          if (!select(index)) return false;
+          break;
+        }
+      }
+    }
+  }
+  for (auto& stub : stubs) {
+    assembler.bind(stub.label);
+    parallel_move(std::move(stub.moves));
+    assembler.jmp(m_block_labels[stub.target]);
+  }
+  if (m_traps) {
+    assembler.bind(m_trap);
+    assembler.ud2();
+  }
+  assembler.align(16, 0xcc);
+  assembler.bind(m_pool);
+  for (const auto& constant : m_constants) {
+    assembler.bytes(constant.first, 8);
+    assembler.bytes(constant.second, 8);
+  }
+  if (!assembler.finish()) return false;
+
+  if (code.entries.size() < m_module.functions.size()) code.entries.resize(m_module.functions.size(), UndefinedCodeOffset);
+  while (code.bytes.size() % 16) code.bytes.emplace_back(0xcc);
+  const uint32_t entry = code.bytes.size();
+  code.entries[function_index] = entry;
+  code.bytes.insert(code.bytes.end(), assembler.code().begin(), assembler.code().end());
+  for (const auto& call : m_calls) code.calls.push_back({entry + call.offset, call.function});
+  code.calls_runtime = code.calls_runtime || m_runtime_calls;
+
+  ++m_stats.functions;
+  m_stats.spill_slots += alloc_stats.spill_slots;
+  m_stats.code_bytes += assembler.size();
+  return true;
+}
+
+bool X86CodeGen::select(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  switch (instr.kind) {
+    case IrInstr::Kind::None:
+    case IrInstr::Kind::Param:
+    case IrInstr::Kind::Phi:
+    case IrInstr::Kind::Const:
+      // parameters arrive in the prologue, phis on the edges and constants
+      // where they are used
+      return true;
+    case IrInstr::Kind::StackSlot:
+      // its address is used where it is needed
+      zero_slot(index);
+      return true;
+    case IrInstr::Kind::FieldAddr: {
+      X86Mem slot;
+      if (frame_address(index, slot)) return true;
+      const auto dst = def(index);
+      const auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+      auto field = address(instr.operands[0], m_scan->position(index));
+      field.disp += instr.index;
+      m_asm->lea(8, w, field);
+      if (!dst.is(w)) m_asm->mov(8, dst, reg(w));
+      return true;
+    }
+    case IrInstr::Kind::ElementAddr:
+      return select_element_addr(index);
+    case IrInstr::Kind::BoundsCheck:
+      select_bounds_check(index);
+      return true;
+    case IrInstr::Kind::Neg:
+    case IrInstr::Kind::Add:
+    case IrInstr::Kind::Sub:
+    case IrInstr::Kind::Mul:
+      if (ir_is_vector(instr.type)) return select_vector(index);
+      return ir_is_float(instr.type) ? select_float(index) : select_binary(index);
+    case IrInstr::Kind::Div:
+      if (ir_is_vector(instr.type)) return select_vector(index);
+      return ir_is_float(instr.type) ? select_float(index) : select_division(index);
+    case IrInstr::Kind::Equal:
+    case IrInstr::Kind::Great:
+    case IrInstr::Kind::GreatOrEqual:
+    case IrInstr::Kind::Less:
+    case IrInstr::Kind::LessOrEqual:
+      return ir_is_vector(instr.type) ? select_vector(index) : select_compare(index);
+    case IrInstr::Kind::Splat:
+      return select_splat(index);
+    case IrInstr::Kind::Lane:
+      return select_lane(index);
+    case IrInstr::Kind::InsertLane:
+      return select_insert_lane(index);
+    case IrInstr::Kind::Shuffle:
+      return select_shuffle(index);
+    case IrInstr::Kind::Load:
+      return select_load(index);
+    case IrInstr::Kind::Store:
+      return select_store(index);
+    case IrInstr::Kind::Call:
+      return select_call(index);
+    case IrInstr::Kind::RuntimeCall:
+      return select_runtime_call(index);
+    case IrInstr::Kind::FunctionAddr: {
+      const auto dst = def(index);
+      const auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+      m_calls.push_back({m_asm->lea_rip(w), instr.index});
+      if (!dst.is(w)) m_asm->mov(8, dst, reg(w));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool X86CodeGen::select_binary(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  if (!is_supported(instr.type) || instr.type == IrType::Ptr) return false;
+  const auto position = m_scan->position(index);
+  const auto dst = def(index);
+  auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+  const uint32_t size = 4;
+
+  auto a = use(instr.operands[0], position, X86GprScratch);
+  if (instr.kind == IrInstr::Kind::Neg) {
+    if (!a.is(w)) m_asm->mov(size, reg(w), a);
+    m_asm->neg(size, w);
+  } else {
+    auto b = use(instr.operands[1], position, X86GprScratch);
+    const bool commutative = instr.kind != IrInstr::Kind::Sub;
+    if (commutative && (a.is_imm() || (b.is(w) && !a.is(w)))) std::swap(a, b);
+    if (b.is(w) && !a.is(w)) w = X86GprScratch;
+
+    const bool is_add = instr.kind == IrInstr::Kind::Add;
+    if (a.is_reg() && !a.is(w) && ((is_add && b.is_reg()) || (instr.kind != IrInstr::Kind::Mul && b.is_imm()))) {
+      // three operand add through the address unit
+      X86Mem sum = X86Mem::at(a.reg, b.is_imm() ? static_cast<int32_t>(is_add ? b.imm : -b.imm) : 0);
+      if (b.is_reg()) sum.index = b.reg;
+      m_asm->lea(size, w, sum);
+    } else if (instr.kind == IrInstr::Kind::Mul && b.is_imm() && !a.is_imm()) {
+      m_asm->imul(size, w, a, static_cast<int32_t>(b.imm));
+    } else {
+      if (!a.is(w)) m_asm->mov(size, reg(w), a);
+      if (instr.kind == IrInstr::Kind::Mul) {
+        if (b.is_imm()) {
+          m_asm->imul(size, w, reg(w), static_cast<int32_t>(b.imm));
+        } else {
+          m_asm->imul(size, w, b);
+        }
+      } else {
+        m_asm->alu(instr.kind == IrInstr::Kind::Add ? X86Alu::Add : X86Alu::Sub, size, reg(w), b);
+      }
+    }
+  }
+  wrap(instr.type, w);
+  if (!dst.is(w)) m_asm->mov(size, dst, reg(w));
+  return true;
+}
+
+bool X86CodeGen::select_float(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto size = ir_type_size(instr.type);
+  const auto dst = def(index);
+  auto w = dst.is_reg() ? dst.reg : X86XmmScratch;
+
+  auto a = use(instr.operands[0], position, X86GprScratch);
+  if (instr.kind == IrInstr::Kind::Neg) {
+    if (!a.is(w)) m_asm->mov(size, reg(w), a);
+    m_asm->xorps(w, mem(constant(size == 4 ? 0x80000000u : 0x8000000000000000u)));
+  } else {
+    auto b = use(instr.operands[1], position, X86GprScratch);
+    const bool commutative = instr.kind == IrInstr::Kind::Add || instr.kind == IrInstr::Kind::Mul;
+    if (commutative && b.is(w) && !a.is(w)) std::swap(a, b);
+    if (b.is(w) && !a.is(w)) w = X86XmmScratch;
+    if (!a.is(w)) m_asm->mov(size, reg(w), a);
+    X86Sse op = X86Sse::Add;
+    switch (instr.kind) {
+      case IrInstr::Kind::Sub: op = X86Sse::Sub; break;
+      case IrInstr::Kind::Mul: op = X86Sse::Mul; break;
+      case IrInstr::Kind::Div: op = X86Sse::Div; break;
+      default: break;
+    }
+    m_asm->sse(op, size, w, b);
+  }
+  if (!dst.is(w)) m_asm->mov(size, dst, reg(w));
+  return true;
+}
+
+bool X86CodeGen::select_compare(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto type = m_function->instrs[instr.operands[0]].type;
+  if (!is_supported(type)) return false;
+  auto a = use(instr.operands[0], position, X86GprScratch);
+  auto b = use(instr.operands[1], position, X86GprScratch);
+  auto kind = instr.kind;
+  X86Condition condition = X86Condition::Equal;
+
+  if (ir_is_float(type)) {
+    const auto size = ir_type_size(type);
+    // unordered sets CF, so only above and above-or-equal are false on
+    // NaN; less is greater with the operands swapped
+    if (kind == IrInstr::Kind::Less || kind == IrInstr::Kind::LessOrEqual) {
+      std::swap(a, b);
+      kind = kind == IrInstr::Kind::Less ? IrInstr::Kind::Great : IrInstr::Kind::GreatOrEqual;
+    }
+    if (!a.is_reg()) {
+      m_asm->mov(size, reg(X86XmmScratch), a);
+      a = reg(X86XmmScratch);
+    }
+    m_asm->ucomis(size, a.reg, b);
+    if (kind == IrInstr::Kind::Equal) {
+      // equal and ordered
+      const auto dst = def(index);
+      if (dst.is_reg()) {
+        m_asm->setcc(X86Condition::Equal, dst.reg);
+        m_asm->setcc(X86Condition::NoParity, X86GprScratch);
+        m_asm->alu(X86Alu::And, 1, dst, reg(X86GprScratch));
+        m_asm->extend(dst.reg, dst, 1, false);
+      } else {
+        m_asm->mov(8, dst, imm(0));
+        m_asm->setcc(X86Condition::Equal, X86GprScratch);
+        m_asm->mov(1, dst, reg(X86GprScratch));
+        m_asm->setcc(X86Condition::NoParity, X86GprScratch);
+        m_asm->alu(X86Alu::And, 1, dst, reg(X86GprScratch));
+      }
+      return true;
+    }
+    condition = kind == IrInstr::Kind::Great ? X86Condition::Above : X86Condition::AboveOrEqual;
+  } else {
+    if (a.is_imm()) {
+      std::swap(a, b);
+      switch (kind) {
+        case IrInstr::Kind::Great: kind = IrInstr::Kind::Less; break;
+        case IrInstr::Kind::GreatOrEqual: kind = IrInstr::Kind::LessOrEqual; break;
+        case IrInstr::Kind::Less: kind = IrInstr::Kind::Great; break;
+        case IrInstr::Kind::LessOrEqual: kind = IrInstr::Kind::GreatOrEqual; break;
+        default: break;
+      }
+    }
+    const auto size = register_size(type);
+    if (a.is_imm() || (a.is_mem() && b.is_mem())) {
+      m_asm->mov(size, reg(X86GprScratch), a);
+      a = reg(X86GprScratch);
+    }
+    m_asm->alu(X86Alu::Cmp, size, a, b);
+    const bool is_signed = ir_is_signed(type);
+    switch (kind) {
+      case IrInstr::Kind::Great: condition = is_signed ? X86Condition::Greater : X86Condition::Above; break;
+      case IrInstr::Kind::GreatOrEqual:
+        condition = is_signed ? X86Condition::GreaterOrEqual : X86Condition::AboveOrEqual;
+        break;
+      case IrInstr::Kind::Less: condition = is_signed ? X86Condition::Less : X86Condition::Below; break;
+      case IrInstr::Kind::LessOrEqual: condition = is_signed ? X86Condition::LessOrEqual : X86Condition::BelowOrEqual; break;
+      default: break;
+    }
+  }
+
+  if (m_fused) {
+    m_fused_condition = condition;
+    ++m_stats.fused_branches;
+    return true;
+  }
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+  m_asm->setcc(condition, w);
+  m_asm->extend(w, reg(w), 1, false);
+  if (!dst.is(w)) m_asm->mov(4, dst, reg(w));
+  return true;
+}
+
+// idiv and div take the dividend in rdx:rax, which the allocator does not
+// know about: the divisor goes to r11 and rax and rdx are preserved around
+// the division when they hold other values
+bool X86CodeGen::select_division(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  if (!is_supported(instr.type) || instr.type == IrType::Ptr) return false;
+  const auto position = m_scan->position(index);
+  const bool is_signed = ir_is_signed(instr.type);
+  // i32 divides in 64 bits, so INT32_MIN / -1 wraps instead of trapping
+  const bool wide = instr.type == IrType::I32;
+  const uint32_t size = wide ? 8 : 4;
+
+  const auto divisor = use(instr.operands[1], position, X86GprScratch);
+  if (wide && !divisor.is_imm()) {
+    m_asm->extend32(X86GprScratch, divisor);
+  } else {
+    m_asm->mov(size, reg(X86GprScratch), divisor);
+  }
+  const bool save_rax = live_across(X86Reg::Rax, position, index);
+  const bool save_rdx = live_across(X86Reg::Rdx, position, index);
+  if (save_rax) m_asm->push(reg(X86Reg::Rax));
+  if (save_rdx) m_asm->push(reg(X86Reg::Rdx));
+
+  const auto dividend = use(instr.operands[0], position, X86Reg::Rax);
+  if (wide && !dividend.is_imm()) {
+    m_asm->extend32(X86Reg::Rax, dividend);
+  } else if (!dividend.is(X86Reg::Rax)) {
+    m_asm->mov(size, reg(X86Reg::Rax), dividend);
+  }
+  if (is_signed) {
+    m_asm->sign_extend_accumulator(size);
+  } else {
+    m_asm->alu(X86Alu::Xor, 4, reg(X86Reg::Rdx), reg(X86Reg::Rdx));
+  }
+  m_asm->div(size, X86GprScratch, is_signed);
+
+  m_asm->mov(4, reg(X86GprScratch), reg(X86Reg::Rax));
+  wrap(instr.type, X86GprScratch);
+  if (save_rdx) m_asm->pop(X86Reg::Rdx);
+  if (save_rax) m_asm->pop(X86Reg::Rax);
+  m_asm->mov(4, def(index), reg(X86GprScratch));
+  return true;
+}
+
+bool X86CodeGen::select_load(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  if (!is_supported(instr.type)) return false;
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : scratch(instr.type);
+  const auto source = mem(address(instr.operands[0], m_scan->position(index)));
+  if (ir_is_vector(instr.type)) {
+    m_asm->movups(reg(w), source, is_wide(instr.type));
+    if (!dst.is(w)) m_asm->movups(dst, reg(w), is_wide(instr.type));
+    return true;
+  }
+  switch (instr.type) {
+    case IrType::Bool:
+    case IrType::U8:
+    case IrType::I8:
+    case IrType::U16:
+    case IrType::I16:
+      m_asm->extend(w, source, ir_type_size(instr.type), ir_is_signed(instr.type));
+      break;
+    default:
+      m_asm->mov(ir_type_size(instr.type), reg(w), source);
+      break;
+  }
+  if (!dst.is(w)) m_asm->mov(register_size(instr.type), dst, reg(w));
+  return true;
+}
+
+bool X86CodeGen::select_store(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto type = m_function->instrs[instr.operands[1]].type;
+  if (!is_supported(type)) return false;
+  const auto size = ir_type_size(type);
+
+  if (ir_is_vector(type)) {
+    auto value = use(instr.operands[1], position, X86XmmScratch);
+    if (value.is_mem()) {
+      m_asm->movups(reg(X86XmmScratch), value, is_wide(type));
+      value = reg(X86XmmScratch);
+    }
+    m_asm->movups(mem(address(instr.operands[0], position)), value, is_wide(type));
+    return true;
+  }
+
+  auto value = use(instr.operands[1], position, X86GprScratch);
+  if (value.is_mem()) {
+    m_asm->mov(register_size(type), reg(scratch(type)), value);
+    value = reg(scratch(type));
+  }
+  // a spilled address needs a second scratch register
+  X86Mem slot;
+  const bool borrow = value.is(X86GprScratch) && !frame_address(instr.operands[0], slot)
+    && !m_scan->location(instr.operands[0], position).is_register();
+  if (borrow) {
+    m_asm->push(reg(X86Reg::Rax));
+    m_asm->mov(8, reg(X86Reg::Rax), mem(spill_slot(m_scan->location(instr.operands[0], position).spill_slot)));
+    m_asm->mov(size, mem(X86Mem::at(X86Reg::Rax)), value);
+    m_asm->pop(X86Reg::Rax);
+    return true;
+  }
+  m_asm->mov(size, mem(address(instr.operands[0], position)), value);
+  return true;
+}
+
+// stack slots start at zero where they are created, large ones in a loop
+// counting r11 up to 0
+void X86CodeGen::zero_slot(IrValueIndex index) {
+  const int32_t size = round_up(m_function->instrs[index].index, 8);
+  const auto offset = m_slot_offsets[index];
+  if (size <= 64) {
+    for (int32_t at = 0; at < size; at += 8) m_asm->mov(8, mem(X86Mem::at(X86Reg::Rbp, offset + at)), imm(0));
+    return;
+  }
+  m_asm->mov(8, reg(X86GprScratch), imm(-size));
+  const auto loop = m_asm->new_label();
+  m_asm->bind(loop);
+  auto slot = X86Mem::at(X86Reg::Rbp, offset + size);
+  slot.index = X86GprScratch;
+  m_asm->mov(8, mem(slot), imm(0));
+  m_asm->alu(X86Alu::Add, 8, reg(X86GprScratch), imm(8));
+  m_asm->jcc(X86Condition::NotEqual, loop);
+}
+
+// lea dst, [base + index * size] once a check passed; i32 indices are
+// zero extended first, registers only hold their low 32 bits
+bool X86CodeGen::select_element_addr(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto base = instr.operands[0];
+  const auto& index_instr = m_function->instrs[instr.operands[1]];
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+
+  const int64_t offset = index_instr.constant.i * instr.index;
+  const bool folded = index_instr.kind == IrInstr::Kind::Const && x86_fits_int32(offset);
+  X86Mem element;
+  const bool in_frame = frame_address(base, element);
+  const auto base_location = m_scan->location(base, position);
+  const bool load_base = !in_frame && !base_location.is_register();
+
+  // a spilled base and an index with a spilled result need a second register
+  const bool borrow = load_base && !folded && w == X86GprScratch;
+  if (borrow) m_asm->push(reg(X86Reg::Rax));
+  if (!folded) {
+    // into the result unless the base is there, before rax is taken
+    const auto r = !load_base && !in_frame && w == base_location.reg ? X86GprScratch : w;
+    m_asm->mov(4, reg(r), use(instr.operands[1], position, r));
+    element.index = r;
+    element.scale = instr.index;
+  } else {
+    element.disp += offset;
+  }
+  if (load_base) {
+    const auto r = borrow ? X86Reg::Rax : X86GprScratch;
+    m_asm->mov(8, reg(r), mem(spill_slot(base_location.spill_slot)));
+    element.base = r;
+  } else if (!in_frame) {
+    element.base = base_location.reg;
+  }
+  m_asm->lea(8, w, element);
+  if (borrow) m_asm->pop(X86Reg::Rax);
+  if (!dst.is(w)) m_asm->mov(8, dst, reg(w));
+  return true;
+}
+
+// unsigned index < length or ud2, which also catches negative indices
+void X86CodeGen::select_bounds_check(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  auto value = use(instr.operands[0], position, X86GprScratch);
+  auto length = use(instr.operands[1], position, X86GprScratch);
+  if (value.is_imm() && length.is_imm()) {
+    if (static_cast<uint32_t>(value.imm) < static_cast<uint32_t>(length.imm)) return;
+    m_traps = true;
+    m_asm->jmp(m_trap);
+    return;
+  }
+  m_traps = true;
+  if (value.is_imm()) {
+    m_asm->alu(X86Alu::Cmp, 4, length, value);
+    m_asm->jcc(X86Condition::BelowOrEqual, m_trap);
+    return;
+  }
+  if (value.is_mem() && !length.is_reg()) {
+    m_asm->mov(4, reg(X86GprScratch), value);
+    value = reg(X86GprScratch);
+  }
+  m_asm->alu(X86Alu::Cmp, 4, value, length);
+  m_asm->jcc(X86Condition::AboveOrEqual, m_trap);
+}
+
+bool X86CodeGen::select_call(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  if (instr.index >= m_module.functions.size() || passes_vector_in_memory(*m_function, instr.operands)) return false;
+
+  std::vector<Move> moves;
+  bool wide_args = false;
+  std::vector<IrValueIndex> stack;
+  uint32_t ints = 0;
+  uint32_t floats = 0;
+  for (auto arg : instr.operands) {
+    const auto type = m_function->instrs[arg].type;
+    if (!is_supported(type)) return false;
+    wide_args = wide_args || is_wide(type);
+    X86Reg target = X86Reg::None;
+    if (is_xmm(type) && floats < FloatArgumentCount) {
+      target = static_cast<X86Reg>(static_cast<uint8_t>(X86Reg::Xmm0) + floats++);
+    } else if (!is_xmm(type) && ints < IntArgumentCount) {
+      target = IntArgumentRegisters[ints++];
+    }
+    if (target == X86Reg::None) {
+      stack.emplace_back(arg);
+      continue;
+    }
+    Move move;
+    move.to.reg = target;
+    move.type = type;
+    if (is_remat(arg)) {
+      move.remat = arg;
+    } else {
+      move.from = m_scan->location(arg, position);
+    }
+    moves.emplace_back(move);
+  }
+
+  // stack arguments are pushed last to first over an optional pad that
+  // keeps rsp 16 byte aligned at the call
+  const uint32_t stack_bytes = round_up(8 * stack.size(), 16);
+  if (stack_bytes != 8 * stack.size()) m_asm->alu(X86Alu::Sub, 8, reg(X86Reg::Rsp), imm(8));
+  for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+    const auto type = m_function->instrs[*it].type;
+    const auto operand = use(*it, position, X86GprScratch);
+    if (operand.is_reg() && ir_is_float(type)) {
+      m_asm->alu(X86Alu::Sub, 8, reg(X86Reg::Rsp), imm(8));
+      m_asm->mov(8, mem(X86Mem::at(X86Reg::Rsp)), operand);
+    } else if (operand.is_imm() && !x86_fits_int32(operand.imm)) {
+      m_asm->mov(8, reg(X86GprScratch), operand);
+      m_asm->push(reg(X86GprScratch));
+    } else {
+      m_asm->push(operand);
+    }
+  }
+  parallel_move(std::move(moves));
+  // callees without f32x8 arguments may use legacy SSE
+  if (m_asm->vex() && !wide_args) m_asm->vzeroupper();
+  m_calls.push_back({m_asm->call(), instr.index});
+  if (stack_bytes) m_asm->alu(X86Alu::Add, 8, reg(X86Reg::Rsp), imm(stack_bytes));
+
+  if (instr.type != IrType::Void) {
+    const auto dst = def(index);
+    const auto result = is_xmm(instr.type) ? X86Reg::Xmm0 : X86Reg::Rax;
+    if (ir_is_vector(instr.type)) {
+      move_vector(instr.type, dst, reg(result));
+    } else if (!dst.is(result)) {
+      m_asm->mov(register_size(instr.type), dst, reg(result));
+    }
+  }
+  return true;
+}
+
+bool X86CodeGen::select_runtime_call(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const void* function = nullptr;
+  switch (static_cast<IrRuntimeFunction>(instr.index)) {
+    case IrRuntimeFunction::RegionEnter: function = reinterpret_cast<const void*>(&region_enter); break;
+    case IrRuntimeFunction::RegionLeave: function = reinterpret_cast<const void*>(&region_leave); break;
+    case IrRuntimeFunction::RegionAllocate: function = reinterpret_cast<const void*>(&region_allocate); break;
+    case IrRuntimeFunction::TaskSpawn: function = reinterpret_cast<const void*>(&task_spawn); break;
+    case IrRuntimeFunction::TaskJoin: function = reinterpret_cast<const void*>(&task_join); break;
+  }
+  if (!function || instr.operands.size() > IntArgumentCount) return false;
+
+  std::vector<Move> moves;
+  for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+    const auto arg = instr.operands[i];
+    Move move;
+    move.to.reg = IntArgumentRegisters[i];
+    move.type = m_function->instrs[arg].type;
+    if (is_remat(arg)) {
+      move.remat = arg;
+    } else {
+      move.from = m_scan->location(arg, position);
+    }
+    moves.emplace_back(move);
+  }
+  parallel_move(std::move(moves));
+  if (m_asm->vex()) m_asm->vzeroupper();
+  // the runtime is linked into this process, further than rel32 reaches
+  m_asm->mov(8, reg(X86GprScratch), imm(reinterpret_cast<intptr_t>(function)));
+  m_asm->call(reg(X86GprScratch));
+  m_runtime_calls = true;
+  if (instr.type != IrType::Void) {
+    const auto dst = def(index);
+    if (!dst.is(X86Reg::Rax)) m_asm->mov(register_size(instr.type), dst, reg(X86Reg::Rax));
+  }
+  return true;
+}
+
+void X86CodeGen::select_return(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  if (!instr.operands.empty()) {
+    const auto type = m_function->instrs[instr.operands[0]].type;
+    const auto result = is_xmm(type) ? X86Reg::Xmm0 : X86Reg::Rax;
+    const auto value = use(instr.operands[0], m_scan->position(index), result);
+    if (ir_is_vector(type)) {
+      move_vector(type, reg(result), value);
+    } else if (!value.is(result)) {
+      m_asm->mov(ir_is_float(type) ? ir_type_size(type) : register_size(type), reg(result), value);
+    }
+  }
+  epilogue();
+}
+
+// Vector arithmetic is dst = dst op src like scalar SSE. Compares leave
+// all ones or zero in a lane, which is masked down to 1 or 1.0; f64x4 has
+// no compares.
+bool X86CodeGen::select_vector(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto type = instr.type;
+  const bool wide = is_wide(type);
+  const bool is_double = ir_element_type(type) == IrType::F64;
+  const bool is_float = is_double || ir_element_type(type) == IrType::F32;
+  if (is_double && instr.is_compare()) return false;
+  const auto dst = def(index);
+  auto w = dst.is_reg() ? dst.reg : X86XmmScratch;
+
+  auto a = use(instr.operands[0], position, X86XmmScratch);
+  if (instr.kind == IrInstr::Kind::Neg) {
+    if (!a.is(w)) m_asm->movups(reg(w), a, wide);
+    if (is_double) {
+      m_asm->packed(X86Packed::XorPs, w, mem(splat_constant64(0x8000000000000000u, wide)), wide);
+    } else if (is_float) {
+      m_asm->packed(X86Packed::XorPs, w, mem(splat_constant(0x80000000u, wide)), wide);
+    } else {
+      // ~a + 1
+      const auto ones = mem(splat_constant(0xffffffffu, false));
+      m_asm->packed(X86Packed::PXor, w, ones);
+      m_asm->packed(X86Packed::PSubD, w, ones);
+    }
+    if (!dst.is(w)) m_asm->movups(dst, reg(w), wide);
+    return true;
+  }
+
+  auto b = use(instr.operands[1], position, X86XmmScratch);
+  X86Packed op = X86Packed::AddPs;
+  X86PackedCompare predicate = X86PackedCompare::Equal;
+  bool compare = instr.is_compare();
+  bool commutative = false;
+  bool swap = false;
+  bool negate = false;
+  switch (instr.kind) {
+    case IrInstr::Kind::Add:
+      op = is_double ? X86Packed::AddPd : is_float ? X86Packed::AddPs : X86Packed::PAddD;
+      commutative = true;
+      break;
+    case IrInstr::Kind::Sub:
+      op = is_double ? X86Packed::SubPd : is_float ? X86Packed::SubPs : X86Packed::PSubD;
+      break;
+    case IrInstr::Kind::Mul:
+      op = is_double ? X86Packed::MulPd : is_float ? X86Packed::MulPs : X86Packed::PMulLD;
+      commutative = true;
+      break;
+    case IrInstr::Kind::Div:
+      if (!is_float) return false;
+      op = is_double ? X86Packed::DivPd : X86Packed::DivPs;
+      break;
+    // cmpps only has equal, less and less or equal that are false on NaN,
+    // pcmpgtd only greater
+    case IrInstr::Kind::Equal:
+      op = X86Packed::PCmpEqD;
+      commutative = true;
+      break;
+    case IrInstr::Kind::Great:
+      predicate = X86PackedCompare::Less;
+      op = X86Packed::PCmpGtD;
+      swap = is_float;
+      break;
+    case IrInstr::Kind::GreatOrEqual:
+      predicate = X86PackedCompare::LessOrEqual;
+      op = X86Packed::PCmpGtD;
+      swap = true;
+      negate = !is_float;
+      break;
+    case IrInstr::Kind::Less:
+      predicate = X86PackedCompare::Less;
+      op = X86Packed::PCmpGtD;
+      swap = !is_float;
+      break;
+    case IrInstr::Kind::LessOrEqual:
+      predicate = X86PackedCompare::LessOrEqual;
+      op = X86Packed::PCmpGtD;
+      negate = !is_float;
+      break;
+    default:
+      return false;
+  }
+  if (swap) std::swap(a, b);
+  if (commutative && b.is(w) && !a.is(w)) std::swap(a, b);
+  if (b.is(w) && !a.is(w)) w = X86XmmScratch;
+  if (!a.is(w)) m_asm->movups(reg(w), a, wide);
+  if (compare && is_float) {
+    m_asm->cmpps(predicate, w, b, wide);
+  } else {
+    m_asm->packed(op, w, b, wide);
+  }
+  if (compare) {
+    const auto one = mem(splat_constant(is_float ? 0x3f800000u : 1u, wide));
+    m_asm->packed(is_float ? X86Packed::AndPs : negate ? X86Packed::PAndN : X86Packed::PAnd, w, one, wide);
+  }
+  if (!dst.is(w)) m_asm->movups(dst, reg(w), wide);
+  return true;
+}
+
+bool X86CodeGen::select_splat(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const bool wide = is_wide(instr.type);
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : X86XmmScratch;
+  const auto& lane = m_function->instrs[instr.operands[0]];
+  if (lane.type == IrType::F64) {
+    // the low half is copied to the high half, and to the upper 16 bytes
+    if (lane.kind == IrInstr::Kind::Const) {
+      m_asm->movups(reg(w), mem(splat_constant64(static_cast<uint64_t>(lane.constant.i), wide)), wide);
+    } else {
+      const auto value = use(instr.operands[0], m_scan->position(index), X86GprScratch);
+      if (!value.is(w)) m_asm->mov(8, reg(w), value);
+      m_asm->shufps(w, reg(w), 0x44);
+      if (wide) m_asm->vinsertf128(w, w, reg(w), 1);
+    }
+  } else if (lane.kind == IrInstr::Kind::Const) {
+    uint32_t bits = static_cast<uint32_t>(lane.constant.i);
+    if (lane.type == IrType::F32) {
+      const float f = static_cast<float>(lane.constant.f);
+      memcpy(&bits, &f, sizeof(bits));
+    }
+    m_asm->movups(reg(w), mem(splat_constant(bits, wide)), wide);
+  } else {
+    const auto value = use(instr.operands[0], m_scan->position(index), X86GprScratch);
+    if (wide) {
+      broadcast(w, value);
+    } else {
+      if (!value.is(w)) m_asm->mov(4, reg(w), value);
+      m_asm->pshufd(w, reg(w), 0);
+    }
+  }
+  if (!dst.is(w)) m_asm->movups(dst, reg(w), wide);
+  return true;
+}
+
+bool X86CodeGen::select_lane(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto type = m_function->instrs[instr.operands[0]].type;
+  uint32_t lane = instr.index & (ir_vector_lanes(type) - 1);
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : scratch(instr.type);
+  const auto vector = use(instr.operands[0], m_scan->position(index), X86XmmScratch);
+  if (vector.is_mem()) {
+    auto source = vector.mem;
+    source.disp += 4 * lane;
+    m_asm->mov(4, reg(w), mem(source));
+  } else if (instr.type == IrType::F32) {
+    auto source = vector.reg;
+    if (lane >= 4) {
+      m_asm->vextractf128(reg(w), source, 1);
+      source = w;
+      lane -= 4;
+    }
+    if (lane) {
+      m_asm->pshufd(w, reg(source), static_cast<uint8_t>(lane));
+    } else if (source != w) {
+      m_asm->mov(4, reg(w), reg(source));
+    }
+  } else if (lane) {
+    m_asm->pextrd(reg(w), vector.reg, static_cast<uint8_t>(lane));
+  } else {
+    m_asm->mov(4, reg(w), vector);
+  }
+  if (!dst.is(w)) m_asm->mov(4, dst, reg(w));
+  return true;
+}
+
+bool X86CodeGen::select_insert_lane(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const auto position = m_scan->position(index);
+  const auto type = instr.type;
+  const bool wide = type == IrType::F32x8;
+  const uint32_t lane = instr.index & (ir_vector_lanes(type) - 1);
+  const auto dst = def(index);
+  const auto vector = use(instr.operands[0], position, X86XmmScratch);
+  auto value = use(instr.operands[1], position, X86GprScratch);
+
+  if (!dst.is_reg()) {
+    // a spilled result is copied and its lane overwritten in memory
+    move_vector(type, dst, vector);
+    auto target = dst.mem;
+    target.disp += 4 * lane;
+    if (value.is_mem()) {
+      m_asm->mov(4, reg(X86GprScratch), value);
+      value = reg(X86GprScratch);
+    }
+    m_asm->mov(4, mem(target), value);
+    return true;
+  }
+  auto w = dst.reg;
+  if (wide) {
+    // 16 byte inserts would clear the upper half, the value is broadcast
+    // and blended into its lane instead
+    const uint8_t mask = static_cast<uint8_t>(1u << lane);
+    if (value.is(w)) {
+      broadcast(w, value);
+      m_asm->vblendps(w, w, vector, static_cast<uint8_t>(~mask), true);
+    } else {
+      broadcast(X86XmmScratch, value);
+      if (vector.is_reg()) {
+        m_asm->vblendps(w, vector.reg, reg(X86XmmScratch), mask, true);
+      } else {
+        m_asm->vblendps(w, X86XmmScratch, vector, static_cast<uint8_t>(~mask), true);
+      }
+    }
+    return true;
+  }
+  if (value.is(w) && !vector.is(w)) w = X86XmmScratch;
+  if (!vector.is(w)) m_asm->movups(reg(w), vector);
+  if (type == IrType::F32x4) {
+    m_asm->insertps(w, value, static_cast<uint8_t>(lane << 4));
+  } else {
+    if (value.is_imm()) {
+      m_asm->mov(4, reg(X86GprScratch), value);
+      value = reg(X86GprScratch);
+    }
+    m_asm->pinsrd(w, value, static_cast<uint8_t>(lane));
+  }
+  if (!dst.is(w)) m_asm->movups(dst, reg(w));
+  return true;
+}
+
+bool X86CodeGen::select_shuffle(IrValueIndex index) {
+  const auto& instr = m_function->instrs[index];
+  const bool wide = instr.type == IrType::F32x8;
+  const auto dst = def(index);
+  const auto w = dst.is_reg() ? dst.reg : X86XmmScratch;
+  const auto vector = use(instr.operands[0], m_scan->position(index), X86XmmScratch);
+  if (wide) {
+    // vpermps takes the lane of every result lane from a register
+    uint64_t words[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+      words[i] = uint64_t{instr.index >> 8 * i & 7} | uint64_t{instr.index >> (8 * i + 4) & 7} << 32;
+    }
+    m_asm->movups(reg(X86XmmScratch), mem(wide_constant(words[0], words[1], words[2], words[3])), true);
+    m_asm->vpermps(w, X86XmmScratch, vector);
+  } else {
+    uint8_t imm = 0;
+    for (uint32_t i = 0; i < 4; ++i) imm |= (instr.index >> 4 * i & 3) << 2 * i;
+    m_asm->pshufd(w, vector, imm);
+  }
+  if (!dst.is(w)) m_asm->movups(dst, reg(w), wide);
+  return true;
+}
+
+void X86CodeGen::prologue() {
+  m_asm->push(reg(X86Reg::Rbp));
+  m_asm->mov(8, reg(X86Reg::Rbp), reg(X86Reg::Rsp));
+  for (auto r : m_saved_registers) m_asm->push(reg(r));
+  if (m_frame_size) m_asm->alu(X86Alu::Sub, 8, reg(X86Reg::Rsp), imm(m_frame_size));
+
+  bool elements = false;
+  for (const auto& instr : m_function->instrs) elements = elements || instr.kind == IrInstr::Kind::ElementAddr;
+
+  // parameters move from their ABI registers into their allocated
+  // locations; integers narrower than 32 bits are extended again as the
+  // ABI leaves the upper bits undefined, and so are 32 bit ones where they
+  // may index elements
+  std::vector<Move> moves;
+  std::vector<std::pair<IrValueIndex, int32_t>> stack;
+  uint32_t ints = 0;
+  uint32_t floats = 0;
+  for (auto param : m_function->params) {
+    const auto& instr = m_function->instrs[param];
+    X86Reg source = X86Reg::None;
+    if (is_xmm(instr.type) && floats < FloatArgumentCount) {
+      source = static_cast<X86Reg>(static_cast<uint8_t>(X86Reg::Xmm0) + floats++);
+    } else if (!is_xmm(instr.type) && ints < IntArgumentCount) {
+      source = IntArgumentRegisters[ints++];
+    }
+    if (source == X86Reg::None) {
+      stack.emplace_back(param, 16 + 8 * static_cast<int32_t>(stack.size()));
+      continue;
+    }
+    wrap(instr.type, source);
+    if (elements && (instr.type == IrType::I32 || instr.type == IrType::U32)) {
+      m_asm->mov(4, reg(source), reg(source));
+    }
+    Move move;
+    move.to = m_scan->location(param, m_scan->block_from(0));
+    move.from.reg = source;
+    move.type = instr.type;
+    moves.emplace_back(move);
+  }
+  parallel_move(std::move(moves));
+  for (const auto& [param, offset] : stack) {
+    const auto& instr = m_function->instrs[param];
+    const auto dst = location(m_scan->location(param, m_scan->block_from(0)));
+    if (dst.is_imm()) continue;
+    const auto w = dst.is_reg() ? dst.reg : scratch(instr.type);
+    m_asm->mov(register_size(instr.type), reg(w), mem(X86Mem::at(X86Reg::Rbp, offset)));
+    wrap(instr.type, w);
+    if (!dst.is(w)) m_asm->mov(register_size(instr.type), dst, reg(w));
+  }
+}
+
+void X86CodeGen::epilogue() {
+  if (m_frame_size) {
+    if (m_saved_registers.empty()) {
+      m_asm->mov(8, reg(X86Reg::Rsp), reg(X86Reg::Rbp));
+    } else {
+      m_asm->lea(8, X86Reg::Rsp, X86Mem::at(X86Reg::Rbp, -8 * static_cast<int32_t>(m_saved_registers.size())));
+    }
+  }
+  if (m_asm->vex() && !is_wide(m_function->return_type)) m_asm->vzeroupper();
+  for (auto it = m_saved_registers.rbegin(); it != m_saved_registers.rend(); ++it) m_asm->pop(*it);
+  m_asm->pop(X86Reg::Rbp);
+  m_asm->ret();
+}
+
+std::vector<X86CodeGen::Move> X86CodeGen::edge_moves(IrBlockIndex from, IrBlockIndex to) {
+  std::vector<Move> moves;
+  const auto& preds = m_function->blocks[to].preds;
+  const auto pred = std::find(preds.begin(), preds.end(), from) - preds.begin();
+  auto is_phi_of_to = [this, to](IrValueIndex value) {
+    const auto& instr = m_function->instrs[value];
+    return instr.kind == IrInstr::Kind::Phi && instr.block == to;
+  };
+  for (const auto& move : m_scan->moves()) {
+    if (move.from_block != from || move.to_block != to) continue;
+    // rematerialized phi operands are added below, the allocator may have
+    // dropped their move when the locations happened to match
+    const auto source = is_phi_of_to(move.value) ? m_function->instrs[move.value].operands[pred] : move.value;
+    if (is_remat(source)) continue;
+    Move edge{move.to, move.from};
+    edge.type = m_function->instrs[move.value].type;
+    moves.emplace_back(edge);
+  }
+  for (auto index : m_function->blocks[to].instrs) {
+    const auto& instr = m_function->instrs[index];
+    if (instr.kind != IrInstr::Kind::Phi) break;
+    if (!is_remat(instr.operands[pred])) continue;
+    Move move;
+    move.to = m_scan->location(index, m_scan->block_from(to));
+    move.remat = instr.operands[pred];
+    move.type = instr.type;
+    moves.emplace_back(move);
+  }
+  return moves;
+}
+
+// Sequentializes moves that happen at the same time: a move runs once no
+// other pending move reads its destination. When only cycles are left the
+// value in one destination is pushed and its readers take it from the
+// machine stack, `saved` counts the bytes pushed. A scalar in an xmm
+// register goes to xmm15 instead, unless a vector move may need it: the
+// readers of a broken cycle have all run before the next cycle is broken.
+// Nothing here changes the flags, so the moves may sit between a fused
+// compare and its branch.
+void X86CodeGen::parallel_move(std::vector<Move> moves) {
+  moves.erase(std::remove_if(moves.begin(), moves.end(), [](const Move& move) {
+    const bool no_target = !move.to.is_register() && move.to.spill_slot == UndefinedSpillSlot;
+    return no_target || (move.remat == UndefinedIrValueIndex && move.from == move.to);
+  }), moves.end());
+
+  auto reads = [](const Move& move, const RegAllocLocation& location) {
+    return move.remat == UndefinedIrValueIndex && move.saved == UndefinedPosition && !move.in_scratch &&
+           move.from == location;
+  };
+  uint32_t saved = 0;
+  while (!moves.empty()) {
+    bool progress = false;
+    for (uint32_t i = 0; i < moves.size();) {
+      bool blocked = false;
+      for (uint32_t j = 0; j < moves.size() && !blocked; ++j) blocked = j != i && reads(moves[j], moves[i].to);
+      if (blocked) {
+        ++i;
+        continue;
+      }
+      move(moves[i], saved);
+      moves.erase(moves.begin() + i);
+      progress = true;
+    }
+    if (progress) continue;
+
+    const auto cycle = moves.front().to;
+    const auto value = location(cycle);
+    IrType type = IrType::Void;
+    for (const auto& other : moves) {
+      if (reads(other, cycle)) type = other.type;
+    }
+    const bool vectors =
+      std::any_of(moves.begin(), moves.end(), [](const Move& move) { return ir_is_vector(move.type); });
+    if (!vectors && value.is_reg() && x86_reg_class(value.reg) == X86RegClass::Xmm) {
+      m_asm->mov(8, reg(X86XmmScratch), value);
+      for (auto& other : moves) {
+        if (reads(other, cycle)) other.in_scratch = true;
+      }
+      continue;
+    }
+    if (ir_is_vector(type)) {
+      m_asm->lea(8, X86Reg::Rsp, X86Mem::at(X86Reg::Rsp, -static_cast<int32_t>(ir_type_size(type))));
+      move_vector(type, mem(X86Mem::at(X86Reg::Rsp)), value);
+      saved += ir_type_size(type);
+    } else if (value.is_reg() && x86_reg_class(value.reg) == X86RegClass::Xmm) {
+      m_asm->lea(8, X86Reg::Rsp, X86Mem::at(X86Reg::Rsp, -8));
+      m_asm->mov(8, mem(X86Mem::at(X86Reg::Rsp)), value);
+      saved += 8;
+    } else {
+      m_asm->push(value);
+      saved += 8;
+    }
+    for (auto& other : moves) {
+      if (reads(other, cycle)) other.saved = saved;
+    }
+  }
+  if (saved) m_asm->lea(8, X86Reg::Rsp, X86Mem::at(X86Reg::Rsp, saved));
+}
+
+void X86CodeGen::move(const Move& move, uint32_t saved) {
+  ++m_stats.moves;
+  const auto dst = location(move.to);
+  X86Operand src;
+  if (move.remat != UndefinedIrValueIndex) {
+    const auto& instr = m_function->instrs[move.remat];
+    X86Mem slot;
+    if (frame_address(move.remat, slot)) {
+      const auto w = dst.is_reg() ? dst.reg : X86GprScratch;
+      m_asm->lea(8, w, slot);
+      if (!dst.is(w)) m_asm->mov(8, dst, reg(w));
+      return;
+    }
+    if (is_xmm(instr.type) && instr.constant.i == 0 && dst.is_reg()) {
+      m_asm->xorps(dst.reg, dst);
+      return;
+    }
+    src = use(move.remat, UndefinedPosition, X86GprScratch);
+    if (src.is_imm() && (dst.is_reg() || x86_fits_int32(src.imm))) {
+      m_asm->mov(register_size(instr.type), dst, src);
+      return;
+    }
+  } else if (move.in_scratch) {
+    src = reg(X86XmmScratch);
+  } else if (move.saved != UndefinedPosition) {
+    src = mem(X86Mem::at(X86Reg::Rsp, saved - move.saved));
+  } else {
+    src = location(move.from);
+  }
+  if (ir_is_vector(move.type)) {
+    move_vector(move.type, dst, src);
+  } else if (src.is_reg() || dst.is_reg()) {
+    m_asm->mov(8, dst, src);
+  } else {
+    m_asm->mov(8, reg(X86GprScratch), src);
+    m_asm->mov(8, dst, reg(X86GprScratch));
+  }
+}
+
+bool X86CodeGen::is_remat(IrValueIndex value) const {
+  X86Mem slot;
+  return m_function->instrs[value].kind == IrInstr::Kind::Const || frame_address(value, slot);
+}
+
+bool X86CodeGen::frame_address(IrValueIndex value, X86Mem& mem) const {
+  const auto& instr = m_function->instrs[value];
+  if (instr.kind == IrInstr::Kind::StackSlot) {
+    mem = X86Mem::at(X86Reg::Rbp, m_slot_offsets[value]);
+    return true;
+  }
+  if (instr.kind != IrInstr::Kind::FieldAddr || !frame_address(instr.operands[0], mem)) return false;
+  mem.disp += instr.index;
+  return true;
+}
+
+X86Mem X86CodeGen::spill_slot(uint32_t slot) const {
+  return X86Mem::at(X86Reg::Rbp, m_spill_base - 8 * static_cast<int32_t>(slot + 1));
+}
+
+X86Operand X86CodeGen::location(const RegAllocLocation& location) const {
+  if (location.is_register()) return reg(location.reg);
+  if (location.spill_slot != UndefinedSpillSlot) return mem(spill_slot(location.spill_slot));
+  return imm(0);
+}
+
+void X86CodeGen::move_vector(IrType type, const X86Operand& dst, const X86Operand& src) {
+  const bool wide = is_wide(type);
+  if (dst.is_reg() || src.is_reg()) {
+    if (!dst.is_reg() || !src.is(dst.reg)) m_asm->movups(dst, src, wide);
+  } else {
+    m_asm->movups(reg(X86XmmScratch), src, wide);
+    m_asm->movups(dst, reg(X86XmmScratch), wide);
+  }
+}
+
+void X86CodeGen::broadcast(X86Reg dst, const X86Operand& value) {
+  if (value.is_mem()) {
+    m_asm->vbroadcastss(dst, value.mem, true);
+    return;
+  }
+  if (!value.is(dst)) m_asm->mov(4, reg(dst), value);
+  m_asm->shufps(dst, reg(dst), 0);
+  m_asm->vinsertf128(dst, dst, reg(dst), 1);
+}
+
+X86Mem X86CodeGen::constant(uint64_t low, uint64_t high) {
+  const std::pair<uint64_t, uint64_t> entry{low, high};
+  auto it = std::find(m_constants.begin(), m_constants.end(), entry);
+  if (it == m_constants.end()) it = m_constants.insert(m_constants.end(), entry);
+  return X86Mem::rip(m_pool, 16 * static_cast<int32_t>(it - m_constants.begin()));
+}
+
+X86Mem X86CodeGen::wide_constant(uint64_t w0, uint64_t w1, uint64_t w2, uint64_t w3) {
+  const std::pair<uint64_t, uint64_t> low{w0, w1};
+  const std::pair<uint64_t, uint64_t> high{w2, w3};
+  uint32_t i = 0;
+  while (i + 1 < m_constants.size() && (m_constants[i] != low || m_constants[i + 1] != high)) ++i;
+  if (i + 1 >= m_constants.size()) {
+    i = m_constants.size();
+    m_constants.emplace_back(low);
+    m_constants.emplace_back(high);
+  }
+  return X86Mem::rip(m_pool, 16 * static_cast<int32_t>(i));
+}
+
+X86Mem X86CodeGen::splat_constant(uint32_t bits, bool wide) {
+  return splat_constant64(uint64_t{bits} << 32 | bits, wide);
+}
+
+X86Mem X86CodeGen::splat_constant64(uint64_t bits, bool wide) {
+  return wide ? wide_constant(bits, bits, bits, bits) : constant(bits, bits);
+}
+
+X86Operand X86CodeGen::use(IrValueIndex value, uint32_t position, X86Reg scratch_reg) {
+  const auto& instr = m_function->instrs[value];
+  if (instr.kind == IrInstr::Kind::Const) {
+    ++m_stats.folded_operands;
+    if (instr.type == IrType::F32) {
+      float f = static_cast<float>(instr.constant.f);
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      return mem(constant(bits));
+    }
+    if (instr.type == IrType::F64) return mem(constant(static_cast<uint64_t>(instr.constant.i)));
+    // vector constants are the zero of reads before any definition
+    if (ir_is_vector(instr.type)) return mem(splat_constant(0, is_wide(instr.type)));
+    if (instr.type == IrType::Ptr) return imm(instr.constant.i);
+    return imm(static_cast<int32_t>(instr.constant.i));
+  }
+  X86Mem slot;
+  if (frame_address(value, slot)) {
+    m_asm->lea(8, scratch_reg, slot);
+    return reg(scratch_reg);
+  }
+  const auto operand = location(m_scan->location(value, position));
+  if (operand.is_mem()) ++m_stats.folded_operands;
+  return operand;
+}
+
+X86Operand X86CodeGen::def(IrValueIndex index) const {
+  const auto& instr = m_function->instrs[index];
+  auto position = m_scan->position(index);
+  if (instr.is_call()) ++position;
+  return location(m_scan->location(index, position));
+}
+
+// folds the address computation into the operand: frame addresses and
+// field offsets become displacements, only a spilled pointer is loaded
+X86Mem X86CodeGen::address(IrValueIndex value, uint32_t position) {
+  int32_t disp = 0;
+  while (true) {
+    X86Mem slot;
+    if (frame_address(value, slot)) {
+      ++m_stats.folded_operands;
+      slot.disp += disp;
+      return slot;
+    }
+    const auto& instr = m_function->instrs[value];
+    const auto location = m_scan->location(value, position);
+    if (location.is_register()) return X86Mem::at(location.reg, disp);
+    if (instr.kind == IrInstr::Kind::FieldAddr
+        && (m_scan->location(instr.operands[0], position).is_register() || frame_address(instr.operands[0], slot))) {
+      disp += instr.index;
+      value = instr.operands[0];
+      continue;
+    }
+    if (location.spill_slot != UndefinedSpillSlot) {
+      m_asm->mov(8, reg(X86GprScratch), mem(spill_slot(location.spill_slot)));
+    }
+    return X86Mem::at(X86GprScratch, disp);
+  }
+}
+
+void X86CodeGen::wrap(IrType type, X86Reg r) {
+  switch (type) {
+    case IrType::I8:
+    case IrType::I16:
+    case IrType::U8:
+    case IrType::U16:
+    case IrType::Bool:
+      m_asm->extend(r, reg(r), ir_type_size(type), ir_is_signed(type));
+      break;
+    default:
+      break;
+  }
+}
+
+bool X86CodeGen::live_across(X86Reg r, uint32_t position, IrValueIndex except) const {
+  for (const auto& interval : m_scan->intervals()) {
+    if (interval.fixed || interval.reg != r || interval.value == except) continue;
+    if (interval.covers(position) && interval.covers(position + 1)) return true;
+  }
+  return false;
+}
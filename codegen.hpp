@@ -0,0 +1,166 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+
+#include "ir.hpp"
+#include "regalloc.hpp"
+#include "x86_assembler.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+static const uint32_t UndefinedCodeOffset = std::numeric_limits<uint32_t>::max();
+
+// a call or lea whose rel32 displacement at offset refers to the entry of
+// function
+struct X86Relocation {
+  uint32_t offset;
+  uint32_t function;
+};
+
+// Machine code of a module. Functions are appended one after the other,
+// each followed by its constant pool, so the buffer can be moved anywhere
+// once calls are linked.
+struct X86Code {
+  std::vector<uint8_t> bytes;
+  // entry offset of every function of the module, UndefinedCodeOffset
+  // until compiled
+  std::vector<uint32_t> entries;
+  std::vector<X86Relocation> calls;
+  // the code calls the runtime of this process by its absolute address,
+  // so it only runs in the process that compiled it
+  bool calls_runtime = false;
+
+  // patches every call displacement, false if a callee was not compiled
+  bool link();
+};
+
+struct X86CodeGenStats {
+  uint32_t functions = 0;
+  uint32_t instructions = 0;
+  // constants, spill slots and addresses used directly as operands
+  uint32_t folded_operands = 0;
+  uint32_t fused_branches = 0;
+  uint32_t moves = 0;
+  uint32_t spill_slots = 0;
+  uint64_t code_bytes = 0;
+};
+
+// Native x86-64 backend for optimized SSA IR. Registers come from
+// LinearScan, instruction selection folds constants into immediates,
+// spilled values into memory operands and StackSlot/FieldAddr chains into
+// [rbp + disp] addressing; constants and frame addresses are never
+// materialized unless a value is needed. A compare feeding the branch
+// right after it becomes cmp + jcc. Functions follow the System V calling
+// convention with an rbp frame of callee saved registers, spill slots and
+// struct storage, and keep integers in 32 bit registers extended from
+// their width, so they can be called from C. Integer division by zero
+// traps like it does in C, and so does a failed BoundsCheck, with ud2.
+// Stack slots are zeroed where they are created. Vectors live in xmm
+// registers and are passed like floats, and load and store unaligned;
+// f32x8 and f64x4 take all of a ymm register, and a function using them
+// is VEX encoded throughout and clears the upper halves before it returns
+// or calls. Functions with vectors the machine cannot run (no SSE4.1, or
+// 32 byte vectors without AVX, or f32x8 shuffles without AVX2) are not
+// compiled. RuntimeCalls call the functions of region.hpp and task.hpp
+// through their address in r11.
+class X86CodeGen {
+public:
+  X86CodeGen(const IrModule& module) : m_module(module) {}
+  X86CodeGen(const X86CodeGen&) = delete;
+  X86CodeGen(X86CodeGen&&) = delete;
+  X86CodeGen& operator=(const X86CodeGen&) = delete;
+  X86CodeGen& operator=(X86CodeGen&&) = delete;
+
+  // appends the function to code, false for IR the backend cannot select
+  bool compile(uint32_t function, X86Code& code);
+  // compiles and links every function
+  bool compile_module(X86Code& code);
+  const X86CodeGenStats& stats() const { return m_stats; }
+
+private:
+  // a copy of a parallel move; source values that are rematerialized
+  // (constants, frame addresses) are not read from a location
+  struct Move {
+    RegAllocLocation to;
+    RegAllocLocation from;
+    IrValueIndex remat = UndefinedIrValueIndex;
+    // read from the machine stack, the saved source of a broken cycle
+    uint32_t saved = UndefinedPosition;
+    // read from xmm15, where a broken cycle of scalar xmm moves saved it
+    bool in_scratch = false;
+    // vectors are copied whole, everything else as 8 bytes
+    IrType type = IrType::Void;
+  };
+
+  const IrModule& m_module;
+  X86CodeGenStats m_stats;
+  const IrFunction* m_function = nullptr;
+  const LinearScan* m_scan = nullptr;
+  X86Assembler* m_asm = nullptr;
+  std::vector<X86Relocation> m_calls;
+  std::vector<X86Label> m_block_labels;
+  std::vector<uint32_t> m_use_counts;
+  std::vector<int32_t> m_slot_offsets;
+  std::vector<X86Reg> m_saved_registers;
+  int32_t m_spill_base = 0;
+  uint32_t m_frame_size = 0;
+  // pool constants, 16 bytes each so packed operations can read them
+  X86Label m_pool = 0;
+  std::vector<std::pair<uint64_t, uint64_t>> m_constants;
+  // condition left in the flags by a compare fused with the next branch
+  bool m_fused = false;
+  X86Condition m_fused_condition = X86Condition::Equal;
+  // the ud2 failed bounds checks jump to, bound after the code if used
+  X86Label m_trap = 0;
+  bool m_traps = false;
+  bool m_runtime_calls = false;
+
+  bool select(IrValueIndex index);
+  bool select_binary(IrValueIndex index);
+  bool select_float(IrValueIndex index);
+  bool select_compare(IrValueIndex index);
+  bool select_division(IrValueIndex index);
+  bool select_load(IrValueIndex index);
+  bool select_store(IrValueIndex index);
+  void zero_slot(IrValueIndex index);
+  bool select_element_addr(IrValueIndex index);
+  void select_bounds_check(IrValueIndex index);
+  bool select_call(IrValueIndex index);
+  bool select_runtime_call(IrValueIndex index);
+  void select_return(IrValueIndex index);
+  bool select_vector(IrValueIndex index);
+  bool select_splat(IrValueIndex index);
+  bool select_lane(IrValueIndex index);
+  bool select_insert_lane(IrValueIndex index);
+  bool select_shuffle(IrValueIndex index);
+
+  void prologue();
+  void epilogue();
+  void parallel_move(std::vector<Move> moves);
+  void move(const Move& move, uint32_t saved);
+  void move_vector(IrType type, const X86Operand& dst, const X86Operand& src);
+  // the f32 in every lane of a ymm register
+  void broadcast(X86Reg dst, const X86Operand& value);
+  std::vector<Move> edge_moves(IrBlockIndex from, IrBlockIndex to);
+
+  bool is_remat(IrValueIndex value) const;
+  bool frame_address(IrValueIndex value, X86Mem& mem) const;
+  X86Mem spill_slot(uint32_t slot) const;
+  X86Operand location(const RegAllocLocation& location) const;
+  X86Mem constant(uint64_t low, uint64_t high = 0);
+  // 32 bytes in two adjacent pool entries
+  X86Mem wide_constant(uint64_t w0, uint64_t w1, uint64_t w2, uint64_t w3);
+  // the 32 bit value in every lane of a 16 or, if wide, 32 byte constant
+  X86Mem splat_constant(uint32_t bits, bool wide);
+  // the same for 64 bit lanes
+  X86Mem splat_constant64(uint64_t bits, bool wide);
+  // the value as an operand at position: a register, memory or an integer
+  // immediate; frame addresses are computed into scratch
+  X86Operand use(IrValueIndex value, uint32_t position, X86Reg scratch);
+  X86Operand def(IrValueIndex index) const;
+  X86Mem address(IrValueIndex value, uint32_t position);
+  void wrap(IrType type, X86Reg reg);
+  bool live_across(X86Reg reg, uint32_t position, IrValueIndex except) const;
+};
+
+#endif  // CODEGEN_HPP
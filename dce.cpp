@@ -0,0 +1,151 @@
+#include "dce.hpp"
+#include "inliner.hpp"
+
+DceStats Dce::run(const std::vector<uint32_t>& roots) {
+  DceStats stats;
+  const auto graph = Inliner::call_graph(m_module);
+  std::vector<bool> reachable(m_module.functions.size(), false);
+  std::vector<uint32_t> stack;
+  for (auto root : roots) {
+    if (reachable[root]) continue;
+    reachable[root] = true;
+    stack.emplace_back(root);
+  }
+  while (!stack.empty()) {
+    const auto function = stack.back();
+    stack.pop_back();
+    for (auto callee : graph[function]) {
+      if (reachable[callee]) continue;
+      reachable[callee] = true;
+      stack.emplace_back(callee);
+    }
+  }
+
+  std::vector<uint32_t> renumber(m_module.functions.size(), UndefinedIrValueIndex);
+  std::vector<IrFunction> kept;
+  for (uint32_t function = 0; function < m_module.functions.size(); ++function) {
+    if (!reachable[function]) {
+      ++stats.functions_removed;
+      continue;
+    }
+    renumber[function] = kept.size();
+    kept.emplace_back(std::move(m_module.functions[function]));
+  }
+  m_module.functions = std::move(kept);
+
+  for (auto& function : m_module.functions) {
+    for (auto& instr : function.instrs) {
+      if (instr.kind == IrInstr::Kind::Call || instr.kind == IrInstr::Kind::FunctionAddr) {
+        instr.index = renumber[instr.index];
+      }
+    }
+    const auto function_stats = remove_dead_code(function);
+    stats.instrs_removed += function_stats.instrs_removed;
+    stats.stores_removed += function_stats.stores_removed;
+  }
+  return stats;
+}
+
+DceStats Dce::remove_dead_code(IrFunction& function) {
+  DceStats stats;
+  stats.stores_removed = remove_dead_stores(function);
+  auto& instrs = function.instrs;
+
+  std::vector<bool> live(instrs.size(), false);
+  std::vector<IrValueIndex> worklist;
+  for (const auto& block : function.blocks) {
+    for (auto index : block.instrs) {
+      const auto& instr = instrs[index];
+      if (instr.is_terminator() || instr.kind == IrInstr::Kind::Store || instr.is_call() || function.may_trap(instr)) {
+        live[index] = true;
+        worklist.emplace_back(index);
+      }
+    }
+  }
+  while (!worklist.empty()) {
+    const auto index = worklist.back();
+    worklist.pop_back();
+    for (auto operand : instrs[index].operands) {
+      if (live[operand]) continue;
+      live[operand] = true;
+      worklist.emplace_back(operand);
+    }
+  }
+  // parameters stay, they define the signature
+  for (auto param : function.params) live[param] = true;
+
+  for (auto& block : function.blocks) {
+    const auto size = block.instrs.size();
+    block.instrs.erase(
+      std::remove_if(block.instrs.begin(), block.instrs.end(),
+        [&live](IrValueIndex index) { return !live[index]; }),
+      block.instrs.end());
+    stats.instrs_removed += size - block.instrs.size();
+  }
+  for (IrValueIndex index = 0; index < instrs.size(); ++index) {
+    if (live[index]) continue;
+    instrs[index].kind = IrInstr::Kind::None;
+    instrs[index].operands.clear();
+    instrs[index].block = UndefinedIrBlockIndex;
+  }
+  return stats;
+}
+
+uint32_t Dce::remove_dead_stores(IrFunction& function) {
+  auto& instrs = function.instrs;
+  // the stack slot an address is derived from through FieldAddr and
+  // ElementAddr
+  std::vector<IrValueIndex> slot_of(instrs.size(), UndefinedIrValueIndex);
+  std::vector<bool> needed(instrs.size(), false);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto& block : function.blocks) {
+      for (auto index : block.instrs) {
+        const auto& instr = instrs[index];
+        auto slot = slot_of[index];
+        if (instr.kind == IrInstr::Kind::StackSlot) slot = index;
+        if (instr.kind == IrInstr::Kind::FieldAddr || instr.kind == IrInstr::Kind::ElementAddr) {
+          slot = slot_of[instr.operands[0]];
+        }
+        if (slot == slot_of[index]) continue;
+        slot_of[index] = slot;
+        changed = true;
+      }
+    }
+  }
+
+  for (const auto& block : function.blocks) {
+    for (auto index : block.instrs) {
+      const auto& instr = instrs[index];
+      for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+        const auto slot = slot_of[instr.operands[i]];
+        if (slot == UndefinedIrValueIndex) continue;
+        const bool derives =
+          i == 0 && (instr.kind == IrInstr::Kind::FieldAddr || instr.kind == IrInstr::Kind::ElementAddr);
+        const bool stores_into = instr.kind == IrInstr::Kind::Store && i == 0;
+        // a load reads the slot, any other use lets the address escape
+        if (!derives && !stores_into) needed[slot] = true;
+      }
+    }
+  }
+
+  uint32_t removed = 0;
+  for (auto& block : function.blocks) {
+    block.instrs.erase(
+      std::remove_if(block.instrs.begin(), block.instrs.end(),
+        [&](IrValueIndex index) {
+          auto& instr = instrs[index];
+          if (instr.kind != IrInstr::Kind::Store) return false;
+          const auto slot = slot_of[instr.operands[0]];
+          if (slot == UndefinedIrValueIndex || needed[slot]) return false;
+          instr.kind = IrInstr::Kind::None;
+          instr.operands.clear();
+          instr.block = UndefinedIrBlockIndex;
+          ++removed;
+          return true;
+        }),
+      block.instrs.end());
+  }
+  return removed;
+}
@@ -0,0 +1,38 @@
+#ifndef DCE_HPP
+#define DCE_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+struct DceStats {
+  uint32_t functions_removed = 0;
+  uint32_t instrs_removed = 0;
+  uint32_t stores_removed = 0;
+};
+
+// Dead code elimination on the IR. Functions that no root reaches through
+// calls are dropped from the module and the remaining calls renumbered.
+// Within a function, stores into stack slots that are never loaded from and
+// never escape are removed first, then every instruction not needed by a
+// terminator, a store, a call or an instruction that may trap.
+class Dce {
+public:
+  Dce(IrModule& module) : m_module(module) {}
+  Dce(const Dce&) = delete;
+  Dce(Dce&&) = delete;
+  Dce& operator=(const Dce&) = delete;
+  Dce& operator=(Dce&&) = delete;
+
+  // roots are positions in IrModule::functions before the removal
+  DceStats run(const std::vector<uint32_t>& roots);
+
+  static DceStats remove_dead_code(IrFunction& function);
+
+private:
+  IrModule& m_module;
+
+  static uint32_t remove_dead_stores(IrFunction& function);
+};
+
+#endif  // DCE_HPP
@@ -0,0 +1,91 @@
+#include "dominators.hpp"
+#include <algorithm>
+#include <utility>
+
+DominatorTree::DominatorTree(const IrFunction& function) {
+  const auto block_count = function.blocks.size();
+  m_idom.assign(block_count, UndefinedIrBlockIndex);
+  m_children.assign(block_count, {});
+  m_rpo_number.assign(block_count, UndefinedIrBlockIndex);
+  m_pre.assign(block_count, 0);
+  m_post.assign(block_count, 0);
+  if (block_count == 0) return;
+
+  // iterative post-order walk of the CFG. Successors in profiled functions
+  // are visited coldest first, so the hottest one follows its block in
+  // reverse post-order, which is the order code is laid out in.
+  std::vector<std::vector<IrBlockIndex>> weighted;
+  if (function.profiled) {
+    weighted.resize(block_count);
+    for (IrBlockIndex block = 0; block < block_count; ++block) {
+      weighted[block] = function.blocks[block].succs;
+      std::stable_sort(weighted[block].begin(), weighted[block].end(), [&function](IrBlockIndex a, IrBlockIndex b) {
+        return function.blocks[a].weight < function.blocks[b].weight;
+      });
+    }
+  }
+  std::vector<bool> visited(block_count, false);
+  std::vector<std::pair<IrBlockIndex, uint32_t>> stack{{0, 0}};
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& [block, next_succ] = stack.back();
+    const auto& succs = function.profiled ? weighted[block] : function.blocks[block].succs;
+    if (next_succ < succs.size()) {
+      const auto succ = succs[next_succ++];
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack.emplace_back(succ, 0);
+      }
+    } else {
+      m_rpo.emplace_back(block);
+      stack.pop_back();
+    }
+  }
+  std::reverse(m_rpo.begin(), m_rpo.end());
+  for (uint32_t i = 0; i < m_rpo.size(); ++i) m_rpo_number[m_rpo[i]] = i;
+
+  m_idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 1; i < m_rpo.size(); ++i) {
+      const auto block = m_rpo[i];
+      IrBlockIndex new_idom = UndefinedIrBlockIndex;
+      for (auto pred : function.blocks[block].preds) {
+        if (m_idom[pred] == UndefinedIrBlockIndex) continue;
+        new_idom = new_idom == UndefinedIrBlockIndex ? pred : intersect(pred, new_idom);
+      }
+      if (new_idom != m_idom[block]) {
+        m_idom[block] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  for (uint32_t i = 1; i < m_rpo.size(); ++i) {
+    m_children[m_idom[m_rpo[i]]].emplace_back(m_rpo[i]);
+  }
+
+  uint32_t counter = 0;
+  std::vector<std::pair<IrBlockIndex, uint32_t>> tree_stack{{0, 0}};
+  m_pre[0] = counter++;
+  while (!tree_stack.empty()) {
+    auto& [block, next_child] = tree_stack.back();
+    if (next_child < m_children[block].size()) {
+      const auto child = m_children[block][next_child++];
+      m_pre[child] = counter++;
+      tree_stack.emplace_back(child, 0);
+    } else {
+      m_post[block] = counter++;
+      tree_stack.pop_back();
+    }
+  }
+}
+
+IrBlockIndex DominatorTree::intersect(IrBlockIndex a, IrBlockIndex b) const {
+  while (a != b) {
+    while (m_rpo_number[a] > m_rpo_number[b]) a = m_idom[a];
+    while (m_rpo_number[b] > m_rpo_number[a]) b = m_idom[b];
+  }
+  return a;
+}
@@ -0,0 +1,43 @@
+#ifndef DOMINATORS_HPP
+#define DOMINATORS_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+// Dominator tree of an IrFunction computed with the iterative algorithm of
+// Cooper, Harvey, Kennedy "A Simple, Fast Dominance Algorithm". Blocks not
+// reachable from the entry have no immediate dominator.
+class DominatorTree {
+public:
+  DominatorTree(const IrFunction& function);
+  DominatorTree(const DominatorTree&) = delete;
+  DominatorTree(DominatorTree&&) = delete;
+  DominatorTree& operator=(const DominatorTree&) = delete;
+  DominatorTree& operator=(DominatorTree&&) = delete;
+
+  IrBlockIndex idom(IrBlockIndex block) const { return m_idom[block]; }
+  const std::vector<IrBlockIndex>& children(IrBlockIndex block) const { return m_children[block]; }
+  // reachable blocks in reverse post-order, the entry block first; in
+  // profiled functions a block's hottest successor comes right after it
+  // unless another path must reach it first
+  const std::vector<IrBlockIndex>& reverse_post_order() const { return m_rpo; }
+  bool is_reachable(IrBlockIndex block) const { return m_rpo_number[block] != UndefinedIrBlockIndex; }
+
+  bool dominates(IrBlockIndex dominator, IrBlockIndex block) const {
+    return m_pre[dominator] <= m_pre[block] && m_post[block] <= m_post[dominator];
+  }
+
+private:
+  std::vector<IrBlockIndex> m_idom;
+  std::vector<std::vector<IrBlockIndex>> m_children;
+  std::vector<IrBlockIndex> m_rpo;
+  std::vector<uint32_t> m_rpo_number;
+  // pre and post order numbers of the dominator tree walk
+  std::vector<uint32_t> m_pre;
+  std::vector<uint32_t> m_post;
+
+  IrBlockIndex intersect(IrBlockIndex a, IrBlockIndex b) const;
+};
+
+#endif  // DOMINATORS_HPP
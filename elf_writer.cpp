@@ -0,0 +1,189 @@
+#include "elf_writer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// the parts of the ELF64 format the writer needs, spelled out instead of
+// taken from <elf.h> so objects can be written on any host
+static const uint32_t HeaderSize = 64;
+static const uint32_t SectionHeaderSize = 64;
+static const uint32_t SymbolSize = 24;
+static const uint32_t RelocationSize = 24;
+
+static const uint16_t TypeRelocatable = 1;
+static const uint16_t MachineX86_64 = 62;
+
+static const uint32_t SectionProgbits = 1;
+static const uint32_t SectionSymtab = 2;
+static const uint32_t SectionStrtab = 3;
+static const uint32_t SectionRela = 4;
+static const uint64_t FlagAlloc = 0x2;
+static const uint64_t FlagExecInstr = 0x4;
+static const uint64_t FlagInfoLink = 0x40;
+
+static const uint8_t BindLocal = 0;
+static const uint8_t BindGlobal = 1;
+static const uint8_t SymbolNoType = 0;
+static const uint8_t SymbolFunc = 2;
+static const uint8_t SymbolSection = 3;
+static const uint32_t RelocationPlt32 = 4;
+
+enum Section : uint16_t { Null, Text, RelaText, Symtab, Strtab, Shstrtab, NoteStack, SectionCount };
+// the null symbol and the .text section symbol precede the functions
+static const uint32_t FirstFunctionSymbol = 2;
+
+static uint64_t round_up(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// little endian, sizes past 8 bytes are zero filled
+void ElfWriter::put(uint64_t value, uint32_t size) {
+  for (uint32_t i = 0; i < size; ++i) m_object->emplace_back(i < 8 ? static_cast<uint8_t>(value >> (8 * i)) : 0);
+}
+
+void ElfWriter::put_bytes(const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  m_object->insert(m_object->end(), bytes, bytes + size);
+}
+
+void ElfWriter::pad(uint64_t alignment) {
+  m_object->resize(m_base + round_up(m_object->size() - m_base, alignment), 0);
+}
+
+void ElfWriter::section_header(uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+                               uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size) {
+  put(name, 4);
+  put(type, 4);
+  put(flags, 8);
+  put(0, 8);
+  put(offset, 8);
+  put(size, 8);
+  put(link, 4);
+  put(info, 4);
+  put(alignment, 8);
+  put(entry_size, 8);
+}
+
+bool ElfWriter::write(const X86Code& code, std::vector<uint8_t>& object) {
+  if (code.bytes.size() > UINT32_MAX || code.calls_runtime) return false;
+  const uint32_t function_count = m_module.functions.size();
+
+  // string tables first, their sizes decide the layout
+  std::string strings(1, '\0');
+  std::vector<uint32_t> symbol_names(function_count);
+  for (uint32_t function = 0; function < function_count; ++function) {
+    symbol_names[function] = strings.size();
+    const auto name = m_module.functions[function].name;
+    if (name != UndefinedIdIndex) {
+      const auto& id = m_id_cache.get(name);
+      strings.append(id.str, id.length);
+    } else {
+      strings += "function" + std::to_string(function);
+    }
+    strings += '\0';
+  }
+  static const char SectionNames[] = "\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+  // offsets of the names in SectionNames, .text is the tail of .rela.text
+  static const uint32_t SectionNameOffsets[SectionCount] = {0, 6, 1, 12, 20, 28, 38};
+
+  // a function's code runs up to the next entry, its constant pool included
+  std::vector<uint32_t> starts;
+  for (auto entry : code.entries) {
+    if (entry != UndefinedCodeOffset) starts.emplace_back(entry);
+  }
+  starts.emplace_back(code.bytes.size());
+  std::sort(starts.begin(), starts.end());
+
+  const uint64_t text_offset = round_up(HeaderSize, 16);
+  const uint64_t rela_offset = round_up(text_offset + code.bytes.size(), 8);
+  const uint64_t rela_size = static_cast<uint64_t>(code.calls.size()) * RelocationSize;
+  const uint64_t symtab_offset = rela_offset + rela_size;
+  const uint64_t symtab_size = static_cast<uint64_t>(FirstFunctionSymbol + function_count) * SymbolSize;
+  const uint64_t strtab_offset = symtab_offset + symtab_size;
+  const uint64_t shstrtab_offset = strtab_offset + strings.size();
+  const uint64_t headers_offset = round_up(shstrtab_offset + sizeof(SectionNames), 8);
+  const uint64_t total = headers_offset + SectionCount * SectionHeaderSize;
+
+  m_object = &object;
+  m_base = object.size();
+  object.reserve(m_base + total);
+
+  // ELF header: 64 bit, little endian, current version, System V ABI
+  put_bytes("\x7f" "ELF\x02\x01\x01\x00", 8);
+  put(0, 8);
+  put(TypeRelocatable, 2);
+  put(MachineX86_64, 2);
+  put(1, 4);
+  put(0, 8);
+  put(0, 8);
+  put(headers_offset, 8);
+  put(0, 4);
+  put(HeaderSize, 2);
+  put(0, 2);
+  put(0, 2);
+  put(SectionHeaderSize, 2);
+  put(SectionCount, 2);
+  put(Shstrtab, 2);
+
+  pad(16);
+  put_bytes(code.bytes.data(), code.bytes.size());
+
+  pad(8);
+  for (const auto& call : code.calls) {
+    put(call.offset, 8);
+    put((static_cast<uint64_t>(FirstFunctionSymbol + call.function) << 32) | RelocationPlt32, 8);
+    // the displacement is relative to the end of the call
+    put(static_cast<uint64_t>(-4), 8);
+  }
+
+  put(0, SymbolSize);
+  put(0, 4);
+  put((BindLocal << 4) | SymbolSection, 1);
+  put(0, 1);
+  put(Text, 2);
+  put(0, 16);
+  for (uint32_t function = 0; function < function_count; ++function) {
+    const auto entry = function < code.entries.size() ? code.entries[function] : UndefinedCodeOffset;
+    put(symbol_names[function], 4);
+    if (entry == UndefinedCodeOffset) {
+      put((BindGlobal << 4) | SymbolNoType, 1);
+      put(0, 1);
+      put(Null, 2);
+      put(0, 16);
+      continue;
+    }
+    const auto end = *std::upper_bound(starts.begin(), starts.end(), entry);
+    put((BindGlobal << 4) | SymbolFunc, 1);
+    put(0, 1);
+    put(Text, 2);
+    put(entry, 8);
+    put(end - entry, 8);
+  }
+  put_bytes(strings.data(), strings.size());
+  put_bytes(SectionNames, sizeof(SectionNames));
+
+  pad(8);
+  section_header(0, 0, 0, 0, 0, 0, 0, 0, 0);
+  section_header(SectionNameOffsets[Text], SectionProgbits, FlagAlloc | FlagExecInstr, text_offset,
+                 code.bytes.size(), 0, 0, 16, 0);
+  section_header(SectionNameOffsets[RelaText], SectionRela, FlagInfoLink, rela_offset, rela_size, Symtab, Text, 8,
+                 RelocationSize);
+  // sh_info of a symbol table is the index of its first global symbol
+  section_header(SectionNameOffsets[Symtab], SectionSymtab, 0, symtab_offset, symtab_size, Strtab,
+                 FirstFunctionSymbol, 8, SymbolSize);
+  section_header(SectionNameOffsets[Strtab], SectionStrtab, 0, strtab_offset, strings.size(), 0, 0, 1, 0);
+  section_header(SectionNameOffsets[Shstrtab], SectionStrtab, 0, shstrtab_offset, sizeof(SectionNames), 0, 0, 1, 0);
+  // marks the object as not needing an executable stack
+  section_header(SectionNameOffsets[NoteStack], SectionProgbits, 0, headers_offset, 0, 0, 0, 1, 0);
+  m_object = nullptr;
+  return object.size() - m_base == total;
+}
+
+bool ElfWriter::write_file(const X86Code& code, const char* path) {
+  std::vector<uint8_t> object;
+  if (!write(code, object)) return false;
+  auto* file = std::fopen(path, "wb");
+  if (!file) return false;
+  const bool written = std::fwrite(object.data(), 1, object.size(), file) == object.size();
+  return std::fclose(file) == 0 && written;
+}
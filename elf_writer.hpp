@@ -0,0 +1,48 @@
+#ifndef ELF_WRITER_HPP
+#define ELF_WRITER_HPP
+
+#include "codegen.hpp"
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+// Writes the machine code of a module as an ELF64 x86-64 relocatable
+// object, ready for the system linker. The layout is computed up front so
+// the object is produced in one pass over the code: the ELF header, .text,
+// .rela.text, .symtab, .strtab, .shstrtab, an empty .note.GNU-stack and
+// the section headers. Every function becomes a global symbol named after
+// its IrFunction; functions without code stay undefined so another object
+// can provide them. Calls are emitted as R_X86_64_PLT32 relocations, so the
+// code does not need to be linked in memory first.
+class ElfWriter {
+public:
+  ElfWriter(const IrModule& module, const IdCache& id_cache) : m_module(module), m_id_cache(id_cache) {}
+  ElfWriter(const ElfWriter&) = delete;
+  ElfWriter(ElfWriter&&) = delete;
+  ElfWriter& operator=(const ElfWriter&) = delete;
+  ElfWriter& operator=(ElfWriter&&) = delete;
+
+  // appends the object file to object, false if the code does not fit the
+  // 32 bit offsets and sizes used for sections or calls the runtime of the
+  // compiling process
+  bool write(const X86Code& code, std::vector<uint8_t>& object);
+  // write() into a file at path, false on errors
+  bool write_file(const X86Code& code, const char* path);
+
+private:
+  const IrModule& m_module;
+  const IdCache& m_id_cache;
+  std::vector<uint8_t>* m_object = nullptr;
+  // offset of the object being written in m_object
+  size_t m_base = 0;
+
+  void put(uint64_t value, uint32_t size);
+  void put_bytes(const void* data, size_t size);
+  // zeros up to the alignment, relative to the start of the object
+  void pad(uint64_t alignment);
+  void section_header(uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+                      uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size);
+};
+
+#endif  // ELF_WRITER_HPP
@@ -0,0 +1,46 @@
+#include "executable_memory.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// functions start on cache lines
+static const size_t CodeAlignment = 64;
+
+static size_t page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+ExecutableMemory::~ExecutableMemory() {
+  for (const auto& chunk : m_chunks) munmap(chunk.memory, chunk.size);
+}
+
+const uint8_t* ExecutableMemory::install(const uint8_t* code, size_t size) {
+  const size_t alignment = m_shared_pages ? CodeAlignment : page_size();
+  if (m_chunks.empty() || (m_chunks.back().used + alignment - 1) / alignment * alignment + size > m_chunks.back().size) {
+    const size_t chunk_size = std::max(m_chunk_size, (size + page_size() - 1) / page_size() * page_size());
+    void* memory = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    m_chunks.push_back({static_cast<uint8_t*>(memory), chunk_size, 0});
+  }
+
+  auto& chunk = m_chunks.back();
+  const size_t start = (chunk.used + alignment - 1) / alignment * alignment;
+  // only the pages the code lands on change protection, the ones above it
+  // stay writable and were never executable
+  const size_t first_page = start / page_size() * page_size();
+  const size_t end_page = (start + size + page_size() - 1) / page_size() * page_size();
+  uint8_t* pages = chunk.memory + first_page;
+  if (mprotect(pages, end_page - first_page, PROT_READ | PROT_WRITE) != 0) return nullptr;
+  memcpy(chunk.memory + start, code, size);
+  if (mprotect(pages, end_page - first_page, PROT_READ | PROT_EXEC) != 0) return nullptr;
+  chunk.used = start + size;
+  return chunk.memory + start;
+}
+
+size_t ExecutableMemory::used() const {
+  size_t used = 0;
+  for (const auto& chunk : m_chunks) used += chunk.used;
+  return used;
+}
@@ -0,0 +1,41 @@
+#ifndef EXECUTABLE_MEMORY_HPP
+#define EXECUTABLE_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pages for generated machine code, never writable and executable at the
+// same time. Code is appended to large mappings; installing it makes the
+// pages it lands on writable, copies it and flips them back to read and
+// execute, so installing must not race with running code of the same
+// pages. Without shared pages every install starts on a fresh page, so
+// code can be installed while code installed before it runs.
+class ExecutableMemory {
+public:
+  explicit ExecutableMemory(size_t chunk_size = 1 << 20, bool shared_pages = true)
+    : m_chunk_size(chunk_size), m_shared_pages(shared_pages) {}
+  ExecutableMemory(const ExecutableMemory&) = delete;
+  ExecutableMemory(ExecutableMemory&&) = delete;
+  ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+  ExecutableMemory& operator=(ExecutableMemory&&) = delete;
+  ~ExecutableMemory();
+
+  // address of the installed copy of code, nullptr when the system refuses
+  // to map or protect memory
+  const uint8_t* install(const uint8_t* code, size_t size);
+  size_t used() const;
+
+private:
+  struct Chunk {
+    uint8_t* memory;
+    size_t size;
+    size_t used;
+  };
+
+  size_t m_chunk_size;
+  bool m_shared_pages;
+  std::vector<Chunk> m_chunks;
+};
+
+#endif  // EXECUTABLE_MEMORY_HPP
@@ -0,0 +1,110 @@
+#include "execution_profile.hpp"
+#include <cstdio>
+#include <sstream>
+
+void ExecutionProfile::add(const RegBytecodeModule& module, const IdCache& id_cache, const uint64_t* counters) {
+  for (uint32_t index = 0; index < module.counters.size(); ++index) {
+    const auto& counter = module.counters[index];
+    const auto name = module.functions[counter.function].name;
+    if (name == UndefinedIdIndex) continue;
+    const auto& string = id_cache.get(name);
+    auto& function = functions[std::string(string.str, string.length)];
+    const auto count = counters[index];
+    switch (counter.kind) {
+      case RegCounter::Kind::Calls:
+        function.calls += count;
+        break;
+      case RegCounter::Kind::Branch:
+      case RegCounter::Kind::BranchTaken: {
+        if (function.branches.size() <= counter.site) function.branches.resize(counter.site + 1);
+        auto& branch = function.branches[counter.site];
+        (counter.kind == RegCounter::Kind::Branch ? branch.runs : branch.taken) += count;
+        break;
+      }
+      case RegCounter::Kind::Loop:
+      case RegCounter::Kind::LoopIterations: {
+        if (function.loops.size() <= counter.site) function.loops.resize(counter.site + 1);
+        auto& loop = function.loops[counter.site];
+        (counter.kind == RegCounter::Kind::Loop ? loop.runs : loop.iterations) += count;
+        break;
+      }
+    }
+  }
+}
+
+const FunctionProfile* ExecutionProfile::find(const IdCache::String& name) const {
+  const auto it = functions.find(std::string(name.str, name.length));
+  return it == functions.end() ? nullptr : &it->second;
+}
+
+void ExecutionProfile::write(std::ostream& out) const {
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(source_hash));
+  out << "smallang-profile " << ExecutionProfileVersion << ' ' << hash << '\n';
+  for (const auto& [name, function] : functions) {
+    out << "function " << name << ' ' << function.calls << '\n';
+    for (uint32_t site = 0; site < function.branches.size(); ++site) {
+      const auto& branch = function.branches[site];
+      out << "branch " << name << ' ' << site << ' ' << branch.runs << ' ' << branch.taken << '\n';
+    }
+    for (uint32_t site = 0; site < function.loops.size(); ++site) {
+      const auto& loop = function.loops[site];
+      out << "loop " << name << ' ' << site << ' ' << loop.runs << ' ' << loop.iterations << '\n';
+    }
+  }
+}
+
+bool ExecutionProfile::read(std::istream& in, std::string& error) {
+  source_hash = 0;
+  functions.clear();
+  std::string line;
+  uint32_t line_number = 0;
+  auto fail = [&](const char* message) {
+    error = "line " + std::to_string(line_number) + ": " + message;
+    source_hash = 0;
+    functions.clear();
+    return false;
+  };
+
+  ++line_number;
+  if (!std::getline(in, line)) return fail("not a profile");
+  {
+    std::istringstream header(line);
+    std::string magic;
+    uint32_t version = 0;
+    if (!(header >> magic >> version >> std::hex >> source_hash) || magic != "smallang-profile") {
+      return fail("not a profile");
+    }
+    if (version != ExecutionProfileVersion) return fail("profile of another version");
+  }
+
+  while (std::getline(in, line)) {
+    ++line_number;
+    std::istringstream record(line);
+    std::string kind;
+    std::string name;
+    if (!(record >> kind)) continue;
+    if (!(record >> name)) return fail("missing function name");
+    auto& function = functions[name];
+    if (kind == "function") {
+      if (!(record >> function.calls)) return fail("malformed function record");
+      continue;
+    }
+    uint32_t site;
+    uint64_t runs;
+    uint64_t count;
+    if (!(record >> site >> runs >> count)) return fail("malformed site record");
+    // sites index vectors, no function has this many statements
+    if (site >= 1u << 20) return fail("site out of range");
+    if (kind == "branch") {
+      if (function.branches.size() <= site) function.branches.resize(site + 1);
+      function.branches[site] = {runs, count};
+    } else if (kind == "loop") {
+      if (function.loops.size() <= site) function.loops.resize(site + 1);
+      function.loops[site] = {runs, count};
+    } else {
+      return fail("unknown record");
+    }
+  }
+  return true;
+}
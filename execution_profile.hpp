@@ -0,0 +1,60 @@
+#ifndef EXECUTION_PROFILE_HPP
+#define EXECUTION_PROFILE_HPP
+
+#include "id_cache.hpp"
+#include "reg_bytecode.hpp"
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Counts of a program's runs: how often each function was called, each if
+// statement ran and found its condition true, and each while statement ran
+// and looped. RegVm collects them with the Counter instructions RegCompiler
+// emits, Lowering turns them into block weights, and the optimizer inlines,
+// unrolls and lays out blocks by those. Sites are the if and while
+// statements of a function numbered in source order and functions are
+// known by name, so a profile fits the source it came from; the hash of
+// that source is kept to tell. Profiles of several runs add up. Files are
+// text, one record per line:
+//   smallang-profile <version> <source hash, 16 hex digits>
+//   function <name> <calls>
+//   branch <name> <site> <runs> <taken>
+//   loop <name> <site> <runs> <iterations>
+static const uint32_t ExecutionProfileVersion = 1;
+
+struct BranchProfile {
+  uint64_t runs = 0;
+  uint64_t taken = 0;
+};
+
+struct LoopProfile {
+  uint64_t runs = 0;
+  uint64_t iterations = 0;
+};
+
+struct FunctionProfile {
+  uint64_t calls = 0;
+  // indexed by site
+  std::vector<BranchProfile> branches;
+  std::vector<LoopProfile> loops;
+};
+
+struct ExecutionProfile {
+  uint64_t source_hash = 0;
+  // ordered, so written profiles do not depend on hashing
+  std::map<std::string, FunctionProfile> functions;
+
+  // adds the counters of a run of module, indexed like module.counters
+  void add(const RegBytecodeModule& module, const IdCache& id_cache, const uint64_t* counters);
+  // nullptr for functions without counts
+  const FunctionProfile* find(const IdCache::String& name) const;
+  void write(std::ostream& out) const;
+  // replaces the profile with the one read, false and the reason in error
+  // for files of another version or with malformed records
+  bool read(std::istream& in, std::string& error);
+};
+
+#endif  // EXECUTION_PROFILE_HPP
@@ -0,0 +1,169 @@
+#include "gvn.hpp"
+#include "dominators.hpp"
+#include <utility>
+
+GvnStats Gvn::run() {
+  GvnStats stats;
+  auto& instrs = m_function.instrs;
+  if (m_function.blocks.empty()) return stats;
+
+  DominatorTree tree(m_function);
+  std::vector<IrValueIndex> map(instrs.size(), UndefinedIrValueIndex);
+  auto resolve = [&map](IrValueIndex value) {
+    while (map[value] != UndefinedIrValueIndex) value = map[value];
+    return value;
+  };
+
+  // values inserted into the table, popped when their block's subtree is left
+  std::vector<IrValueIndex> scope;
+  struct Frame {
+    IrBlockIndex block;
+    uint32_t next_child;
+    uint32_t scope_size;
+  };
+  std::vector<Frame> stack;
+
+  auto enter = [&](IrBlockIndex block) {
+    stack.push_back(Frame{block, 0, static_cast<uint32_t>(scope.size())});
+    auto& block_instrs = m_function.blocks[block].instrs;
+    for (auto index : block_instrs) {
+      auto& instr = instrs[index];
+      for (auto& operand : instr.operands) operand = resolve(operand);
+      if (!is_numberable(instr)) continue;
+
+      canonicalize(instr);
+      ++stats.values_numbered;
+      const auto leader = m_table.find(index);
+      if (leader != UndefinedIrValueIndex) {
+        map[index] = leader;
+        instr.kind = IrInstr::Kind::None;
+        instr.operands.clear();
+        ++stats.redundant_removed;
+      } else {
+        m_table.insert(index);
+        scope.emplace_back(index);
+      }
+    }
+    block_instrs.erase(
+      std::remove_if(block_instrs.begin(), block_instrs.end(),
+        [&instrs](IrValueIndex index) { return instrs[index].kind == IrInstr::Kind::None; }),
+      block_instrs.end());
+  };
+
+  enter(0);
+  while (!stack.empty()) {
+    auto& frame = stack.back();
+    const auto& children = tree.children(frame.block);
+    if (frame.next_child < children.size()) {
+      enter(children[frame.next_child++]);
+      continue;
+    }
+    while (scope.size() > frame.scope_size) {
+      m_table.erase(scope.back());
+      scope.pop_back();
+    }
+    stack.pop_back();
+  }
+
+  // phi operands on back edges were visited before their definitions
+  m_function.replace_uses(map);
+  return stats;
+}
+
+void Gvn::canonicalize(IrInstr& instr) const {
+  switch (instr.kind) {
+    case IrInstr::Kind::Great:
+      instr.kind = IrInstr::Kind::Less;
+      std::swap(instr.operands[0], instr.operands[1]);
+      break;
+    case IrInstr::Kind::GreatOrEqual:
+      instr.kind = IrInstr::Kind::LessOrEqual;
+      std::swap(instr.operands[0], instr.operands[1]);
+      break;
+    case IrInstr::Kind::Add:
+    case IrInstr::Kind::Mul:
+    case IrInstr::Kind::Equal:
+      if (instr.operands[0] > instr.operands[1]) std::swap(instr.operands[0], instr.operands[1]);
+      break;
+    default:
+      break;
+  }
+}
+
+bool Gvn::is_numberable(const IrInstr& instr) {
+  return instr.kind == IrInstr::Kind::Phi || instr.is_pure();
+}
+
+IrValueIndex Gvn::ValueTable::find(IrValueIndex value) const {
+  if (m_slots.empty()) return UndefinedIrValueIndex;
+  const auto& instr = m_instrs[value];
+  const auto mask = m_slots.size() - 1;
+  for (auto slot = hash(instr) & mask;; slot = (slot + 1) & mask) {
+    const auto candidate = m_slots[slot];
+    if (candidate == UndefinedIrValueIndex) return UndefinedIrValueIndex;
+    if (equal(m_instrs[candidate], instr)) return candidate;
+  }
+}
+
+void Gvn::ValueTable::insert(IrValueIndex value) {
+  if ((m_size + 1) * 2 > m_slots.size()) grow();
+  const auto mask = m_slots.size() - 1;
+  auto slot = hash(m_instrs[value]) & mask;
+  while (m_slots[slot] != UndefinedIrValueIndex) slot = (slot + 1) & mask;
+  m_slots[slot] = value;
+  ++m_size;
+}
+
+void Gvn::ValueTable::erase(IrValueIndex value) {
+  const auto mask = m_slots.size() - 1;
+  auto hole = hash(m_instrs[value]) & mask;
+  while (m_slots[hole] != value) hole = (hole + 1) & mask;
+
+  // shift back every following entry whose probe sequence passes the hole
+  for (auto slot = (hole + 1) & mask; m_slots[slot] != UndefinedIrValueIndex; slot = (slot + 1) & mask) {
+    const auto home = hash(m_instrs[m_slots[slot]]) & mask;
+    const bool stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+    if (stays) continue;
+    m_slots[hole] = m_slots[slot];
+    hole = slot;
+  }
+  m_slots[hole] = UndefinedIrValueIndex;
+  --m_size;
+}
+
+uint64_t Gvn::ValueTable::hash(const IrInstr& instr) const {
+  auto mix = [](uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+  };
+  uint64_t h = mix(static_cast<uint64_t>(instr.kind), static_cast<uint64_t>(instr.type));
+  if (instr.kind == IrInstr::Kind::Const) h = mix(h, static_cast<uint64_t>(instr.constant.i));
+  if (instr.kind == IrInstr::Kind::Phi) h = mix(h, instr.block);
+  // offsets of FieldAddr, lanes of Lane, InsertLane and Shuffle
+  h = mix(h, instr.index);
+  for (auto operand : instr.operands) h = mix(h, operand);
+  // final avalanche so that the low bits used for the slot are well mixed
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+bool Gvn::ValueTable::equal(const IrInstr& a, const IrInstr& b) const {
+  if (a.kind != b.kind || a.type != b.type || a.operands != b.operands || a.index != b.index) return false;
+  if (a.kind == IrInstr::Kind::Const) return a.constant == b.constant;
+  if (a.kind == IrInstr::Kind::Phi) return a.block == b.block;
+  return true;
+}
+
+void Gvn::ValueTable::grow() {
+  std::vector<IrValueIndex> old_slots(m_slots.empty() ? 64 : m_slots.size() * 2, UndefinedIrValueIndex);
+  old_slots.swap(m_slots);
+  const auto mask = m_slots.size() - 1;
+  for (auto value : old_slots) {
+    if (value == UndefinedIrValueIndex) continue;
+    auto slot = hash(m_instrs[value]) & mask;
+    while (m_slots[slot] != UndefinedIrValueIndex) slot = (slot + 1) & mask;
+    m_slots[slot] = value;
+  }
+}
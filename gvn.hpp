@@ -0,0 +1,59 @@
+#ifndef GVN_HPP
+#define GVN_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+class DominatorTree;
+
+struct GvnStats {
+  uint32_t values_numbered = 0;
+  uint32_t redundant_removed = 0;
+};
+
+// Hash based global value numbering. Blocks are visited in dominator tree
+// order and every pure instruction is looked up in a table of the values
+// available in the dominating blocks; a hit replaces the instruction by the
+// earlier value. Commutative operands are sorted and Great/GreatOrEqual are
+// rewritten to Less/LessOrEqual so that equivalent comparisons meet.
+class Gvn {
+public:
+  Gvn(IrFunction& function) : m_function(function), m_table(function.instrs) {}
+  Gvn(const Gvn&) = delete;
+  Gvn(Gvn&&) = delete;
+  Gvn& operator=(const Gvn&) = delete;
+  Gvn& operator=(Gvn&&) = delete;
+
+  GvnStats run();
+
+private:
+  // Open addressing table with linear probing. Slots hold value indices and
+  // the instructions themselves are the keys. Erasing uses backward shift, so
+  // no tombstones pile up when dominator scopes are left.
+  class ValueTable {
+  public:
+    ValueTable(const std::vector<IrInstr>& instrs) : m_instrs(instrs) {}
+
+    IrValueIndex find(IrValueIndex value) const;
+    void insert(IrValueIndex value);
+    void erase(IrValueIndex value);
+
+  private:
+    const std::vector<IrInstr>& m_instrs;
+    std::vector<IrValueIndex> m_slots;
+    uint32_t m_size = 0;
+
+    uint64_t hash(const IrInstr& instr) const;
+    bool equal(const IrInstr& a, const IrInstr& b) const;
+    void grow();
+  };
+
+  IrFunction& m_function;
+  ValueTable m_table;
+
+  void canonicalize(IrInstr& instr) const;
+  static bool is_numberable(const IrInstr& instr);
+};
+
+#endif  // GVN_HPP
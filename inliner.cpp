@@ -0,0 +1,244 @@
+#include "inliner.hpp"
+#include "id_cache.hpp"
+#include <utility>
+
+const std::vector<InlineDecision>& Inliner::run() {
+  m_decisions.clear();
+  const auto graph = call_graph(m_module);
+  const auto sccs = bottom_up_sccs(graph);
+  std::vector<uint32_t> scc_of(m_module.functions.size());
+  for (uint32_t scc = 0; scc < sccs.size(); ++scc) {
+    for (auto function : sccs[scc]) scc_of[function] = scc;
+  }
+  // weight of all profiled calls, before inlining copies any
+  uint64_t call_weight = 0;
+  for (const auto& function : m_module.functions) {
+    if (!function.profiled) continue;
+    for (const auto& block : function.blocks) {
+      for (auto index : block.instrs) {
+        if (function.instrs[index].kind == IrInstr::Kind::Call) call_weight += block.weight;
+      }
+    }
+  }
+
+  for (const auto& scc : sccs) {
+    for (auto caller : scc) {
+      std::vector<IrValueIndex> calls;
+      for (const auto& block : m_module.functions[caller].blocks) {
+        for (auto index : block.instrs) {
+          if (m_module.functions[caller].instrs[index].kind == IrInstr::Kind::Call) calls.emplace_back(index);
+        }
+      }
+
+      for (auto call : calls) {
+        const auto callee = m_module.functions[caller].instrs[call].index;
+        const auto& callee_function = m_module.functions[callee];
+        InlineDecision decision{caller, callee, callee_function.instr_count(), InlineDecision::Reason::Inlined};
+        const auto& caller_function = m_module.functions[caller];
+        const auto weight = caller_function.blocks[caller_function.instrs[call].block].weight;
+        const bool cold = caller_function.profiled && weight == 0;
+        decision.hot = caller_function.profiled && weight > 0 && weight * 100 >= call_weight * m_options.hot_percent;
+        if (callee_function.blocks.empty() || !callee_function.blocks[0].preds.empty()) {
+          decision.reason = InlineDecision::Reason::Declaration;
+        } else if (scc_of[callee] == scc_of[caller]) {
+          decision.reason = InlineDecision::Reason::Recursive;
+        } else if (cold && decision.callee_size > m_options.cold_threshold) {
+          decision.reason = InlineDecision::Reason::Cold;
+        } else if (decision.callee_size > (decision.hot ? m_options.hot_threshold : m_options.threshold)) {
+          decision.reason = InlineDecision::Reason::TooLarge;
+        } else if (m_module.functions[caller].instr_count() + decision.callee_size > m_options.caller_budget) {
+          decision.reason = InlineDecision::Reason::OverBudget;
+        } else {
+          inline_call(caller, call);
+        }
+        m_decisions.emplace_back(decision);
+      }
+    }
+  }
+  return m_decisions;
+}
+
+void Inliner::report(std::ostream& out, const IdCache& id_cache) const {
+  auto name = [&](uint32_t function) {
+    const auto id = m_module.functions[function].name;
+    return id == UndefinedIdIndex ? "<anonymous>" : id_cache.get(id).str;
+  };
+  for (const auto& decision : m_decisions) {
+    out << name(decision.caller) << " -> " << name(decision.callee)
+        << " (" << decision.callee_size << " instrs): ";
+    switch (decision.reason) {
+      case InlineDecision::Reason::Inlined: out << (decision.hot ? "inlined hot call" : "inlined"); break;
+      case InlineDecision::Reason::Declaration: out << "no body"; break;
+      case InlineDecision::Reason::Recursive: out << "recursive"; break;
+      case InlineDecision::Reason::TooLarge: out << "callee too large"; break;
+      case InlineDecision::Reason::OverBudget: out << "caller over budget"; break;
+      case InlineDecision::Reason::Cold: out << "cold call"; break;
+    }
+    out << '\n';
+  }
+}
+
+std::vector<std::vector<uint32_t>> Inliner::call_graph(const IrModule& module) {
+  std::vector<std::vector<uint32_t>> graph(module.functions.size());
+  for (uint32_t function = 0; function < module.functions.size(); ++function) {
+    const auto& ir_function = module.functions[function];
+    for (const auto& block : ir_function.blocks) {
+      for (auto index : block.instrs) {
+        const auto& instr = ir_function.instrs[index];
+        // taking the address of a function counts as calling it
+        if (instr.kind != IrInstr::Kind::Call && instr.kind != IrInstr::Kind::FunctionAddr) continue;
+        auto& callees = graph[function];
+        if (std::find(callees.begin(), callees.end(), instr.index) == callees.end()) callees.emplace_back(instr.index);
+      }
+    }
+  }
+  return graph;
+}
+
+// iterative Tarjan, components come out in reverse topological order
+std::vector<std::vector<uint32_t>> Inliner::bottom_up_sccs(const std::vector<std::vector<uint32_t>>& graph) {
+  const uint32_t undefined = UndefinedIrValueIndex;
+  std::vector<uint32_t> index(graph.size(), undefined);
+  std::vector<uint32_t> low_link(graph.size(), 0);
+  std::vector<bool> on_stack(graph.size(), false);
+  std::vector<uint32_t> stack;
+  std::vector<std::vector<uint32_t>> sccs;
+  uint32_t counter = 0;
+
+  for (uint32_t root = 0; root < graph.size(); ++root) {
+    if (index[root] != undefined) continue;
+    std::vector<std::pair<uint32_t, uint32_t>> walk{{root, 0}};
+    index[root] = low_link[root] = counter++;
+    stack.emplace_back(root);
+    on_stack[root] = true;
+
+    while (!walk.empty()) {
+      auto& [node, next_edge] = walk.back();
+      if (next_edge < graph[node].size()) {
+        const auto succ = graph[node][next_edge++];
+        if (index[succ] == undefined) {
+          index[succ] = low_link[succ] = counter++;
+          stack.emplace_back(succ);
+          on_stack[succ] = true;
+          walk.emplace_back(succ, 0);
+        } else if (on_stack[succ]) {
+          low_link[node] = std::min(low_link[node], index[succ]);
+        }
+        continue;
+      }
+
+      const auto finished = node;
+      walk.pop_back();
+      if (!walk.empty()) {
+        const auto parent = walk.back().first;
+        low_link[parent] = std::min(low_link[parent], low_link[finished]);
+      }
+      if (low_link[finished] == index[finished]) {
+        sccs.emplace_back();
+        uint32_t member = undefined;
+        do {
+          member = stack.back();
+          stack.pop_back();
+          on_stack[member] = false;
+          sccs.back().emplace_back(member);
+        } while (member != finished);
+      }
+    }
+  }
+  return sccs;
+}
+
+void Inliner::inline_call(uint32_t caller_index, IrValueIndex call) {
+  auto& caller = m_module.functions[caller_index];
+  const auto& callee = m_module.functions[caller.instrs[call].index];
+  const auto args = caller.instrs[call].operands;
+  const auto call_block = caller.instrs[call].block;
+  const auto call_weight = caller.blocks[call_block].weight;
+
+  // everything after the call continues in a new block
+  const auto continuation = caller.create_block();
+  {
+    auto& block_instrs = caller.blocks[call_block].instrs;
+    const auto position = std::find(block_instrs.begin(), block_instrs.end(), call);
+    caller.blocks[continuation].instrs.assign(position + 1, block_instrs.end());
+    block_instrs.erase(position, block_instrs.end());
+  }
+  for (auto index : caller.blocks[continuation].instrs) caller.instrs[index].block = continuation;
+  caller.blocks[continuation].succs = std::move(caller.blocks[call_block].succs);
+  caller.blocks[call_block].succs.clear();
+  for (auto succ : caller.blocks[continuation].succs) {
+    for (auto& pred : caller.blocks[succ].preds) {
+      if (pred == call_block) pred = continuation;
+    }
+  }
+
+  caller.blocks[continuation].weight = call_weight;
+
+  std::vector<IrBlockIndex> block_map(callee.blocks.size());
+  const uint64_t entry_weight = callee.blocks.empty() ? 0 : callee.blocks[0].weight;
+  for (IrBlockIndex block = 0; block < callee.blocks.size(); ++block) {
+    block_map[block] = caller.create_block();
+    if (entry_weight) {
+      const auto share = static_cast<double>(callee.blocks[block].weight) / static_cast<double>(entry_weight);
+      caller.blocks[block_map[block]].weight = static_cast<uint64_t>(share * static_cast<double>(call_weight));
+    }
+  }
+
+  std::vector<IrValueIndex> value_map(callee.instrs.size(), UndefinedIrValueIndex);
+  std::vector<IrValueIndex> cloned;
+  std::vector<std::pair<IrBlockIndex, IrValueIndex>> returns;
+  for (IrBlockIndex block = 0; block < callee.blocks.size(); ++block) {
+    const auto mapped_block = block_map[block];
+    for (auto index : callee.blocks[block].instrs) {
+      const auto& instr = callee.instrs[index];
+      if (instr.kind == IrInstr::Kind::Param) {
+        value_map[index] = args[instr.index];
+        continue;
+      }
+      if (instr.kind == IrInstr::Kind::Return) {
+        const auto jump = caller.create(mapped_block, IrInstr::Kind::Jump, IrType::Void);
+        caller.instrs[jump].targets[0] = continuation;
+        returns.emplace_back(mapped_block, instr.operands.empty() ? UndefinedIrValueIndex : instr.operands[0]);
+        continue;
+      }
+      const auto copy = caller.create(mapped_block, instr.kind, instr.type);
+      auto& copy_instr = caller.instrs[copy];
+      copy_instr.operands = instr.operands;
+      copy_instr.constant = instr.constant;
+      copy_instr.index = instr.index;
+      for (uint32_t i = 0; i < 2; ++i) {
+        if (instr.targets[i] != UndefinedIrBlockIndex) copy_instr.targets[i] = block_map[instr.targets[i]];
+      }
+      value_map[index] = copy;
+      cloned.emplace_back(copy);
+    }
+  }
+  for (auto copy : cloned) {
+    for (auto& operand : caller.instrs[copy].operands) operand = value_map[operand];
+  }
+  for (IrBlockIndex block = 0; block < callee.blocks.size(); ++block) {
+    auto& mapped = caller.blocks[block_map[block]];
+    for (auto pred : callee.blocks[block].preds) mapped.preds.emplace_back(block_map[pred]);
+    for (auto succ : callee.blocks[block].succs) mapped.succs.emplace_back(block_map[succ]);
+  }
+  for (auto& [block, value] : returns) caller.add_edge(block, continuation);
+
+  caller.create_jump(call_block, block_map[0]);
+
+  IrValueIndex result = UndefinedIrValueIndex;
+  if (callee.return_type != IrType::Void && !returns.empty()) {
+    if (returns.size() == 1) {
+      result = value_map[returns[0].second];
+    } else {
+      result = caller.create_phi(continuation, callee.return_type);
+      for (auto& [block, value] : returns) caller.instrs[result].operands.emplace_back(value_map[value]);
+    }
+  }
+
+  caller.instrs[call].kind = IrInstr::Kind::None;
+  caller.instrs[call].operands.clear();
+  caller.instrs[call].block = UndefinedIrBlockIndex;
+  std::vector<IrValueIndex> map(caller.instrs.size(), UndefinedIrValueIndex);
+  map[call] = result;
+  if (result != UndefinedIrValueIndex) caller.replace_uses(map);
+}
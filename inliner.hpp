@@ -0,0 +1,66 @@
+#ifndef INLINER_HPP
+#define INLINER_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class IdCache;
+
+struct InlineDecision {
+  enum class Reason { Inlined, Declaration, Recursive, TooLarge, OverBudget, Cold };
+
+  uint32_t caller;
+  uint32_t callee;
+  uint32_t callee_size;
+  Reason reason;
+  // the call ran often enough in the profile to take larger callees
+  bool hot = false;
+};
+
+// Bottom-up inliner over the call graph of an IrModule. Strongly connected
+// components are visited callees first (Tarjan), so a callee is already
+// simplified by its own inlining when its size is judged. A call is inlined
+// if the callee has at most `threshold` instructions, is not part of the
+// caller's component, and the caller stays within `caller_budget` instructions.
+// In profiled callers the block weight of a call decides instead: calls
+// making up at least `hot_percent` of all profiled calls inline callees of
+// up to `hot_threshold` instructions, calls that never ran only callees of
+// up to `cold_threshold`. Inlined blocks take the callee's weights scaled
+// to the call.
+class Inliner {
+public:
+  struct Options {
+    uint32_t threshold = 40;
+    uint32_t caller_budget = 2000;
+    uint32_t hot_threshold = 160;
+    uint32_t cold_threshold = 8;
+    uint32_t hot_percent = 1;
+  };
+
+  Inliner(IrModule& module) : m_module(module) {}
+  Inliner(IrModule& module, Options options) : m_module(module), m_options(options) {}
+  Inliner(const Inliner&) = delete;
+  Inliner(Inliner&&) = delete;
+  Inliner& operator=(const Inliner&) = delete;
+  Inliner& operator=(Inliner&&) = delete;
+
+  const std::vector<InlineDecision>& run();
+  const std::vector<InlineDecision>& decisions() const { return m_decisions; }
+  void report(std::ostream& out, const IdCache& id_cache) const;
+
+  // callee sets of every function, used for the bottom-up order
+  static std::vector<std::vector<uint32_t>> call_graph(const IrModule& module);
+  // strongly connected components, callees before callers
+  static std::vector<std::vector<uint32_t>> bottom_up_sccs(const std::vector<std::vector<uint32_t>>& graph);
+
+private:
+  IrModule& m_module;
+  Options m_options;
+  std::vector<InlineDecision> m_decisions;
+
+  void inline_call(uint32_t caller, IrValueIndex call);
+};
+
+#endif  // INLINER_HPP
@@ -0,0 +1,568 @@
+#ifndef IR_HPP
+#define IR_HPP
+
+#include "id_cache.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using IrValueIndex = std::uint32_t;
+static const IrValueIndex UndefinedIrValueIndex = std::numeric_limits<IrValueIndex>::max();
+
+using IrBlockIndex = std::uint32_t;
+static const IrBlockIndex UndefinedIrBlockIndex = std::numeric_limits<IrBlockIndex>::max();
+
+// F32x4, F32x8, I32x4 and F64x4 are vectors of f32, i32 and f64 lanes;
+// programs cannot name F64x4, only the vectorizer creates it
+enum class IrType {
+  Void, Bool, I8, I16, I32, U8, U16, U32, F32, F64, Ptr, F32x4, F32x8, I32x4, F64x4
+};
+
+inline uint32_t ir_type_size(IrType type) {
+  switch (type) {
+    case IrType::Bool:
+    case IrType::I8:
+    case IrType::U8:
+      return 1;
+    case IrType::I16:
+    case IrType::U16:
+      return 2;
+    case IrType::I32:
+    case IrType::U32:
+    case IrType::F32:
+      return 4;
+    case IrType::F64:
+    case IrType::Ptr:
+      return 8;
+    case IrType::F32x4:
+    case IrType::I32x4:
+      return 16;
+    case IrType::F32x8:
+    case IrType::F64x4:
+      return 32;
+    default:
+      return 0;
+  }
+}
+
+inline bool ir_is_float(IrType type) {
+  return type == IrType::F32 || type == IrType::F64;
+}
+
+inline bool ir_is_vector(IrType type) {
+  return type == IrType::F32x4 || type == IrType::F32x8 || type == IrType::I32x4 || type == IrType::F64x4;
+}
+
+// 1 for scalars
+inline uint32_t ir_vector_lanes(IrType type) {
+  switch (type) {
+    case IrType::F32x4:
+    case IrType::I32x4:
+    case IrType::F64x4:
+      return 4;
+    case IrType::F32x8:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+// the type of a lane, scalars are their own element type
+inline IrType ir_element_type(IrType type) {
+  switch (type) {
+    case IrType::F32x4:
+    case IrType::F32x8:
+      return IrType::F32;
+    case IrType::I32x4:
+      return IrType::I32;
+    case IrType::F64x4:
+      return IrType::F64;
+    default:
+      return type;
+  }
+}
+
+inline bool ir_is_signed(IrType type) {
+  switch (type) {
+    case IrType::I8:
+    case IrType::I16:
+    case IrType::I32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct IrConst {
+  IrType type = IrType::Void;
+  union {
+    int64_t i;
+    double f;
+  };
+
+  IrConst() : i(0) {}
+
+  // integers are kept truncated to the width of their type, so two constants
+  // of the same type are equal iff their payloads are equal
+  static IrConst make_int(IrType type, int64_t value) {
+    IrConst c;
+    c.type = type;
+    switch (type) {
+      case IrType::Bool: c.i = value != 0; break;
+      case IrType::I8: c.i = static_cast<int8_t>(value); break;
+      case IrType::I16: c.i = static_cast<int16_t>(value); break;
+      case IrType::I32: c.i = static_cast<int32_t>(value); break;
+      case IrType::U8: c.i = static_cast<uint8_t>(value); break;
+      case IrType::U16: c.i = static_cast<uint16_t>(value); break;
+      case IrType::U32: c.i = static_cast<uint32_t>(value); break;
+      default: c.i = value; break;
+    }
+    return c;
+  }
+
+  static IrConst make_float(IrType type, double value) {
+    IrConst c;
+    c.type = type;
+    c.f = type == IrType::F32 ? static_cast<float>(value) : value;
+    return c;
+  }
+
+  // the only vector constant, all lanes zero
+  static IrConst make_zero(IrType type) {
+    return ir_is_float(type) ? make_float(type, 0.0) : make_int(type, 0);
+  }
+
+  // floats compare by bit pattern, 0.0 and -0.0 are different constants
+  bool operator==(const IrConst& other) const {
+    return type == other.type && i == other.i;
+  }
+  bool operator!=(const IrConst& other) const { return !(*this == other); }
+};
+
+// functions of the runtime a RuntimeCall calls, see region.hpp and task.hpp
+enum class IrRuntimeFunction : uint32_t {
+  RegionEnter, RegionLeave, RegionAllocate, TaskSpawn, TaskJoin,
+};
+
+struct IrInstr {
+  enum class Kind {
+    None, Const, Param, Phi,
+    Neg, Add, Sub, Mul, Div,
+    Equal, Great, GreatOrEqual, Less, LessOrEqual,
+    Splat, Lane, InsertLane, Shuffle,
+    StackSlot, FieldAddr, ElementAddr, BoundsCheck, Load, Store, FunctionAddr, Call, RuntimeCall,
+    Jump, Branch, Return,
+  };
+
+  Kind kind = Kind::None;
+  IrType type = IrType::Void;
+  IrBlockIndex block = UndefinedIrBlockIndex;
+  // phi operands are ordered like the predecessors of the owning block
+  std::vector<IrValueIndex> operands;
+  // Jump: targets[0], Branch: targets[0] if operands[0] is true, else targets[1]
+  IrBlockIndex targets[2] = {UndefinedIrBlockIndex, UndefinedIrBlockIndex};
+  IrConst constant;
+  // Param: position in the parameter list, StackSlot: size in bytes,
+  // FieldAddr: byte offset added to operands[0], ElementAddr: size of the
+  // elements operands[1] counts from operands[0], Call and FunctionAddr:
+  // callee in the IrModule, RuntimeCall: the IrRuntimeFunction, which takes
+  // the operands in integer registers,
+  // Lane and InsertLane: the lane, Shuffle: lane i of the result is lane
+  // (index >> 4 * i & 15) of operands[0]
+  uint32_t index = 0;
+
+  bool is_terminator() const { return is_terminator(kind); }
+
+  static bool is_terminator(Kind kind) {
+    switch (kind) {
+      case Kind::Jump:
+      case Kind::Branch:
+      case Kind::Return:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // calls clobber the registers the caller saves
+  bool is_call() const { return is_call(kind); }
+
+  static bool is_call(Kind kind) {
+    return kind == Kind::Call || kind == Kind::RuntimeCall;
+  }
+
+  bool is_binary() const { return is_binary(kind); }
+
+  static bool is_binary(Kind kind) {
+    switch (kind) {
+      case Kind::Add:
+      case Kind::Sub:
+      case Kind::Mul:
+      case Kind::Div:
+      case Kind::Equal:
+      case Kind::Great:
+      case Kind::GreatOrEqual:
+      case Kind::Less:
+      case Kind::LessOrEqual:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // instructions without side effects that only depend on their operands
+  bool is_pure() const { return is_pure(kind); }
+
+  static bool is_pure(Kind kind) {
+    switch (kind) {
+      case Kind::Const:
+      case Kind::Neg:
+      case Kind::FieldAddr:
+      case Kind::ElementAddr:
+      case Kind::Splat:
+      case Kind::Lane:
+      case Kind::InsertLane:
+      case Kind::Shuffle:
+        return true;
+      default:
+        return is_binary(kind);
+    }
+  }
+
+  bool is_compare() const { return is_compare(kind); }
+
+  static bool is_compare(Kind kind) {
+    switch (kind) {
+      case Kind::Equal:
+      case Kind::Great:
+      case Kind::GreatOrEqual:
+      case Kind::Less:
+      case Kind::LessOrEqual:
+        return true;
+      default:
+        return false;
+    }
+  }
+};
+
+struct IrBlock {
+  std::vector<IrValueIndex> instrs;
+  std::vector<IrBlockIndex> preds;
+  std::vector<IrBlockIndex> succs;
+  // how often the block ran in the profile of its function, an estimate
+  // once passes have copied or merged code
+  uint64_t weight = 0;
+};
+
+class IrFunction {
+public:
+  IdIndex name = UndefinedIdIndex;
+  IrType return_type = IrType::Void;
+  std::vector<IrValueIndex> params;
+  std::vector<IrInstr> instrs;
+  // blocks[0] is the entry block
+  std::vector<IrBlock> blocks;
+  // block weights come from a profile; without one they are all 0
+  bool profiled = false;
+
+  IrBlockIndex create_block() {
+    blocks.emplace_back();
+    return blocks.size() - 1;
+  }
+
+  IrValueIndex create(IrBlockIndex block, IrInstr::Kind kind, IrType type) {
+    const IrValueIndex index = instrs.size();
+    instrs.emplace_back();
+    auto& instr = instrs.back();
+    instr.kind = kind;
+    instr.type = type;
+    instr.block = block;
+    blocks[block].instrs.emplace_back(index);
+    return index;
+  }
+
+  IrValueIndex create_const(IrBlockIndex block, IrConst value) {
+    const auto index = create(block, IrInstr::Kind::Const, value.type);
+    instrs[index].constant = value;
+    return index;
+  }
+
+  IrValueIndex create_unary(IrBlockIndex block, IrInstr::Kind kind, IrType type, IrValueIndex operand) {
+    const auto index = create(block, kind, type);
+    instrs[index].operands = {operand};
+    return index;
+  }
+
+  IrValueIndex create_binary(IrBlockIndex block, IrInstr::Kind kind, IrType type, IrValueIndex left, IrValueIndex right) {
+    const auto index = create(block, kind, type);
+    instrs[index].operands = {left, right};
+    return index;
+  }
+
+  // phis are kept in front of all other instructions of a block
+  IrValueIndex create_phi(IrBlockIndex block, IrType type) {
+    const IrValueIndex index = instrs.size();
+    instrs.emplace_back();
+    auto& instr = instrs.back();
+    instr.kind = IrInstr::Kind::Phi;
+    instr.type = type;
+    instr.block = block;
+    auto& block_instrs = blocks[block].instrs;
+    block_instrs.insert(block_instrs.begin() + phi_count(block), index);
+    return index;
+  }
+
+  void create_jump(IrBlockIndex block, IrBlockIndex target) {
+    const auto index = create(block, IrInstr::Kind::Jump, IrType::Void);
+    instrs[index].targets[0] = target;
+    add_edge(block, target);
+  }
+
+  void create_branch(IrBlockIndex block, IrValueIndex cond, IrBlockIndex if_true, IrBlockIndex if_false) {
+    const auto index = create(block, IrInstr::Kind::Branch, IrType::Void);
+    instrs[index].operands = {cond};
+    instrs[index].targets[0] = if_true;
+    instrs[index].targets[1] = if_false;
+    add_edge(block, if_true);
+    add_edge(block, if_false);
+  }
+
+  void create_return(IrBlockIndex block, IrValueIndex value = UndefinedIrValueIndex) {
+    const auto index = create(block, IrInstr::Kind::Return, IrType::Void);
+    if (value != UndefinedIrValueIndex) instrs[index].operands = {value};
+  }
+
+  void add_edge(IrBlockIndex from, IrBlockIndex to) {
+    blocks[from].succs.emplace_back(to);
+    blocks[to].preds.emplace_back(from);
+  }
+
+  uint32_t phi_count(IrBlockIndex block) const {
+    uint32_t count = 0;
+    for (auto index : blocks[block].instrs) {
+      if (instrs[index].kind != IrInstr::Kind::Phi) break;
+      ++count;
+    }
+    return count;
+  }
+
+  IrValueIndex terminator(IrBlockIndex block) const {
+    const auto& block_instrs = blocks[block].instrs;
+    if (block_instrs.empty() || !instrs[block_instrs.back()].is_terminator())
+      return UndefinedIrValueIndex;
+    return block_instrs.back();
+  }
+
+  // bounds checks, and integer divisions unless the divisor is a constant
+  // other than 0, or -1 when signed
+  bool may_trap(const IrInstr& instr) const {
+    if (instr.kind == IrInstr::Kind::BoundsCheck) return true;
+    if (instr.kind != IrInstr::Kind::Div || ir_is_float(ir_element_type(instr.type))) return false;
+    const auto& divisor = instrs[instr.operands[1]];
+    if (divisor.kind != IrInstr::Kind::Const || divisor.constant.i == 0) return true;
+    return ir_is_signed(instr.type) && divisor.constant.i == -1;
+  }
+
+  // removes a single from -> to edge together with the matching phi operands
+  void remove_edge(IrBlockIndex from, IrBlockIndex to) {
+    auto& succs = blocks[from].succs;
+    auto succ_it = std::find(succs.begin(), succs.end(), to);
+    if (succ_it != succs.end()) succs.erase(succ_it);
+
+    auto& preds = blocks[to].preds;
+    auto pred_it = std::find(preds.begin(), preds.end(), from);
+    if (pred_it == preds.end()) return;
+    const auto position = pred_it - preds.begin();
+    preds.erase(pred_it);
+    for (auto index : blocks[to].instrs) {
+      auto& instr = instrs[index];
+      if (instr.kind != IrInstr::Kind::Phi) break;
+      instr.operands.erase(instr.operands.begin() + position);
+    }
+  }
+
+  // map[v] is the value replacing v, or UndefinedIrValueIndex to keep v
+  void replace_uses(const std::vector<IrValueIndex>& map) {
+    auto resolve = [&map](IrValueIndex value) {
+      while (value < map.size() && map[value] != UndefinedIrValueIndex) value = map[value];
+      return value;
+    };
+    for (auto& block : blocks) {
+      for (auto index : block.instrs) {
+        for (auto& operand : instrs[index].operands) operand = resolve(operand);
+      }
+    }
+    for (auto& param : params) param = resolve(param);
+  }
+
+  // drops every block with keep[block] == false and renumbers the rest,
+  // instruction indices stay stable
+  void remove_blocks(const std::vector<bool>& keep) {
+    for (IrBlockIndex block = 0; block < blocks.size(); ++block) {
+      if (keep[block]) continue;
+      for (auto succ : std::vector<IrBlockIndex>(blocks[block].succs)) remove_edge(block, succ);
+    }
+
+    std::vector<IrBlockIndex> renumber(blocks.size(), UndefinedIrBlockIndex);
+    std::vector<IrBlock> kept;
+    kept.reserve(blocks.size());
+    for (IrBlockIndex block = 0; block < blocks.size(); ++block) {
+      if (keep[block]) {
+        renumber[block] = kept.size();
+        kept.emplace_back(std::move(blocks[block]));
+      } else {
+        for (auto index : blocks[block].instrs) erase(index);
+      }
+    }
+    blocks = std::move(kept);
+
+    for (IrBlockIndex block = 0; block < blocks.size(); ++block) {
+      auto& b = blocks[block];
+      for (auto& pred : b.preds) pred = renumber[pred];
+      for (auto& succ : b.succs) succ = renumber[succ];
+      for (auto index : b.instrs) {
+        auto& instr = instrs[index];
+        instr.block = block;
+        for (auto& target : instr.targets) {
+          if (target != UndefinedIrBlockIndex) target = renumber[target];
+        }
+      }
+    }
+  }
+
+  // removes phis whose operands are all the same value (or the phi itself),
+  // returns the number of removed phis
+  uint32_t remove_trivial_phis() {
+    std::vector<IrValueIndex> map(instrs.size(), UndefinedIrValueIndex);
+    uint32_t removed = 0;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto& block : blocks) {
+        for (auto index : block.instrs) {
+          auto& instr = instrs[index];
+          if (instr.kind != IrInstr::Kind::Phi) break;
+          IrValueIndex same = UndefinedIrValueIndex;
+          bool trivial = true;
+          for (auto operand : instr.operands) {
+            while (map[operand] != UndefinedIrValueIndex) operand = map[operand];
+            if (operand == index || operand == same) continue;
+            if (same != UndefinedIrValueIndex) {
+              trivial = false;
+              break;
+            }
+            same = operand;
+          }
+          if (trivial && same != UndefinedIrValueIndex) {
+            map[index] = same;
+            instr.kind = IrInstr::Kind::None;
+            ++removed;
+            changed = true;
+          }
+        }
+      }
+      for (auto& block : blocks) {
+        block.instrs.erase(
+          std::remove_if(block.instrs.begin(), block.instrs.end(),
+            [this](IrValueIndex index) { return instrs[index].kind == IrInstr::Kind::None; }),
+          block.instrs.end());
+      }
+    }
+    if (removed) replace_uses(map);
+    return removed;
+  }
+
+  uint32_t instr_count() const {
+    uint32_t count = 0;
+    for (auto& block : blocks) count += block.instrs.size();
+    return count;
+  }
+
+private:
+  void erase(IrValueIndex index) {
+    auto& instr = instrs[index];
+    instr.kind = IrInstr::Kind::None;
+    instr.block = UndefinedIrBlockIndex;
+    instr.operands.clear();
+  }
+};
+
+struct IrModule {
+  std::vector<IrFunction> functions;
+};
+
+// folds a unary or binary instruction over constant operands, returns false
+// when the result is not a compile time constant (e.g. division by zero)
+inline bool ir_fold(IrInstr::Kind kind, IrType type, const IrConst& left, const IrConst& right, IrConst& result) {
+  using Kind = IrInstr::Kind;
+  const auto operand_type = left.type;
+  // the only vector constant is zero, vector results are never folded
+  if (ir_is_vector(type) || ir_is_vector(operand_type)) return false;
+
+  if (IrInstr::is_compare(kind)) {
+    int compare = 0;
+    if (ir_is_float(operand_type)) {
+      compare = left.f < right.f ? -1 : (left.f > right.f ? 1 : 0);
+      if (left.f != left.f || right.f != right.f) {
+        result = IrConst::make_int(type, 0);
+        return true;
+      }
+    } else if (ir_is_signed(operand_type)) {
+      compare = left.i < right.i ? -1 : (left.i > right.i ? 1 : 0);
+    } else {
+      const auto l = static_cast<uint64_t>(left.i);
+      const auto r = static_cast<uint64_t>(right.i);
+      compare = l < r ? -1 : (l > r ? 1 : 0);
+    }
+    bool value = false;
+    switch (kind) {
+      case Kind::Equal: value = compare == 0; break;
+      case Kind::Great: value = compare > 0; break;
+      case Kind::GreatOrEqual: value = compare >= 0; break;
+      case Kind::Less: value = compare < 0; break;
+      case Kind::LessOrEqual: value = compare <= 0; break;
+      default: return false;
+    }
+    result = IrConst::make_int(type, value);
+    return true;
+  }
+
+  if (ir_is_float(type)) {
+    double value = 0.0;
+    switch (kind) {
+      case Kind::Neg: value = -left.f; break;
+      case Kind::Add: value = left.f + right.f; break;
+      case Kind::Sub: value = left.f - right.f; break;
+      case Kind::Mul: value = left.f * right.f; break;
+      case Kind::Div: value = left.f / right.f; break;
+      default: return false;
+    }
+    result = IrConst::make_float(type, value);
+    return true;
+  }
+
+  // wrap around in the width of the type, unsigned arithmetic avoids UB
+  const auto l = static_cast<uint64_t>(left.i);
+  const auto r = static_cast<uint64_t>(right.i);
+  uint64_t value = 0;
+  switch (kind) {
+    case Kind::Neg: value = 0 - l; break;
+    case Kind::Add: value = l + r; break;
+    case Kind::Sub: value = l - r; break;
+    case Kind::Mul: value = l * r; break;
+    case Kind::Div:
+      if (right.i == 0) return false;
+      if (ir_is_signed(type)) {
+        value = static_cast<uint64_t>(left.i / right.i);
+      } else {
+        value = l / r;
+      }
+      break;
+    default: return false;
+  }
+  result = IrConst::make_int(type, static_cast<int64_t>(value));
+  return true;
+}
+
+#endif  // IR_HPP
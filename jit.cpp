@@ -0,0 +1,592 @@
+#include "jit.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+// A stencil is the fixed part of one machine instruction. Most end in a
+// ModRM byte addressing [rbx + disp32] and are followed by the patched
+// displacement of a frame slot or struct field.
+struct JitStencil {
+  uint8_t size;
+  uint8_t bytes[7];
+};
+
+static const JitStencil LoadRax = {3, {0x48, 0x8b, 0x83}};        // mov rax, [rbx + d]
+static const JitStencil StoreRax = {3, {0x48, 0x89, 0x83}};       // mov [rbx + d], rax
+static const JitStencil AddRax = {3, {0x48, 0x03, 0x83}};         // add rax, [rbx + d]
+static const JitStencil SubRax = {3, {0x48, 0x2b, 0x83}};         // sub rax, [rbx + d]
+static const JitStencil MulRax = {4, {0x48, 0x0f, 0xaf, 0x83}};   // imul rax, [rbx + d]
+static const JitStencil CmpRax = {3, {0x48, 0x3b, 0x83}};         // cmp rax, [rbx + d]
+static const JitStencil CmpZero = {3, {0x48, 0x83, 0xbb}};        // cmp qword [rbx + d], imm8
+static const JitStencil DivRax = {5, {0x48, 0x99, 0x48, 0xf7, 0xbb}};  // cqo; idiv qword [rbx + d]
+static const JitStencil LeaRdi = {3, {0x48, 0x8d, 0xbb}};         // lea rdi, [rbx + d]
+static const JitStencil LoadEax = {2, {0x8b, 0x83}};              // mov eax, [rbx + d]
+static const JitStencil StoreEax = {2, {0x89, 0x83}};             // mov [rbx + d], eax
+static const JitStencil NegRax = {3, {0x48, 0xf7, 0xd8}};         // neg rax
+static const JitStencil AddRaxImm = {2, {0x48, 0x05}};            // add rax, imm32
+static const JitStencil AddRaxRcx = {3, {0x48, 0x01, 0xc8}};      // add rax, rcx
+static const JitStencil MovRaxImm = {2, {0x48, 0xb8}};            // mov rax, imm64
+static const JitStencil MovEaxImm = {1, {0xb8}};                  // mov eax, imm32
+static const JitStencil ZeroExtendAl = {3, {0x0f, 0xb6, 0xc0}};   // movzx eax, al
+static const JitStencil FlipSign64 = {5, {0x48, 0x0f, 0xba, 0xf8, 0x3f}};  // btc rax, 63
+static const JitStencil FlipSign32 = {4, {0x0f, 0xba, 0xf8, 0x1f}};        // btc eax, 31
+static const JitStencil EqualNotParity = {5, {0x0f, 0x9b, 0xc1, 0x20, 0xc8}};  // setnp cl; and al, cl
+static const JitStencil Jump = {1, {0xe9}};                       // jmp rel32
+static const JitStencil Return = {2, {0x5b, 0xc3}};              // pop rbx; ret
+static const JitStencil ReturnOk = {4, {0x31, 0xc0, 0x5b, 0xc3}};  // xor eax, eax; return
+static const JitStencil ZeroRax = {2, {0x31, 0xc0}};               // xor eax, eax
+// push rbx; mov rbx, rdi
+static const JitStencil Prologue = {4, {0x53, 0x48, 0x89, 0xfb}};
+// the entry from C around the internal one, which follows it: push r12;
+// push r13; push rax; mov r12, rsi; mov r13, [r12 + d8]; call the internal
+// entry; pop rcx; pop r13; pop r12; ret
+static const JitStencil SaveContext = {5, {0x41, 0x54, 0x41, 0x55, 0x50}};
+static const JitStencil MovR12Rsi = {3, {0x49, 0x89, 0xf4}};
+static const JitStencil LoadR13Context = {4, {0x4d, 0x8b, 0x6c, 0x24}};
+static const JitStencil CallPastRestore = {5, {0xe8, 0x06, 0x00, 0x00, 0x00}};
+static const JitStencil RestoreContext = {6, {0x59, 0x41, 0x5d, 0x41, 0x5c, 0xc3}};
+static const uint8_t ExternalEntrySize = 5 + 3 + 5 + 5 + 6;
+// mov ecx, imm32 / xor eax, eax; rep stosq
+static const JitStencil MovEcxImm = {1, {0xb9}};
+static const JitStencil ZeroRdi = {5, {0x31, 0xc0, 0xf3, 0x48, 0xab}};
+// call sequence, see Call below
+static const JitStencil LeaRaxRdi = {3, {0x48, 0x8d, 0x87}};       // lea rax, [rdi + d]
+static const JitStencil CmpRaxContext = {4, {0x49, 0x3b, 0x44, 0x24}};      // cmp rax, [r12 + d8]
+static const JitStencil DecR13 = {4, {0x49, 0x83, 0xed, 0x01}};    // sub r13, 1
+static const JitStencil IncR13 = {4, {0x49, 0x83, 0xc5, 0x01}};    // add r13, 1
+static const JitStencil LoadRaxContext = {4, {0x49, 0x8b, 0x44, 0x24}};     // mov rax, [r12 + d8]
+static const JitStencil LoadRaxEntry = {3, {0x48, 0x8b, 0x80}};    // mov rax, [rax + d]
+static const JitStencil AddRaxImm8 = {3, {0x48, 0x83, 0xc0}};      // add rax, imm8
+static const JitStencil CallRax = {2, {0xff, 0xd0}};               // call rax
+static const JitStencil TestEax = {2, {0x85, 0xc0}};               // test eax, eax
+// frames of at most this many slots are cleared by single stores
+static const uint32_t MaxUnrolledClear = 16;
+
+// Integer stencils by type, in the order of the typed opcode groups I8,
+// I16, I32, U8, U16, U32. Results are wrapped by extending the low part of
+// rax again, which keeps slots sign or zero extended like RegVm does.
+static const JitStencil Wrap[] = {
+  {4, {0x48, 0x0f, 0xbe, 0xc0}}, {4, {0x48, 0x0f, 0xbf, 0xc0}}, {3, {0x48, 0x63, 0xc0}},
+  {3, {0x0f, 0xb6, 0xc0}}, {3, {0x0f, 0xb7, 0xc0}}, {2, {0x89, 0xc0}},
+};
+static const JitStencil LoadFieldRax[] = {
+  {4, {0x48, 0x0f, 0xbe, 0x83}}, {4, {0x48, 0x0f, 0xbf, 0x83}}, {3, {0x48, 0x63, 0x83}},
+  {3, {0x0f, 0xb6, 0x83}}, {3, {0x0f, 0xb7, 0x83}}, {2, {0x8b, 0x83}},
+};
+static const JitStencil LoadFieldRcx[] = {
+  {4, {0x48, 0x0f, 0xbe, 0x8b}}, {4, {0x48, 0x0f, 0xbf, 0x8b}}, {3, {0x48, 0x63, 0x8b}},
+  {3, {0x0f, 0xb6, 0x8b}}, {3, {0x0f, 0xb7, 0x8b}}, {2, {0x8b, 0x8b}},
+};
+static const JitStencil StoreFieldRax[] = {
+  {2, {0x88, 0x83}}, {3, {0x66, 0x89, 0x83}}, {2, {0x89, 0x83}},
+  {2, {0x88, 0x83}}, {3, {0x66, 0x89, 0x83}}, {2, {0x89, 0x83}},
+};
+
+// Float stencils by type, F32 then F64.
+static const JitStencil LoadXmm0[] = {{4, {0xf3, 0x0f, 0x10, 0x83}}, {4, {0xf2, 0x0f, 0x10, 0x83}}};
+static const JitStencil LoadXmm1[] = {{4, {0xf3, 0x0f, 0x10, 0x8b}}, {4, {0xf2, 0x0f, 0x10, 0x8b}}};
+static const JitStencil StoreXmm0[] = {{4, {0xf3, 0x0f, 0x11, 0x83}}, {4, {0xf2, 0x0f, 0x11, 0x83}}};
+static const JitStencil AddXmm0[] = {{4, {0xf3, 0x0f, 0x58, 0x83}}, {4, {0xf2, 0x0f, 0x58, 0x83}}};
+static const JitStencil SubXmm0[] = {{4, {0xf3, 0x0f, 0x5c, 0x83}}, {4, {0xf2, 0x0f, 0x5c, 0x83}}};
+static const JitStencil MulXmm0[] = {{4, {0xf3, 0x0f, 0x59, 0x83}}, {4, {0xf2, 0x0f, 0x59, 0x83}}};
+static const JitStencil DivXmm0[] = {{4, {0xf3, 0x0f, 0x5e, 0x83}}, {4, {0xf2, 0x0f, 0x5e, 0x83}}};
+static const JitStencil CompareXmm0[] = {{3, {0x0f, 0x2e, 0x83}}, {4, {0x66, 0x0f, 0x2e, 0x83}}};  // ucomis xmm0, [rbx + d]
+static const JitStencil CompareXmm1Xmm0[] = {{3, {0x0f, 0x2e, 0xc8}}, {4, {0x66, 0x0f, 0x2e, 0xc8}}};
+static const JitStencil ConvertEaxXmm1[] = {{4, {0xf3, 0x0f, 0x2a, 0xc8}}, {4, {0xf2, 0x0f, 0x2a, 0xc8}}};
+static const JitStencil AddXmm0Xmm1[] = {{4, {0xf3, 0x0f, 0x58, 0xc1}}, {4, {0xf2, 0x0f, 0x58, 0xc1}}};
+
+// condition codes of jcc and setcc
+enum class JitCondition : uint8_t {
+  Below = 0x2, AboveOrEqual = 0x3, Equal = 0x4, NotEqual = 0x5, BelowOrEqual = 0x6, Above = 0x7,
+  Parity = 0xa, Less = 0xc, GreaterOrEqual = 0xd, LessOrEqual = 0xe, Greater = 0xf,
+};
+
+// code jumped to from anywhere in a function, emitted after its body
+enum class JitStub { StackOverflow, DivisionByZero, Exit, Count };
+
+struct JitFixup {
+  uint32_t position;
+  // bytecode offset of a jump target, or a JitStub
+  uint32_t target;
+};
+
+struct JitStencilWriter {
+  std::vector<uint8_t>& code;
+  std::vector<JitFixup> jumps;
+  std::vector<JitFixup> stub_jumps;
+
+  void copy(const JitStencil& stencil) { code.insert(code.end(), stencil.bytes, stencil.bytes + stencil.size); }
+  void patch8(uint8_t value) { code.push_back(value); }
+  void patch32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) code.push_back(value >> (i * 8));
+  }
+  void patch64(uint64_t value) {
+    patch32(static_cast<uint32_t>(value));
+    patch32(static_cast<uint32_t>(value >> 32));
+  }
+  // stencil addressing a frame slot
+  void slot(const JitStencil& stencil, uint32_t slot) {
+    copy(stencil);
+    patch32(slot * 8);
+  }
+  // stencil addressing a byte offset of the frame
+  void field(const JitStencil& stencil, uint32_t offset) {
+    copy(stencil);
+    patch32(offset);
+  }
+  void jump(JitCondition condition, uint32_t target) {
+    patch8(0x0f);
+    patch8(0x80 | static_cast<uint8_t>(condition));
+    jumps.push_back({static_cast<uint32_t>(code.size()), target});
+    patch32(0);
+  }
+  void jump(uint32_t target) {
+    copy(Jump);
+    jumps.push_back({static_cast<uint32_t>(code.size()), target});
+    patch32(0);
+  }
+  void jump_stub(JitCondition condition, JitStub stub) {
+    patch8(0x0f);
+    patch8(0x80 | static_cast<uint8_t>(condition));
+    stub_jumps.push_back({static_cast<uint32_t>(code.size()), static_cast<uint32_t>(stub)});
+    patch32(0);
+  }
+  void set(JitCondition condition) {
+    patch8(0x0f);
+    patch8(0x90 | static_cast<uint8_t>(condition));
+    patch8(0xc0);
+  }
+  void context(const JitStencil& stencil, size_t offset) {
+    copy(stencil);
+    patch8(offset);
+  }
+  // the entry from C, followed by the internal entry it calls
+  void external_entry() {
+    copy(SaveContext);
+    copy(MovR12Rsi);
+    context(LoadR13Context, offsetof(JitContext, frames_left));
+    copy(CallPastRestore);
+    copy(RestoreContext);
+  }
+};
+
+static JitCondition int_condition(RegTypedOp op) {
+  switch (op) {
+    case RegTypedOp::Equal: case RegTypedOp::JumpUnlessEqual: return JitCondition::Equal;
+    case RegTypedOp::Great: case RegTypedOp::JumpUnlessGreat: return JitCondition::Greater;
+    case RegTypedOp::GreatOrEqual: case RegTypedOp::JumpUnlessGreatOrEqual: return JitCondition::GreaterOrEqual;
+    case RegTypedOp::Less: case RegTypedOp::JumpUnlessLess: return JitCondition::Less;
+    default: return JitCondition::LessOrEqual;
+  }
+}
+
+// the value of a Const of an integer group as its slot holds it
+static uint64_t int_constant(uint32_t group, uint32_t immediate) {
+  const auto value = static_cast<int32_t>(immediate);
+  switch (group) {
+    case 0: return static_cast<int64_t>(static_cast<int8_t>(value));
+    case 1: return static_cast<int64_t>(static_cast<int16_t>(value));
+    case 2: return static_cast<int64_t>(value);
+    case 3: return static_cast<uint8_t>(value);
+    case 4: return static_cast<uint16_t>(value);
+    default: return static_cast<uint32_t>(value);
+  }
+}
+
+// loads one operand of a float compare into xmm0 and compares it to the
+// other, swapped for Less and LessOrEqual so that every compare reads the
+// above or above-or-equal conditions, which are false for unordered values
+static void float_compare(JitStencilWriter& writer, uint32_t f, RegTypedOp op, uint32_t a, uint32_t b) {
+  const bool swap = op == RegTypedOp::Less || op == RegTypedOp::LessOrEqual
+    || op == RegTypedOp::JumpUnlessLess || op == RegTypedOp::JumpUnlessLessOrEqual;
+  writer.slot(LoadXmm0[f], swap ? b : a);
+  writer.slot(CompareXmm0[f], swap ? a : b);
+}
+
+static bool translate_int(JitStencilWriter& writer, uint32_t group, RegTypedOp op, const uint32_t* pc) {
+  const auto& wrap = Wrap[group];
+  switch (op) {
+    case RegTypedOp::Const:
+      writer.copy(MovRaxImm);
+      writer.patch64(int_constant(group, pc[1]));
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::Add:
+    case RegTypedOp::Sub:
+    case RegTypedOp::Mul:
+      writer.slot(LoadRax, pc[1]);
+      writer.slot(op == RegTypedOp::Add ? AddRax : op == RegTypedOp::Sub ? SubRax : MulRax, pc[2]);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::Div:
+      writer.slot(CmpZero, pc[2]);
+      writer.patch8(0);
+      writer.jump_stub(JitCondition::Equal, JitStub::DivisionByZero);
+      writer.slot(LoadRax, pc[1]);
+      writer.slot(DivRax, pc[2]);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::Neg:
+      writer.slot(LoadRax, pc[1]);
+      writer.copy(NegRax);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::Equal:
+    case RegTypedOp::Great:
+    case RegTypedOp::GreatOrEqual:
+    case RegTypedOp::Less:
+    case RegTypedOp::LessOrEqual:
+      writer.slot(LoadRax, pc[1]);
+      writer.slot(CmpRax, pc[2]);
+      writer.set(int_condition(op));
+      writer.copy(ZeroExtendAl);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::LoadField:
+      writer.field(LoadFieldRax[group], pc[1]);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::StoreField:
+      writer.slot(LoadRax, pc[1]);
+      writer.field(StoreFieldRax[group], pc[0]);
+      return true;
+    case RegTypedOp::AddImm:
+      writer.slot(LoadRax, pc[1]);
+      writer.copy(AddRaxImm);
+      writer.patch32(pc[2]);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::AddField:
+      writer.slot(LoadRax, pc[1]);
+      writer.field(LoadFieldRcx[group], pc[2]);
+      writer.copy(AddRaxRcx);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::JumpUnlessEqual:
+    case RegTypedOp::JumpUnlessGreat:
+    case RegTypedOp::JumpUnlessGreatOrEqual:
+    case RegTypedOp::JumpUnlessLess:
+    case RegTypedOp::JumpUnlessLessOrEqual:
+      writer.slot(LoadRax, pc[0]);
+      writer.slot(CmpRax, pc[1]);
+      // the inverse condition code differs in the lowest bit
+      writer.jump(static_cast<JitCondition>(static_cast<uint8_t>(int_condition(op)) ^ 1), pc[2]);
+      return true;
+    case RegTypedOp::IncrementLessJump:
+      writer.slot(LoadRax, pc[0]);
+      writer.copy(AddRaxImm);
+      writer.patch32(pc[1]);
+      writer.copy(wrap);
+      writer.slot(StoreRax, pc[0]);
+      writer.slot(CmpRax, pc[2]);
+      writer.jump(JitCondition::Less, pc[3]);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool translate_float(JitStencilWriter& writer, uint32_t f, RegTypedOp op, const uint32_t* pc) {
+  switch (op) {
+    case RegTypedOp::Const:
+      writer.copy(MovRaxImm);
+      writer.patch64(f == 0 ? pc[1] : pc[1] | static_cast<uint64_t>(pc[2]) << 32);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::Add:
+    case RegTypedOp::Sub:
+    case RegTypedOp::Mul:
+    case RegTypedOp::Div: {
+      const JitStencil* arithmetic[] = {AddXmm0, SubXmm0, MulXmm0, DivXmm0};
+      writer.slot(LoadXmm0[f], pc[1]);
+      writer.slot(arithmetic[static_cast<uint32_t>(op) - static_cast<uint32_t>(RegTypedOp::Add)][f], pc[2]);
+      writer.slot(StoreXmm0[f], pc[0]);
+      return true;
+    }
+    case RegTypedOp::Neg:
+      if (f == 0) {
+        writer.slot(LoadEax, pc[1]);
+        writer.copy(FlipSign32);
+        writer.slot(StoreEax, pc[0]);
+      } else {
+        writer.slot(LoadRax, pc[1]);
+        writer.copy(FlipSign64);
+        writer.slot(StoreRax, pc[0]);
+      }
+      return true;
+    case RegTypedOp::Equal:
+    case RegTypedOp::Great:
+    case RegTypedOp::GreatOrEqual:
+    case RegTypedOp::Less:
+    case RegTypedOp::LessOrEqual:
+      float_compare(writer, f, op, pc[1], pc[2]);
+      if (op == RegTypedOp::Equal) {
+        writer.set(JitCondition::Equal);
+        writer.copy(EqualNotParity);
+      } else {
+        writer.set(op == RegTypedOp::Great || op == RegTypedOp::Less ? JitCondition::Above : JitCondition::AboveOrEqual);
+      }
+      writer.copy(ZeroExtendAl);
+      writer.slot(StoreRax, pc[0]);
+      return true;
+    case RegTypedOp::LoadField:
+      // the load clears the upper half of xmm0, the slot is stored whole
+      writer.field(LoadXmm0[f], pc[1]);
+      writer.slot(StoreXmm0[1], pc[0]);
+      return true;
+    case RegTypedOp::StoreField:
+      writer.slot(LoadXmm0[f], pc[1]);
+      writer.field(StoreXmm0[f], pc[0]);
+      return true;
+    case RegTypedOp::AddImm:
+      writer.copy(MovEaxImm);
+      writer.patch32(pc[2]);
+      writer.copy(ConvertEaxXmm1[f]);
+      writer.slot(LoadXmm0[f], pc[1]);
+      writer.copy(AddXmm0Xmm1[f]);
+      writer.slot(StoreXmm0[f], pc[0]);
+      return true;
+    case RegTypedOp::AddField:
+      writer.slot(LoadXmm0[f], pc[1]);
+      writer.field(AddXmm0[f], pc[2]);
+      writer.slot(StoreXmm0[f], pc[0]);
+      return true;
+    case RegTypedOp::JumpUnlessEqual:
+      float_compare(writer, f, op, pc[0], pc[1]);
+      writer.jump(JitCondition::NotEqual, pc[2]);
+      writer.jump(JitCondition::Parity, pc[2]);
+      return true;
+    case RegTypedOp::JumpUnlessGreat:
+    case RegTypedOp::JumpUnlessGreatOrEqual:
+    case RegTypedOp::JumpUnlessLess:
+    case RegTypedOp::JumpUnlessLessOrEqual:
+      float_compare(writer, f, op, pc[0], pc[1]);
+      writer.jump(op == RegTypedOp::JumpUnlessGreat || op == RegTypedOp::JumpUnlessLess ? JitCondition::BelowOrEqual : JitCondition::Below, pc[2]);
+      return true;
+    case RegTypedOp::IncrementLessJump:
+      writer.copy(MovEaxImm);
+      writer.patch32(pc[1]);
+      writer.copy(ConvertEaxXmm1[f]);
+      writer.slot(LoadXmm0[f], pc[0]);
+      writer.copy(AddXmm0Xmm1[f]);
+      writer.slot(StoreXmm0[f], pc[0]);
+      writer.slot(LoadXmm1[f], pc[2]);
+      writer.copy(CompareXmm1Xmm0[f]);
+      writer.jump(JitCondition::Above, pc[3]);
+      return true;
+    default:
+      return false;
+  }
+}
+
+Jit::Jit(const RegBytecodeModule& module, uint32_t stack_slots, uint32_t max_frames, bool concurrent)
+  : m_module(module), m_stack(stack_slots), m_max_frames(max_frames), m_entries(module.functions.size(), nullptr),
+    m_osr_offsets(module.functions.size()), m_memory(1 << 20, !concurrent) {}
+
+JitEntry Jit::osr_entry(uint32_t function, uint32_t target) const {
+  if (!m_entries[function]) return nullptr;
+  for (const auto& [header, offset] : m_osr_offsets[function]) {
+    if (header == target) {
+      return reinterpret_cast<JitEntry>(const_cast<uint8_t*>(static_cast<const uint8_t*>(m_entries[function]) + offset));
+    }
+  }
+  return nullptr;
+}
+
+bool Jit::translate(const RegBytecodeFunction& function, std::vector<uint8_t>& code,
+                    std::vector<std::pair<uint32_t, uint32_t>>& osr_offsets) const {
+  JitStencilWriter writer{code, {}, {}};
+  writer.external_entry();
+  writer.copy(Prologue);
+  const auto locals = function.registers - function.params;
+  if (locals > MaxUnrolledClear) {
+    writer.slot(LeaRdi, function.params);
+    writer.copy(MovEcxImm);
+    writer.patch32(locals);
+    writer.copy(ZeroRdi);
+  } else if (locals) {
+    writer.copy(ZeroRax);
+    for (uint32_t slot = function.params; slot < function.registers; ++slot) writer.slot(StoreRax, slot);
+  }
+
+  // machine code offset of every bytecode offset an instruction starts at
+  std::vector<uint32_t> offsets(function.code.size() + 1, 0);
+  const uint32_t* const begin = function.code.data();
+  for (const uint32_t* pc = begin; pc != begin + function.code.size();) {
+    offsets[pc - begin] = code.size();
+    const auto opcode = static_cast<RegOpcode>(*pc++);
+    if (opcode >= RegOpcode::Count) return false;
+    switch (opcode) {
+      case RegOpcode::Nop:
+        break;
+      case RegOpcode::Move:
+        writer.slot(LoadRax, pc[1]);
+        writer.slot(StoreRax, pc[0]);
+        break;
+      case RegOpcode::Jump:
+        writer.jump(pc[0]);
+        break;
+      case RegOpcode::JumpIfFalse:
+        writer.slot(CmpZero, pc[0]);
+        writer.patch8(0);
+        writer.jump(JitCondition::Equal, pc[1]);
+        break;
+      case RegOpcode::Call: {
+        // the callee frame starts at the first argument; check that it and
+        // one more frame fit, call the internal entry behind the one in the
+        // entry table and pass a failure of the callee on
+        const auto& callee = m_module.functions[pc[1]];
+        writer.slot(LeaRdi, pc[2]);
+        writer.field(LeaRaxRdi, callee.registers * 8);
+        writer.context(CmpRaxContext, offsetof(JitContext, stack_end));
+        writer.jump_stub(JitCondition::Above, JitStub::StackOverflow);
+        writer.copy(DecR13);
+        writer.jump_stub(JitCondition::Below, JitStub::StackOverflow);
+        writer.context(LoadRaxContext, offsetof(JitContext, entries));
+        writer.field(LoadRaxEntry, pc[1] * sizeof(void*));
+        writer.copy(AddRaxImm8);
+        writer.patch8(ExternalEntrySize);
+        writer.copy(CallRax);
+        writer.copy(IncR13);
+        writer.copy(TestEax);
+        writer.jump_stub(JitCondition::NotEqual, JitStub::Exit);
+        // callees return their value in their first slot
+        if (callee.return_type != IrType::Void) {
+          writer.slot(LoadRax, pc[2]);
+          writer.slot(StoreRax, pc[0]);
+        }
+        break;
+      }
+      case RegOpcode::Return:
+        writer.slot(LoadRax, pc[0]);
+        writer.slot(StoreRax, 0);
+        writer.copy(ReturnOk);
+        break;
+      case RegOpcode::ReturnVoid:
+        writer.copy(ReturnOk);
+        break;
+      case RegOpcode::Counter:
+        // counted code stays interpreted, where the counters are
+        return false;
+      case RegOpcode::FrameAddress:
+      case RegOpcode::Subslice:
+      case RegOpcode::RegionEnter:
+      case RegOpcode::RegionLeave:
+      case RegOpcode::NewSlice:
+      case RegOpcode::Spawn:
+      case RegOpcode::Join:
+        // there are no stencils for arrays, slices, regions and tasks either
+        return false;
+      default: {
+        // there are no vector stencils, vector code stays interpreted
+        RegVectorOp vector_op;
+        if (reg_vector_op(opcode, vector_op)) return false;
+        const auto typed = static_cast<uint32_t>(opcode) - static_cast<uint32_t>(RegOpcode::ConstI8);
+        const auto group = typed / static_cast<uint32_t>(RegTypedOp::Count);
+        const auto op = static_cast<RegTypedOp>(typed % static_cast<uint32_t>(RegTypedOp::Count));
+        const bool translated = group < 6 ? translate_int(writer, group, op, pc) : translate_float(writer, group - 6, op, pc);
+        if (!translated) return false;
+        break;
+      }
+    }
+    pc += reg_operand_count(opcode);
+  }
+
+  uint32_t stubs[static_cast<uint32_t>(JitStub::Count)];
+  stubs[static_cast<uint32_t>(JitStub::StackOverflow)] = code.size();
+  writer.copy(MovEaxImm);
+  writer.patch32(static_cast<uint32_t>(VmStatus::StackOverflow));
+  writer.copy(Return);
+  stubs[static_cast<uint32_t>(JitStub::DivisionByZero)] = code.size();
+  writer.copy(MovEaxImm);
+  writer.patch32(static_cast<uint32_t>(VmStatus::DivisionByZero));
+  writer.copy(Return);
+  stubs[static_cast<uint32_t>(JitStub::Exit)] = code.size();
+  writer.copy(Return);
+
+  // on-stack replacement entries: an entry from C and the prologue without
+  // clearing the frame, then a jump to the loop header
+  osr_offsets.clear();
+  for (const uint32_t* pc = begin; pc != begin + function.code.size();) {
+    const auto offset = static_cast<uint32_t>(pc - begin);
+    const auto opcode = static_cast<RegOpcode>(*pc++);
+    uint32_t target = 0;
+    const bool is_loop = reg_jump_target(opcode, pc, target) && target <= offset;
+    if (is_loop && std::none_of(osr_offsets.begin(), osr_offsets.end(), [&](const auto& entry) { return entry.first == target; })) {
+      osr_offsets.emplace_back(target, code.size());
+      writer.external_entry();
+      writer.copy(Prologue);
+      writer.jump(target);
+    }
+    pc += reg_operand_count(opcode);
+  }
+
+  const auto patch = [&](uint32_t position, uint32_t target) {
+    const int32_t displacement = static_cast<int32_t>(target) - static_cast<int32_t>(position + 4);
+    memcpy(code.data() + position, &displacement, sizeof(displacement));
+  };
+  for (const auto& fixup : writer.jumps) {
+    if (fixup.target >= function.code.size()) return false;
+    patch(fixup.position, offsets[fixup.target]);
+  }
+  for (const auto& fixup : writer.stub_jumps) patch(fixup.position, stubs[fixup.target]);
+  return true;
+}
+
+bool Jit::compile(uint32_t function) {
+  if (!JIT_SUPPORTED) return false;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<uint32_t> worklist{function};
+  std::vector<uint32_t> installed;
+  std::vector<uint8_t> code;
+  // a function is only compiled with all of its callees, the ones already
+  // installed by a failed compile are forgotten
+  const auto fail = [&] {
+    for (auto index : installed) m_entries[index] = nullptr;
+    return false;
+  };
+  while (!worklist.empty()) {
+    const auto index = worklist.back();
+    worklist.pop_back();
+    if (m_entries[index]) continue;
+    const auto& reg_function = m_module.functions[index];
+    code.clear();
+    if (!translate(reg_function, code, m_osr_offsets[index])) return fail();
+    const auto* entry = m_memory.install(code.data(), code.size());
+    if (!entry) return fail();
+    m_entries[index] = entry;
+    installed.emplace_back(index);
+    ++m_stats.functions;
+    m_stats.code_bytes += code.size();
+
+    for (const uint32_t* pc = reg_function.code.data(); pc != reg_function.code.data() + reg_function.code.size();) {
+      const auto opcode = static_cast<RegOpcode>(*pc++);
+      if (opcode == RegOpcode::Call && !m_entries[pc[1]]) worklist.push_back(pc[1]);
+      pc += reg_operand_count(opcode);
+    }
+  }
+  m_stats.compile_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+VmStatus Jit::call(uint32_t function_index, const std::vector<VmSlot>& args, VmSlot& result) {
+  const auto& function = m_module.functions[function_index];
+  if (!m_entries[function_index]) return VmStatus::InvalidOpcode;
+  VmSlot* base = m_stack.data();
+  if (function.registers > m_stack.size()) return VmStatus::StackOverflow;
+  std::copy(args.begin(), args.begin() + std::min<size_t>(args.size(), function.params), base);
+  std::fill(base + std::min<size_t>(args.size(), function.params), base + function.params, VmSlot{0});
+
+  JitContext context{m_entries.data(), m_stack.data() + m_stack.size(), m_max_frames};
+  const auto entry = reinterpret_cast<JitEntry>(const_cast<void*>(m_entries[function_index]));
+  const auto status = static_cast<VmStatus>(entry(base, &context));
+  if (status == VmStatus::Ok && function.return_type != IrType::Void) result = base[0];
+  return status;
+}
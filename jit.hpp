@@ -0,0 +1,94 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "executable_memory.hpp"
+#include "reg_bytecode.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// State shared by all compiled code of one Jit, the stencils address its
+// members relative to r12.
+struct JitContext {
+  // entry of every function of the module, nullptr until compiled
+  const void* const* entries;
+  VmSlot* stack_end;
+  // calls that may still nest, compiled code counts them down in r13
+  uint64_t frames_left;
+};
+
+// compiled function: takes its frame and the context, returns a VmStatus
+using JitEntry = uint32_t (*)(VmSlot* base, JitContext* context);
+
+struct JitStats {
+  uint32_t functions = 0;
+  uint64_t code_bytes = 0;
+  uint64_t compile_nanoseconds = 0;
+};
+
+// Baseline compiler from register bytecode to x86-64. Every instruction is
+// expanded from a fixed machine code stencil whose holes (frame slot
+// displacements, immediates, branch targets) are patched, without any
+// analysis across instructions: values stay in the frame slots RegVm
+// uses, with rbx pointing at the frame and r12 at the JitContext. Frames
+// share one slot array like in RegVm, so the two agree on every frame
+// layout. Compiling a function compiles all functions it can call. The
+// entry of a function sets up r12 and r13 for the internal entry behind
+// it, which compiled calls go to directly: it only saves rbx and clears
+// the frame with stores.
+//
+// Because the frames agree, every loop header (the target of a backward
+// jump) also gets an on-stack replacement entry: it sets up the registers
+// like the prologue and jumps into the loop, so a frame RegVm was
+// interpreting can continue in compiled code. A concurrent Jit installs
+// every function on fresh pages, so compiled code may run on one thread
+// while compile() runs on another.
+class Jit {
+public:
+  Jit(const RegBytecodeModule& module, uint32_t stack_slots = 1 << 20, uint32_t max_frames = 1 << 16,
+      bool concurrent = false);
+  Jit(const Jit&) = delete;
+  Jit(Jit&&) = delete;
+  Jit& operator=(const Jit&) = delete;
+  Jit& operator=(Jit&&) = delete;
+
+  // false when the target is not supported, code cannot be translated or
+  // executable memory is not available
+  bool compile(uint32_t function);
+  bool is_compiled(uint32_t function) const { return m_entries[function] != nullptr; }
+  const JitStats& stats() const { return m_stats; }
+  // the entry table compiled code calls through, for callers that run
+  // compiled code on frames of their own
+  const void* const* entries() const { return m_entries.data(); }
+  // entry of a compiled function continuing at the loop header at word
+  // offset target of its bytecode, nullptr if target is no loop header
+  JitEntry osr_entry(uint32_t function, uint32_t target) const;
+
+  // the function must be compiled; result is left untouched for functions
+  // without a return value
+  VmStatus call(uint32_t function, const std::vector<VmSlot>& args, VmSlot& result);
+
+private:
+  const RegBytecodeModule& m_module;
+  std::vector<VmSlot> m_stack;
+  uint32_t m_max_frames;
+  std::vector<const void*> m_entries;
+  // loop headers and the code offsets of their entries, by function
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> m_osr_offsets;
+  ExecutableMemory m_memory;
+  JitStats m_stats;
+
+  // machine code of one function, calls refer to callees through the
+  // context, so code can be translated before its callees are installed
+  bool translate(const RegBytecodeFunction& function, std::vector<uint8_t>& code,
+                 std::vector<std::pair<uint32_t, uint32_t>>& osr_offsets) const;
+};
+
+#endif  // JIT_HPP
@@ -5,6 +5,8 @@
 #include <string>
 #include <istream>
 #include <memory>
+#include <cstdint>
+#include <cstdlib>
 
 #include "token.hpp"
 
@@ -48,22 +50,36 @@ public:
         m_buffer += m_last_char;
         next_char();
       } while (::isdigit(last_char()));
-      const auto value = atoi(m_buffer.c_str());
-      m_tokens.emplace_back(std::make_unique<LiteralToken<int32_t, Token::Kind::I32Literal>>(value));
+      if (m_last_char == '.') {
+        do {
+          m_buffer += m_last_char;
+          next_char();
+        } while (::isdigit(last_char()));
+        const auto value = strtod(m_buffer.c_str(), nullptr);
+        m_tokens.emplace_back(std::make_unique<LiteralToken<double, Token::Kind::F64Literal>>(value));
+      } else {
+        const auto value = atoi(m_buffer.c_str());
+        m_tokens.emplace_back(std::make_unique<LiteralToken<int32_t, Token::Kind::I32Literal>>(value));
+      }
     } else {
       switch (m_last_char) {
         case '(': push_token_kind(Token::Kind::LeftParen); break;
         case ')': push_token_kind(Token::Kind::RightParen); break;
         case '{': push_token_kind(Token::Kind::LeftBrace); break;
         case '}': push_token_kind(Token::Kind::RightBrace); break;
+        case '[': push_token_kind(Token::Kind::LeftBracket); break;
+        case ']': push_token_kind(Token::Kind::RightBracket); break;
+        case ',': push_token_kind(Token::Kind::Comma); break;
+        case ':': push_token_kind(Token::Kind::Colon); break;
+        case '.': push_token_kind(Token::Kind::Dot); break;
         case '+': push_token_kind(Token::Kind::Add); break;
-        case '-': push_token_kind(Token::Kind::Sub); break;
+        case '-': push_token_kind(next_char_is('>') ? Token::Kind::Arrow : Token::Kind::Sub); break;
         case '*': push_token_kind(Token::Kind::Mul); break;
         case '/': push_token_kind(Token::Kind::Div); break;
         case ';': push_token_kind(Token::Kind::Semicolon); break;
-        case '=': push_token_kind(Token::Kind::Assign); break;
-        case '>': push_token_kind(Token::Kind::Great); break;
-        case '<': push_token_kind(Token::Kind::Less); break;
+        case '=': push_token_kind(next_char_is('=') ? Token::Kind::Equals : Token::Kind::Assign); break;
+        case '>': push_token_kind(next_char_is('=') ? Token::Kind::GreatOrEqual : Token::Kind::Great); break;
+        case '<': push_token_kind(next_char_is('=') ? Token::Kind::LessOrEqual : Token::Kind::Less); break;
         case '\'': {
           const auto chr = next_char();
           if (next_char() != '\'') {
@@ -91,17 +107,29 @@ public:
     return *m_tokens.back();
   }
 
+  // line of the last character read, starting at 1
+  uint32_t line() const { return m_line; }
+
 private:
   std::istream& m_in;
   Tokens& m_tokens;
   std::string m_buffer;
   char m_last_char = 0;
+  uint32_t m_line = 1;
 
   inline char next_char() {
+    if (m_last_char == '\n') ++m_line;
     m_last_char = m_in.get() ;
     return m_last_char;
   }
 
+  // consumes the next character if it is chr, for two character tokens
+  inline bool next_char_is(char chr) {
+    if (m_in.peek() != chr) return false;
+    next_char();
+    return true;
+  }
+
   inline char last_char() {
     return m_last_char;
   }
@@ -110,9 +138,16 @@ private:
     m_tokens.emplace_back(std::make_unique<Token>(kind));
   }
 
+  // white space and line comments
   void omit_white_spaces() {
-    while (::isspace(last_char())) {
-      next_char();
+    for (;;) {
+      while (::isspace(last_char())) {
+        next_char();
+      }
+      if (last_char() != '/' || m_in.peek() != '/') return;
+      while (last_char() != '\n' && last_char() != EOF) {
+        next_char();
+      }
     }
   }
 };
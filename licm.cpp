@@ -0,0 +1,132 @@
+#include "licm.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+LicmStats Licm::run() {
+  LicmStats stats;
+  if (m_function.blocks.empty()) return stats;
+
+  DominatorTree tree(m_function);
+  LoopInfo loop_info(m_function, tree);
+  for (const auto& loop : loop_info.loops()) {
+    if (loop.preheader == UndefinedIrBlockIndex) continue;
+    ++stats.loops;
+    stats.hoisted += hoist(loop);
+    stats.strength_reduced += strength_reduce(loop);
+  }
+  return stats;
+}
+
+uint32_t Licm::hoist(const Loop& loop) {
+  uint32_t hoisted = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block : loop.blocks) {
+      // copy, the block shrinks while hoisting
+      const auto block_instrs = m_function.blocks[block].instrs;
+      for (auto index : block_instrs) {
+        if (!can_hoist(loop, m_function.instrs[index])) continue;
+        move_to_preheader(loop, index);
+        ++hoisted;
+        changed = true;
+      }
+    }
+  }
+  return hoisted;
+}
+
+uint32_t Licm::strength_reduce(const Loop& loop) {
+  if (loop.latches.size() != 1) return 0;
+  const auto header = loop.header;
+  const auto latch = loop.latches[0];
+  const auto& preds = m_function.blocks[header].preds;
+  const uint32_t preheader_position = std::find(preds.begin(), preds.end(), loop.preheader) - preds.begin();
+  const uint32_t latch_position = std::find(preds.begin(), preds.end(), latch) - preds.begin();
+
+  struct Candidate {
+    IrValueIndex mul;
+    IrValueIndex phi;
+    IrValueIndex factor;
+  };
+  std::vector<Candidate> candidates;
+  for (auto block : loop.blocks) {
+    for (auto index : m_function.blocks[block].instrs) {
+      const auto& instr = m_function.instrs[index];
+      if (instr.kind != IrInstr::Kind::Mul || ir_is_float(instr.type) || ir_is_vector(instr.type)) continue;
+      for (uint32_t i = 0; i < 2; ++i) {
+        const auto phi = instr.operands[i];
+        const auto factor = instr.operands[1 - i];
+        const auto& phi_instr = m_function.instrs[phi];
+        if (phi_instr.kind != IrInstr::Kind::Phi || phi_instr.block != header) continue;
+        if (phi_instr.type != instr.type || !is_invariant(loop, factor)) continue;
+
+        // basic induction variable: i = phi(init, i + c) or phi(init, i - c)
+        const auto& next = m_function.instrs[phi_instr.operands[latch_position]];
+        if (next.kind != IrInstr::Kind::Add && next.kind != IrInstr::Kind::Sub) continue;
+        const bool step_right = next.operands[0] == phi && m_function.instrs[next.operands[1]].kind == IrInstr::Kind::Const;
+        const bool step_left = next.kind == IrInstr::Kind::Add && next.operands[1] == phi
+          && m_function.instrs[next.operands[0]].kind == IrInstr::Kind::Const;
+        if (!step_right && !step_left) continue;
+
+        candidates.push_back(Candidate{index, phi, factor});
+        break;
+      }
+    }
+  }
+
+  std::vector<IrValueIndex> map(m_function.instrs.size(), UndefinedIrValueIndex);
+  for (const auto& candidate : candidates) {
+    const auto type = m_function.instrs[candidate.mul].type;
+    const auto next = m_function.instrs[candidate.phi].operands[latch_position];
+    const auto next_kind = m_function.instrs[next].kind;
+    const auto& next_operands = m_function.instrs[next].operands;
+    const auto step = next_operands[0] == candidate.phi ? next_operands[1] : next_operands[0];
+    const auto init = m_function.instrs[candidate.phi].operands[preheader_position];
+
+    const auto scaled_init = insert_before_terminator(loop.preheader, IrInstr::Kind::Mul, type, init, candidate.factor);
+    const auto scaled_step = insert_before_terminator(loop.preheader, IrInstr::Kind::Mul, type, step, candidate.factor);
+    const auto phi = m_function.create_phi(header, type);
+    const auto scaled_next = insert_before_terminator(latch, next_kind, type, phi, scaled_step);
+    auto& operands = m_function.instrs[phi].operands;
+    operands.assign(m_function.blocks[header].preds.size(), scaled_init);
+    operands[latch_position] = scaled_next;
+
+    auto& block_instrs = m_function.blocks[m_function.instrs[candidate.mul].block].instrs;
+    block_instrs.erase(std::find(block_instrs.begin(), block_instrs.end(), candidate.mul));
+    m_function.instrs[candidate.mul].kind = IrInstr::Kind::None;
+    m_function.instrs[candidate.mul].operands.clear();
+    map[candidate.mul] = phi;
+  }
+  if (!candidates.empty()) m_function.replace_uses(map);
+  return candidates.size();
+}
+
+bool Licm::is_invariant(const Loop& loop, IrValueIndex value) const {
+  return !loop.contains(m_function.instrs[value].block);
+}
+
+bool Licm::can_hoist(const Loop& loop, const IrInstr& instr) const {
+  if (!instr.is_pure()) return false;
+  for (auto operand : instr.operands) {
+    if (!is_invariant(loop, operand)) return false;
+  }
+  // a division might be guarded by a check of its divisor inside the loop
+  return !m_function.may_trap(instr);
+}
+
+void Licm::move_to_preheader(const Loop& loop, IrValueIndex value) {
+  auto& from = m_function.blocks[m_function.instrs[value].block].instrs;
+  from.erase(std::find(from.begin(), from.end(), value));
+  auto& to = m_function.blocks[loop.preheader].instrs;
+  to.insert(to.end() - 1, value);
+  m_function.instrs[value].block = loop.preheader;
+}
+
+IrValueIndex Licm::insert_before_terminator(IrBlockIndex block, IrInstr::Kind kind, IrType type,
+    IrValueIndex left, IrValueIndex right) {
+  const auto value = m_function.create_binary(block, kind, type, left, right);
+  auto& block_instrs = m_function.blocks[block].instrs;
+  std::swap(block_instrs[block_instrs.size() - 1], block_instrs[block_instrs.size() - 2]);
+  return value;
+}
@@ -0,0 +1,43 @@
+#ifndef LICM_HPP
+#define LICM_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+struct Loop;
+
+struct LicmStats {
+  uint32_t loops = 0;
+  uint32_t hoisted = 0;
+  uint32_t strength_reduced = 0;
+};
+
+// Loop-invariant code motion and induction variable strength reduction.
+// Pure instructions whose operands are defined outside a loop move to its
+// preheader, inner loops first so that values can travel through the whole
+// nest. A multiplication of a basic induction variable i = phi(init, i +- c)
+// by an invariant k becomes a new induction variable stepping by c * k.
+class Licm {
+public:
+  Licm(IrFunction& function) : m_function(function) {}
+  Licm(const Licm&) = delete;
+  Licm(Licm&&) = delete;
+  Licm& operator=(const Licm&) = delete;
+  Licm& operator=(Licm&&) = delete;
+
+  LicmStats run();
+
+private:
+  IrFunction& m_function;
+
+  uint32_t hoist(const Loop& loop);
+  uint32_t strength_reduce(const Loop& loop);
+  bool is_invariant(const Loop& loop, IrValueIndex value) const;
+  bool can_hoist(const Loop& loop, const IrInstr& instr) const;
+  void move_to_preheader(const Loop& loop, IrValueIndex value);
+  IrValueIndex insert_before_terminator(IrBlockIndex block, IrInstr::Kind kind, IrType type,
+    IrValueIndex left, IrValueIndex right);
+};
+
+#endif  // LICM_HPP
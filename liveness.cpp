@@ -0,0 +1,148 @@
+#include "liveness.hpp"
+#include "bit_set.hpp"
+#include <algorithm>
+#include <iterator>
+
+Liveness::Liveness(const IrFunction& function, const DominatorTree& tree, uint64_t dense_limit)
+    : m_function(function), m_tree(tree) {
+  number_values();
+  const auto local = compute_local_sets();
+  m_words = bits_words(m_values.size());
+  // in, out and the three local sets
+  const uint64_t dense_bytes = uint64_t(5) * m_function.blocks.size() * m_words * sizeof(uint64_t);
+  m_stats.values = m_values.size();
+  m_stats.sparse = dense_bytes > dense_limit;
+  if (m_stats.sparse) {
+    solve_sparse(local);
+  } else {
+    solve_dense(local);
+  }
+}
+
+void Liveness::number_values() {
+  m_ids.assign(m_function.instrs.size(), UndefinedIrValueIndex);
+  for (auto block : m_tree.reverse_post_order()) {
+    for (auto index : m_function.blocks[block].instrs) {
+      if (m_function.instrs[index].type == IrType::Void) continue;
+      m_ids[index] = m_values.size();
+      m_values.emplace_back(index);
+    }
+  }
+}
+
+Liveness::LocalSets Liveness::compute_local_sets() const {
+  const auto block_count = m_function.blocks.size();
+  LocalSets local;
+  local.gen.resize(block_count);
+  local.kill.resize(block_count);
+  local.phi_uses.resize(block_count);
+  for (auto block : m_tree.reverse_post_order()) {
+    for (auto index : m_function.blocks[block].instrs) {
+      const auto& instr = m_function.instrs[index];
+      if (m_ids[index] != UndefinedIrValueIndex) local.kill[block].emplace_back(m_ids[index]);
+      if (instr.kind == IrInstr::Kind::Phi) {
+        const auto& preds = m_function.blocks[block].preds;
+        for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+          const auto id = m_ids[instr.operands[i]];
+          if (id != UndefinedIrValueIndex && m_tree.is_reachable(preds[i])) local.phi_uses[preds[i]].emplace_back(id);
+        }
+        continue;
+      }
+      // in SSA form an operand from the same block is defined above its use
+      for (auto operand : instr.operands) {
+        const auto id = m_ids[operand];
+        if (id != UndefinedIrValueIndex && m_function.instrs[operand].block != block) local.gen[block].emplace_back(id);
+      }
+    }
+  }
+  for (uint32_t block = 0; block < block_count; ++block) {
+    for (auto* set : {&local.gen[block], &local.kill[block], &local.phi_uses[block]}) {
+      std::sort(set->begin(), set->end());
+      set->erase(std::unique(set->begin(), set->end()), set->end());
+    }
+  }
+  return local;
+}
+
+void Liveness::solve_dense(const LocalSets& local) {
+  const auto block_count = m_function.blocks.size();
+  const auto row = [this](std::vector<uint64_t>& matrix, uint32_t block) { return matrix.data() + block * m_words; };
+  std::vector<uint64_t> gen(block_count * m_words, 0);
+  std::vector<uint64_t> kill(block_count * m_words, 0);
+  std::vector<uint64_t> phi_uses(block_count * m_words, 0);
+  for (uint32_t block = 0; block < block_count; ++block) {
+    for (auto id : local.gen[block]) bits_set(row(gen, block), id);
+    for (auto id : local.kill[block]) bits_set(row(kill, block), id);
+    for (auto id : local.phi_uses[block]) bits_set(row(phi_uses, block), id);
+  }
+  m_in.assign(block_count * m_words, 0);
+  m_out.assign(block_count * m_words, 0);
+
+  const auto& rpo = m_tree.reverse_post_order();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ++m_stats.iterations;
+    for (auto it = rpo.rbegin(); it != rpo.rend(); ++it) {
+      const auto block = *it;
+      auto* out = row(m_out, block);
+      std::copy(row(phi_uses, block), row(phi_uses, block) + m_words, out);
+      for (auto succ : m_function.blocks[block].succs) bits_or(out, row(m_in, succ), m_words);
+      if (bits_transfer(row(m_in, block), row(gen, block), out, row(kill, block), m_words)) changed = true;
+    }
+  }
+}
+
+void Liveness::solve_sparse(const LocalSets& local) {
+  const auto block_count = m_function.blocks.size();
+  m_sparse_in.assign(block_count, {});
+  m_sparse_out.assign(block_count, {});
+
+  const auto& rpo = m_tree.reverse_post_order();
+  SparseSet merged;
+  SparseSet live;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ++m_stats.iterations;
+    for (auto it = rpo.rbegin(); it != rpo.rend(); ++it) {
+      const auto block = *it;
+      auto& out = m_sparse_out[block];
+      out = local.phi_uses[block];
+      for (auto succ : m_function.blocks[block].succs) {
+        const auto& in = m_sparse_in[succ];
+        merged.clear();
+        std::set_union(out.begin(), out.end(), in.begin(), in.end(), std::back_inserter(merged));
+        out.swap(merged);
+      }
+      live.clear();
+      std::set_difference(out.begin(), out.end(), local.kill[block].begin(), local.kill[block].end(), std::back_inserter(live));
+      merged.clear();
+      std::set_union(live.begin(), live.end(), local.gen[block].begin(), local.gen[block].end(), std::back_inserter(merged));
+      if (merged != m_sparse_in[block]) {
+        m_sparse_in[block].swap(merged);
+        changed = true;
+      }
+    }
+  }
+}
+
+bool Liveness::contains(const std::vector<uint64_t>& dense, const std::vector<SparseSet>& sparse,
+    IrBlockIndex block, IrValueIndex value) const {
+  const auto id = m_ids[value];
+  if (id == UndefinedIrValueIndex || !m_tree.is_reachable(block)) return false;
+  if (m_stats.sparse) return std::binary_search(sparse[block].begin(), sparse[block].end(), id);
+  return bits_test(dense.data() + block * m_words, id);
+}
+
+std::vector<IrValueIndex> Liveness::values(const std::vector<uint64_t>& dense, const std::vector<SparseSet>& sparse,
+    IrBlockIndex block) const {
+  std::vector<IrValueIndex> result;
+  if (m_stats.sparse) {
+    for (auto id : sparse[block]) result.emplace_back(m_values[id]);
+  } else {
+    bits_for_each(dense.data() + block * m_words, m_words, [&](uint32_t id) { result.emplace_back(m_values[id]); });
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
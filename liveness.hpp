@@ -0,0 +1,73 @@
+#ifndef LIVENESS_HPP
+#define LIVENESS_HPP
+
+#include "dominators.hpp"
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+struct LivenessStats {
+  uint32_t values = 0;
+  uint32_t iterations = 0;
+  bool sparse = false;
+};
+
+// Live-in and live-out sets of every reachable block over the SSA values of
+// an IrFunction. A phi operand is live-out of the predecessor it flows from,
+// not live-in of the phi's block, and phi results are defined at the top of
+// their block, so they are never live-in. The backward problem is solved by
+// visiting blocks in post-order until nothing changes, with dense bit sets
+// (see bit_set.hpp) per block; functions whose sets would take more than
+// dense_limit bytes use sorted value lists instead.
+class Liveness {
+public:
+  static const uint64_t DefaultDenseLimit = uint64_t(64) << 20;
+
+  Liveness(const IrFunction& function, const DominatorTree& tree, uint64_t dense_limit = DefaultDenseLimit);
+  Liveness(const Liveness&) = delete;
+  Liveness(Liveness&&) = delete;
+  Liveness& operator=(const Liveness&) = delete;
+  Liveness& operator=(Liveness&&) = delete;
+
+  bool is_live_in(IrBlockIndex block, IrValueIndex value) const { return contains(m_in, m_sparse_in, block, value); }
+  bool is_live_out(IrBlockIndex block, IrValueIndex value) const { return contains(m_out, m_sparse_out, block, value); }
+  // values in increasing order
+  std::vector<IrValueIndex> live_in(IrBlockIndex block) const { return values(m_in, m_sparse_in, block); }
+  std::vector<IrValueIndex> live_out(IrBlockIndex block) const { return values(m_out, m_sparse_out, block); }
+  const LivenessStats& stats() const { return m_stats; }
+
+private:
+  using SparseSet = std::vector<uint32_t>;
+
+  // upward exposed uses, definitions and phi operands flowing out of a block
+  struct LocalSets {
+    std::vector<SparseSet> gen;
+    std::vector<SparseSet> kill;
+    std::vector<SparseSet> phi_uses;
+  };
+
+  const IrFunction& m_function;
+  const DominatorTree& m_tree;
+  LivenessStats m_stats;
+  // dense numbering of the instructions that produce a value
+  std::vector<uint32_t> m_ids;
+  std::vector<IrValueIndex> m_values;
+  // dense: one row of m_words words per block
+  uint32_t m_words = 0;
+  std::vector<uint64_t> m_in;
+  std::vector<uint64_t> m_out;
+  std::vector<SparseSet> m_sparse_in;
+  std::vector<SparseSet> m_sparse_out;
+
+  void number_values();
+  LocalSets compute_local_sets() const;
+  void solve_dense(const LocalSets& local);
+  void solve_sparse(const LocalSets& local);
+
+  bool contains(const std::vector<uint64_t>& dense, const std::vector<SparseSet>& sparse,
+      IrBlockIndex block, IrValueIndex value) const;
+  std::vector<IrValueIndex> values(const std::vector<uint64_t>& dense, const std::vector<SparseSet>& sparse,
+      IrBlockIndex block) const;
+};
+
+#endif  // LIVENESS_HPP
@@ -0,0 +1,66 @@
+#include "loops.hpp"
+#include "dominators.hpp"
+
+LoopInfo::LoopInfo(const IrFunction& function, const DominatorTree& tree) {
+  const auto block_count = function.blocks.size();
+  m_loop_of.assign(block_count, UndefinedLoopIndex);
+
+  for (auto header : tree.reverse_post_order()) {
+    Loop loop;
+    for (auto pred : function.blocks[header].preds) {
+      if (tree.is_reachable(pred) && tree.dominates(header, pred)) loop.latches.emplace_back(pred);
+    }
+    if (loop.latches.empty()) continue;
+
+    loop.header = header;
+    loop.body.assign(block_count, false);
+    loop.body[header] = true;
+    std::vector<IrBlockIndex> stack;
+    for (auto latch : loop.latches) {
+      if (loop.body[latch]) continue;
+      loop.body[latch] = true;
+      stack.emplace_back(latch);
+    }
+    while (!stack.empty()) {
+      const auto block = stack.back();
+      stack.pop_back();
+      for (auto pred : function.blocks[block].preds) {
+        if (loop.body[pred] || !tree.is_reachable(pred)) continue;
+        loop.body[pred] = true;
+        stack.emplace_back(pred);
+      }
+    }
+    for (auto block : tree.reverse_post_order()) {
+      if (loop.body[block]) loop.blocks.emplace_back(block);
+    }
+
+    IrBlockIndex outside = UndefinedIrBlockIndex;
+    uint32_t outside_count = 0;
+    for (auto pred : function.blocks[header].preds) {
+      if (loop.body[pred]) continue;
+      outside = pred;
+      ++outside_count;
+    }
+    if (outside_count == 1 && function.blocks[outside].succs.size() == 1) loop.preheader = outside;
+    m_loops.emplace_back(std::move(loop));
+  }
+
+  std::stable_sort(m_loops.begin(), m_loops.end(),
+    [](const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+
+  for (LoopIndex index = 0; index < m_loops.size(); ++index) {
+    for (auto block : m_loops[index].blocks) {
+      if (m_loop_of[block] == UndefinedLoopIndex) m_loop_of[block] = index;
+    }
+    for (LoopIndex outer = index + 1; outer < m_loops.size(); ++outer) {
+      if (m_loops[outer].contains(m_loops[index].header)) {
+        m_loops[index].parent = outer;
+        break;
+      }
+    }
+  }
+  for (LoopIndex index = m_loops.size(); index-- > 0;) {
+    auto& loop = m_loops[index];
+    if (loop.parent != UndefinedLoopIndex) loop.depth = m_loops[loop.parent].depth + 1;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef LOOPS_HPP
+#define LOOPS_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class DominatorTree;
+
+using LoopIndex = std::uint32_t;
+static const LoopIndex UndefinedLoopIndex = std::numeric_limits<LoopIndex>::max();
+
+struct Loop {
+  IrBlockIndex header = UndefinedIrBlockIndex;
+  // the only predecessor from outside the loop, if it jumps unconditionally
+  // to the header; code hoisted out of the loop goes there
+  IrBlockIndex preheader = UndefinedIrBlockIndex;
+  std::vector<IrBlockIndex> latches;
+  // in reverse post-order, the header first
+  std::vector<IrBlockIndex> blocks;
+  // body[block] is true for blocks of this loop, nested loops included
+  std::vector<bool> body;
+  LoopIndex parent = UndefinedLoopIndex;
+  uint32_t depth = 1;
+
+  bool contains(IrBlockIndex block) const { return body[block]; }
+};
+
+// Natural loops of an IrFunction, found from the back edges of the dominator
+// tree. Loops sharing a header are merged; inner loops come first.
+class LoopInfo {
+public:
+  LoopInfo(const IrFunction& function, const DominatorTree& tree);
+  LoopInfo(const LoopInfo&) = delete;
+  LoopInfo(LoopInfo&&) = delete;
+  LoopInfo& operator=(const LoopInfo&) = delete;
+  LoopInfo& operator=(LoopInfo&&) = delete;
+
+  const std::vector<Loop>& loops() const { return m_loops; }
+  // innermost loop containing the block
+  LoopIndex loop_of(IrBlockIndex block) const { return m_loop_of[block]; }
+
+private:
+  std::vector<Loop> m_loops;
+  std::vector<LoopIndex> m_loop_of;
+};
+
+#endif  // LOOPS_HPP
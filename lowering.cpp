@@ -0,0 +1,617 @@
+#include "lowering.hpp"
+#include "ast_types.hpp"
+#include "region.hpp"
+
+void Lowering::lower_module(AstNodeIndex global_scope) {
+  const auto* dict = m_ast[global_scope].scope.dict;
+  if (!dict) return;
+
+  // declare everything first so that calls can refer to any function
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) {
+      declare_function(node_idx);
+    }
+  }
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) {
+      lower_function(node_idx);
+    }
+  }
+}
+
+IrFunction& Lowering::lower_function(AstNodeIndex function) {
+  const auto& function_node = m_ast[function];
+  m_function_index = declare_function(function);
+  m_function = &m_module.functions[m_function_index];
+  m_defs.clear();
+  m_sealed.clear();
+  m_incomplete_phis.clear();
+  m_slots.clear();
+  m_slices.clear();
+  m_regions = 0;
+  m_branch_sites = 0;
+  m_loop_sites = 0;
+  m_function_profile = nullptr;
+  if (m_profile && m_function->name != UndefinedIdIndex) {
+    m_function_profile = m_profile->find(m_id_cache->get(m_function->name));
+  }
+  m_function->profiled = m_function_profile != nullptr;
+
+  m_block = create_block();
+  seal_block(m_block);
+  if (m_function_profile) m_function->blocks[m_block].weight = m_function_profile->calls;
+
+  const auto& fun_type = m_ast[function_node.function.function_type_with_named_params].fun_type_with_named_params;
+  if (fun_type.names && function_node.function.scope.dict) {
+    for (uint32_t i = 0; i < fun_type.names->size(); ++i) {
+      const auto variable = function_node.function.scope.dict->find((*fun_type.names)[i]);
+      if (variable == UndefinedAstNodeIndex) continue;
+
+      auto create_param = [this](IrType type) {
+        const auto param = m_function->create(m_block, IrInstr::Kind::Param, type);
+        m_function->instrs[param].index = m_function->params.size();
+        m_function->params.emplace_back(param);
+        return param;
+      };
+      if (m_ast[m_ast[variable].local_variable.value.type].kind == AstNode::Kind::SliceType) {
+        const auto pointer = create_param(IrType::Ptr);
+        m_slices[variable] = {pointer, create_param(IrType::I32)};
+        continue;
+      }
+      write_variable(variable, m_block, create_param(variable_type(variable)));
+    }
+  }
+
+  if (function_node.function.block_stmt != UndefinedAstNodeIndex) {
+    lower_stmt(function_node.function.block_stmt);
+  }
+
+  if (m_function->terminator(m_block) == UndefinedIrValueIndex) {
+    const bool unreachable = m_block != 0 && m_function->blocks[m_block].preds.empty();
+    if (m_function->return_type == IrType::Void || unreachable) {
+      m_function->create_return(m_block);
+    } else {
+      m_function->create_return(m_block, create_undefined(m_function->return_type));
+    }
+  }
+
+  remove_unreachable_blocks();
+  m_function->remove_trivial_phis();
+  return *m_function;
+}
+
+IrType Lowering::to_ir_type(AstNode::Kind type_kind) {
+  switch (type_kind) {
+    case AstNode::Kind::I8Type: return IrType::I8;
+    case AstNode::Kind::I16Type: return IrType::I16;
+    case AstNode::Kind::I32Type: return IrType::I32;
+    case AstNode::Kind::U8Type: return IrType::U8;
+    case AstNode::Kind::U16Type: return IrType::U16;
+    case AstNode::Kind::U32Type: return IrType::U32;
+    case AstNode::Kind::F32Type: return IrType::F32;
+    case AstNode::Kind::F64Type: return IrType::F64;
+    case AstNode::Kind::F32x4Type: return IrType::F32x4;
+    case AstNode::Kind::F32x8Type: return IrType::F32x8;
+    case AstNode::Kind::I32x4Type: return IrType::I32x4;
+    default: return IrType::Void;
+  }
+}
+
+// functions without blocks are declarations until they are lowered
+uint32_t Lowering::declare_function(AstNodeIndex function) {
+  const auto it = m_function_indices.find(function);
+  if (it != m_function_indices.end()) return it->second;
+
+  const uint32_t index = m_module.functions.size();
+  m_function_indices.emplace(function, index);
+  m_module.functions.emplace_back();
+  auto& ir_function = m_module.functions.back();
+  const auto& function_node = m_ast[function].function;
+  ir_function.name = function_node.scope.name;
+  const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params;
+  if (fun_type.fun_type.return_type != UndefinedAstNodeIndex) {
+    ir_function.return_type = to_ir_type(m_ast[fun_type.fun_type.return_type].kind);
+  }
+  // the vector may have moved the function being lowered
+  if (m_function) m_function = &m_module.functions[m_function_index];
+  return index;
+}
+
+// entry(args) loads the parameters of the function from args and returns
+// what it returns, 0 for nothing
+uint32_t Lowering::declare_spawn_entry(AstNodeIndex function) {
+  const auto callee = declare_function(function);
+  const auto it = m_spawn_entries.find(callee);
+  if (it != m_spawn_entries.end()) return it->second;
+
+  IrFunction entry;
+  entry.return_type = IrType::I32;
+  const auto block = entry.create_block();
+  const auto args = entry.create(block, IrInstr::Kind::Param, IrType::Ptr);
+  entry.params.emplace_back(args);
+  const auto& fun_type =
+    m_ast[m_ast[function].function.function_type_with_named_params].fun_type_with_named_params.fun_type;
+  std::vector<IrValueIndex> operands;
+  for (uint32_t i = 0; fun_type.param_types && i < fun_type.param_types->size(); ++i) {
+    const auto address = entry.create_unary(block, IrInstr::Kind::FieldAddr, IrType::Ptr, args);
+    entry.instrs[address].index = 8 * i;
+    const auto type = to_ir_type(m_ast[(*fun_type.param_types)[i]].kind);
+    operands.emplace_back(entry.create_unary(block, IrInstr::Kind::Load, type, address));
+  }
+  const auto return_type = m_module.functions[callee].return_type;
+  auto result = entry.create(block, IrInstr::Kind::Call, return_type);
+  entry.instrs[result].operands = std::move(operands);
+  entry.instrs[result].index = callee;
+  if (return_type == IrType::Void) result = entry.create_const(block, IrConst::make_zero(IrType::I32));
+  entry.create_return(block, result);
+
+  const uint32_t index = m_module.functions.size();
+  m_spawn_entries.emplace(callee, index);
+  m_module.functions.emplace_back(std::move(entry));
+  if (m_function) m_function = &m_module.functions[m_function_index];
+  return index;
+}
+
+IrBlockIndex Lowering::create_block() {
+  const auto block = m_function->create_block();
+  m_defs.emplace_back();
+  m_sealed.emplace_back(false);
+  m_incomplete_phis.emplace_back();
+  return block;
+}
+
+void Lowering::seal_block(IrBlockIndex block) {
+  for (auto& [variable, phi] : m_incomplete_phis[block]) {
+    add_phi_operands(variable, phi);
+  }
+  m_incomplete_phis[block].clear();
+  m_sealed[block] = true;
+}
+
+void Lowering::write_variable(AstNodeIndex variable, IrBlockIndex block, IrValueIndex value) {
+  m_defs[block][variable] = value;
+}
+
+IrValueIndex Lowering::read_variable(AstNodeIndex variable, IrBlockIndex block) {
+  const auto it = m_defs[block].find(variable);
+  if (it != m_defs[block].end()) return it->second;
+  return read_variable_recursive(variable, block);
+}
+
+IrValueIndex Lowering::read_variable_recursive(AstNodeIndex variable, IrBlockIndex block) {
+  IrValueIndex value = UndefinedIrValueIndex;
+  const auto& preds = m_function->blocks[block].preds;
+
+  if (!m_sealed[block]) {
+    value = m_function->create_phi(block, variable_type(variable));
+    m_incomplete_phis[block].emplace_back(variable, value);
+  } else if (preds.size() == 1) {
+    value = read_variable(variable, preds[0]);
+  } else if (preds.empty()) {
+    value = create_undefined(variable_type(variable));
+  } else {
+    // break potential cycles with an operandless phi
+    value = m_function->create_phi(block, variable_type(variable));
+    write_variable(variable, block, value);
+    value = add_phi_operands(variable, value);
+  }
+  write_variable(variable, block, value);
+  return value;
+}
+
+IrValueIndex Lowering::add_phi_operands(AstNodeIndex variable, IrValueIndex phi) {
+  const auto preds = m_function->blocks[m_function->instrs[phi].block].preds;
+  std::vector<IrValueIndex> operands;
+  operands.reserve(preds.size());
+  for (auto pred : preds) {
+    operands.emplace_back(read_variable(variable, pred));
+  }
+  m_function->instrs[phi].operands = std::move(operands);
+  return phi;
+}
+
+// reads of variables without any definition yield zero, the constant lives in
+// front of the entry block so that it dominates every use
+IrValueIndex Lowering::create_undefined(IrType type) {
+  const auto value = create_in_entry(IrInstr::Kind::Const, type);
+  m_function->instrs[value].constant = IrConst::make_zero(type);
+  return value;
+}
+
+IrValueIndex Lowering::create_runtime_call(IrRuntimeFunction function, IrType type,
+                                          std::vector<IrValueIndex> operands) {
+  const auto call = m_function->create(m_block, IrInstr::Kind::RuntimeCall, type);
+  m_function->instrs[call].operands = std::move(operands);
+  m_function->instrs[call].index = static_cast<uint32_t>(function);
+  return call;
+}
+
+IrValueIndex Lowering::create_in_entry(IrInstr::Kind kind, IrType type) {
+  const auto value = m_function->create(0, kind, type);
+  auto& entry = m_function->blocks[0].instrs;
+  entry.pop_back();
+  entry.insert(entry.begin(), value);
+  return value;
+}
+
+IrType Lowering::variable_type(AstNodeIndex variable) const {
+  const auto& node = m_ast[variable];
+  return to_ir_type(m_ast[node.local_variable.value.type].kind);
+}
+
+bool Lowering::is_struct_type(AstNodeIndex type) const {
+  return m_ast[type].kind == AstNode::Kind::StructType;
+}
+
+uint32_t Lowering::type_size(AstNodeIndex type) const {
+  if (m_ast[type].kind == AstNode::Kind::ArrayType) {
+    return m_ast[type].array_type.length * type_size(m_ast[type].array_type.element);
+  }
+  if (!is_struct_type(type)) return ir_type_size(to_ir_type(m_ast[type].kind));
+
+  const auto* dict = m_ast[m_ast[type].struct_type.struct_scope].scope.dict;
+  uint32_t size = 0;
+  if (dict) {
+    for (auto field : dict->get_nodes()) {
+      const auto& field_node = m_ast[field].struct_field;
+      size = std::max(size, field_node.offset + type_size(field_node.value.type));
+    }
+  }
+  return size;
+}
+
+void Lowering::lower_stmt(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt];
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (node.block_stmt.stmts) {
+        for (auto child : *node.block_stmt.stmts) lower_stmt(child);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      const auto type = m_ast[variable].local_variable.value.type;
+      if (is_struct_type(type) || m_ast[type].kind == AstNode::Kind::ArrayType) {
+        const auto slot = create_in_entry(IrInstr::Kind::StackSlot, IrType::Ptr);
+        m_function->instrs[slot].index = type_size(type);
+        m_slots[variable] = slot;
+        break;
+      }
+      if (m_ast[type].kind == AstNode::Kind::SliceType) {
+        m_slices[variable] = lower_slice(node.variable_decl_stmt.init_expr);
+        break;
+      }
+      const auto value = node.variable_decl_stmt.init_expr != UndefinedAstNodeIndex
+        ? lower_expr(node.variable_decl_stmt.init_expr)
+        : create_undefined(variable_type(variable));
+      write_variable(variable, m_block, value);
+      break;
+    }
+    case AstNode::Kind::ExprStmt:
+      lower_expr(node.expr_stmt.expr);
+      break;
+    case AstNode::Kind::ReturnStmt: {
+      // the value may read what the regions being left allocated
+      const auto value = node.return_stmt.expr != UndefinedAstNodeIndex ? lower_expr(node.return_stmt.expr)
+                                                                          : UndefinedIrValueIndex;
+      for (uint32_t region = 0; region < m_regions; ++region) {
+        create_runtime_call(IrRuntimeFunction::RegionLeave, IrType::Void, {});
+      }
+      if (value != UndefinedIrValueIndex) {
+        m_function->create_return(m_block, value);
+      } else {
+        m_function->create_return(m_block);
+      }
+      // anything after a return is unreachable and removed at the end
+      m_block = create_block();
+      seal_block(m_block);
+      break;
+    }
+    case AstNode::Kind::RegionStmt:
+      create_runtime_call(IrRuntimeFunction::RegionEnter, IrType::Void, {});
+      ++m_regions;
+      lower_stmt(node.region_stmt.stmt);
+      --m_regions;
+      create_runtime_call(IrRuntimeFunction::RegionLeave, IrType::Void, {});
+      break;
+    case AstNode::Kind::IfElseStmt: {
+      const auto site = m_branch_sites++;
+      BranchProfile branch;
+      if (m_function_profile && site < m_function_profile->branches.size()) {
+        branch = m_function_profile->branches[site];
+      }
+      const auto cond = lower_expr(node.if_else_stmt.expr);
+      const auto then_block = create_block();
+      const auto join_block = create_block();
+      auto else_block = join_block;
+      if (node.if_else_stmt.else_stmt != UndefinedAstNodeIndex) {
+        else_block = create_block();
+      }
+      m_function->create_branch(m_block, cond, then_block, else_block);
+
+      seal_block(then_block);
+      m_block = then_block;
+      m_function->blocks[then_block].weight = branch.taken;
+      lower_stmt(node.if_else_stmt.stmt);
+      m_function->create_jump(m_block, join_block);
+      // what reaches the join, a return on the way leaves a block weighing 0
+      uint64_t join_weight = m_function->blocks[m_block].weight;
+
+      if (else_block != join_block) {
+        seal_block(else_block);
+        m_block = else_block;
+        m_function->blocks[else_block].weight = branch.runs - std::min(branch.taken, branch.runs);
+        lower_stmt(node.if_else_stmt.else_stmt);
+        m_function->create_jump(m_block, join_block);
+        join_weight += m_function->blocks[m_block].weight;
+      } else {
+        join_weight += branch.runs - std::min(branch.taken, branch.runs);
+      }
+      m_function->blocks[join_block].weight = join_weight;
+      seal_block(join_block);
+      m_block = join_block;
+      break;
+    }
+    case AstNode::Kind::WhileStmt: {
+      const auto site = m_loop_sites++;
+      LoopProfile loop;
+      if (m_function_profile && site < m_function_profile->loops.size()) {
+        loop = m_function_profile->loops[site];
+      }
+      const auto header_block = create_block();
+      const auto body_block = create_block();
+      const auto exit_block = create_block();
+      m_function->blocks[header_block].weight = loop.runs + loop.iterations;
+      m_function->blocks[body_block].weight = loop.iterations;
+      m_function->blocks[exit_block].weight = loop.runs;
+      m_function->create_jump(m_block, header_block);
+
+      m_block = header_block;
+      const auto cond = lower_expr(node.while_stmt.expr);
+      m_function->create_branch(m_block, cond, body_block, exit_block);
+      seal_block(body_block);
+      seal_block(exit_block);
+
+      m_block = body_block;
+      lower_stmt(node.while_stmt.stmt);
+      m_function->create_jump(m_block, header_block);
+      seal_block(header_block);
+      m_block = exit_block;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+IrValueIndex Lowering::lower_expr(AstNodeIndex expr) {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::I8, node.i8_literal.literal_value));
+    case AstNode::Kind::I16Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::I16, node.i16_literal.literal_value));
+    case AstNode::Kind::I32Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::I32, node.i32_literal.literal_value));
+    case AstNode::Kind::U8Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::U8, node.u8_literal.literal_value));
+    case AstNode::Kind::U16Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::U16, node.u16_literal.literal_value));
+    case AstNode::Kind::U32Literal:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::U32, node.u32_literal.literal_value));
+    case AstNode::Kind::CharLiteral:
+      return m_function->create_const(m_block, IrConst::make_int(IrType::I8, node.char_literal.chr));
+    case AstNode::Kind::F32Literal:
+      return m_function->create_const(m_block, IrConst::make_float(IrType::F32, node.f32_literal.literal_value));
+    case AstNode::Kind::F64Literal:
+      return m_function->create_const(m_block, IrConst::make_float(IrType::F64, node.f64_literal.literal_value));
+    case AstNode::Kind::LocalVariable: {
+      const auto slot = m_slots.find(expr);
+      if (slot != m_slots.end()) return slot->second;
+      return read_variable(expr, m_block);
+    }
+    case AstNode::Kind::FieldExpr: {
+      const auto address = lower_address(expr);
+      const auto field_type = m_ast[node.field_expr.field].struct_field.value.type;
+      // nested structs are used by address
+      if (is_struct_type(field_type)) return address;
+      return m_function->create_unary(m_block, IrInstr::Kind::Load, to_ir_type(m_ast[field_type].kind), address);
+    }
+    case AstNode::Kind::CallExpr: {
+      std::vector<IrValueIndex> args;
+      const auto& fun_type =
+        m_ast[m_ast[node.call_expr.function].function.function_type_with_named_params].fun_type_with_named_params;
+      if (node.call_expr.args) {
+        for (uint32_t i = 0; i < node.call_expr.args->size(); ++i) {
+          const auto arg = (*node.call_expr.args)[i];
+          if (m_ast[(*fun_type.fun_type.param_types)[i]].kind != AstNode::Kind::SliceType) {
+            args.emplace_back(lower_expr(arg));
+            continue;
+          }
+          const auto [pointer, length] = lower_slice(arg);
+          args.emplace_back(pointer);
+          args.emplace_back(length);
+        }
+      }
+      const auto callee = declare_function(node.call_expr.function);
+      const auto call = m_function->create(m_block, IrInstr::Kind::Call, m_module.functions[callee].return_type);
+      m_function->instrs[call].operands = std::move(args);
+      m_function->instrs[call].index = callee;
+      return call;
+    }
+    case AstNode::Kind::SpawnExpr: {
+      const auto& call = m_ast[node.spawn_expr.expr].call_expr;
+      const uint32_t count = call.args ? call.args->size() : 0;
+      const auto args = create_in_entry(IrInstr::Kind::StackSlot, IrType::Ptr);
+      m_function->instrs[args].index = 8 * std::max(count, 1u);
+      for (uint32_t i = 0; i < count; ++i) {
+        const auto value = lower_expr((*call.args)[i]);
+        const auto address = m_function->create_unary(m_block, IrInstr::Kind::FieldAddr, IrType::Ptr, args);
+        m_function->instrs[address].index = 8 * i;
+        m_function->create_binary(m_block, IrInstr::Kind::Store, IrType::Void, address, value);
+      }
+      const auto entry = m_function->create(m_block, IrInstr::Kind::FunctionAddr, IrType::Ptr);
+      m_function->instrs[entry].index = declare_spawn_entry(call.function);
+      const auto count_value = m_function->create_const(m_block, IrConst::make_int(IrType::I32, count));
+      return create_runtime_call(IrRuntimeFunction::TaskSpawn, IrType::I32, {entry, args, count_value});
+    }
+    case AstNode::Kind::JoinExpr:
+      return create_runtime_call(IrRuntimeFunction::TaskJoin, IrType::I32, {lower_expr(node.join_expr.expr)});
+    case AstNode::Kind::AssignExpr: {
+      const auto value = lower_expr(node.assign_expr.right);
+      const auto& left = m_ast[node.assign_expr.left];
+      if (left.kind == AstNode::Kind::FieldExpr) {
+        const auto address = lower_address(node.assign_expr.left);
+        m_function->create_binary(m_block, IrInstr::Kind::Store, IrType::Void, address, value);
+      } else if (left.kind == AstNode::Kind::IndexExpr) {
+        const auto address = lower_element(node.assign_expr.left);
+        m_function->create_binary(m_block, IrInstr::Kind::Store, IrType::Void, address, value);
+      } else if (left.kind == AstNode::Kind::LaneExpr) {
+        // the vector variable gets a copy with the lane replaced
+        const auto variable = left.lane_expr.expr;
+        const auto vector = read_variable(variable, m_block);
+        const auto insert = m_function->create_binary(m_block, IrInstr::Kind::InsertLane,
+                                                      m_function->instrs[vector].type, vector, value);
+        m_function->instrs[insert].index = left.lane_expr.lane;
+        write_variable(variable, m_block, insert);
+      } else {
+        write_variable(node.assign_expr.left, m_block, value);
+      }
+      return value;
+    }
+    case AstNode::Kind::ParenthExpr:
+      return lower_expr(node.parenth_expr.expr);
+    case AstNode::Kind::NegExpr: {
+      const auto operand = lower_expr(node.neg_expr.expr);
+      const auto type = m_function->instrs[operand].type;
+      return m_function->create_unary(m_block, IrInstr::Kind::Neg, type, operand);
+    }
+    case AstNode::Kind::VectorExpr: {
+      std::vector<IrValueIndex> lanes;
+      for (auto arg : *node.vector_expr.args) lanes.emplace_back(lower_expr(arg));
+      const auto type = to_ir_type(m_ast[node.vector_expr.value.type].kind);
+      auto vector = m_function->create_unary(m_block, IrInstr::Kind::Splat, type, lanes[0]);
+      for (uint32_t lane = 1; lane < lanes.size(); ++lane) {
+        vector = m_function->create_binary(m_block, IrInstr::Kind::InsertLane, type, vector, lanes[lane]);
+        m_function->instrs[vector].index = lane;
+      }
+      return vector;
+    }
+    case AstNode::Kind::LaneExpr: {
+      const auto vector = lower_expr(node.lane_expr.expr);
+      const auto type = ir_element_type(m_function->instrs[vector].type);
+      const auto lane = m_function->create_unary(m_block, IrInstr::Kind::Lane, type, vector);
+      m_function->instrs[lane].index = node.lane_expr.lane;
+      return lane;
+    }
+    case AstNode::Kind::IndexExpr:
+      return m_function->create_unary(m_block, IrInstr::Kind::Load, ast_expr_type(m_ast, expr), lower_element(expr));
+    case AstNode::Kind::LengthExpr:
+      return lower_slice(node.length_expr.expr).second;
+    case AstNode::Kind::NewExpr:
+      return lower_slice(expr).first;
+    case AstNode::Kind::ShuffleExpr: {
+      const auto vector = lower_expr(node.shuffle_expr.expr);
+      const auto shuffle =
+        m_function->create_unary(m_block, IrInstr::Kind::Shuffle, m_function->instrs[vector].type, vector);
+      m_function->instrs[shuffle].index = node.shuffle_expr.lanes;
+      return shuffle;
+    }
+    case AstNode::Kind::AddExpr: return lower_binary(IrInstr::Kind::Add, node.add_expr);
+    case AstNode::Kind::SubExpr: return lower_binary(IrInstr::Kind::Sub, node.sub_expr);
+    case AstNode::Kind::MulExpr: return lower_binary(IrInstr::Kind::Mul, node.mul_expr);
+    case AstNode::Kind::DivExpr: return lower_binary(IrInstr::Kind::Div, node.div_expr);
+    case AstNode::Kind::EqualExpr: return lower_binary(IrInstr::Kind::Equal, node.equal_expr);
+    case AstNode::Kind::GreatExpr: return lower_binary(IrInstr::Kind::Great, node.great_expr);
+    case AstNode::Kind::GreatOrEqualExpr: return lower_binary(IrInstr::Kind::GreatOrEqual, node.great__or_equal_expr);
+    case AstNode::Kind::LessExpr: return lower_binary(IrInstr::Kind::Less, node.less_expr);
+    case AstNode::Kind::LessOrEqualExpr: return lower_binary(IrInstr::Kind::LessOrEqual, node.less_or_equal_expr);
+    default:
+      // strings, globals and aggregates have no IR representation yet
+      return create_undefined(IrType::I32);
+  }
+}
+
+IrValueIndex Lowering::lower_binary(IrInstr::Kind kind, const AstNode::BinaryExpr& expr) {
+  const auto left = lower_expr(expr.left);
+  const auto right = lower_expr(expr.right);
+  // vector compares give a vector of 1 and 0 lanes, not a Bool
+  const auto operand_type = m_function->instrs[left].type;
+  const auto type = IrInstr::is_compare(kind) && !ir_is_vector(operand_type) ? IrType::Bool : operand_type;
+  return m_function->create_binary(m_block, kind, type, left, right);
+}
+
+IrValueIndex Lowering::lower_address(AstNodeIndex expr) {
+  const auto& node = m_ast[expr];
+  if (node.kind != AstNode::Kind::FieldExpr) return lower_expr(expr);
+
+  const auto base = lower_address(node.field_expr.expr);
+  const auto address = m_function->create_unary(m_block, IrInstr::Kind::FieldAddr, IrType::Ptr, base);
+  m_function->instrs[address].index = m_ast[node.field_expr.field].struct_field.offset;
+  return address;
+}
+
+std::pair<IrValueIndex, IrValueIndex> Lowering::lower_slice(AstNodeIndex expr) {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::ParenthExpr:
+      return lower_slice(node.parenth_expr.expr);
+    case AstNode::Kind::LocalVariable: {
+      const auto slice = m_slices.find(expr);
+      if (slice != m_slices.end()) return slice->second;
+      const auto length = m_ast[node.local_variable.value.type].array_type.length;
+      return {m_slots.at(expr), m_function->create_const(m_block, IrConst::make_int(IrType::I32, length))};
+    }
+    case AstNode::Kind::NewExpr: {
+      const auto length = lower_expr(node.new_expr.length);
+      const auto size = type_size(m_ast[node.new_expr.value.type].array_type.element);
+      // 0 <= length and the elements fit a region allocation
+      const auto bound = m_function->create_const(m_block, IrConst::make_int(IrType::I32, RegionMaxBytes / size + 1));
+      m_function->create_binary(m_block, IrInstr::Kind::BoundsCheck, IrType::Void, length, bound);
+      const auto element_size = m_function->create_const(m_block, IrConst::make_int(IrType::I32, size));
+      const auto bytes = m_function->create_binary(m_block, IrInstr::Kind::Mul, IrType::I32, length, element_size);
+      return {create_runtime_call(IrRuntimeFunction::RegionAllocate, IrType::Ptr, {bytes}), length};
+    }
+    default: {
+      const auto [pointer, length] = lower_slice(node.slice_expr.expr);
+      const auto low = lower_expr(node.slice_expr.low);
+      const auto high = lower_expr(node.slice_expr.high);
+      // low <= high <= length, each as a check against one more
+      const auto one = m_function->create_const(m_block, IrConst::make_int(IrType::I32, 1));
+      const auto length_bound = m_function->create_binary(m_block, IrInstr::Kind::Add, IrType::I32, length, one);
+      m_function->create_binary(m_block, IrInstr::Kind::BoundsCheck, IrType::Void, high, length_bound);
+      const auto high_bound = m_function->create_binary(m_block, IrInstr::Kind::Add, IrType::I32, high, one);
+      m_function->create_binary(m_block, IrInstr::Kind::BoundsCheck, IrType::Void, low, high_bound);
+      const auto element = m_ast[node.slice_expr.value.type].array_type.element;
+      const auto address = m_function->create_binary(m_block, IrInstr::Kind::ElementAddr, IrType::Ptr, pointer, low);
+      m_function->instrs[address].index = type_size(element);
+      return {address, m_function->create_binary(m_block, IrInstr::Kind::Sub, IrType::I32, high, low)};
+    }
+  }
+}
+
+IrValueIndex Lowering::lower_element(AstNodeIndex expr) {
+  const auto& node = m_ast[expr].index_expr;
+  const auto [pointer, length] = lower_slice(node.expr);
+  const auto index = lower_expr(node.index);
+  m_function->create_binary(m_block, IrInstr::Kind::BoundsCheck, IrType::Void, index, length);
+  const auto address = m_function->create_binary(m_block, IrInstr::Kind::ElementAddr, IrType::Ptr, pointer, index);
+  m_function->instrs[address].index = ir_type_size(ast_expr_type(m_ast, expr));
+  return address;
+}
+
+void Lowering::remove_unreachable_blocks() {
+  std::vector<bool> reachable(m_function->blocks.size(), false);
+  std::vector<IrBlockIndex> stack{0};
+  reachable[0] = true;
+  while (!stack.empty()) {
+    const auto block = stack.back();
+    stack.pop_back();
+    for (auto succ : m_function->blocks[block].succs) {
+      if (reachable[succ]) continue;
+      reachable[succ] = true;
+      stack.emplace_back(succ);
+    }
+  }
+  m_function->remove_blocks(reachable);
+}
@@ -0,0 +1,100 @@
+#ifndef LOWERING_HPP
+#define LOWERING_HPP
+
+#include "ast.hpp"
+#include "execution_profile.hpp"
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Translates functions of the Ast into the SSA form of ir.hpp. Local variables
+// are turned into SSA values directly while lowering, using the algorithm of
+// Braun et al. "Simple and Efficient Construction of Static Single Assignment Form".
+// Given an ExecutionProfile, functions it has counts for are profiled:
+// their entry blocks weigh the number of calls, branches split the weight
+// of an if statement by how often it was taken, and loop bodies weigh the
+// iterations of their while statement. Arrays live in stack slots like
+// structs; slices are a pointer and a length, two values and two
+// parameters, and every index into either is checked by a BoundsCheck.
+// Region statements become RuntimeCalls that enter and leave a region
+// around their block, and a return leaves the regions it is inside;
+// new [T; n] checks n and allocates the elements with another. spawn f(args)
+// stores the arguments to a stack slot, 8 bytes each, and passes it with
+// the address of a function that loads them and calls f to the TaskSpawn
+// RuntimeCall; there is one such function per spawned function, without a
+// name. join is the TaskJoin RuntimeCall.
+class Lowering {
+public:
+  Lowering(const Ast& ast, IrModule& module) : m_ast(ast), m_module(module) {}
+  Lowering(const Ast& ast, IrModule& module, const ExecutionProfile& profile, const IdCache& id_cache)
+    : m_ast(ast), m_module(module), m_profile(&profile), m_id_cache(&id_cache) {}
+  Lowering(const Lowering&) = delete;
+  Lowering(Lowering&&) = delete;
+  Lowering& operator=(const Lowering&) = delete;
+  Lowering& operator=(Lowering&&) = delete;
+
+  // lowers every function declared in the given global scope
+  void lower_module(AstNodeIndex global_scope);
+  IrFunction& lower_function(AstNodeIndex function);
+
+  static IrType to_ir_type(AstNode::Kind type_kind);
+
+private:
+  const Ast& m_ast;
+  IrModule& m_module;
+  const ExecutionProfile* m_profile = nullptr;
+  const IdCache* m_id_cache = nullptr;
+  // counts of the function being lowered, nullptr without
+  const FunctionProfile* m_function_profile = nullptr;
+  // if and while statements of the function seen so far
+  uint32_t m_branch_sites = 0;
+  uint32_t m_loop_sites = 0;
+  IrFunction* m_function = nullptr;
+  uint32_t m_function_index = 0;
+  // Function nodes to their position in IrModule::functions
+  std::unordered_map<AstNodeIndex, uint32_t> m_function_indices;
+  IrBlockIndex m_block = UndefinedIrBlockIndex;
+
+  using Defs = std::unordered_map<AstNodeIndex, IrValueIndex>;
+  std::vector<Defs> m_defs;
+  std::vector<bool> m_sealed;
+  std::vector<std::vector<std::pair<AstNodeIndex, IrValueIndex>>> m_incomplete_phis;
+  // struct and array typed locals live in memory, mapped to their StackSlot
+  std::unordered_map<AstNodeIndex, IrValueIndex> m_slots;
+  // slice typed locals to their pointer and length, slices are never
+  // assigned after their declaration
+  std::unordered_map<AstNodeIndex, std::pair<IrValueIndex, IrValueIndex>> m_slices;
+  // region statements around the statement being lowered
+  uint32_t m_regions = 0;
+  // spawned functions to the function that calls them with stored arguments
+  std::unordered_map<uint32_t, uint32_t> m_spawn_entries;
+
+  uint32_t declare_function(AstNodeIndex function);
+  IrBlockIndex create_block();
+  void seal_block(IrBlockIndex block);
+  void write_variable(AstNodeIndex variable, IrBlockIndex block, IrValueIndex value);
+  IrValueIndex read_variable(AstNodeIndex variable, IrBlockIndex block);
+  IrValueIndex read_variable_recursive(AstNodeIndex variable, IrBlockIndex block);
+  IrValueIndex add_phi_operands(AstNodeIndex variable, IrValueIndex phi);
+  IrValueIndex create_undefined(IrType type);
+  IrValueIndex create_in_entry(IrInstr::Kind kind, IrType type);
+  IrValueIndex create_runtime_call(IrRuntimeFunction function, IrType type, std::vector<IrValueIndex> operands);
+  uint32_t declare_spawn_entry(AstNodeIndex function);
+  IrType variable_type(AstNodeIndex variable) const;
+  bool is_struct_type(AstNodeIndex type) const;
+  uint32_t type_size(AstNodeIndex type) const;
+
+  void lower_stmt(AstNodeIndex stmt);
+  IrValueIndex lower_expr(AstNodeIndex expr);
+  IrValueIndex lower_binary(IrInstr::Kind kind, const AstNode::BinaryExpr& expr);
+  IrValueIndex lower_address(AstNodeIndex expr);
+  // the pointer and length of an array or slice expression
+  std::pair<IrValueIndex, IrValueIndex> lower_slice(AstNodeIndex expr);
+  // the checked address of an IndexExpr's element
+  IrValueIndex lower_element(AstNodeIndex expr);
+  void remove_unreachable_blocks();
+};
+
+#endif  // LOWERING_HPP
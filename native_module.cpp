@@ -0,0 +1,21 @@
+#include "native_module.hpp"
+#include "jit.hpp"
+#include <utility>
+
+bool NativeModule::load() {
+  if (!JIT_SUPPORTED) return false;
+  X86CodeGen codegen(m_module);
+  X86Code code;
+  const bool compiled = codegen.compile_module(code);
+  m_stats = codegen.stats();
+  if (!compiled) return false;
+  m_code = m_memory.install(code.bytes.data(), code.bytes.size());
+  if (!m_code) return false;
+  m_entries = std::move(code.entries);
+  return true;
+}
+
+const void* NativeModule::entry(uint32_t function) const {
+  if (!m_code || function >= m_entries.size() || m_entries[function] == UndefinedCodeOffset) return nullptr;
+  return m_code + m_entries[function];
+}
@@ -0,0 +1,40 @@
+#ifndef NATIVE_MODULE_HPP
+#define NATIVE_MODULE_HPP
+
+#include "codegen.hpp"
+#include "executable_memory.hpp"
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+// Runs a module compiled by X86CodeGen in this process, without an object
+// file or the system linker. Every function is compiled into one buffer,
+// calls between them are resolved in place (they are relative, so the
+// buffer can land anywhere) and the whole module is installed into
+// executable memory with a single copy and protection change. Entries
+// follow the System V calling convention and can be called through plain
+// function pointers.
+class NativeModule {
+public:
+  NativeModule(const IrModule& module) : m_module(module), m_memory(0) {}
+  NativeModule(const NativeModule&) = delete;
+  NativeModule(NativeModule&&) = delete;
+  NativeModule& operator=(const NativeModule&) = delete;
+  NativeModule& operator=(NativeModule&&) = delete;
+
+  // false when the target is not supported, a function cannot be compiled
+  // or executable memory is not available
+  bool load();
+  // entry of a function, nullptr until loaded
+  const void* entry(uint32_t function) const;
+  const X86CodeGenStats& stats() const { return m_stats; }
+
+private:
+  const IrModule& m_module;
+  ExecutableMemory m_memory;
+  const uint8_t* m_code = nullptr;
+  std::vector<uint32_t> m_entries;
+  X86CodeGenStats m_stats;
+};
+
+#endif  // NATIVE_MODULE_HPP
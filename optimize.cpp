@@ -0,0 +1,47 @@
+#include "optimize.hpp"
+#include "gvn.hpp"
+#include "inliner.hpp"
+#include "licm.hpp"
+#include "sccp.hpp"
+
+uint32_t native_vector_bytes() {
+  return __builtin_cpu_supports("avx") ? 32 : __builtin_cpu_supports("sse4.1") ? 16 : 0;
+}
+
+const FunctionOptimizeStats* OptimizeStats::find(IdIndex name) const {
+  for (const auto& function : functions) {
+    if (function.name == name) return &function;
+  }
+  return nullptr;
+}
+
+OptimizeStats optimize_module(IrModule& module, const OptimizeOptions& options) {
+  OptimizeStats stats;
+  Inliner(module).run();
+  for (auto& function : module.functions) {
+    stats.functions.emplace_back();
+    auto& function_stats = stats.functions.back();
+    function_stats.name = function.name;
+    function_stats.unroll = Unroller(function).run();
+    Sccp(function).run();
+    function_stats.scalar_replacement = ScalarReplacement(function).run();
+    if (function_stats.scalar_replacement.replaced) Sccp(function).run();
+    Gvn(function).run();
+    function_stats.bounds_checks = BoundsCheckElimination(function).run();
+    Vectorizer vectorizer(function, options.vectorize);
+    function_stats.vectorize = vectorizer.run();
+    if (options.vectorize_report && options.id_cache) vectorizer.report(*options.vectorize_report, *options.id_cache);
+    Licm(function).run();
+  }
+
+  // functions inlined everywhere go
+  std::vector<uint32_t> roots;
+  for (uint32_t index = 0; index < module.functions.size(); ++index) {
+    if (options.root != UndefinedIdIndex && module.functions[index].name == options.root) roots.emplace_back(index);
+  }
+  if (roots.empty()) {
+    for (uint32_t index = 0; index < module.functions.size(); ++index) roots.emplace_back(index);
+  }
+  stats.dce = Dce(module).run(roots);
+  return stats;
+}
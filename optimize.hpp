@@ -0,0 +1,54 @@
+#ifndef OPTIMIZE_HPP
+#define OPTIMIZE_HPP
+
+#include "bounds_check.hpp"
+#include "dce.hpp"
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include "scalar_replacement.hpp"
+#include "unroll.hpp"
+#include "vectorize.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// widest vectors in bytes this machine runs: 32 with AVX, 16 with SSE4.1
+uint32_t native_vector_bytes();
+
+struct OptimizeOptions {
+  // as wide as the machine allows unless changed
+  Vectorizer::Options vectorize{native_vector_bytes()};
+  // the function whose callees are kept, every function is kept if the
+  // module has none of that name
+  IdIndex root = UndefinedIdIndex;
+  // writes why each loop was or was not vectorized, needs id_cache
+  std::ostream* vectorize_report = nullptr;
+  const IdCache* id_cache = nullptr;
+};
+
+// what the passes did to one function
+struct FunctionOptimizeStats {
+  IdIndex name = UndefinedIdIndex;
+  UnrollStats unroll;
+  ScalarReplacementStats scalar_replacement;
+  BoundsCheckStats bounds_checks;
+  std::vector<VectorizeDecision> vectorize;
+};
+
+struct OptimizeStats {
+  // in the order of the functions before Dce
+  std::vector<FunctionOptimizeStats> functions;
+  DceStats dce;
+
+  // the stats of the function called name, nullptr if there is none
+  const FunctionOptimizeStats* find(IdIndex name) const;
+};
+
+// The pass pipeline of lowered modules, the same for running, writing
+// objects and the tests: Inliner, then per function Unroller, Sccp,
+// ScalarReplacement (and Sccp again if it replaced a slot, as fields that
+// became values may fold further), Gvn, BoundsCheckElimination, Vectorizer
+// and Licm, and last Dce from the root.
+OptimizeStats optimize_module(IrModule& module, const OptimizeOptions& options = {});
+
+#endif  // OPTIMIZE_HPP
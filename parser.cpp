@@ -1,25 +1,1194 @@
 #include "parser.hpp"
+#include "ast_types.hpp"
 #include "lexer.hpp"
+#include "task.hpp"
+#include <algorithm>
 
-void Parser::parse() {
-  auto& token = m_lexer.next(); 
-  if (token.get_kind() != Token::Kind::Fun) 
-    return;
+namespace {
 
-  auto& id_token = m_lexer.next();
+struct BinaryOp {
+  Token::Kind token;
+  AstNode::Kind kind;
+  uint32_t level;
+};
 
-  if (id_token.get_kind() != Token::Kind::Id)
-    return;
+// lowest precedence first
+const BinaryOp BinaryOps[] = {
+  {Token::Kind::Equals, AstNode::Kind::EqualExpr, 0},
+  {Token::Kind::Less, AstNode::Kind::LessExpr, 1},
+  {Token::Kind::Great, AstNode::Kind::GreatExpr, 1},
+  {Token::Kind::LessOrEqual, AstNode::Kind::LessOrEqualExpr, 1},
+  {Token::Kind::GreatOrEqual, AstNode::Kind::GreatOrEqualExpr, 1},
+  {Token::Kind::Add, AstNode::Kind::AddExpr, 2},
+  {Token::Kind::Sub, AstNode::Kind::SubExpr, 2},
+  {Token::Kind::Mul, AstNode::Kind::MulExpr, 3},
+  {Token::Kind::Div, AstNode::Kind::DivExpr, 3},
+};
+const uint32_t BinaryLevels = 4;
 
-  auto& left_paren_token = m_lexer.next();
+AstNode::Kind type_kind(IrType type) {
+  switch (type) {
+    case IrType::I8: return AstNode::Kind::I8Type;
+    case IrType::I16: return AstNode::Kind::I16Type;
+    case IrType::U8: return AstNode::Kind::U8Type;
+    case IrType::U16: return AstNode::Kind::U16Type;
+    case IrType::U32: return AstNode::Kind::U32Type;
+    case IrType::F32: return AstNode::Kind::F32Type;
+    case IrType::F64: return AstNode::Kind::F64Type;
+    case IrType::F32x4: return AstNode::Kind::F32x4Type;
+    case IrType::F32x8: return AstNode::Kind::F32x8Type;
+    case IrType::I32x4: return AstNode::Kind::I32x4Type;
+    default: return AstNode::Kind::I32Type;
+  }
+}
+
+const char* type_name(IrType type) {
+  switch (type) {
+    case IrType::Void: return "no value";
+    case IrType::Bool: return "a comparison";
+    case IrType::I8: return "i8";
+    case IrType::I16: return "i16";
+    case IrType::I32: return "i32";
+    case IrType::U8: return "u8";
+    case IrType::U16: return "u16";
+    case IrType::U32: return "u32";
+    case IrType::F32: return "f32";
+    case IrType::F64: return "f64";
+    case IrType::Ptr: return "a struct";
+    case IrType::F32x4: return "f32x4";
+    case IrType::F32x8: return "f32x8";
+    case IrType::I32x4: return "i32x4";
+    case IrType::F64x4: return "f64x4";
+  }
+  return "";
+}
+
+bool is_scalar(IrType type) {
+  return type != IrType::Void && type != IrType::Bool && type != IrType::Ptr && !ir_is_vector(type);
+}
 
-  if (left_paren_token.get_kind() != Token::Kind::LeftParen)
-    return;
+// types a variable, parameter or expression of the language can have
+bool is_value(IrType type) {
+  return is_scalar(type) || ir_is_vector(type);
+}
+
+}  // namespace
+
+bool Parser::parse() {
+  m_global_scope = create_scope(AstNode::Kind::GlobalScope, UndefinedIdIndex);
+  m_scope = m_global_scope;
+  advance();
+  while (kind() != Token::Kind::Eof) {
+    if (kind() == Token::Kind::Struct) {
+      if (!parse_struct()) return false;
+    } else if (kind() == Token::Kind::Fun) {
+      if (!parse_function()) return false;
+    } else {
+      fail("expected 'fun' or 'struct'");
+      return false;
+    }
+  }
+  if (!m_undeclared.empty()) {
+    const auto [function, line] = m_undeclared.front();
+    m_error = "line " + std::to_string(line) + ": '" + name(m_ast[function].scope.name) + "' is not declared";
+    return false;
+  }
+
+  const auto* dict = m_ast[m_global_scope].scope.dict;
+  if (!dict) return true;
+  for (auto node : dict->get_nodes()) {
+    if (m_ast[node].kind != AstNode::Kind::Function) continue;
+    m_function = node;
+    if (!check_stmt(m_ast[node].function.block_stmt)) return false;
+  }
+  return true;
+}
 
+Token::Kind Parser::kind() {
+  return m_lexer.last().get_kind();
+}
+
+void Parser::advance() {
   m_lexer.next();
+}
+
+bool Parser::accept(Token::Kind kind) {
+  if (this->kind() != kind) return false;
+  advance();
+  return true;
+}
+
+bool Parser::expect(Token::Kind kind, const char* what) {
+  if (accept(kind)) return true;
+  fail(std::string("expected ") + what);
+  return false;
+}
+
+AstNodeIndex Parser::fail(const std::string& message) {
+  if (m_error.empty()) m_error = "line " + std::to_string(m_lexer.line()) + ": " + message;
+  return UndefinedAstNodeIndex;
+}
+
+AstNodeIndex Parser::fail(AstNodeIndex node, const std::string& message) {
+  // a variable node is shared by all its uses, its line is the declaration
+  if (m_ast[node].kind == AstNode::Kind::LocalVariable && m_stmt != UndefinedAstNodeIndex) node = m_stmt;
+  if (m_error.empty()) m_error = "line " + std::to_string(m_lines[node]) + ": " + message;
+  return UndefinedAstNodeIndex;
+}
+
+IdIndex Parser::id() {
+  const auto& text = static_cast<const IdToken&>(m_lexer.last()).get_id();
+  return m_id_cache.get(text.c_str(), text.size());
+}
+
+std::string Parser::name(IdIndex id) const {
+  const auto& string = m_id_cache.get(id);
+  return std::string(string.str, string.length);
+}
+
+AstNodeIndex Parser::create(AstNode::Kind kind) {
+  const auto node = m_ast.create(kind);
+  if (node >= m_lines.size()) m_lines.resize(node + 1, 0);
+  m_lines[node] = m_lexer.line();
+  return node;
+}
+
+AstNodeIndex Parser::create_scope(AstNode::Kind kind, IdIndex name) {
+  const auto scope = create(kind);
+  m_ast[scope].scope.outer_scope = m_scope;
+  m_ast[scope].scope.name = name;
+  return scope;
+}
+
+AstNodeIndex Parser::create_type(IrType type) {
+  return create(type_kind(type));
+}
+
+bool Parser::parse_struct() {
+  advance();
+  if (kind() != Token::Kind::Id) {
+    fail("expected a struct name");
+    return false;
+  }
+  const auto struct_name = id();
+  if (lookup(struct_name) != UndefinedAstNodeIndex) {
+    fail("'" + name(struct_name) + "' is already declared");
+    return false;
+  }
+  advance();
+  if (!expect(Token::Kind::LeftBrace, "'{'")) return false;
+
+  const auto struc = create_scope(AstNode::Kind::Struct, struct_name);
+  uint32_t offset = 0;
+  while (!accept(Token::Kind::RightBrace)) {
+    if (kind() != Token::Kind::Id) {
+      fail("expected a field name");
+      return false;
+    }
+    const auto field_name = id();
+    const auto* dict = m_ast[struc].scope.dict;
+    if (dict && dict->find(field_name) != UndefinedAstNodeIndex) {
+      fail("duplicate field '" + name(field_name) + "'");
+      return false;
+    }
+    advance();
+    if (!expect(Token::Kind::Colon, "':'")) return false;
+    const auto type = parse_type();
+    if (type == UndefinedAstNodeIndex) return false;
+    if (ir_is_vector(ast_value_type(m_ast, type))) {
+      fail("vector fields are not supported");
+      return false;
+    }
+    if (is_sequence(type)) {
+      fail("array and slice fields are not supported");
+      return false;
+    }
+
+    // naturally aligned, a nested struct takes its size rounded up to its
+    // alignment like in C
+    const auto align = alignment(type);
+    offset = (offset + align - 1) / align * align;
+    const auto field = create(AstNode::Kind::StructField);
+    m_ast[field].struct_field.value.type = type;
+    m_ast[field].struct_field.name = field_name;
+    m_ast[field].struct_field.offset = offset;
+    m_ast[struc].scope.add_node(field, field_name);
+    offset += (ast_type_size(m_ast, type) + align - 1) / align * align;
+    if (!expect(Token::Kind::Semicolon, "';'")) return false;
+  }
+  // declared after its fields, so a struct cannot contain itself
+  m_ast[m_global_scope].scope.add_node(struc, struct_name);
+  return true;
+}
+
+bool Parser::parse_function() {
+  advance();
+  if (kind() != Token::Kind::Id) {
+    fail("expected a function name");
+    return false;
+  }
+  const auto function_name = id();
+  auto function = lookup(function_name);
+  const auto undeclared = std::find_if(m_undeclared.begin(), m_undeclared.end(),
+    [function](const auto& entry) { return entry.first == function; });
+  if (undeclared != m_undeclared.end()) {
+    m_undeclared.erase(undeclared);
+  } else if (function != UndefinedAstNodeIndex) {
+    fail("'" + name(function_name) + "' is already declared");
+    return false;
+  } else {
+    function = create_scope(AstNode::Kind::Function, function_name);
+    m_ast[m_global_scope].scope.add_node(function, function_name);
+  }
+  advance();
+
+  const auto fun_type = create(AstNode::Kind::FunTypeWithNamedParams);
+  m_ast[function].function.function_type_with_named_params = fun_type;
+  m_ast[fun_type].fun_type_with_named_params.fun_type.return_type = UndefinedAstNodeIndex;
+  if (!expect(Token::Kind::LeftParen, "'('")) return false;
+  uint32_t float_params = 0;
+  if (!accept(Token::Kind::RightParen)) {
+    do {
+      if (kind() != Token::Kind::Id) {
+        fail("expected a parameter name");
+        return false;
+      }
+      const auto param_name = id();
+      const auto* dict = m_ast[function].scope.dict;
+      if (dict && dict->find(param_name) != UndefinedAstNodeIndex) {
+        fail("duplicate parameter '" + name(param_name) + "'");
+        return false;
+      }
+      advance();
+      if (!expect(Token::Kind::Colon, "':'")) return false;
+      const auto type = parse_type();
+      if (type == UndefinedAstNodeIndex) return false;
+      if (is_struct(type)) {
+        fail("struct parameters are not supported");
+        return false;
+      }
+      if (m_ast[type].kind == AstNode::Kind::ArrayType) {
+        fail("array parameters are not supported, pass a slice");
+        return false;
+      }
+      const auto value_type = ast_value_type(m_ast, type);
+      if (ir_is_vector(value_type) && float_params >= MaxFloatRegisterParams) {
+        fail("vector parameters must be among the first " + std::to_string(MaxFloatRegisterParams) +
+             " float and vector parameters");
+        return false;
+      }
+      if (ir_is_float(value_type) || ir_is_vector(value_type)) ++float_params;
+      const auto param = create(AstNode::Kind::LocalVariable);
+      m_ast[param].local_variable.name = param_name;
+      m_ast[param].local_variable.value.type = type;
+      m_ast[fun_type].fun_type_with_named_params.fun_type.add_param_type(type);
+      m_ast[fun_type].fun_type_with_named_params.add_name(param_name);
+      m_ast[function].scope.add_node(param, param_name);
+    } while (accept(Token::Kind::Comma));
+    if (!expect(Token::Kind::RightParen, "')'")) return false;
+  }
+  if (accept(Token::Kind::Arrow)) {
+    const auto type = parse_type();
+    if (type == UndefinedAstNodeIndex) return false;
+    if (is_struct(type)) {
+      fail("struct return values are not supported");
+      return false;
+    }
+    if (is_sequence(type)) {
+      fail("array and slice return values are not supported");
+      return false;
+    }
+    m_ast[fun_type].fun_type_with_named_params.fun_type.return_type = type;
+  }
+
+  m_scope = function;
+  m_function = function;
+  const auto body = parse_block();
+  m_scope = m_global_scope;
+  if (body == UndefinedAstNodeIndex) return false;
+  m_ast[function].function.block_stmt = body;
+  return true;
+}
+
+AstNodeIndex Parser::parse_type() {
+  AstNode::Kind type_kind;
+  switch (kind()) {
+    case Token::Kind::I8: type_kind = AstNode::Kind::I8Type; break;
+    case Token::Kind::I16: type_kind = AstNode::Kind::I16Type; break;
+    case Token::Kind::I32: type_kind = AstNode::Kind::I32Type; break;
+    case Token::Kind::U8: type_kind = AstNode::Kind::U8Type; break;
+    case Token::Kind::U16: type_kind = AstNode::Kind::U16Type; break;
+    case Token::Kind::U32: type_kind = AstNode::Kind::U32Type; break;
+    case Token::Kind::F32: type_kind = AstNode::Kind::F32Type; break;
+    case Token::Kind::F64: type_kind = AstNode::Kind::F64Type; break;
+    case Token::Kind::F32x4: type_kind = AstNode::Kind::F32x4Type; break;
+    case Token::Kind::F32x8: type_kind = AstNode::Kind::F32x8Type; break;
+    case Token::Kind::I32x4: type_kind = AstNode::Kind::I32x4Type; break;
+    case Token::Kind::LeftBracket: {
+      advance();
+      const auto element = parse_type();
+      if (element == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!is_scalar(ast_value_type(m_ast, element))) return fail("array elements must be scalars");
+      auto type = UndefinedAstNodeIndex;
+      if (accept(Token::Kind::Semicolon)) {
+        if (kind() != Token::Kind::I32Literal) return fail("expected the array length");
+        const auto length = static_cast<const LiteralToken<int32_t, Token::Kind::I32Literal>&>(m_lexer.last()).get_value();
+        if (length < 1 || length > static_cast<int32_t>(MaxArrayLength)) {
+          return fail("array lengths go from 1 to " + std::to_string(MaxArrayLength));
+        }
+        advance();
+        type = create(AstNode::Kind::ArrayType);
+        m_ast[type].array_type.length = length;
+      } else {
+        type = create(AstNode::Kind::SliceType);
+      }
+      m_ast[type].array_type.element = element;
+      if (!expect(Token::Kind::RightBracket, "']'")) return UndefinedAstNodeIndex;
+      return type;
+    }
+    case Token::Kind::Id: {
+      const auto struc = m_ast[m_global_scope].scope.dict ? m_ast[m_global_scope].scope.dict->find(id())
+                                                          : UndefinedAstNodeIndex;
+      if (struc == UndefinedAstNodeIndex || m_ast[struc].kind != AstNode::Kind::Struct) {
+        return fail("'" + name(id()) + "' is not a type");
+      }
+      advance();
+      const auto type = create(AstNode::Kind::StructType);
+      m_ast[type].struct_type.struct_scope = struc;
+      return type;
+    }
+    default:
+      return fail("expected a type");
+  }
+  advance();
+  return create(type_kind);
+}
+
+AstNodeIndex Parser::parse_block() {
+  if (!expect(Token::Kind::LeftBrace, "'{'")) return UndefinedAstNodeIndex;
+  const auto scope = create_scope(AstNode::Kind::BlockScope, UndefinedIdIndex);
+  const auto block = create(AstNode::Kind::BlockStmt);
+  m_ast[scope].block_scope.block_stmt = block;
+  m_ast[block].block_stmt.block_scope = scope;
+  m_scope = scope;
+  while (!accept(Token::Kind::RightBrace)) {
+    if (kind() == Token::Kind::Eof) return fail("expected '}'");
+    const auto stmt = parse_stmt();
+    if (stmt == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+    m_ast[block].block_stmt.add_stmt(stmt);
+  }
+  m_scope = m_ast[scope].scope.outer_scope;
+  return block;
+}
+
+AstNodeIndex Parser::parse_stmt() {
+  switch (kind()) {
+    case Token::Kind::LeftBrace:
+      return parse_block();
+    case Token::Kind::Var:
+    case Token::Kind::Val:
+      return parse_var_decl();
+    case Token::Kind::If: {
+      const auto stmt = create(AstNode::Kind::IfElseStmt);
+      advance();
+      const auto expr = parse_condition();
+      if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      const auto then_stmt = parse_stmt();
+      if (then_stmt == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      auto else_stmt = UndefinedAstNodeIndex;
+      if (accept(Token::Kind::Else)) {
+        else_stmt = parse_stmt();
+        if (else_stmt == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      }
+      m_ast[stmt].if_else_stmt.expr = expr;
+      m_ast[stmt].if_else_stmt.stmt = then_stmt;
+      m_ast[stmt].if_else_stmt.else_stmt = else_stmt;
+      return stmt;
+    }
+    case Token::Kind::While: {
+      const auto stmt = create(AstNode::Kind::WhileStmt);
+      advance();
+      const auto expr = parse_condition();
+      if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      const auto body = parse_stmt();
+      if (body == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      m_ast[stmt].while_stmt.expr = expr;
+      m_ast[stmt].while_stmt.stmt = body;
+      return stmt;
+    }
+    case Token::Kind::Region: {
+      const auto stmt = create(AstNode::Kind::RegionStmt);
+      advance();
+      ++m_regions;
+      const auto body = parse_block();
+      --m_regions;
+      if (body == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      m_ast[stmt].region_stmt.stmt = body;
+      return stmt;
+    }
+    case Token::Kind::Return: {
+      const auto stmt = create(AstNode::Kind::ReturnStmt);
+      advance();
+      auto expr = UndefinedAstNodeIndex;
+      if (kind() != Token::Kind::Semicolon) {
+        expr = parse_expr();
+        if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      }
+      if (!expect(Token::Kind::Semicolon, "';'")) return UndefinedAstNodeIndex;
+      m_ast[stmt].return_stmt.expr = expr;
+      return stmt;
+    }
+    default: {
+      const auto expr = parse_expr();
+      if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!expect(Token::Kind::Semicolon, "';'")) return UndefinedAstNodeIndex;
+      const auto stmt = create(AstNode::Kind::ExprStmt);
+      m_ast[stmt].expr_stmt.expr = expr;
+      return stmt;
+    }
+  }
+}
+
+AstNodeIndex Parser::parse_var_decl() {
+  const bool is_value = kind() == Token::Kind::Val;
+  advance();
+  if (kind() != Token::Kind::Id) return fail("expected a variable name");
+  const auto variable_name = id();
+  const auto* dict = m_ast[m_scope].scope.dict;
+  if (dict && dict->find(variable_name) != UndefinedAstNodeIndex) {
+    return fail("'" + name(variable_name) + "' is already declared in this block");
+  }
+  advance();
+  auto type = UndefinedAstNodeIndex;
+  if (accept(Token::Kind::Colon)) {
+    type = parse_type();
+    if (type == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  }
+  auto init_expr = UndefinedAstNodeIndex;
+  const bool is_array = type != UndefinedAstNodeIndex && m_ast[type].kind == AstNode::Kind::ArrayType;
+  if (accept(Token::Kind::Assign)) {
+    if (is_struct(type)) return fail("struct variables cannot be initialized");
+    if (is_array) return fail("array variables cannot be initialized");
+    init_expr = parse_expr();
+    if (init_expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  } else if (type == UndefinedAstNodeIndex) {
+    return fail("'" + name(variable_name) + "' needs a type or an initializer");
+  } else if (is_value || m_ast[type].kind == AstNode::Kind::SliceType) {
+    // slices have nothing to start at
+    return fail("'" + name(variable_name) + "' needs an initializer");
+  } else if (!is_struct(type) && !is_array) {
+    // converted to the type of the variable when checked
+    init_expr = create(AstNode::Kind::I32Literal);
+    m_ast[init_expr].i32_literal.value.type = create(AstNode::Kind::I32Type);
+  }
+  if (!expect(Token::Kind::Semicolon, "';'")) return UndefinedAstNodeIndex;
+
+  // declared after the initializer, which still sees an outer variable of
+  // the same name
+  const auto variable = create(AstNode::Kind::LocalVariable);
+  m_ast[variable].local_variable.name = variable_name;
+  m_ast[variable].local_variable.value.type = type;
+  m_ast[m_scope].scope.add_node(variable, variable_name);
+  if (is_value) m_values.insert(variable);
+  const auto stmt = create(AstNode::Kind::VariableDeclStmt);
+  m_ast[stmt].variable_decl_stmt.variable = variable;
+  m_ast[stmt].variable_decl_stmt.init_expr = init_expr;
+  return stmt;
+}
+
+AstNodeIndex Parser::parse_condition() {
+  if (!expect(Token::Kind::LeftParen, "'('")) return UndefinedAstNodeIndex;
+  const auto expr = parse_expr();
+  if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+  return expr;
+}
+
+AstNodeIndex Parser::parse_expr() {
+  const auto left = parse_binary(0);
+  if (left == UndefinedAstNodeIndex || kind() != Token::Kind::Assign) return left;
+  const auto left_kind = m_ast[left].kind;
+  // whether an index is a lane or an element is known once types are, the
+  // checks find out
+  if (left_kind != AstNode::Kind::LocalVariable && left_kind != AstNode::Kind::FieldExpr &&
+      left_kind != AstNode::Kind::IndexExpr) {
+    return fail("cannot assign to this expression");
+  }
+  if (m_values.count(left)) {
+    return fail("cannot assign to val '" + name(m_ast[left].local_variable.name) + "'");
+  }
+  advance();
+  // right associative
+  const auto right = parse_expr();
+  if (right == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  const auto expr = create(AstNode::Kind::AssignExpr);
+  m_ast[expr].assign_expr.left = left;
+  m_ast[expr].assign_expr.right = right;
+  return expr;
+}
+
+AstNodeIndex Parser::parse_binary(uint32_t level) {
+  if (level == BinaryLevels) return parse_unary();
+  auto left = parse_binary(level + 1);
+  while (left != UndefinedAstNodeIndex) {
+    const auto* op = std::find_if(std::begin(BinaryOps), std::end(BinaryOps),
+      [&](const BinaryOp& op) { return op.token == kind() && op.level == level; });
+    if (op == std::end(BinaryOps)) break;
+    advance();
+    const auto right = parse_binary(level + 1);
+    if (right == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+    const auto expr = create(op->kind);
+    m_ast[expr].add_expr.left = left;
+    m_ast[expr].add_expr.right = right;
+    left = expr;
+  }
+  return left;
+}
+
+AstNodeIndex Parser::parse_unary() {
+  if (!accept(Token::Kind::Sub)) return parse_primary();
+  const auto operand = parse_unary();
+  if (operand == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+  // negative literals stay literals, so they convert like any other
+  auto& node = m_ast[operand];
+  if (node.kind == AstNode::Kind::I32Literal) {
+    node.i32_literal.literal_value = static_cast<int32_t>(0u - static_cast<uint32_t>(node.i32_literal.literal_value));
+    return operand;
+  }
+  if (node.kind == AstNode::Kind::F64Literal) {
+    node.f64_literal.literal_value = -node.f64_literal.literal_value;
+    return operand;
+  }
+  const auto expr = create(AstNode::Kind::NegExpr);
+  m_ast[expr].neg_expr.expr = operand;
+  return expr;
+}
+
+AstNodeIndex Parser::parse_primary() {
+  AstNodeIndex expr;
+  switch (kind()) {
+    case Token::Kind::I32Literal:
+      expr = create(AstNode::Kind::I32Literal);
+      m_ast[expr].i32_literal.value.type = create(AstNode::Kind::I32Type);
+      m_ast[expr].i32_literal.literal_value =
+        static_cast<const LiteralToken<int32_t, Token::Kind::I32Literal>&>(m_lexer.last()).get_value();
+      advance();
+      break;
+    case Token::Kind::F64Literal:
+      expr = create(AstNode::Kind::F64Literal);
+      m_ast[expr].f64_literal.value.type = create(AstNode::Kind::F64Type);
+      m_ast[expr].f64_literal.literal_value =
+        static_cast<const LiteralToken<double, Token::Kind::F64Literal>&>(m_lexer.last()).get_value();
+      advance();
+      break;
+    case Token::Kind::LeftParen: {
+      advance();
+      const auto inner = parse_expr();
+      if (inner == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+      expr = create(AstNode::Kind::ParenthExpr);
+      m_ast[expr].parenth_expr.expr = inner;
+      break;
+    }
+    case Token::Kind::F32x4:
+    case Token::Kind::F32x8:
+    case Token::Kind::I32x4: {
+      expr = create(AstNode::Kind::VectorExpr);
+      m_ast[expr].vector_expr.value.type = parse_type();
+      if (!expect(Token::Kind::LeftParen, "'('")) return UndefinedAstNodeIndex;
+      do {
+        const auto arg = parse_expr();
+        if (arg == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+        m_ast[expr].vector_expr.add_arg(arg);
+      } while (accept(Token::Kind::Comma));
+      if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+      break;
+    }
+    case Token::Kind::Shuffle: {
+      advance();
+      if (!expect(Token::Kind::LeftParen, "'('")) return UndefinedAstNodeIndex;
+      const auto vector = parse_expr();
+      if (vector == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      expr = create(AstNode::Kind::ShuffleExpr);
+      m_ast[expr].shuffle_expr.expr = vector;
+      while (accept(Token::Kind::Comma)) {
+        if (kind() != Token::Kind::I32Literal) return fail("expected a lane");
+        const auto lane = static_cast<const LiteralToken<int32_t, Token::Kind::I32Literal>&>(m_lexer.last()).get_value();
+        auto& shuffle = m_ast[expr].shuffle_expr;
+        if (lane < 0 || lane > 7 || shuffle.count == 8) return fail("lane out of range");
+        shuffle.lanes |= static_cast<uint32_t>(lane) << 4 * shuffle.count++;
+        advance();
+      }
+      if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+      break;
+    }
+    case Token::Kind::New: {
+      // allocations live as long as the innermost region around them
+      if (!m_regions) return fail("'new' outside a region");
+      advance();
+      if (!expect(Token::Kind::LeftBracket, "'['")) return UndefinedAstNodeIndex;
+      const auto element = parse_type();
+      if (element == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!is_scalar(ast_value_type(m_ast, element))) return fail("array elements must be scalars");
+      if (!expect(Token::Kind::Semicolon, "';'")) return UndefinedAstNodeIndex;
+      const auto length = parse_expr();
+      if (length == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!expect(Token::Kind::RightBracket, "']'")) return UndefinedAstNodeIndex;
+      const auto type = create(AstNode::Kind::SliceType);
+      m_ast[type].array_type.element = element;
+      expr = create(AstNode::Kind::NewExpr);
+      m_ast[expr].new_expr.value.type = type;
+      m_ast[expr].new_expr.length = length;
+      break;
+    }
+    case Token::Kind::Spawn: {
+      advance();
+      if (kind() != Token::Kind::Id) return fail("expected a function call");
+      const auto id_name = id();
+      advance();
+      if (kind() != Token::Kind::LeftParen) return fail("expected a function call");
+      const auto call = parse_call(id_name);
+      if (call == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      expr = create(AstNode::Kind::SpawnExpr);
+      m_ast[expr].spawn_expr.expr = call;
+      break;
+    }
+    case Token::Kind::Join: {
+      advance();
+      if (!expect(Token::Kind::LeftParen, "'('")) return UndefinedAstNodeIndex;
+      const auto task = parse_expr();
+      if (task == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+      expr = create(AstNode::Kind::JoinExpr);
+      m_ast[expr].join_expr.expr = task;
+      break;
+    }
+    case Token::Kind::Id: {
+      const auto id_name = id();
+      advance();
+      if (kind() == Token::Kind::LeftParen) {
+        expr = parse_call(id_name);
+        if (expr == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+        break;
+      }
+      expr = lookup(id_name);
+      if (expr == UndefinedAstNodeIndex) return fail("'" + name(id_name) + "' is not declared");
+      if (m_ast[expr].kind != AstNode::Kind::LocalVariable) return fail("'" + name(id_name) + "' is not a variable");
+      break;
+    }
+    default:
+      return fail("expected an expression");
+  }
+
+  while (kind() == Token::Kind::Dot || kind() == Token::Kind::LeftBracket) {
+    if (accept(Token::Kind::LeftBracket)) {
+      const auto index = parse_expr();
+      if (index == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      if (accept(Token::Kind::Colon)) {
+        const auto high = parse_expr();
+        if (high == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+        if (!expect(Token::Kind::RightBracket, "']'")) return UndefinedAstNodeIndex;
+        const auto slice = create(AstNode::Kind::SliceExpr);
+        m_ast[slice].slice_expr.value.type = UndefinedAstNodeIndex;
+        m_ast[slice].slice_expr.expr = expr;
+        m_ast[slice].slice_expr.low = index;
+        m_ast[slice].slice_expr.high = high;
+        expr = slice;
+        continue;
+      }
+      if (!expect(Token::Kind::RightBracket, "']'")) return UndefinedAstNodeIndex;
+      const auto index_expr = create(AstNode::Kind::IndexExpr);
+      m_ast[index_expr].index_expr.expr = expr;
+      m_ast[index_expr].index_expr.index = index;
+      expr = index_expr;
+      continue;
+    }
+    advance();
+    if (kind() != Token::Kind::Id) return fail("expected a field name");
+    auto type = UndefinedAstNodeIndex;
+    for (auto base = expr; type == UndefinedAstNodeIndex;) {
+      const auto& node = m_ast[base];
+      if (node.kind == AstNode::Kind::ParenthExpr) {
+        base = node.parenth_expr.expr;
+        continue;
+      }
+      if (node.kind == AstNode::Kind::LocalVariable) type = node.local_variable.value.type;
+      if (node.kind == AstNode::Kind::FieldExpr) type = m_ast[node.field_expr.field].struct_field.value.type;
+      break;
+    }
+    if (!is_struct(type) && name(id()) == "len") {
+      advance();
+      const auto length = create(AstNode::Kind::LengthExpr);
+      m_ast[length].length_expr.expr = expr;
+      expr = length;
+      continue;
+    }
+    if (!is_struct(type)) return fail("'." + name(id()) + "' needs a struct");
+    const auto struc = m_ast[type].struct_type.struct_scope;
+    const auto* dict = m_ast[struc].scope.dict;
+    const auto field = dict ? dict->find(id()) : UndefinedAstNodeIndex;
+    if (field == UndefinedAstNodeIndex) {
+      return fail("'" + name(m_ast[struc].scope.name) + "' has no field '" + name(id()) + "'");
+    }
+    advance();
+    const auto field_expr = create(AstNode::Kind::FieldExpr);
+    m_ast[field_expr].field_expr.expr = expr;
+    m_ast[field_expr].field_expr.field = field;
+    expr = field_expr;
+  }
+  return expr;
+}
+
+AstNodeIndex Parser::parse_call(IdIndex function_name) {
+  auto function = lookup(function_name);
+  if (function == UndefinedAstNodeIndex) {
+    // declared by its definition later on
+    function = create(AstNode::Kind::Function);
+    m_ast[function].scope.outer_scope = m_global_scope;
+    m_ast[function].scope.name = function_name;
+    m_ast[m_global_scope].scope.add_node(function, function_name);
+    m_undeclared.emplace_back(function, m_lexer.line());
+  } else if (m_ast[function].kind != AstNode::Kind::Function) {
+    return fail("'" + name(function_name) + "' is not a function");
+  }
+  advance();
+  const auto call = create(AstNode::Kind::CallExpr);
+  m_ast[call].call_expr.function = function;
+  if (!accept(Token::Kind::RightParen)) {
+    do {
+      const auto arg = parse_expr();
+      if (arg == UndefinedAstNodeIndex) return UndefinedAstNodeIndex;
+      m_ast[call].call_expr.add_arg(arg);
+    } while (accept(Token::Kind::Comma));
+    if (!expect(Token::Kind::RightParen, "')'")) return UndefinedAstNodeIndex;
+  }
+  return call;
+}
+
+AstNodeIndex Parser::lookup(IdIndex name) const {
+  for (auto scope = m_scope; scope != UndefinedAstNodeIndex; scope = m_ast[scope].scope.outer_scope) {
+    const auto* dict = m_ast[scope].scope.dict;
+    if (!dict) continue;
+    const auto node = dict->find(name);
+    if (node != UndefinedAstNodeIndex) return node;
+  }
+  return UndefinedAstNodeIndex;
+}
+
+bool Parser::is_struct(AstNodeIndex type) const {
+  return type != UndefinedAstNodeIndex && m_ast[type].kind == AstNode::Kind::StructType;
+}
+
+bool Parser::is_sequence(AstNodeIndex type) const {
+  return type != UndefinedAstNodeIndex &&
+         (m_ast[type].kind == AstNode::Kind::ArrayType || m_ast[type].kind == AstNode::Kind::SliceType);
+}
+
+std::string Parser::describe(AstNodeIndex expr, IrType type) const {
+  const auto sequence = ast_sequence_type(m_ast, expr);
+  if (sequence == UndefinedAstNodeIndex) return type_name(type);
+  const auto& array_type = m_ast[sequence].array_type;
+  std::string text = std::string("[") + type_name(ast_value_type(m_ast, array_type.element));
+  if (m_ast[sequence].kind == AstNode::Kind::ArrayType) text += "; " + std::to_string(array_type.length);
+  return text + "]";
+}
+
+uint32_t Parser::alignment(AstNodeIndex type) const {
+  if (!is_struct(type)) return ir_type_size(ast_value_type(m_ast, type));
+  uint32_t align = 1;
+  if (const auto* dict = m_ast[m_ast[type].struct_type.struct_scope].scope.dict) {
+    for (auto field : dict->get_nodes()) align = std::max(align, alignment(m_ast[field].struct_field.value.type));
+  }
+  return align;
+}
+
+bool Parser::check_stmt(AstNodeIndex stmt) {
+  m_stmt = stmt;
+  const auto& node = m_ast[stmt];
+  IrType type;
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (node.block_stmt.stmts) {
+        for (auto child : *node.block_stmt.stmts) {
+          if (!check_stmt(child)) return false;
+        }
+      }
+      return true;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      const auto init_expr = node.variable_decl_stmt.init_expr;
+      const auto declared = m_ast[variable].local_variable.value.type;
+      if (init_expr == UndefinedAstNodeIndex) return true;
+      if (declared != UndefinedAstNodeIndex && m_ast[declared].kind == AstNode::Kind::SliceType) {
+        return check_slice(init_expr, declared, "the initializer");
+      }
+      if (declared != UndefinedAstNodeIndex) {
+        return check_value(init_expr, ast_value_type(m_ast, declared), "the initializer");
+      }
+      if (!check_expr(init_expr, type)) return false;
+      // a slice names the elements of another one, arrays are not copied
+      const auto sequence = ast_sequence_type(m_ast, init_expr);
+      if (sequence != UndefinedAstNodeIndex && m_ast[sequence].kind == AstNode::Kind::SliceType) {
+        m_ast[variable].local_variable.value.type = sequence;
+        return true;
+      }
+      if (!is_value(type)) {
+        fail(variable, "cannot declare '" + name(m_ast[variable].local_variable.name) + "' from " +
+                       describe(init_expr, type));
+        return false;
+      }
+      m_ast[variable].local_variable.value.type = create_type(type);
+      return true;
+    }
+    case AstNode::Kind::ExprStmt:
+      return check_expr(node.expr_stmt.expr, type);
+    case AstNode::Kind::ReturnStmt: {
+      const auto& fun_type = m_ast[m_ast[m_function].function.function_type_with_named_params];
+      const auto return_type = ast_value_type(m_ast, fun_type.fun_type_with_named_params.fun_type.return_type);
+      const auto function_name = name(m_ast[m_function].scope.name);
+      if (node.return_stmt.expr == UndefinedAstNodeIndex) {
+        if (return_type == IrType::Void) return true;
+        fail(stmt, "'" + function_name + "' must return a value");
+        return false;
+      }
+      if (return_type == IrType::Void) {
+        fail(stmt, "'" + function_name + "' returns no value");
+        return false;
+      }
+      return check_value(node.return_stmt.expr, return_type, "the return value");
+    }
+    case AstNode::Kind::IfElseStmt:
+      if (!check_value(node.if_else_stmt.expr, IrType::Bool, "the condition")) return false;
+      if (!check_stmt(node.if_else_stmt.stmt)) return false;
+      return node.if_else_stmt.else_stmt == UndefinedAstNodeIndex || check_stmt(node.if_else_stmt.else_stmt);
+    case AstNode::Kind::WhileStmt:
+      return check_value(node.while_stmt.expr, IrType::Bool, "the condition") && check_stmt(node.while_stmt.stmt);
+    case AstNode::Kind::RegionStmt:
+      return check_stmt(node.region_stmt.stmt);
+    default:
+      return true;
+  }
+}
+
+bool Parser::check_expr(AstNodeIndex expr, IrType& type) {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::LocalVariable: {
+      const auto variable_type = node.local_variable.value.type;
+      type = is_struct(variable_type) || is_sequence(variable_type) ? IrType::Ptr : ast_value_type(m_ast, variable_type);
+      return true;
+    }
+    case AstNode::Kind::FieldExpr: {
+      const auto field_type = m_ast[node.field_expr.field].struct_field.value.type;
+      type = is_struct(field_type) ? IrType::Ptr : ast_value_type(m_ast, field_type);
+      return true;
+    }
+    case AstNode::Kind::ParenthExpr:
+      return check_expr(node.parenth_expr.expr, type);
+    case AstNode::Kind::NegExpr:
+      if (!check_expr(node.neg_expr.expr, type)) return false;
+      if (is_value(type)) return true;
+      fail(expr, "cannot negate " + describe(node.neg_expr.expr, type));
+      return false;
+    case AstNode::Kind::AssignExpr: {
+      const auto left = node.assign_expr.left;
+      if (!check_expr(left, type)) return false;
+      if (type == IrType::Ptr) {
+        fail(expr, ast_sequence_type(m_ast, left) != UndefinedAstNodeIndex
+                     ? "arrays and slices can only be assigned element by element"
+                     : "struct values can only be assigned field by field");
+        return false;
+      }
+      // lanes are assigned through the vector variable they belong to
+      if (m_ast[left].kind == AstNode::Kind::LaneExpr) {
+        const auto variable = m_ast[left].lane_expr.expr;
+        if (m_ast[variable].kind != AstNode::Kind::LocalVariable) {
+          fail(expr, "cannot assign to this expression");
+          return false;
+        }
+        if (m_values.count(variable)) {
+          fail(expr, "cannot assign to val '" + name(m_ast[variable].local_variable.name) + "'");
+          return false;
+        }
+      }
+      return check_value(node.assign_expr.right, type, "the assigned value");
+    }
+    case AstNode::Kind::CallExpr: {
+      const auto& fun_type = m_ast[m_ast[node.call_expr.function].function.function_type_with_named_params]
+        .fun_type_with_named_params.fun_type;
+      const size_t params = fun_type.param_types ? fun_type.param_types->size() : 0;
+      const size_t args = node.call_expr.args ? node.call_expr.args->size() : 0;
+      const auto function_name = name(m_ast[node.call_expr.function].scope.name);
+      if (params != args) {
+        fail(expr, "'" + function_name + "' takes " + std::to_string(params) + " arguments, not " + std::to_string(args));
+        return false;
+      }
+      for (size_t arg = 0; arg < args; ++arg) {
+        const auto param_type = (*fun_type.param_types)[arg];
+        if (m_ast[param_type].kind == AstNode::Kind::SliceType) {
+          if (!check_slice((*node.call_expr.args)[arg], param_type, "the argument")) return false;
+          continue;
+        }
+        if (!check_value((*node.call_expr.args)[arg], ast_value_type(m_ast, param_type), "the argument")) return false;
+      }
+      type = ast_value_type(m_ast, fun_type.return_type);
+      return true;
+    }
+    case AstNode::Kind::AddExpr:
+    case AstNode::Kind::SubExpr:
+    case AstNode::Kind::MulExpr:
+    case AstNode::Kind::DivExpr:
+    case AstNode::Kind::EqualExpr:
+    case AstNode::Kind::GreatExpr:
+    case AstNode::Kind::GreatOrEqualExpr:
+    case AstNode::Kind::LessExpr:
+    case AstNode::Kind::LessOrEqualExpr: {
+      IrType left_type;
+      IrType right_type;
+      if (!check_expr(node.add_expr.left, left_type) || !check_expr(node.add_expr.right, right_type)) return false;
+      if (!unify(node.add_expr.left, left_type, node.add_expr.right, right_type, type)) {
+        fail(expr, "mismatched operands, " + describe(node.add_expr.left, left_type) + " and " +
+                   describe(node.add_expr.right, right_type));
+        return false;
+      }
+      if (node.kind == AstNode::Kind::DivExpr && type == IrType::I32x4) {
+        fail(expr, "i32x4 has no division");
+        return false;
+      }
+      // vector compares give 1 in the lanes where they hold, 0 elsewhere
+      if (node.kind == AstNode::Kind::AddExpr || node.kind == AstNode::Kind::SubExpr ||
+          node.kind == AstNode::Kind::MulExpr || node.kind == AstNode::Kind::DivExpr || ir_is_vector(type)) {
+        return true;
+      }
+      type = IrType::Bool;
+      return true;
+    }
+    case AstNode::Kind::VectorExpr: {
+      type = ast_value_type(m_ast, node.vector_expr.value.type);
+      const auto& args = *node.vector_expr.args;
+      if (args.size() != 1 && args.size() != ir_vector_lanes(type)) {
+        fail(expr, std::string(type_name(type)) + " takes 1 or " + std::to_string(ir_vector_lanes(type)) +
+                   " lanes, not " + std::to_string(args.size()));
+        return false;
+      }
+      for (auto arg : args) {
+        if (!check_value(arg, ir_element_type(type), "the lane")) return false;
+      }
+      return true;
+    }
+    case AstNode::Kind::LaneExpr:
+      if (!check_expr(node.lane_expr.expr, type)) return false;
+      if (!ir_is_vector(type)) {
+        fail(expr, std::string("cannot take a lane of ") + type_name(type));
+        return false;
+      }
+      if (node.lane_expr.lane >= ir_vector_lanes(type)) {
+        fail(expr, std::string(type_name(type)) + " has no lane " + std::to_string(node.lane_expr.lane));
+        return false;
+      }
+      type = ir_element_type(type);
+      return true;
+    case AstNode::Kind::IndexExpr: {
+      const auto base = node.index_expr.expr;
+      if (!check_expr(base, type)) return false;
+      const auto sequence = ast_sequence_type(m_ast, base);
+      if (sequence != UndefinedAstNodeIndex) {
+        type = ast_value_type(m_ast, m_ast[sequence].array_type.element);
+        return check_value(node.index_expr.index, IrType::I32, "the index");
+      }
+      if (!ir_is_vector(type)) {
+        fail(expr, "cannot index " + describe(base, type));
+        return false;
+      }
+      // lanes of vectors are constants
+      const auto& index = m_ast[node.index_expr.index];
+      if (index.kind != AstNode::Kind::I32Literal) {
+        fail(expr, "the lane of a vector must be a literal");
+        return false;
+      }
+      if (index.i32_literal.literal_value < 0) {
+        fail(expr, "lane out of range");
+        return false;
+      }
+      const uint32_t lane = index.i32_literal.literal_value;
+      auto& lane_expr = m_ast[expr];
+      lane_expr.kind = AstNode::Kind::LaneExpr;
+      lane_expr.lane_expr.expr = base;
+      lane_expr.lane_expr.lane = lane;
+      return check_expr(expr, type);
+    }
+    case AstNode::Kind::SliceExpr: {
+      const auto base = node.slice_expr.expr;
+      if (!check_expr(base, type)) return false;
+      const auto sequence = ast_sequence_type(m_ast, base);
+      if (sequence == UndefinedAstNodeIndex) {
+        fail(expr, "cannot slice " + describe(base, type));
+        return false;
+      }
+      if (!check_value(node.slice_expr.low, IrType::I32, "the index") ||
+          !check_value(node.slice_expr.high, IrType::I32, "the index")) {
+        return false;
+      }
+      if (node.slice_expr.value.type == UndefinedAstNodeIndex) {
+        const auto slice_type = create(AstNode::Kind::SliceType);
+        m_lines[slice_type] = m_lines[expr];
+        m_ast[slice_type].array_type.element = m_ast[sequence].array_type.element;
+        m_ast[expr].slice_expr.value.type = slice_type;
+      }
+      type = IrType::Ptr;
+      return true;
+    }
+    case AstNode::Kind::LengthExpr:
+      if (!check_expr(node.length_expr.expr, type)) return false;
+      if (ast_sequence_type(m_ast, node.length_expr.expr) == UndefinedAstNodeIndex) {
+        fail(expr, "'.len' needs an array or a slice, not " + describe(node.length_expr.expr, type));
+        return false;
+      }
+      type = IrType::I32;
+      return true;
+    case AstNode::Kind::NewExpr:
+      if (!check_value(node.new_expr.length, IrType::I32, "the length")) return false;
+      type = IrType::Ptr;
+      return true;
+    case AstNode::Kind::SpawnExpr: {
+      const auto call = node.spawn_expr.expr;
+      if (!check_expr(call, type)) return false;
+      const auto function = m_ast[call].call_expr.function;
+      const auto function_name = name(m_ast[function].scope.name);
+      if (type != IrType::I32 && type != IrType::Void) {
+        fail(expr, "cannot spawn '" + function_name + "', it returns " + type_name(type));
+        return false;
+      }
+      // the arguments are copied to the task, 8 bytes each
+      const auto* params = m_ast[m_ast[function].function.function_type_with_named_params]
+        .fun_type_with_named_params.fun_type.param_types;
+      if (params && params->size() > TaskMaxArgs) {
+        fail(expr, "cannot spawn '" + function_name + "', it takes more than " + std::to_string(TaskMaxArgs) +
+                   " arguments");
+        return false;
+      }
+      for (size_t param = 0; params && param < params->size(); ++param) {
+        if (!is_scalar(ast_value_type(m_ast, (*params)[param])) || is_sequence((*params)[param])) {
+          fail(expr, "cannot spawn '" + function_name + "', it takes arguments that are not scalars");
+          return false;
+        }
+      }
+      type = IrType::I32;
+      return true;
+    }
+    case AstNode::Kind::JoinExpr:
+      if (!check_value(node.join_expr.expr, IrType::I32, "the task")) return false;
+      type = IrType::I32;
+      return true;
+    case AstNode::Kind::ShuffleExpr: {
+      if (!check_expr(node.shuffle_expr.expr, type)) return false;
+      if (!ir_is_vector(type)) {
+        fail(expr, std::string("cannot shuffle ") + type_name(type));
+        return false;
+      }
+      const auto lanes = ir_vector_lanes(type);
+      bool in_range = node.shuffle_expr.count == lanes;
+      for (uint32_t lane = 0; lane < node.shuffle_expr.count; ++lane) {
+        in_range = in_range && (node.shuffle_expr.lanes >> 4 * lane & 15) < lanes;
+      }
+      if (!in_range) {
+        fail(expr, std::string("shuffling ") + type_name(type) + " takes " + std::to_string(lanes) + " lanes below " +
+                   std::to_string(lanes));
+        return false;
+      }
+      return true;
+    }
+    default:
+      type = ast_expr_type(m_ast, expr);
+      return true;
+  }
+}
+
+bool Parser::check_value(AstNodeIndex expr, IrType type, const char* what) {
+  IrType actual;
+  if (!check_expr(expr, actual)) return false;
+  if (actual == type || (is_scalar(actual) && convert_literal(expr, type))) return true;
+  fail(expr, std::string(what) + " is " + describe(expr, actual) + " where " + type_name(type) + " is expected");
+  return false;
+}
+
+bool Parser::check_slice(AstNodeIndex expr, AstNodeIndex type, const char* what) {
+  IrType actual;
+  if (!check_expr(expr, actual)) return false;
+  const auto sequence = ast_sequence_type(m_ast, expr);
+  const auto element = ast_value_type(m_ast, m_ast[type].array_type.element);
+  if (sequence != UndefinedAstNodeIndex && ast_value_type(m_ast, m_ast[sequence].array_type.element) == element) {
+    return true;
+  }
+  fail(expr, std::string(what) + " is " + describe(expr, actual) + " where [" + type_name(element) + "] is expected");
+  return false;
+}
+
+bool Parser::unify(AstNodeIndex left, IrType left_type, AstNodeIndex right, IrType right_type, IrType& type) {
+  if (!is_value(left_type) || !is_value(right_type)) return false;
+  type = left_type;
+  if (left_type == right_type || convert_literal(right, left_type)) return true;
+  type = right_type;
+  return convert_literal(left, right_type);
+}
+
+bool Parser::convert_literal(AstNodeIndex expr, IrType type) {
+  auto& node = m_ast[expr];
+  if (node.kind == AstNode::Kind::ParenthExpr) return convert_literal(node.parenth_expr.expr, type);
+  int64_t integer = 0;
+  double real = 0;
+  bool is_float = false;
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal: integer = node.i8_literal.literal_value; break;
+    case AstNode::Kind::I16Literal: integer = node.i16_literal.literal_value; break;
+    case AstNode::Kind::I32Literal: integer = node.i32_literal.literal_value; break;
+    case AstNode::Kind::U8Literal: integer = node.u8_literal.literal_value; break;
+    case AstNode::Kind::U16Literal: integer = node.u16_literal.literal_value; break;
+    case AstNode::Kind::U32Literal: integer = node.u32_literal.literal_value; break;
+    case AstNode::Kind::F32Literal: real = node.f32_literal.literal_value; is_float = true; break;
+    case AstNode::Kind::F64Literal: real = node.f64_literal.literal_value; is_float = true; break;
+    default: return false;
+  }
+  if (ir_is_vector(type)) {
+    // a literal where a vector is expected sets every lane
+    if (is_float && !ir_is_float(ir_element_type(type))) return false;
+    const auto lane = create(is_float ? AstNode::Kind::F64Literal : AstNode::Kind::I32Literal);
+    m_lines[lane] = m_lines[expr];
+    auto& lane_node = m_ast[lane];
+    lane_node.value.type = create(is_float ? AstNode::Kind::F64Type : AstNode::Kind::I32Type);
+    if (is_float) {
+      lane_node.f64_literal.literal_value = real;
+    } else {
+      lane_node.i32_literal.literal_value = static_cast<int32_t>(integer);
+    }
+    convert_literal(lane, ir_element_type(type));
+    const auto value_type = node.value.type;
+    node.kind = AstNode::Kind::VectorExpr;
+    node.vector_expr.args = nullptr;
+    node.vector_expr.add_arg(lane);
+    m_ast[value_type].kind = type_kind(type);
+    return true;
+  }
+  if (!is_scalar(type) || (is_float && !ir_is_float(type))) return false;
 
-  while (m_lexer.last().get_kind() != Token::Kind::RightBrace 
-    && m_lexer.last().get_kind() != Token::Kind::Eof) {
-    m_lexer.next();
+  const auto value_type = node.value.type;
+  node.i64_literal.literal_value = 0;
+  switch (type) {
+    case IrType::I8: node.kind = AstNode::Kind::I8Literal; node.i8_literal.literal_value = integer; break;
+    case IrType::I16: node.kind = AstNode::Kind::I16Literal; node.i16_literal.literal_value = integer; break;
+    case IrType::I32: node.kind = AstNode::Kind::I32Literal; node.i32_literal.literal_value = integer; break;
+    case IrType::U8: node.kind = AstNode::Kind::U8Literal; node.u8_literal.literal_value = integer; break;
+    case IrType::U16: node.kind = AstNode::Kind::U16Literal; node.u16_literal.literal_value = integer; break;
+    case IrType::U32: node.kind = AstNode::Kind::U32Literal; node.u32_literal.literal_value = integer; break;
+    case IrType::F32:
+      node.kind = AstNode::Kind::F32Literal;
+      node.f32_literal.literal_value = is_float ? real : integer;
+      break;
+    default:
+      node.kind = AstNode::Kind::F64Literal;
+      node.f64_literal.literal_value = is_float ? real : integer;
+      break;
   }
+  m_ast[value_type].kind = type_kind(type);
+  return true;
 }
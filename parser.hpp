@@ -1,21 +1,143 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include "ast.hpp"
 #include "id_cache.hpp"
+#include "ir.hpp"
+#include "token.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 class Lexer;
-class Ast;
-class IdCache;
 
+// longest array, in elements
+static const uint32_t MaxArrayLength = 1 << 16;
+// float and vector parameters passed in registers, vectors must be among them
+static const uint32_t MaxFloatRegisterParams = 8;
+
+// Recursive descent parser for whole modules:
+//
+//   module := (struct | function)*
+//   struct := 'struct' id '{' (id ':' type ';')* '}'
+//   function := 'fun' id '(' (id ':' type (',' id ':' type)*)? ')' ('->' type)? block
+//   stmt := block | ('var' | 'val') id (':' type)? ('=' expr)? ';'
+//         | 'if' '(' expr ')' stmt ('else' stmt)? | 'while' '(' expr ')' stmt
+//         | 'region' block | 'return' expr? ';' | expr ';'
+//   type := scalar | vector_type | id | '[' type (';' i32_literal)? ']'
+//   expr := assignment over ==, < > <= >=, + -, * /, unary -, field access,
+//           indexing a[i], slicing a[low:high] and a.len
+//   primary := ... | vector_type '(' expr (',' expr)* ')' | 'shuffle' '(' expr (',' lane)* ')'
+//            | 'new' '[' type ';' expr ']' | 'spawn' id '(' args ')' | 'join' '(' expr ')'
+//
+// Names are resolved while parsing through the scope nodes of the Ast, so
+// expressions refer to the LocalVariable, StructField and Function nodes
+// directly; functions may be called before they are declared, structs
+// must be declared before they are used. Struct fields are laid out like
+// C lays them out. Types are checked as far as the backends need: operands
+// agree in type, with integer and float literals taking the type of the
+// other side, struct values only appear as the base of a field access and
+// conditions are comparisons. Variables declared without an initializer
+// start at zero. The vector types f32x4, f32x8 and i32x4 work element-wise
+// with a literal operand setting every lane; their compares give 1 in the
+// lanes where they hold and 0 elsewhere, so they are no conditions.
+// Indexing a vector takes a literal lane, and vector parameters are
+// among the first MaxFloatRegisterParams float and vector ones. Arrays [T; n] hold n scalars
+// and start at zero; slices [T] name a range of an array or of another
+// slice and are how arrays are passed to functions. Both are indexed with
+// checked i32 indices and neither is copied, assigned or returned whole.
+// new [T; n] is a slice of n zeroed elements, allocated in the region
+// statement lexically around it and freed when the region's block ends;
+// since slices cannot be assigned or returned, none outlives its region.
+// spawn f(args) runs the call as a green thread and is an i32 handle that
+// join(handle) waits for, giving the i32 the function returned, 0 for
+// functions without a result. Spawned functions take at most TaskMaxArgs
+// scalars; a task only joins the handles it spawned, and the ones it did
+// not join are joined when it ends.
 class Parser {
 public:
-  Parser(Lexer& lexer, Ast& ast, IdCache& id_cache) : 
+  Parser(Lexer& lexer, Ast& ast, IdCache& id_cache) :
     m_lexer(lexer), m_ast(ast), m_id_cache(id_cache) {}
 
-  void parse();
+  // parses the module into a new GlobalScope node, false on the first
+  // error, which error() describes
+  bool parse();
+  AstNodeIndex global_scope() const { return m_global_scope; }
+  const std::string& error() const { return m_error; }
+  // source line of every node the parser created, 0 for other nodes
+  const std::vector<uint32_t>& lines() const { return m_lines; }
+
 private:
   Lexer& m_lexer;
   Ast& m_ast;
   IdCache& m_id_cache;
+  AstNodeIndex m_global_scope = UndefinedAstNodeIndex;
+  // innermost scope names are looked up in, and the function being parsed
+  // or checked
+  AstNodeIndex m_scope = UndefinedAstNodeIndex;
+  AstNodeIndex m_function = UndefinedAstNodeIndex;
+  // statement being checked
+  AstNodeIndex m_stmt = UndefinedAstNodeIndex;
+  // functions called before their declaration, with the line of the call
+  std::vector<std::pair<AstNodeIndex, uint32_t>> m_undeclared;
+  // variables declared with val
+  std::unordered_set<AstNodeIndex> m_values;
+  // region statements around the statement being parsed
+  uint32_t m_regions = 0;
+  // source line of every node the parser created, for errors found later
+  std::vector<uint32_t> m_lines;
+  std::string m_error;
+
+  Token::Kind kind();
+  void advance();
+  bool accept(Token::Kind kind);
+  bool expect(Token::Kind kind, const char* what);
+  // records the first error, at the current line or the line of node;
+  // returns UndefinedAstNodeIndex so parse functions can return it
+  AstNodeIndex fail(const std::string& message);
+  AstNodeIndex fail(AstNodeIndex node, const std::string& message);
+  IdIndex id();
+  std::string name(IdIndex id) const;
+  AstNodeIndex create(AstNode::Kind kind);
+  AstNodeIndex create_scope(AstNode::Kind kind, IdIndex name);
+  AstNodeIndex create_type(IrType type);
+
+  bool parse_struct();
+  bool parse_function();
+  AstNodeIndex parse_type();
+  AstNodeIndex parse_block();
+  AstNodeIndex parse_stmt();
+  AstNodeIndex parse_var_decl();
+  AstNodeIndex parse_condition();
+  AstNodeIndex parse_expr();
+  AstNodeIndex parse_binary(uint32_t level);
+  AstNodeIndex parse_unary();
+  AstNodeIndex parse_primary();
+  AstNodeIndex parse_call(IdIndex name);
+
+  AstNodeIndex lookup(IdIndex name) const;
+  bool is_struct(AstNodeIndex type) const;
+  // arrays and slices
+  bool is_sequence(AstNodeIndex type) const;
+  // the type of expr for messages, spelling out arrays and slices
+  std::string describe(AstNodeIndex expr, IrType type) const;
+  uint32_t alignment(AstNodeIndex type) const;
+
+  // types are checked once every function is declared; struct, array and
+  // slice values have the type Ptr
+  bool check_stmt(AstNodeIndex stmt);
+  bool check_expr(AstNodeIndex expr, IrType& type);
+  // checks expr where a value of type is expected
+  bool check_value(AstNodeIndex expr, IrType type, const char* what);
+  // checks expr where the SliceType type is expected, which any array or
+  // slice of the same elements is
+  bool check_slice(AstNodeIndex expr, AstNodeIndex type, const char* what);
+  // the common type of two operands, converting a literal on either side
+  bool unify(AstNodeIndex left, IrType left_type, AstNodeIndex right, IrType right_type, IrType& type);
+  // gives a literal the type, false for other expressions or a float
+  // literal where an integer is expected
+  bool convert_literal(AstNodeIndex expr, IrType type);
 };
 
 #endif  // PARSER_HPP
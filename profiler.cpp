@@ -0,0 +1,134 @@
+#include "profiler.hpp"
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// glibc before 2.41 only has the member behind the union
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// the profiler whose VM the signal handler asks for samples
+static std::atomic<Profiler*> s_active{nullptr};
+
+Profiler::Profiler(const ProfilerOptions& options)
+  : m_options(options), m_stacks(new Stack[options.max_stacks]), m_frames(new RegSampleFrame[options.max_frames]) {}
+
+Profiler::~Profiler() {
+  stop();
+}
+
+bool Profiler::start(RegVm& vm) {
+  if (m_vm || m_options.frequency == 0) return false;
+  Profiler* expected = nullptr;
+  if (!s_active.compare_exchange_strong(expected, this)) return false;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handle_signal;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &m_previous) != 0) {
+    s_active.store(nullptr);
+    return false;
+  }
+  // the signal goes to this thread. CPU time clocks only expire on
+  // scheduler ticks, which would cap sampling at a few hundred hertz.
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+  if (timer_create(CLOCK_MONOTONIC, &event, &m_timer) != 0) {
+    sigaction(SIGPROF, &m_previous, nullptr);
+    s_active.store(nullptr);
+    return false;
+  }
+  m_vm = &vm;
+  m_vm->set_profiler(this);
+  const uint64_t period = 1000000000 / m_options.frequency;
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = period / 1000000000;
+  interval.it_interval.tv_nsec = period % 1000000000;
+  interval.it_value = interval.it_interval;
+  timer_settime(m_timer, 0, &interval, nullptr);
+  return true;
+}
+
+void Profiler::stop() {
+  if (!m_vm) return;
+  timer_delete(m_timer);
+  s_active.store(nullptr);
+  sigaction(SIGPROF, &m_previous, nullptr);
+  m_vm->set_profiler(nullptr);
+  m_vm = nullptr;
+}
+
+void Profiler::handle_signal(int, siginfo_t*, void*) {
+  const int saved_errno = errno;
+  if (auto* profiler = s_active.load(std::memory_order_acquire)) profiler->m_vm->request_sample();
+  errno = saved_errno;
+}
+
+void Profiler::record(const RegSampleFrame* frames, uint32_t depth) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (uint32_t i = 0; i < depth; ++i) {
+    hash = (hash ^ (uint64_t{frames[i].function} << 32 | frames[i].offset)) * 0x100000001b3;
+    hash ^= hash >> 32;
+  }
+  hash |= 1;
+
+  const uint32_t capacity = m_options.max_stacks;
+  for (uint32_t probe = 0, index = hash % capacity; probe < capacity; ++probe, index = (index + 1) % capacity) {
+    auto& stack = m_stacks[index];
+    const auto stack_hash = stack.hash.load(std::memory_order_acquire);
+    if (stack_hash == hash && stack.depth == depth &&
+        !memcmp(&m_frames[stack.first], frames, depth * sizeof(RegSampleFrame))) {
+      stack.count.fetch_add(1, std::memory_order_relaxed);
+      m_samples.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (stack_hash != 0) continue;
+    // a free entry, published once it is complete
+    const uint32_t first = m_frames_used.load(std::memory_order_relaxed);
+    if (first + uint64_t{depth} > m_options.max_frames) break;
+    memcpy(&m_frames[first], frames, depth * sizeof(RegSampleFrame));
+    m_frames_used.store(first + depth, std::memory_order_relaxed);
+    stack.first = first;
+    stack.depth = depth;
+    stack.count.store(1, std::memory_order_relaxed);
+    stack.hash.store(hash, std::memory_order_release);
+    m_samples.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Profiler::write_folded(std::ostream& out, const RegBytecodeModule& module, const IdCache& id_cache) const {
+  // offsets on the same line name the same frame
+  std::map<std::string, uint64_t> lines;
+  for (uint32_t index = 0; index < m_options.max_stacks; ++index) {
+    const auto& stack = m_stacks[index];
+    if (stack.hash.load(std::memory_order_acquire) == 0) continue;
+    const auto count = stack.count.load(std::memory_order_relaxed);
+    std::string line;
+    for (uint32_t frame = stack.depth; frame-- > 0;) {
+      const auto& sample = m_frames[stack.first + frame];
+      const auto& function = module.functions[sample.function];
+      if (function.name != UndefinedIdIndex) {
+        const auto& name = id_cache.get(function.name);
+        line.append(name.str, name.length);
+      } else {
+        line += "function" + std::to_string(sample.function);
+      }
+      const auto source_line = function.line(sample.offset);
+      line += source_line ? ":" + std::to_string(source_line) : "+" + std::to_string(sample.offset);
+      if (frame) line += ';';
+    }
+    lines[line] += count;
+  }
+  for (const auto& [line, count] : lines) out << line << ' ' << count << '\n';
+}
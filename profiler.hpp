@@ -0,0 +1,82 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "id_cache.hpp"
+#include "reg_bytecode.hpp"
+#include "reg_vm.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <signal.h>
+#include <time.h>
+
+struct ProfilerOptions {
+  // samples per second
+  uint32_t frequency = 1000;
+  // distinct stacks and frames of all of them kept, samples of new stacks
+  // beyond either are dropped
+  uint32_t max_stacks = 1 << 14;
+  uint32_t max_frames = 1 << 20;
+};
+
+// Sampling profiler for RegVm. A timer of the thread running the VM raises
+// SIGPROF on that thread; the handler only asks the VM for a sample, which
+// the VM takes before its next instruction (reg_vm.hpp), so stacks are
+// always consistent. Stacks are counted in an open addressed table
+// allocated up front and never locked: new entries are published with a
+// release store of their hash and counts are atomic, so the table can be
+// read while sampling goes on. Stacks deeper than MaxDepth lose their
+// outermost calls. Time spent in compiled code of a tiered VM is charged
+// to the first interpreted instruction after it. One profiler runs at a
+// time.
+class Profiler {
+public:
+  static const uint32_t MaxDepth = 256;
+
+  explicit Profiler(const ProfilerOptions& options = {});
+  Profiler(const Profiler&) = delete;
+  Profiler(Profiler&&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+  Profiler& operator=(Profiler&&) = delete;
+  ~Profiler();
+
+  // starts sampling vm, which must run on the calling thread, as must
+  // stop(); false when another profiler is running or the timer cannot be
+  // set up
+  bool start(RegVm& vm);
+  void stop();
+  uint64_t samples() const { return m_samples.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+  // called by RegVm with the calls in progress, innermost first
+  void record(const RegSampleFrame* frames, uint32_t depth);
+
+  // one line per stack, callers first, "main:12;fib:4;fib:5 42", the
+  // folded format flame graph tools read. Frames are named after their
+  // function and source line, or the word offset in its code when the
+  // module has no line tables.
+  void write_folded(std::ostream& out, const RegBytecodeModule& module, const IdCache& id_cache) const;
+
+private:
+  struct Stack {
+    // 0 while the entry is free, stored last
+    std::atomic<uint64_t> hash{0};
+    uint32_t first = 0;
+    uint32_t depth = 0;
+    std::atomic<uint64_t> count{0};
+  };
+
+  ProfilerOptions m_options;
+  std::unique_ptr<Stack[]> m_stacks;
+  std::unique_ptr<RegSampleFrame[]> m_frames;
+  std::atomic<uint32_t> m_frames_used{0};
+  std::atomic<uint64_t> m_samples{0};
+  std::atomic<uint64_t> m_dropped{0};
+  RegVm* m_vm = nullptr;
+  timer_t m_timer;
+  struct sigaction m_previous;
+
+  static void handle_signal(int signal, siginfo_t* info, void* context);
+};
+
+#endif  // PROFILER_HPP
@@ -0,0 +1,296 @@
+#ifndef REG_BYTECODE_HPP
+#define REG_BYTECODE_HPP
+
+#include "id_cache.hpp"
+#include "ir.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Instruction set of the register machine in reg_vm.hpp. Code is an array
+// of 32 bit words, an opcode word followed by its operands. Registers are
+// slots of the frame: the parameters first, then the other locals, then
+// temporaries. Jump targets are word offsets into the function's code, so
+// code can be moved or mapped anywhere.
+//   Const               dst imm            f64 takes two words, low first
+//   Move                dst src
+//   Add .. LessOrEqual  dst a b            comparisons produce 0 or 1
+//   Neg                 dst a
+//   LoadField           dst offset         byte offset from the first slot
+//   StoreField          offset src
+//   Jump                target
+//   JumpIfFalse         cond target
+//   Call                dst function first arguments are in first, first+1..
+//   Return              src
+//   ReturnVoid
+//   Counter             index              adds one to a counter of the run
+// Arrays and slices are named by two slots, a pointer to the elements and
+// the length. An array's elements follow those two slots in the frame.
+//   FrameAddress        dst slot           pointer to a slot of the frame
+//   Subslice            dst s low high size the elements low..high of s, if
+//                                          low <= high <= length
+//   LoadElement         dst s index        fail unless index < length
+//   StoreElement        s index src
+// Regions allocate from the RegionArena of the running thread:
+//   RegionEnter
+//   RegionLeave
+//   NewSlice            dst n size         n zeroed elements of size bytes, if
+//                                          0 <= n and n * size <= RegionMaxBytes
+// Tasks run on the TaskScheduler of task.hpp, each in a RegVm of its own:
+//   Spawn               dst function first the call as a task, dst its handle
+//   Join                dst task           the task's result once it ended
+// Superinstructions fuse the sequences that dominate loops and struct code:
+//   AddImm              dst a imm          a + imm
+//   AddField            dst a offset       a + field
+//   JumpUnless<Cmp>     a b target         compare and branch
+//   IncrementLessJump   r imm bound target r += imm, jump while r < bound
+// Vectors take 2 (f32x4, i32x4) or 4 (f32x8) consecutive slots named by
+// the first, lane 0 in the lowest bytes. Their instructions are typed too:
+//   Move, Return        like the scalar ones, for the whole vector
+//   Splat               dst a              every lane set to the scalar a
+//   Lane                dst v lane         scalar dst
+//   InsertLane          dst v a lane       v with the lane set to a
+//   Shuffle             dst v lanes        lane i from lane (lanes >> 4 * i & 15)
+//   Add .. Neg          dst a b            element-wise
+//   Equal .. LessOrEqual dst a b           lanes of 1 where the compare holds, else 0
+#define REG_BYTECODE_TYPED_OPCODES(X, T) \
+  X(Const##T) X(Add##T) X(Sub##T) X(Mul##T) X(Div##T) X(Neg##T) \
+  X(Equal##T) X(Great##T) X(GreatOrEqual##T) X(Less##T) X(LessOrEqual##T) \
+  X(LoadField##T) X(StoreField##T) X(AddImm##T) X(AddField##T) \
+  X(JumpUnlessEqual##T) X(JumpUnlessGreat##T) X(JumpUnlessGreatOrEqual##T) \
+  X(JumpUnlessLess##T) X(JumpUnlessLessOrEqual##T) X(IncrementLessJump##T) \
+  X(LoadElement##T) X(StoreElement##T)
+
+#define REG_BYTECODE_VECTOR_OPCODES(X, T) \
+  X(Move##T) X(Return##T) X(Splat##T) X(Lane##T) X(InsertLane##T) X(Shuffle##T) \
+  X(Add##T) X(Sub##T) X(Mul##T) X(Div##T) X(Neg##T) \
+  X(Equal##T) X(Great##T) X(GreatOrEqual##T) X(Less##T) X(LessOrEqual##T)
+
+#define REG_BYTECODE_OPCODES(X) \
+  X(Nop) X(Move) X(Jump) X(JumpIfFalse) X(Call) X(Return) X(ReturnVoid) X(Counter) \
+  X(FrameAddress) X(Subslice) X(RegionEnter) X(RegionLeave) X(NewSlice) X(Spawn) X(Join) \
+  REG_BYTECODE_TYPED_OPCODES(X, I8) REG_BYTECODE_TYPED_OPCODES(X, I16) REG_BYTECODE_TYPED_OPCODES(X, I32) \
+  REG_BYTECODE_TYPED_OPCODES(X, U8) REG_BYTECODE_TYPED_OPCODES(X, U16) REG_BYTECODE_TYPED_OPCODES(X, U32) \
+  REG_BYTECODE_TYPED_OPCODES(X, F32) REG_BYTECODE_TYPED_OPCODES(X, F64) \
+  REG_BYTECODE_VECTOR_OPCODES(X, F32x4) REG_BYTECODE_VECTOR_OPCODES(X, F32x8) REG_BYTECODE_VECTOR_OPCODES(X, I32x4)
+
+enum class RegOpcode : uint32_t {
+#define REG_BYTECODE_ENUM(name) name,
+  REG_BYTECODE_OPCODES(REG_BYTECODE_ENUM)
+#undef REG_BYTECODE_ENUM
+  Count,
+};
+
+enum class RegTypedOp : uint32_t {
+  Const, Add, Sub, Mul, Div, Neg,
+  Equal, Great, GreatOrEqual, Less, LessOrEqual,
+  LoadField, StoreField, AddImm, AddField,
+  JumpUnlessEqual, JumpUnlessGreat, JumpUnlessGreatOrEqual, JumpUnlessLess, JumpUnlessLessOrEqual,
+  IncrementLessJump, LoadElement, StoreElement,
+  Count,
+};
+
+enum class RegVectorOp : uint32_t {
+  Move, Return, Splat, Lane, InsertLane, Shuffle,
+  Add, Sub, Mul, Div, Neg,
+  Equal, Great, GreatOrEqual, Less, LessOrEqual,
+  Count,
+};
+
+static_assert(static_cast<uint32_t>(RegOpcode::ConstI16) - static_cast<uint32_t>(RegOpcode::ConstI8)
+  == static_cast<uint32_t>(RegTypedOp::Count), "typed opcode groups must match RegTypedOp");
+static_assert(static_cast<uint32_t>(RegOpcode::MoveF32x8) - static_cast<uint32_t>(RegOpcode::MoveF32x4)
+  == static_cast<uint32_t>(RegVectorOp::Count), "vector opcode groups must match RegVectorOp");
+
+// the typed instruction for values of type, Bool shares the U8 group
+inline RegOpcode reg_typed_opcode(RegTypedOp op, IrType type) {
+  const auto first = static_cast<uint32_t>(RegOpcode::ConstI8);
+  if (type == IrType::Bool) type = IrType::U8;
+  const auto group = static_cast<uint32_t>(type) - static_cast<uint32_t>(IrType::I8);
+  return static_cast<RegOpcode>(first + group * static_cast<uint32_t>(RegTypedOp::Count) + static_cast<uint32_t>(op));
+}
+
+// the vector instruction for values of a vector type
+inline RegOpcode reg_vector_opcode(RegVectorOp op, IrType type) {
+  const auto first = static_cast<uint32_t>(RegOpcode::MoveF32x4);
+  const auto group = static_cast<uint32_t>(type) - static_cast<uint32_t>(IrType::F32x4);
+  return static_cast<RegOpcode>(first + group * static_cast<uint32_t>(RegVectorOp::Count) + static_cast<uint32_t>(op));
+}
+
+// false for scalar instructions
+inline bool reg_vector_op(RegOpcode opcode, RegVectorOp& op) {
+  const auto first = static_cast<uint32_t>(RegOpcode::MoveF32x4);
+  if (static_cast<uint32_t>(opcode) < first) return false;
+  op = static_cast<RegVectorOp>((static_cast<uint32_t>(opcode) - first) % static_cast<uint32_t>(RegVectorOp::Count));
+  return true;
+}
+
+inline const char* reg_opcode_name(RegOpcode opcode) {
+  static const char* names[] = {
+#define REG_BYTECODE_NAME(name) #name,
+    REG_BYTECODE_OPCODES(REG_BYTECODE_NAME)
+#undef REG_BYTECODE_NAME
+  };
+  return names[static_cast<uint32_t>(opcode)];
+}
+
+// number of operand words following the opcode word
+inline uint32_t reg_operand_count(RegOpcode opcode) {
+  switch (opcode) {
+    case RegOpcode::Nop: return 0;
+    case RegOpcode::Move: return 2;
+    case RegOpcode::Jump: return 1;
+    case RegOpcode::JumpIfFalse: return 2;
+    case RegOpcode::Call: return 3;
+    case RegOpcode::Return: return 1;
+    case RegOpcode::ReturnVoid: return 0;
+    case RegOpcode::Counter: return 1;
+    case RegOpcode::FrameAddress: return 2;
+    case RegOpcode::Subslice: return 5;
+    case RegOpcode::RegionEnter: return 0;
+    case RegOpcode::RegionLeave: return 0;
+    case RegOpcode::NewSlice: return 3;
+    case RegOpcode::Spawn: return 3;
+    case RegOpcode::Join: return 2;
+    default: break;
+  }
+  RegVectorOp vector_op;
+  if (reg_vector_op(opcode, vector_op)) {
+    switch (vector_op) {
+      case RegVectorOp::Return: return 1;
+      case RegVectorOp::Move:
+      case RegVectorOp::Splat:
+      case RegVectorOp::Neg:
+        return 2;
+      case RegVectorOp::InsertLane: return 4;
+      default: return 3;
+    }
+  }
+  const auto typed = static_cast<uint32_t>(opcode) - static_cast<uint32_t>(RegOpcode::ConstI8);
+  switch (static_cast<RegTypedOp>(typed % static_cast<uint32_t>(RegTypedOp::Count))) {
+    case RegTypedOp::Const: return opcode == RegOpcode::ConstF64 ? 3 : 2;
+    case RegTypedOp::Neg:
+    case RegTypedOp::LoadField:
+    case RegTypedOp::StoreField:
+      return 2;
+    case RegTypedOp::IncrementLessJump: return 4;
+    default: return 3;
+  }
+}
+
+// true for instructions that may jump, with the word offset they jump to
+inline bool reg_jump_target(RegOpcode opcode, const uint32_t* operands, uint32_t& target) {
+  switch (opcode) {
+    case RegOpcode::Jump: target = operands[0]; return true;
+    case RegOpcode::JumpIfFalse: target = operands[1]; return true;
+    case RegOpcode::Nop:
+    case RegOpcode::Move:
+    case RegOpcode::Call:
+    case RegOpcode::Return:
+    case RegOpcode::ReturnVoid:
+    case RegOpcode::Counter:
+    case RegOpcode::FrameAddress:
+    case RegOpcode::Subslice:
+    case RegOpcode::RegionEnter:
+    case RegOpcode::RegionLeave:
+    case RegOpcode::NewSlice:
+    case RegOpcode::Spawn:
+    case RegOpcode::Join:
+      return false;
+    default: break;
+  }
+  RegVectorOp vector_op;
+  if (reg_vector_op(opcode, vector_op)) return false;
+  const auto typed = static_cast<uint32_t>(opcode) - static_cast<uint32_t>(RegOpcode::ConstI8);
+  switch (static_cast<RegTypedOp>(typed % static_cast<uint32_t>(RegTypedOp::Count))) {
+    case RegTypedOp::JumpUnlessEqual:
+    case RegTypedOp::JumpUnlessGreat:
+    case RegTypedOp::JumpUnlessGreatOrEqual:
+    case RegTypedOp::JumpUnlessLess:
+    case RegTypedOp::JumpUnlessLessOrEqual:
+      target = operands[2];
+      return true;
+    case RegTypedOp::IncrementLessJump:
+      target = operands[3];
+      return true;
+    default:
+      return false;
+  }
+}
+
+// code from offset on was compiled from the source line
+struct RegLine {
+  uint32_t offset;
+  uint32_t line;
+};
+
+struct RegBytecodeFunction {
+  IdIndex name = UndefinedIdIndex;
+  IrType return_type = IrType::Void;
+  uint32_t params = 0;
+  // frame size in 8 byte slots: locals, struct storage and temporaries
+  uint32_t registers = 0;
+  std::vector<uint32_t> code;
+  // ascending offsets, empty when the compiler was given no lines
+  std::vector<RegLine> lines;
+
+  // source line of the instruction at offset, 0 if unknown
+  uint32_t line(uint32_t offset) const {
+    uint32_t line = 0;
+    for (const auto& entry : lines) {
+      if (entry.offset > offset) break;
+      line = entry.line;
+    }
+    return line;
+  }
+
+  void emit(RegOpcode opcode, std::initializer_list<uint32_t> operands) {
+    code.emplace_back(static_cast<uint32_t>(opcode));
+    code.insert(code.end(), operands.begin(), operands.end());
+  }
+};
+
+// What a Counter instruction counts, the sites are numbered per function
+// in source order (execution_profile.hpp)
+struct RegCounter {
+  enum class Kind : uint32_t {
+    // entries of the function
+    Calls,
+    // executions of an if statement and how often its condition held
+    Branch, BranchTaken,
+    // executions of a while statement and of its body
+    Loop, LoopIterations,
+  };
+
+  uint32_t function;
+  Kind kind;
+  uint32_t site;
+};
+
+struct RegBytecodeModule {
+  std::vector<RegBytecodeFunction> functions;
+  // indexed by the operand of Counter instructions
+  std::vector<RegCounter> counters;
+};
+
+// What the interpreter needs of a function. The code belongs to a
+// RegBytecodeFunction or lies in a mapped image (reg_image.hpp).
+struct RegFunctionCode {
+  const uint32_t* code = nullptr;
+  uint32_t size = 0;
+  uint32_t params = 0;
+  uint32_t registers = 0;
+  IrType return_type = IrType::Void;
+};
+
+inline std::vector<RegFunctionCode> reg_function_code(const RegBytecodeModule& module) {
+  std::vector<RegFunctionCode> functions;
+  functions.reserve(module.functions.size());
+  for (const auto& function : module.functions) {
+    functions.push_back({function.code.data(), static_cast<uint32_t>(function.code.size()), function.params,
+                         function.registers, function.return_type});
+  }
+  return functions;
+}
+
+#endif  // REG_BYTECODE_HPP
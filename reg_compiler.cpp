@@ -0,0 +1,878 @@
+#include "reg_compiler.hpp"
+#include "ast_types.hpp"
+#include <cstring>
+
+static bool is_int_type(IrType type) {
+  return type != IrType::F32 && type != IrType::F64 && type != IrType::Void && !ir_is_vector(type);
+}
+
+// registers a value of the type takes
+static uint32_t slot_count(IrType type) {
+  return ir_is_vector(type) ? ir_type_size(type) / 8 : 1;
+}
+
+// registers a local of the declared type takes: structs their storage,
+// slices a pointer and a length, arrays those and their elements
+static uint32_t type_slots(const Ast& ast, AstNodeIndex type) {
+  switch (ast[type].kind) {
+    case AstNode::Kind::StructType:
+      return std::max<uint32_t>(1, (ast_type_size(ast, type) + 7) / 8);
+    case AstNode::Kind::SliceType:
+      return 2;
+    case AstNode::Kind::ArrayType:
+      return 2 + (ast_type_size(ast, type) + 7) / 8;
+    default:
+      return slot_count(ast_value_type(ast, type));
+  }
+}
+
+static RegVectorOp vector_op(RegTypedOp op) {
+  switch (op) {
+    case RegTypedOp::Add: return RegVectorOp::Add;
+    case RegTypedOp::Sub: return RegVectorOp::Sub;
+    case RegTypedOp::Mul: return RegVectorOp::Mul;
+    case RegTypedOp::Div: return RegVectorOp::Div;
+    case RegTypedOp::Neg: return RegVectorOp::Neg;
+    case RegTypedOp::Equal: return RegVectorOp::Equal;
+    case RegTypedOp::Great: return RegVectorOp::Great;
+    case RegTypedOp::GreatOrEqual: return RegVectorOp::GreatOrEqual;
+    case RegTypedOp::Less: return RegVectorOp::Less;
+    default: return RegVectorOp::LessOrEqual;
+  }
+}
+
+static AstNodeIndex strip_parenths(const Ast& ast, AstNodeIndex expr) {
+  while (ast[expr].kind == AstNode::Kind::ParenthExpr) expr = ast[expr].parenth_expr.expr;
+  return expr;
+}
+
+// the compare and branch that jumps when a compare of this kind fails
+static bool jump_unless_op(AstNode::Kind kind, RegTypedOp& op) {
+  switch (kind) {
+    case AstNode::Kind::EqualExpr: op = RegTypedOp::JumpUnlessEqual; return true;
+    case AstNode::Kind::GreatExpr: op = RegTypedOp::JumpUnlessGreat; return true;
+    case AstNode::Kind::GreatOrEqualExpr: op = RegTypedOp::JumpUnlessGreatOrEqual; return true;
+    case AstNode::Kind::LessExpr: op = RegTypedOp::JumpUnlessLess; return true;
+    case AstNode::Kind::LessOrEqualExpr: op = RegTypedOp::JumpUnlessLessOrEqual; return true;
+    default: return false;
+  }
+}
+
+// the compare and branch that jumps when an integer compare of this kind
+// holds, there is no inverse of Equal
+static bool jump_if_op(AstNode::Kind kind, RegTypedOp& op) {
+  switch (kind) {
+    case AstNode::Kind::GreatExpr: op = RegTypedOp::JumpUnlessLessOrEqual; return true;
+    case AstNode::Kind::GreatOrEqualExpr: op = RegTypedOp::JumpUnlessLess; return true;
+    case AstNode::Kind::LessExpr: op = RegTypedOp::JumpUnlessGreatOrEqual; return true;
+    case AstNode::Kind::LessOrEqualExpr: op = RegTypedOp::JumpUnlessGreat; return true;
+    default: return false;
+  }
+}
+
+void RegCompiler::compile_module(AstNodeIndex global_scope) {
+  const auto* dict = m_ast[global_scope].scope.dict;
+  if (!dict) return;
+
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) function_index(node_idx);
+  }
+  for (auto node_idx : dict->get_nodes()) {
+    if (m_ast[node_idx].kind == AstNode::Kind::Function) compile_function(node_idx);
+  }
+}
+
+uint32_t RegCompiler::function_index(AstNodeIndex function) {
+  auto it = m_function_indices.find(function);
+  if (it != m_function_indices.end()) return it->second;
+
+  const uint32_t index = m_module.functions.size();
+  m_module.functions.emplace_back();
+  auto& reg_function = m_module.functions.back();
+  const auto& function_node = m_ast[function].function;
+  reg_function.name = function_node.scope.name;
+  const auto& fun_type = m_ast[function_node.function_type_with_named_params].fun_type_with_named_params;
+  reg_function.return_type = ast_value_type(m_ast, fun_type.fun_type.return_type);
+  reg_function.params = 0;
+  if (fun_type.fun_type.param_types) {
+    for (auto type : *fun_type.fun_type.param_types) reg_function.params += type_slots(m_ast, type);
+  }
+  m_function_indices.emplace(function, index);
+  // the module may have grown under the function being compiled
+  if (m_function) m_function = &m_module.functions[m_function_index];
+  return index;
+}
+
+RegBytecodeFunction& RegCompiler::compile_function(AstNodeIndex function) {
+  const auto& function_node = m_ast[function];
+  m_function_index = function_index(function);
+  m_function = &m_module.functions[m_function_index];
+  m_function->code.clear();
+  m_function->lines.clear();
+  m_slots.clear();
+  m_locals = 0;
+
+  // parameters take the first slots, where the caller placed the arguments
+  const auto& fun_type = m_ast[function_node.function.function_type_with_named_params].fun_type_with_named_params;
+  if (fun_type.names) {
+    for (uint32_t i = 0; i < fun_type.names->size(); ++i) {
+      const auto variable = function_node.function.scope.dict
+        ? function_node.function.scope.dict->find((*fun_type.names)[i]) : UndefinedAstNodeIndex;
+      if (variable != UndefinedAstNodeIndex) m_slots[variable] = m_locals;
+      m_locals += type_slots(m_ast, (*fun_type.fun_type.param_types)[i]);
+    }
+  }
+  if (function_node.function.block_stmt != UndefinedAstNodeIndex) allocate_locals(function_node.function.block_stmt);
+  m_next_temp = m_locals;
+  m_registers = m_locals;
+  m_branch_sites = 0;
+  m_loop_sites = 0;
+  m_regions = 0;
+  emit_counter(RegCounter::Kind::Calls, 0);
+
+  if (function_node.function.block_stmt != UndefinedAstNodeIndex) {
+    compile_stmt(function_node.function.block_stmt);
+  }
+
+  if (m_function->return_type == IrType::Void) {
+    m_function->emit(RegOpcode::ReturnVoid, {});
+  } else {
+    const auto zero = allocate_temp(slot_count(m_function->return_type));
+    emit_const(m_function->return_type, zero, 0);
+    emit_return(m_function->return_type, zero);
+  }
+  m_function->registers = m_registers;
+  return *m_function;
+}
+
+void RegCompiler::mark_line(AstNodeIndex node) {
+  if (!m_options.lines || node >= m_options.lines->size() || !(*m_options.lines)[node]) return;
+  const uint32_t line = (*m_options.lines)[node];
+  const uint32_t offset = m_function->code.size();
+  auto& lines = m_function->lines;
+  if (!lines.empty() && lines.back().line == line) return;
+  if (!lines.empty() && lines.back().offset == offset) {
+    lines.back().line = line;
+  } else {
+    lines.push_back({offset, line});
+  }
+}
+
+void RegCompiler::emit_counter(RegCounter::Kind kind, uint32_t site) {
+  if (!m_options.counters) return;
+  m_function->emit(RegOpcode::Counter, {static_cast<uint32_t>(m_module.counters.size())});
+  m_module.counters.push_back({m_function_index, kind, site});
+}
+
+// every declared local gets its own slots up front, so temporaries can be
+// stacked above all of them
+void RegCompiler::allocate_locals(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt];
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (node.block_stmt.stmts) {
+        for (auto child : *node.block_stmt.stmts) allocate_locals(child);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      m_slots[variable] = m_locals;
+      m_locals += type_slots(m_ast, m_ast[variable].local_variable.value.type);
+      break;
+    }
+    case AstNode::Kind::IfElseStmt:
+      allocate_locals(node.if_else_stmt.stmt);
+      if (node.if_else_stmt.else_stmt != UndefinedAstNodeIndex) allocate_locals(node.if_else_stmt.else_stmt);
+      break;
+    case AstNode::Kind::WhileStmt:
+      allocate_locals(node.while_stmt.stmt);
+      break;
+    case AstNode::Kind::RegionStmt:
+      allocate_locals(node.region_stmt.stmt);
+      break;
+    default:
+      break;
+  }
+}
+
+uint32_t RegCompiler::allocate_temp(uint32_t slots) {
+  const auto temp = m_next_temp;
+  m_next_temp += slots;
+  m_registers = std::max(m_registers, m_next_temp);
+  return temp;
+}
+
+// byte offset of a field of a struct local from the first slot
+bool RegCompiler::field_offset(AstNodeIndex expr, uint32_t& offset) const {
+  const auto& node = m_ast[expr];
+  if (node.kind != AstNode::Kind::FieldExpr) return false;
+  const auto base = node.field_expr.expr;
+  if (m_ast[base].kind == AstNode::Kind::LocalVariable) {
+    auto it = m_slots.find(base);
+    if (it == m_slots.end()) return false;
+    offset = it->second * 8;
+  } else if (!field_offset(base, offset)) {
+    return false;
+  }
+  offset += m_ast[node.field_expr.field].struct_field.offset;
+  return true;
+}
+
+// the slot of a scalar local, UndefinedRegister for anything else
+uint32_t RegCompiler::local_slot(AstNodeIndex expr) const {
+  const auto& node = m_ast[expr];
+  if (node.kind != AstNode::Kind::LocalVariable) return UndefinedRegister;
+  auto it = m_slots.find(expr);
+  if (it == m_slots.end() || ast_value_type(m_ast, node.local_variable.value.type) == IrType::Void) return UndefinedRegister;
+  return it->second;
+}
+
+uint32_t RegCompiler::sequence_slot(AstNodeIndex expr) const {
+  expr = strip_parenths(m_ast, expr);
+  const auto& node = m_ast[expr];
+  if (node.kind != AstNode::Kind::LocalVariable) return UndefinedRegister;
+  const auto kind = m_ast[node.local_variable.value.type].kind;
+  if (kind != AstNode::Kind::ArrayType && kind != AstNode::Kind::SliceType) return UndefinedRegister;
+  auto it = m_slots.find(expr);
+  return it == m_slots.end() ? UndefinedRegister : it->second;
+}
+
+uint32_t RegCompiler::length_slot(AstNodeIndex expr) const {
+  const auto& node = m_ast[strip_parenths(m_ast, expr)];
+  if (node.kind != AstNode::Kind::LengthExpr) return UndefinedRegister;
+  const auto slot = sequence_slot(node.length_expr.expr);
+  return slot == UndefinedRegister ? UndefinedRegister : slot + 1;
+}
+
+bool RegCompiler::is_int_literal(AstNodeIndex expr, int32_t& value) const {
+  const auto& node = m_ast[strip_parenths(m_ast, expr)];
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal: value = node.i8_literal.literal_value; return true;
+    case AstNode::Kind::I16Literal: value = node.i16_literal.literal_value; return true;
+    case AstNode::Kind::I32Literal: value = node.i32_literal.literal_value; return true;
+    case AstNode::Kind::U8Literal: value = node.u8_literal.literal_value; return true;
+    case AstNode::Kind::U16Literal: value = node.u16_literal.literal_value; return true;
+    case AstNode::Kind::U32Literal: value = node.u32_literal.literal_value; return true;
+    case AstNode::Kind::CharLiteral: value = node.char_literal.chr; return true;
+    default: return false;
+  }
+}
+
+// whether evaluating expr may write a local or a field
+bool RegCompiler::has_assign(AstNodeIndex expr) const {
+  const auto& node = m_ast[expr];
+  switch (node.kind) {
+    case AstNode::Kind::AssignExpr:
+      return true;
+    case AstNode::Kind::ParenthExpr:
+    case AstNode::Kind::NegExpr:
+      return has_assign(node.parenth_expr.expr);
+    case AstNode::Kind::LaneExpr:
+      return has_assign(node.lane_expr.expr);
+    case AstNode::Kind::LengthExpr:
+      return has_assign(node.length_expr.expr);
+    case AstNode::Kind::IndexExpr:
+      return has_assign(node.index_expr.expr) || has_assign(node.index_expr.index);
+    case AstNode::Kind::SliceExpr:
+      return has_assign(node.slice_expr.expr) || has_assign(node.slice_expr.low) || has_assign(node.slice_expr.high);
+    case AstNode::Kind::NewExpr:
+      return has_assign(node.new_expr.length);
+    case AstNode::Kind::SpawnExpr:
+      return has_assign(node.spawn_expr.expr);
+    case AstNode::Kind::JoinExpr:
+      return has_assign(node.join_expr.expr);
+    case AstNode::Kind::ShuffleExpr:
+      return has_assign(node.shuffle_expr.expr);
+    case AstNode::Kind::VectorExpr:
+      for (auto arg : *node.vector_expr.args) {
+        if (has_assign(arg)) return true;
+      }
+      return false;
+    case AstNode::Kind::CallExpr:
+      if (node.call_expr.args) {
+        for (auto arg : *node.call_expr.args) {
+          if (has_assign(arg)) return true;
+        }
+      }
+      return false;
+    case AstNode::Kind::EqualExpr:
+    case AstNode::Kind::GreatExpr:
+    case AstNode::Kind::GreatOrEqualExpr:
+    case AstNode::Kind::LessExpr:
+    case AstNode::Kind::LessOrEqualExpr:
+    case AstNode::Kind::AddExpr:
+    case AstNode::Kind::SubExpr:
+    case AstNode::Kind::MulExpr:
+    case AstNode::Kind::DivExpr:
+      return has_assign(node.add_expr.left) || has_assign(node.add_expr.right);
+    default:
+      return false;
+  }
+}
+
+void RegCompiler::emit_typed(RegTypedOp op, IrType type, std::initializer_list<uint32_t> operands) {
+  if (ir_is_vector(type)) {
+    m_function->emit(reg_vector_opcode(vector_op(op), type), operands);
+  } else {
+    m_function->emit(reg_typed_opcode(op, type), operands);
+  }
+}
+
+void RegCompiler::emit_move(IrType type, uint32_t dst, uint32_t src) {
+  if (ir_is_vector(type)) {
+    m_function->emit(reg_vector_opcode(RegVectorOp::Move, type), {dst, src});
+  } else {
+    m_function->emit(RegOpcode::Move, {dst, src});
+  }
+}
+
+void RegCompiler::emit_return(IrType type, uint32_t src) {
+  if (ir_is_vector(type)) {
+    m_function->emit(reg_vector_opcode(RegVectorOp::Return, type), {src});
+  } else {
+    m_function->emit(RegOpcode::Return, {src});
+  }
+}
+
+void RegCompiler::emit_const(IrType type, uint32_t dst, int32_t value) {
+  if (ir_is_vector(type)) {
+    // the lane goes to the first slot, which Splat may overwrite
+    emit_const(ir_element_type(type), dst, value);
+    m_function->emit(reg_vector_opcode(RegVectorOp::Splat, type), {dst, dst});
+  } else if (type == IrType::F32) {
+    const float f = value;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    emit_typed(RegTypedOp::Const, type, {dst, bits});
+  } else if (type == IrType::F64) {
+    const double d = value;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    emit_typed(RegTypedOp::Const, type, {dst, static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32)});
+  } else {
+    emit_typed(RegTypedOp::Const, type, {dst, static_cast<uint32_t>(value)});
+  }
+}
+
+void RegCompiler::patch(uint32_t operand, uint32_t target) {
+  m_function->code[operand] = target;
+}
+
+void RegCompiler::compile_stmt(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt];
+  // temporaries of a statement die with it
+  const auto temps = m_next_temp;
+  if (node.kind != AstNode::Kind::BlockStmt) mark_line(stmt);
+  switch (node.kind) {
+    case AstNode::Kind::BlockStmt:
+      if (node.block_stmt.stmts) {
+        for (auto child : *node.block_stmt.stmts) compile_stmt(child);
+      }
+      break;
+    case AstNode::Kind::VariableDeclStmt: {
+      const auto variable = node.variable_decl_stmt.variable;
+      const auto type = m_ast[variable].local_variable.value.type;
+      if (m_ast[type].kind == AstNode::Kind::ArrayType) {
+        // the elements follow the pointer and the length
+        const auto first = m_slots[variable];
+        m_function->emit(RegOpcode::FrameAddress, {first, first + 2});
+        emit_const(IrType::I32, first + 1, m_ast[type].array_type.length);
+        break;
+      }
+      if (m_ast[type].kind == AstNode::Kind::SliceType) {
+        compile_slice(node.variable_decl_stmt.init_expr, m_slots[variable]);
+        break;
+      }
+      const auto slot = local_slot(variable);
+      // struct and array storage starts zeroed with the frame
+      if (slot == UndefinedRegister) break;
+      if (node.variable_decl_stmt.init_expr != UndefinedAstNodeIndex) {
+        compile_expr(node.variable_decl_stmt.init_expr, slot);
+      } else {
+        emit_const(ast_value_type(m_ast, m_ast[variable].local_variable.value.type), slot, 0);
+      }
+      break;
+    }
+    case AstNode::Kind::ExprStmt:
+      compile_expr(node.expr_stmt.expr, UndefinedRegister);
+      break;
+    case AstNode::Kind::ReturnStmt: {
+      const auto expr = node.return_stmt.expr;
+      if (m_function->return_type == IrType::Void) {
+        if (expr != UndefinedAstNodeIndex) compile_expr(expr, UndefinedRegister);
+        for (uint32_t region = 0; region < m_regions; ++region) m_function->emit(RegOpcode::RegionLeave, {});
+        m_function->emit(RegOpcode::ReturnVoid, {});
+        break;
+      }
+      uint32_t src;
+      if (expr != UndefinedAstNodeIndex) {
+        src = compile_expr(expr, UndefinedRegister);
+      } else {
+        src = allocate_temp(slot_count(m_function->return_type));
+        emit_const(m_function->return_type, src, 0);
+      }
+      // the value is computed before the regions it may read are left
+      for (uint32_t region = 0; region < m_regions; ++region) m_function->emit(RegOpcode::RegionLeave, {});
+      emit_return(m_function->return_type, src);
+      break;
+    }
+    case AstNode::Kind::IfElseStmt: {
+      const auto site = m_branch_sites++;
+      emit_counter(RegCounter::Kind::Branch, site);
+      const auto to_else = compile_branch_unless(node.if_else_stmt.expr);
+      m_next_temp = temps;
+      emit_counter(RegCounter::Kind::BranchTaken, site);
+      compile_stmt(node.if_else_stmt.stmt);
+      if (node.if_else_stmt.else_stmt == UndefinedAstNodeIndex) {
+        patch(to_else, m_function->code.size());
+        break;
+      }
+      m_function->emit(RegOpcode::Jump, {0});
+      const uint32_t to_end = m_function->code.size() - 1;
+      patch(to_else, m_function->code.size());
+      compile_stmt(node.if_else_stmt.else_stmt);
+      patch(to_end, m_function->code.size());
+      break;
+    }
+    case AstNode::Kind::WhileStmt:
+      compile_while(stmt);
+      break;
+    case AstNode::Kind::RegionStmt:
+      m_function->emit(RegOpcode::RegionEnter, {});
+      ++m_regions;
+      compile_stmt(node.region_stmt.stmt);
+      --m_regions;
+      m_function->emit(RegOpcode::RegionLeave, {});
+      break;
+    default:
+      break;
+  }
+  m_next_temp = temps;
+}
+
+void RegCompiler::compile_while(AstNodeIndex stmt) {
+  const auto& node = m_ast[stmt].while_stmt;
+  const auto site = m_loop_sites++;
+  emit_counter(RegCounter::Kind::Loop, site);
+  if (!m_options.superinstructions) {
+    const uint32_t header = m_function->code.size();
+    const auto cond = compile_expr(node.expr, UndefinedRegister);
+    m_function->emit(RegOpcode::JumpIfFalse, {cond, 0});
+    const uint32_t to_exit = m_function->code.size() - 1;
+    emit_counter(RegCounter::Kind::LoopIterations, site);
+    compile_stmt(node.stmt);
+    m_function->emit(RegOpcode::Jump, {header});
+    patch(to_exit, m_function->code.size());
+    return;
+  }
+
+  // rotated: one test before entering, then the test closes every iteration
+  const auto cond = strip_parenths(m_ast, node.expr);
+  const auto& body = m_ast[node.stmt];
+  const bool is_block = body.kind == AstNode::Kind::BlockStmt;
+  const auto last_stmt = is_block
+    ? (body.block_stmt.stmts && !body.block_stmt.stmts->empty() ? body.block_stmt.stmts->back() : UndefinedAstNodeIndex)
+    : node.stmt;
+  const auto temps = m_next_temp;
+
+  if (is_increment_loop(cond, last_stmt)) {
+    const auto& less = m_ast[cond].less_expr;
+    const auto counter = local_slot(less.left);
+    const auto type = ast_expr_type(m_ast, less.left);
+    // a constant bound is materialized once into a register that lives
+    // across the loop
+    auto bound = local_slot(less.right);
+    if (bound == UndefinedRegister) bound = length_slot(less.right);
+    if (bound == UndefinedRegister) {
+      bound = allocate_temp();
+      compile_expr(less.right, bound);
+    }
+    m_function->emit(reg_typed_opcode(RegTypedOp::JumpUnlessLess, type), {counter, bound, 0});
+    const uint32_t to_exit = m_function->code.size() - 1;
+    const uint32_t loop = m_function->code.size();
+    emit_counter(RegCounter::Kind::LoopIterations, site);
+    const auto body_temps = m_next_temp;
+    if (is_block) {
+      for (auto child : *body.block_stmt.stmts) {
+        if (child != last_stmt) compile_stmt(child);
+      }
+    }
+    m_next_temp = body_temps;
+    mark_line(stmt);
+    const auto& increment = m_ast[strip_parenths(m_ast, m_ast[m_ast[last_stmt].expr_stmt.expr].assign_expr.right)];
+    int32_t step = 0;
+    is_int_literal(increment.add_expr.right, step);
+    if (increment.kind == AstNode::Kind::SubExpr) step = static_cast<int32_t>(0 - static_cast<uint32_t>(step));
+    emit_typed(RegTypedOp::IncrementLessJump, type, {counter, static_cast<uint32_t>(step), bound, loop});
+    patch(to_exit, m_function->code.size());
+    m_next_temp = temps;
+    return;
+  }
+
+  const auto to_exit = compile_branch_unless(cond);
+  m_next_temp = temps;
+  const uint32_t loop = m_function->code.size();
+  emit_counter(RegCounter::Kind::LoopIterations, site);
+  compile_stmt(node.stmt);
+
+  // the test at the bottom belongs to the while
+  mark_line(stmt);
+  RegTypedOp op;
+  const auto& compare = m_ast[cond];
+  if (jump_if_op(compare.kind, op) && is_int_type(ast_expr_type(m_ast, compare.less_expr.left))) {
+    uint32_t left, right;
+    compile_operands(compare.less_expr, left, right);
+    emit_typed(op, ast_expr_type(m_ast, compare.less_expr.left), {left, right, loop});
+  } else {
+    const auto to_exit_bottom = compile_branch_unless(cond);
+    m_function->emit(RegOpcode::Jump, {loop});
+    patch(to_exit_bottom, m_function->code.size());
+  }
+  patch(to_exit, m_function->code.size());
+  m_next_temp = temps;
+}
+
+// `while (i < n) { ..; i = i + c; }` with an integer local i and a bound n
+// that is a local, the length of one or a constant
+bool RegCompiler::is_increment_loop(AstNodeIndex cond, AstNodeIndex last_stmt) const {
+  if (last_stmt == UndefinedAstNodeIndex) return false;
+  const auto& compare = m_ast[cond];
+  if (compare.kind != AstNode::Kind::LessExpr) return false;
+  const auto counter = compare.less_expr.left;
+  if (local_slot(counter) == UndefinedRegister || !is_int_type(ast_expr_type(m_ast, counter))) return false;
+  int32_t step;
+  const auto bound = compare.less_expr.right;
+  if (local_slot(bound) == UndefinedRegister && length_slot(bound) == UndefinedRegister && !is_int_literal(bound, step)) {
+    return false;
+  }
+
+  const auto& stmt = m_ast[last_stmt];
+  if (stmt.kind != AstNode::Kind::ExprStmt) return false;
+  const auto& assign = m_ast[stmt.expr_stmt.expr];
+  if (assign.kind != AstNode::Kind::AssignExpr || assign.assign_expr.left != counter) return false;
+  const auto& increment = m_ast[strip_parenths(m_ast, assign.assign_expr.right)];
+  if (increment.kind != AstNode::Kind::AddExpr && increment.kind != AstNode::Kind::SubExpr) return false;
+  return strip_parenths(m_ast, increment.add_expr.left) == counter && is_int_literal(increment.add_expr.right, step);
+}
+
+uint32_t RegCompiler::compile_branch_unless(AstNodeIndex cond) {
+  cond = strip_parenths(m_ast, cond);
+  const auto& node = m_ast[cond];
+  RegTypedOp op;
+  if (m_options.superinstructions && jump_unless_op(node.kind, op)) {
+    uint32_t left, right;
+    compile_operands(node.less_expr, left, right);
+    emit_typed(op, ast_expr_type(m_ast, node.less_expr.left), {left, right, 0});
+  } else {
+    const auto value = compile_expr(cond, UndefinedRegister);
+    m_function->emit(RegOpcode::JumpIfFalse, {value, 0});
+  }
+  return m_function->code.size() - 1;
+}
+
+uint32_t RegCompiler::compile_expr(AstNodeIndex expr, uint32_t target) {
+  const auto& node = m_ast[expr];
+  const auto dst = [&] {
+    return target != UndefinedRegister ? target : allocate_temp(slot_count(ast_expr_type(m_ast, expr)));
+  };
+  switch (node.kind) {
+    case AstNode::Kind::I8Literal:
+    case AstNode::Kind::I16Literal:
+    case AstNode::Kind::I32Literal:
+    case AstNode::Kind::U8Literal:
+    case AstNode::Kind::U16Literal:
+    case AstNode::Kind::U32Literal:
+    case AstNode::Kind::CharLiteral: {
+      int32_t value = 0;
+      is_int_literal(expr, value);
+      const auto r = dst();
+      emit_const(ast_expr_type(m_ast, expr), r, value);
+      return r;
+    }
+    case AstNode::Kind::F32Literal: {
+      const auto r = dst();
+      uint32_t bits;
+      memcpy(&bits, &node.f32_literal.literal_value, sizeof(bits));
+      emit_typed(RegTypedOp::Const, IrType::F32, {r, bits});
+      return r;
+    }
+    case AstNode::Kind::F64Literal: {
+      const auto r = dst();
+      uint64_t bits;
+      memcpy(&bits, &node.f64_literal.literal_value, sizeof(bits));
+      emit_typed(RegTypedOp::Const, IrType::F64, {r, static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32)});
+      return r;
+    }
+    case AstNode::Kind::LocalVariable: {
+      const auto slot = local_slot(expr);
+      if (slot == UndefinedRegister) {
+        const auto r = dst();
+        emit_const(IrType::I32, r, 0);
+        return r;
+      }
+      if (target == UndefinedRegister || target == slot) return slot;
+      emit_move(ast_expr_type(m_ast, expr), target, slot);
+      return target;
+    }
+    case AstNode::Kind::FieldExpr: {
+      uint32_t offset = 0;
+      const auto type = ast_value_type(m_ast, m_ast[node.field_expr.field].struct_field.value.type);
+      const auto r = dst();
+      if (type == IrType::Void || !field_offset(expr, offset)) {
+        emit_const(IrType::I32, r, 0);
+      } else {
+        emit_typed(RegTypedOp::LoadField, type, {r, offset});
+      }
+      return r;
+    }
+    case AstNode::Kind::SpawnExpr:
+    case AstNode::Kind::CallExpr: {
+      // a spawn passes the arguments of its call the same way
+      const bool spawn = node.kind == AstNode::Kind::SpawnExpr;
+      const auto& call = spawn ? m_ast[node.spawn_expr.expr].call_expr : node.call_expr;
+      const auto callee = function_index(call.function);
+      const auto& param_types = *m_ast[m_ast[call.function].function.function_type_with_named_params]
+                                   .fun_type_with_named_params.fun_type.param_types;
+      // arguments go to consecutive temporaries that become the callee's
+      // parameters, their own temporaries are stacked above them
+      const auto first = m_next_temp;
+      const uint32_t args = call.args ? call.args->size() : 0;
+      std::vector<uint32_t> registers;
+      for (uint32_t i = 0; i < args; ++i) registers.emplace_back(allocate_temp(type_slots(m_ast, param_types[i])));
+      for (uint32_t i = 0; i < args; ++i) {
+        const auto arg = (*call.args)[i];
+        if (m_ast[param_types[i]].kind == AstNode::Kind::SliceType) {
+          compile_slice(arg, registers[i]);
+        } else {
+          compile_expr(arg, registers[i]);
+        }
+      }
+      m_next_temp = first;
+      const auto r = dst();
+      m_function->emit(spawn ? RegOpcode::Spawn : RegOpcode::Call, {r, callee, first});
+      return r;
+    }
+    case AstNode::Kind::JoinExpr: {
+      const auto mark = m_next_temp;
+      const auto task = compile_expr(node.join_expr.expr, UndefinedRegister);
+      m_next_temp = mark;
+      const auto r = dst();
+      m_function->emit(RegOpcode::Join, {r, task});
+      return r;
+    }
+    case AstNode::Kind::AssignExpr:
+      return compile_assign(expr, target);
+    case AstNode::Kind::ParenthExpr:
+      return compile_expr(node.parenth_expr.expr, target);
+    case AstNode::Kind::NegExpr: {
+      const auto mark = m_next_temp;
+      const auto a = compile_expr(node.neg_expr.expr, UndefinedRegister);
+      m_next_temp = mark;
+      const auto r = dst();
+      emit_typed(RegTypedOp::Neg, ast_expr_type(m_ast, node.neg_expr.expr), {r, a});
+      return r;
+    }
+    case AstNode::Kind::VectorExpr: {
+      // every lane is evaluated before the vector is written, which may be
+      // a local the lanes read
+      const auto type = ast_expr_type(m_ast, expr);
+      std::vector<uint32_t> lanes;
+      for (auto arg : *node.vector_expr.args) lanes.emplace_back(compile_expr(arg, UndefinedRegister));
+      const auto r = dst();
+      m_function->emit(reg_vector_opcode(RegVectorOp::Splat, type), {r, lanes[0]});
+      for (uint32_t lane = 1; lane < lanes.size(); ++lane) {
+        m_function->emit(reg_vector_opcode(RegVectorOp::InsertLane, type), {r, r, lanes[lane], lane});
+      }
+      return r;
+    }
+    case AstNode::Kind::LaneExpr: {
+      const auto mark = m_next_temp;
+      const auto type = ast_expr_type(m_ast, node.lane_expr.expr);
+      const auto v = compile_expr(node.lane_expr.expr, UndefinedRegister);
+      m_next_temp = mark;
+      const auto r = dst();
+      m_function->emit(reg_vector_opcode(RegVectorOp::Lane, type), {r, v, node.lane_expr.lane});
+      return r;
+    }
+    case AstNode::Kind::IndexExpr: {
+      const auto mark = m_next_temp;
+      const auto s = compile_slice(node.index_expr.expr, UndefinedRegister);
+      const auto i = compile_expr(node.index_expr.index, UndefinedRegister);
+      m_next_temp = mark;
+      const auto r = dst();
+      emit_typed(RegTypedOp::LoadElement, ast_expr_type(m_ast, expr), {r, s, i});
+      return r;
+    }
+    case AstNode::Kind::LengthExpr: {
+      const auto mark = m_next_temp;
+      const auto s = compile_slice(node.length_expr.expr, UndefinedRegister);
+      m_next_temp = mark;
+      // read in place like a local
+      if (target == UndefinedRegister && s < m_locals) return s + 1;
+      const auto r = dst();
+      m_function->emit(RegOpcode::Move, {r, s + 1});
+      return r;
+    }
+    case AstNode::Kind::SliceExpr:
+    case AstNode::Kind::NewExpr:
+      return compile_slice(expr, target);
+    case AstNode::Kind::ShuffleExpr: {
+      const auto mark = m_next_temp;
+      const auto type = ast_expr_type(m_ast, expr);
+      const auto v = compile_expr(node.shuffle_expr.expr, UndefinedRegister);
+      m_next_temp = mark;
+      const auto r = dst();
+      m_function->emit(reg_vector_opcode(RegVectorOp::Shuffle, type), {r, v, node.shuffle_expr.lanes});
+      return r;
+    }
+    case AstNode::Kind::AddExpr: return compile_binary(RegTypedOp::Add, node.add_expr, target);
+    case AstNode::Kind::SubExpr: return compile_binary(RegTypedOp::Sub, node.sub_expr, target);
+    case AstNode::Kind::MulExpr: return compile_binary(RegTypedOp::Mul, node.mul_expr, target);
+    case AstNode::Kind::DivExpr: return compile_binary(RegTypedOp::Div, node.div_expr, target);
+    case AstNode::Kind::EqualExpr: return compile_binary(RegTypedOp::Equal, node.equal_expr, target);
+    case AstNode::Kind::GreatExpr: return compile_binary(RegTypedOp::Great, node.great_expr, target);
+    case AstNode::Kind::GreatOrEqualExpr: return compile_binary(RegTypedOp::GreatOrEqual, node.great__or_equal_expr, target);
+    case AstNode::Kind::LessExpr: return compile_binary(RegTypedOp::Less, node.less_expr, target);
+    case AstNode::Kind::LessOrEqualExpr: return compile_binary(RegTypedOp::LessOrEqual, node.less_or_equal_expr, target);
+    default: {
+      const auto r = dst();
+      emit_const(IrType::I32, r, 0);
+      return r;
+    }
+  }
+}
+
+uint32_t RegCompiler::compile_assign(AstNodeIndex expr, uint32_t target) {
+  const auto& node = m_ast[expr].assign_expr;
+  const auto& left = m_ast[node.left];
+
+  if (left.kind == AstNode::Kind::LocalVariable) {
+    const auto slot = local_slot(node.left);
+    if (slot != UndefinedRegister) {
+      compile_expr(node.right, slot);
+      if (target == UndefinedRegister || target == slot) return slot;
+      emit_move(ast_expr_type(m_ast, node.left), target, slot);
+      return target;
+    }
+  } else if (left.kind == AstNode::Kind::LaneExpr) {
+    const auto variable = left.lane_expr.expr;
+    const auto slot = local_slot(variable);
+    const auto value = compile_expr(node.right, target);
+    const auto type = ast_expr_type(m_ast, variable);
+    m_function->emit(reg_vector_opcode(RegVectorOp::InsertLane, type), {slot, slot, value, left.lane_expr.lane});
+    return value;
+  } else if (left.kind == AstNode::Kind::IndexExpr) {
+    auto value = compile_expr(node.right, target);
+    const auto type = ast_expr_type(m_ast, node.left);
+    // a local read in place must not observe an assignment in the index
+    if (value < m_locals && has_assign(left.index_expr.index)) {
+      const auto copy = allocate_temp();
+      m_function->emit(RegOpcode::Move, {copy, value});
+      value = copy;
+    }
+    const auto mark = m_next_temp;
+    const auto s = compile_slice(left.index_expr.expr, UndefinedRegister);
+    const auto i = compile_expr(left.index_expr.index, UndefinedRegister);
+    emit_typed(RegTypedOp::StoreElement, type, {s, i, value});
+    m_next_temp = mark;
+    return value;
+  } else if (left.kind == AstNode::Kind::FieldExpr) {
+    uint32_t offset = 0;
+    const auto type = ast_value_type(m_ast, m_ast[left.field_expr.field].struct_field.value.type);
+    if (type != IrType::Void && field_offset(node.left, offset)) {
+      const auto value = compile_expr(node.right, target);
+      emit_typed(RegTypedOp::StoreField, type, {offset, value});
+      return value;
+    }
+  }
+  return compile_expr(node.right, target);
+}
+
+uint32_t RegCompiler::compile_slice(AstNodeIndex expr, uint32_t target) {
+  expr = strip_parenths(m_ast, expr);
+  const auto& node = m_ast[expr];
+  if (node.kind == AstNode::Kind::SliceExpr) {
+    const auto mark = m_next_temp;
+    const auto s = compile_slice(node.slice_expr.expr, UndefinedRegister);
+    const auto low = compile_expr(node.slice_expr.low, UndefinedRegister);
+    const auto high = compile_expr(node.slice_expr.high, UndefinedRegister);
+    m_next_temp = mark;
+    // Subslice reads its operands before it writes
+    const auto r = target != UndefinedRegister ? target : allocate_temp(2);
+    const auto element = m_ast[node.slice_expr.value.type].array_type.element;
+    m_function->emit(RegOpcode::Subslice, {r, s, low, high, ast_type_size(m_ast, element)});
+    return r;
+  }
+  if (node.kind == AstNode::Kind::NewExpr) {
+    const auto mark = m_next_temp;
+    const auto n = compile_expr(node.new_expr.length, UndefinedRegister);
+    m_next_temp = mark;
+    const auto r = target != UndefinedRegister ? target : allocate_temp(2);
+    const auto element = m_ast[node.new_expr.value.type].array_type.element;
+    m_function->emit(RegOpcode::NewSlice, {r, n, ast_type_size(m_ast, element)});
+    return r;
+  }
+  const auto slot = sequence_slot(expr);
+  if (target == UndefinedRegister || target == slot) return slot;
+  m_function->emit(RegOpcode::Move, {target, slot});
+  m_function->emit(RegOpcode::Move, {target + 1, slot + 1});
+  return target;
+}
+
+void RegCompiler::compile_operands(const AstNode::BinaryExpr& expr, uint32_t& left, uint32_t& right) {
+  left = compile_expr(expr.left, UndefinedRegister);
+  // a local read in place must not observe an assignment on the right
+  if (left < m_locals && has_assign(expr.right)) {
+    const auto type = ast_expr_type(m_ast, expr.left);
+    const auto copy = allocate_temp(slot_count(type));
+    emit_move(type, copy, left);
+    left = copy;
+  }
+  right = compile_expr(expr.right, UndefinedRegister);
+}
+
+uint32_t RegCompiler::compile_binary(RegTypedOp op, const AstNode::BinaryExpr& expr, uint32_t target) {
+  const auto type = ast_expr_type(m_ast, expr.left);
+  const auto mark = m_next_temp;
+  const auto dst = [&] {
+    m_next_temp = mark;
+    return target != UndefinedRegister ? target : allocate_temp(slot_count(type));
+  };
+
+  if (m_options.superinstructions && (op == RegTypedOp::Add || op == RegTypedOp::Sub)) {
+    int32_t imm;
+    if (is_int_type(type) && is_int_literal(expr.right, imm)) {
+      const auto a = compile_expr(expr.left, UndefinedRegister);
+      if (op == RegTypedOp::Sub) imm = static_cast<int32_t>(0 - static_cast<uint32_t>(imm));
+      const auto r = dst();
+      emit_typed(RegTypedOp::AddImm, type, {r, a, static_cast<uint32_t>(imm)});
+      return r;
+    }
+    // the field is read when the addition executes, after the other operand
+    uint32_t offset;
+    const auto right = strip_parenths(m_ast, expr.right);
+    const auto left = strip_parenths(m_ast, expr.left);
+    if (op == RegTypedOp::Add && ast_value_type(m_ast, m_ast[right].kind == AstNode::Kind::FieldExpr
+          ? m_ast[m_ast[right].field_expr.field].struct_field.value.type : UndefinedAstNodeIndex) == type
+        && field_offset(right, offset)) {
+      const auto a = compile_expr(expr.left, UndefinedRegister);
+      const auto r = dst();
+      emit_typed(RegTypedOp::AddField, type, {r, a, offset});
+      return r;
+    }
+    if (op == RegTypedOp::Add && !has_assign(expr.right) && ast_value_type(m_ast, m_ast[left].kind == AstNode::Kind::FieldExpr
+          ? m_ast[m_ast[left].field_expr.field].struct_field.value.type : UndefinedAstNodeIndex) == type
+        && field_offset(left, offset)) {
+      const auto b = compile_expr(expr.right, UndefinedRegister);
+      const auto r = dst();
+      emit_typed(RegTypedOp::AddField, type, {r, b, offset});
+      return r;
+    }
+  }
+
+  uint32_t a, b;
+  compile_operands(expr, a, b);
+  const auto r = dst();
+  emit_typed(op, type, {r, a, b});
+  return r;
+}
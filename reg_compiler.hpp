@@ -0,0 +1,106 @@
+#ifndef REG_COMPILER_HPP
+#define REG_COMPILER_HPP
+
+#include "ast.hpp"
+#include "reg_bytecode.hpp"
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+static const uint32_t UndefinedRegister = std::numeric_limits<uint32_t>::max();
+
+// Translates functions of the Ast into register bytecode. Every local owns
+// frame slots that instructions read and write directly, one per scalar
+// and two or four per vector; arrays and slices take a pointer and a
+// length, followed by the elements for arrays; temporaries are allocated above the locals
+// like a stack and released after each statement. With superinstructions
+// enabled, while loops are rotated so the condition is tested at the
+// bottom, compares feeding a branch become one compare-and-branch,
+// additions of constants and fields fuse their operand, and a loop ending
+// in `i = i + c` under `i < n` closes with one IncrementLessJump. Expressions the machine cannot represent evaluate to
+// an i32 zero, like in BytecodeCompiler. Given the source line of every
+// Ast node, each function gets a table mapping code offsets back to lines.
+// With counters, Counter instructions count calls of every function and
+// how often each if and while statement runs, takes its branch or loops,
+// for the profile of execution_profile.hpp; sites are numbered in source
+// order, the order Lowering numbers them in.
+class RegCompiler {
+public:
+  struct Options {
+    bool superinstructions = true;
+    // source line of every Ast node, as Parser::lines() has them
+    const std::vector<uint32_t>* lines = nullptr;
+    bool counters = false;
+  };
+
+  RegCompiler(const Ast& ast, RegBytecodeModule& module) : RegCompiler(ast, module, Options{}) {}
+  RegCompiler(const Ast& ast, RegBytecodeModule& module, Options options)
+    : m_ast(ast), m_module(module), m_options(options) {}
+  RegCompiler(const RegCompiler&) = delete;
+  RegCompiler(RegCompiler&&) = delete;
+  RegCompiler& operator=(const RegCompiler&) = delete;
+  RegCompiler& operator=(RegCompiler&&) = delete;
+
+  // compiles every function declared in the given global scope
+  void compile_module(AstNodeIndex global_scope);
+  RegBytecodeFunction& compile_function(AstNodeIndex function);
+  // position of the function in RegBytecodeModule::functions, declaring it
+  // without code the first time
+  uint32_t function_index(AstNodeIndex function);
+
+private:
+  const Ast& m_ast;
+  RegBytecodeModule& m_module;
+  Options m_options;
+  RegBytecodeFunction* m_function = nullptr;
+  uint32_t m_function_index = 0;
+  std::unordered_map<AstNodeIndex, uint32_t> m_function_indices;
+  // LocalVariable nodes to their first slot
+  std::unordered_map<AstNodeIndex, uint32_t> m_slots;
+  uint32_t m_locals = 0;
+  uint32_t m_next_temp = 0;
+  uint32_t m_registers = 0;
+  // if and while statements of the function seen so far
+  uint32_t m_branch_sites = 0;
+  uint32_t m_loop_sites = 0;
+  // region statements around the statement being compiled
+  uint32_t m_regions = 0;
+
+  void allocate_locals(AstNodeIndex stmt);
+  uint32_t allocate_temp(uint32_t slots = 1);
+  bool field_offset(AstNodeIndex expr, uint32_t& offset) const;
+  uint32_t local_slot(AstNodeIndex expr) const;
+  // the pointer slot of an array or slice local, UndefinedRegister for
+  // anything else
+  uint32_t sequence_slot(AstNodeIndex expr) const;
+  // the slot holding a.len of an array or slice local
+  uint32_t length_slot(AstNodeIndex expr) const;
+  bool is_int_literal(AstNodeIndex expr, int32_t& value) const;
+  bool has_assign(AstNodeIndex expr) const;
+
+  // code emitted from here on belongs to the line of node
+  void mark_line(AstNodeIndex node);
+  void emit_counter(RegCounter::Kind kind, uint32_t site);
+  void emit_typed(RegTypedOp op, IrType type, std::initializer_list<uint32_t> operands);
+  // vectors get value in every lane
+  void emit_const(IrType type, uint32_t dst, int32_t value);
+  void emit_move(IrType type, uint32_t dst, uint32_t src);
+  void emit_return(IrType type, uint32_t src);
+  void patch(uint32_t operand, uint32_t target);
+
+  void compile_stmt(AstNodeIndex stmt);
+  void compile_while(AstNodeIndex stmt);
+  bool is_increment_loop(AstNodeIndex cond, AstNodeIndex last_stmt) const;
+  // jumps away when cond is false, returns the position of the target operand
+  uint32_t compile_branch_unless(AstNodeIndex cond);
+  uint32_t compile_expr(AstNodeIndex expr, uint32_t target);
+  uint32_t compile_assign(AstNodeIndex expr, uint32_t target);
+  // the two registers of an array or slice expression, target if given
+  uint32_t compile_slice(AstNodeIndex expr, uint32_t target);
+  // registers holding both operands, left is copied when right may change it
+  void compile_operands(const AstNode::BinaryExpr& expr, uint32_t& left, uint32_t& right);
+  uint32_t compile_binary(RegTypedOp op, const AstNode::BinaryExpr& expr, uint32_t target);
+};
+
+#endif  // REG_COMPILER_HPP
@@ -0,0 +1,228 @@
+#include "reg_image.hpp"
+#include "task.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// "SLBC" read as a little endian word, so images from a machine of the
+// other byte order fail the first check
+const uint32_t Magic = 0x43424c53;
+
+struct ImageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t opcodes;
+  uint32_t functions;
+  uint64_t source_hash;
+  // of the bytes following the header
+  uint64_t checksum;
+  uint64_t size;
+};
+
+struct ImageFunction {
+  // byte offset of the code in the image and its size in words
+  uint32_t code_offset;
+  uint32_t code_size;
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t params;
+  uint32_t registers;
+  uint32_t return_type;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(ImageHeader) == 40 && sizeof(ImageFunction) == 32, "image layout must not have padding");
+
+}  // namespace
+
+// FNV-1a taking 8 bytes per step; folding the high half back after each
+// multiplication lets differences in high bits reach the whole state
+uint64_t reg_image_hash(const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  const uint64_t prime = 0x100000001b3;
+  uint64_t hash = 0xcbf29ce484222325 ^ size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; ++i) hash = (hash ^ bytes[i]) * prime;
+  return hash;
+}
+
+void RegImageWriter::write(uint64_t source_hash, std::vector<uint8_t>& image) {
+  const size_t base = image.size();
+  const auto& functions = m_module.functions;
+  size_t code_words = 0;
+  size_t name_bytes = 0;
+  for (const auto& function : functions) {
+    code_words += function.code.size();
+    name_bytes += function.name == UndefinedIdIndex ? 0 : m_id_cache.get(function.name).length;
+  }
+  const size_t code_offset = sizeof(ImageHeader) + functions.size() * sizeof(ImageFunction);
+  const size_t names_offset = code_offset + code_words * sizeof(uint32_t);
+  const size_t size = names_offset + name_bytes;
+  image.resize(base + size);
+  uint8_t* const out = image.data() + base;
+
+  ImageHeader header{Magic, RegImageVersion, static_cast<uint32_t>(RegOpcode::Count),
+                     static_cast<uint32_t>(functions.size()), source_hash, 0, size};
+  size_t code = code_offset;
+  size_t name = names_offset;
+  for (size_t index = 0; index < functions.size(); ++index) {
+    const auto& function = functions[index];
+    ImageFunction entry{static_cast<uint32_t>(code), static_cast<uint32_t>(function.code.size()),
+                        static_cast<uint32_t>(name), 0, function.params, function.registers,
+                        static_cast<uint32_t>(function.return_type), 0};
+    if (function.name != UndefinedIdIndex) {
+      const auto& string = m_id_cache.get(function.name);
+      entry.name_length = string.length;
+      memcpy(out + name, string.str, string.length);
+      name += string.length;
+    }
+    memcpy(out + code, function.code.data(), function.code.size() * sizeof(uint32_t));
+    code += function.code.size() * sizeof(uint32_t);
+    memcpy(out + sizeof(ImageHeader) + index * sizeof(ImageFunction), &entry, sizeof(entry));
+  }
+  header.checksum = reg_image_hash(out + sizeof(ImageHeader), size - sizeof(ImageHeader));
+  memcpy(out, &header, sizeof(header));
+}
+
+bool RegImageWriter::write_file(uint64_t source_hash, const std::string& path) {
+  std::vector<uint8_t> image;
+  write(source_hash, image);
+  const auto temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  auto* file = std::fopen(temp_path.c_str(), "wb");
+  if (!file) return false;
+  const bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+  if (std::fclose(file) != 0 || !written || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+RegImage::~RegImage() {
+  unmap();
+}
+
+void RegImage::unmap() {
+  if (m_mapping) munmap(m_mapping, m_mapping_size);
+  m_mapping = nullptr;
+  m_mapping_size = 0;
+}
+
+bool RegImage::map(const std::string& path, uint64_t source_hash) {
+  unmap();
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(ImageHeader))) {
+    close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  m_mapping = mapping;
+  m_mapping_size = status.st_size;
+  if (use(static_cast<const uint8_t*>(mapping), m_mapping_size, source_hash)) return true;
+  unmap();
+  return false;
+}
+
+bool RegImage::use(const uint8_t* image, size_t size, uint64_t source_hash) {
+  m_functions.clear();
+  m_names.clear();
+  ImageHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, image, sizeof(header));
+  if (header.magic != Magic || header.version != RegImageVersion ||
+      header.opcodes != static_cast<uint32_t>(RegOpcode::Count) || header.size != size ||
+      header.source_hash != source_hash ||
+      (size - sizeof(header)) / sizeof(ImageFunction) < header.functions) {
+    return false;
+  }
+  if (reg_image_hash(image + sizeof(header), size - sizeof(header)) != header.checksum) return false;
+
+  m_functions.reserve(header.functions);
+  m_names.reserve(header.functions);
+  const auto* entries = image + sizeof(header);
+  for (uint32_t index = 0; index < header.functions; ++index) {
+    ImageFunction entry;
+    memcpy(&entry, entries + index * sizeof(entry), sizeof(entry));
+    if (entry.code_offset % sizeof(uint32_t) != 0 ||
+        entry.code_offset + uint64_t{entry.code_size} * sizeof(uint32_t) > size ||
+        entry.name_offset + uint64_t{entry.name_length} > size ||
+        entry.return_type > static_cast<uint32_t>(IrType::I32x4) || entry.params > entry.registers) {
+      m_functions.clear();
+      m_names.clear();
+      return false;
+    }
+    m_functions.push_back({reinterpret_cast<const uint32_t*>(image + entry.code_offset), entry.code_size,
+                           entry.params, entry.registers, static_cast<IrType>(entry.return_type)});
+    m_names.push_back({reinterpret_cast<const char*>(image + entry.name_offset), entry.name_length});
+  }
+  std::vector<uint8_t> starts;
+  std::vector<uint32_t> targets;
+  for (const auto& function : m_functions) {
+    if (!check_code(function, starts, targets)) {
+      m_functions.clear();
+      m_names.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RegImage::check_code(const RegFunctionCode& function, std::vector<uint8_t>& starts,
+                          std::vector<uint32_t>& targets) const {
+  // every instruction start, jumps must land on one
+  starts.assign(function.size, 0);
+  targets.clear();
+  auto last = RegOpcode::Nop;
+  uint32_t pc = 0;
+  while (pc < function.size) {
+    if (function.code[pc] >= static_cast<uint32_t>(RegOpcode::Count)) return false;
+    const auto opcode = static_cast<RegOpcode>(function.code[pc]);
+    const uint32_t next = pc + 1 + reg_operand_count(opcode);
+    if (next > function.size) return false;
+    starts[pc] = 1;
+    const uint32_t* operands = function.code + pc + 1;
+    uint32_t target;
+    if (reg_jump_target(opcode, operands, target)) targets.push_back(target);
+    if (opcode == RegOpcode::Call && operands[1] >= m_functions.size()) return false;
+    if (opcode == RegOpcode::NewSlice && operands[2] == 0) return false;
+    if (opcode == RegOpcode::Spawn &&
+        (operands[1] >= m_functions.size() || m_functions[operands[1]].params > TaskMaxArgs)) {
+      return false;
+    }
+    last = opcode;
+    pc = next;
+  }
+  // the interpreter must not run off the end
+  RegVectorOp vector_op;
+  const bool vector_return = reg_vector_op(last, vector_op) && vector_op == RegVectorOp::Return;
+  if (last != RegOpcode::Return && last != RegOpcode::ReturnVoid && last != RegOpcode::Jump && !vector_return) {
+    return false;
+  }
+  for (const auto target : targets) {
+    if (target >= function.size || !starts[target]) return false;
+  }
+  return true;
+}
+
+uint32_t RegImage::find(const char* name) const {
+  const size_t length = strlen(name);
+  for (uint32_t index = 0; index < m_names.size(); ++index) {
+    if (m_names[index].length == length && !memcmp(m_names[index].str, name, length)) return index;
+  }
+  return UndefinedRegImageFunction;
+}
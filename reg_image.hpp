@@ -0,0 +1,84 @@
+#ifndef REG_IMAGE_HPP
+#define REG_IMAGE_HPP
+
+#include "id_cache.hpp"
+#include "reg_bytecode.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Register bytecode saved to a file that RegVm runs in place after mapping
+// it, so unchanged sources skip lexing, parsing and compiling. An image is
+//   header       magic, format version, opcode count, function count,
+//                hash of the source, checksum and size of the image
+//   functions    per function the code and name offsets and sizes, the
+//                parameter and register counts and the return type
+//   code         the code words of every function, in order
+//   names        function names, not terminated
+// in the byte order of the machine that wrote it. Images are found by the
+// hash of the source they were compiled from. Mapping checks the header,
+// the checksum over everything after it, and that code stays inside its
+// function: opcodes exist, instructions end with the code, which ends in a
+// return or jump, and jumps and calls go to code that exists. The checksum catches torn or damaged files; like
+// the compiler's output, an image is trusted to use registers and field
+// offsets inside its frames.
+static const uint32_t RegImageVersion = 1;
+static const uint32_t UndefinedRegImageFunction = std::numeric_limits<uint32_t>::max();
+
+// 64 bit FNV-1a over words, the key of a source and the checksum of an image
+uint64_t reg_image_hash(const void* data, size_t size);
+
+class RegImageWriter {
+public:
+  RegImageWriter(const RegBytecodeModule& module, const IdCache& id_cache) : m_module(module), m_id_cache(id_cache) {}
+  RegImageWriter(const RegImageWriter&) = delete;
+  RegImageWriter(RegImageWriter&&) = delete;
+  RegImageWriter& operator=(const RegImageWriter&) = delete;
+  RegImageWriter& operator=(RegImageWriter&&) = delete;
+
+  // appends the image of the module compiled from a source with the hash
+  void write(uint64_t source_hash, std::vector<uint8_t>& image);
+  // write() into a file at path, false on errors. The image is written
+  // next to it and renamed, so readers never map a partial file.
+  bool write_file(uint64_t source_hash, const std::string& path);
+
+private:
+  const RegBytecodeModule& m_module;
+  const IdCache& m_id_cache;
+};
+
+class RegImage {
+public:
+  RegImage() = default;
+  RegImage(const RegImage&) = delete;
+  RegImage(RegImage&&) = delete;
+  RegImage& operator=(const RegImage&) = delete;
+  RegImage& operator=(RegImage&&) = delete;
+  ~RegImage();
+
+  // maps the image at path, false when it is missing, was compiled from
+  // another source or by another version, or fails the checks above
+  bool map(const std::string& path, uint64_t source_hash);
+  // checks an image already in memory, which must stay there and be
+  // aligned to 4 bytes
+  bool use(const uint8_t* image, size_t size, uint64_t source_hash);
+  // functions for RegVm, pointing into the image
+  const std::vector<RegFunctionCode>& functions() const { return m_functions; }
+  // index of the function, UndefinedRegImageFunction if there is none
+  uint32_t find(const char* name) const;
+
+private:
+  void* m_mapping = nullptr;
+  size_t m_mapping_size = 0;
+  std::vector<RegFunctionCode> m_functions;
+  std::vector<IdCache::String> m_names;
+
+  // starts and targets are scratch space kept across functions
+  bool check_code(const RegFunctionCode& function, std::vector<uint8_t>& starts,
+                  std::vector<uint32_t>& targets) const;
+  void unmap();
+};
+
+#endif  // REG_IMAGE_HPP
@@ -0,0 +1,533 @@
+#include "reg_vm.hpp"
+#include "tiered.hpp"
+#include "profiler.hpp"
+#include "region.hpp"
+#include "task.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && !defined(SMALLANG_VM_SWITCH)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+#define R(n) base[pc[n]]
+
+// jumps to a word offset of the code; jumps backwards are loop back edges,
+// which tiered execution counts and may leave for compiled code. A plain
+// block, VM_DISPATCH may be a continue of the dispatch loop.
+#define VM_JUMP(offset) \
+  { \
+    const uint32_t* const target = code + (offset); \
+    if (Tiered && target < pc) { \
+      pc = target; \
+      goto back_edge; \
+    } \
+    pc = target; \
+    VM_DISPATCH(); \
+  }
+
+// integer results are wrapped to the width through unsigned arithmetic
+#define REG_VM_INT_OPS(T, C) \
+  VM_CASE(Const##T) { R(0).i = C(int32_t(pc[1])); pc += 2; VM_DISPATCH(); } \
+  VM_CASE(Add##T) { R(0).i = C(uint64_t(R(1).i) + uint64_t(R(2).i)); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Sub##T) { R(0).i = C(uint64_t(R(1).i) - uint64_t(R(2).i)); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Mul##T) { R(0).i = C(uint64_t(R(1).i) * uint64_t(R(2).i)); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Div##T) { \
+    if (R(2).i == 0) { m_dispatches = dispatches; return VmStatus::DivisionByZero; } \
+    R(0).i = C(R(1).i / R(2).i); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Neg##T) { R(0).i = C(0 - uint64_t(R(1).i)); pc += 2; VM_DISPATCH(); } \
+  VM_CASE(Equal##T) { R(0).i = R(1).i == R(2).i; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Great##T) { R(0).i = R(1).i > R(2).i; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(GreatOrEqual##T) { R(0).i = R(1).i >= R(2).i; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Less##T) { R(0).i = R(1).i < R(2).i; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(LessOrEqual##T) { R(0).i = R(1).i <= R(2).i; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(LoadField##T) { \
+    C value; \
+    memcpy(&value, reinterpret_cast<uint8_t*>(base) + pc[1], sizeof(C)); \
+    R(0).i = value; \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreField##T) { \
+    const C value = C(R(1).i); \
+    memcpy(reinterpret_cast<uint8_t*>(base) + pc[0], &value, sizeof(C)); \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(AddImm##T) { R(0).i = C(uint64_t(R(1).i) + uint64_t(int64_t(int32_t(pc[2])))); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(AddField##T) { \
+    C value; \
+    memcpy(&value, reinterpret_cast<uint8_t*>(base) + pc[2], sizeof(C)); \
+    R(0).i = C(uint64_t(R(1).i) + uint64_t(int64_t(value))); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(JumpUnlessEqual##T) { if (!(R(0).i == R(1).i)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessGreat##T) { if (!(R(0).i > R(1).i)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessGreatOrEqual##T) { if (!(R(0).i >= R(1).i)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessLess##T) { if (!(R(0).i < R(1).i)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessLessOrEqual##T) { if (!(R(0).i <= R(1).i)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(IncrementLessJump##T) { \
+    auto& counter = R(0); \
+    counter.i = C(uint64_t(counter.i) + uint64_t(int64_t(int32_t(pc[1])))); \
+    if (counter.i < R(2).i) VM_JUMP(pc[3]); \
+    pc += 4; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(LoadElement##T) { \
+    const auto* slice = &R(1); \
+    if (uint64_t(R(2).i) >= uint64_t(slice[1].i)) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; } \
+    C value; \
+    memcpy(&value, reinterpret_cast<const C*>(slice[0].i) + R(2).i, sizeof(C)); \
+    R(0).i = value; \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreElement##T) { \
+    const auto* slice = &R(0); \
+    if (uint64_t(R(1).i) >= uint64_t(slice[1].i)) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; } \
+    const C value = C(R(2).i); \
+    memcpy(reinterpret_cast<C*>(slice[0].i) + R(1).i, &value, sizeof(C)); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  }
+
+#define REG_VM_FLOAT_OPS(T, C, M) \
+  VM_CASE(Add##T) { R(0).M = R(1).M + R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Sub##T) { R(0).M = R(1).M - R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Mul##T) { R(0).M = R(1).M * R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Div##T) { R(0).M = R(1).M / R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Neg##T) { R(0).M = -R(1).M; pc += 2; VM_DISPATCH(); } \
+  VM_CASE(Equal##T) { R(0).i = R(1).M == R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Great##T) { R(0).i = R(1).M > R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(GreatOrEqual##T) { R(0).i = R(1).M >= R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(Less##T) { R(0).i = R(1).M < R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(LessOrEqual##T) { R(0).i = R(1).M <= R(2).M; pc += 3; VM_DISPATCH(); } \
+  VM_CASE(LoadField##T) { \
+    auto& dst = R(0); \
+    dst.i = 0; \
+    memcpy(&dst.M, reinterpret_cast<uint8_t*>(base) + pc[1], sizeof(C)); \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreField##T) { \
+    memcpy(reinterpret_cast<uint8_t*>(base) + pc[0], &R(1).M, sizeof(C)); \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(AddImm##T) { R(0).M = R(1).M + C(int32_t(pc[2])); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(AddField##T) { \
+    C value; \
+    memcpy(&value, reinterpret_cast<uint8_t*>(base) + pc[2], sizeof(C)); \
+    R(0).M = R(1).M + value; \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(JumpUnlessEqual##T) { if (!(R(0).M == R(1).M)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessGreat##T) { if (!(R(0).M > R(1).M)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessGreatOrEqual##T) { if (!(R(0).M >= R(1).M)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessLess##T) { if (!(R(0).M < R(1).M)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(JumpUnlessLessOrEqual##T) { if (!(R(0).M <= R(1).M)) VM_JUMP(pc[2]); pc += 3; VM_DISPATCH(); } \
+  VM_CASE(IncrementLessJump##T) { \
+    auto& counter = R(0); \
+    counter.M = counter.M + C(int32_t(pc[1])); \
+    if (counter.M < R(2).M) VM_JUMP(pc[3]); \
+    pc += 4; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(LoadElement##T) { \
+    const auto* slice = &R(1); \
+    if (uint64_t(R(2).i) >= uint64_t(slice[1].i)) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; } \
+    const auto* source = reinterpret_cast<const C*>(slice[0].i) + R(2).i; \
+    auto& dst = R(0); \
+    dst.i = 0; \
+    memcpy(&dst.M, source, sizeof(C)); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreElement##T) { \
+    const auto* slice = &R(0); \
+    if (uint64_t(R(1).i) >= uint64_t(slice[1].i)) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; } \
+    memcpy(reinterpret_cast<C*>(slice[0].i) + R(1).i, &R(2).M, sizeof(C)); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  }
+
+// lanes of a vector register, copied out so results may overwrite operands
+template <typename C, uint32_t N>
+struct VmVector {
+  C lanes[N];
+
+  static VmVector load(const VmSlot* slot) {
+    VmVector vector;
+    memcpy(vector.lanes, slot, sizeof(vector.lanes));
+    return vector;
+  }
+  void store(VmSlot* slot) const { memcpy(slot, lanes, sizeof(lanes)); }
+};
+
+#define REG_VM_VECTOR_BINARY(T, C, N, expr) \
+  { \
+    const auto a = VmVector<C, N>::load(&R(1)); \
+    const auto b = VmVector<C, N>::load(&R(2)); \
+    VmVector<C, N> vector; \
+    for (uint32_t i = 0; i < N; ++i) vector.lanes[i] = (expr); \
+    vector.store(&R(0)); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  }
+
+// N lanes of C, lanes of integer vectors wrap through W; scalars are the
+// M member of their slot. Lane operands are masked to the vector.
+#define REG_VM_VECTOR_OPS(T, C, N, W, M) \
+  VM_CASE(Move##T) { VmVector<C, N>::load(&R(1)).store(&R(0)); pc += 2; VM_DISPATCH(); } \
+  VM_CASE(Return##T) { \
+    const auto value = VmVector<C, N>::load(&R(0)); \
+    if (frame == frames_begin) { \
+      memcpy(&result, value.lanes, sizeof(result)); \
+      m_dispatches = dispatches; \
+      return VmStatus::Ok; \
+    } \
+    --frame; \
+    function = frame->function; \
+    pc = frame->return_pc; \
+    base = frame->base; \
+    code = function->code; \
+    value.store(&base[frame->dst]); \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Splat##T) { \
+    VmVector<C, N> vector; \
+    std::fill(std::begin(vector.lanes), std::end(vector.lanes), C(R(1).M)); \
+    vector.store(&R(0)); \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Lane##T) { \
+    const C value = VmVector<C, N>::load(&R(1)).lanes[pc[2] & (N - 1)]; \
+    auto& dst = R(0); \
+    dst.i = 0; \
+    dst.M = value; \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(InsertLane##T) { \
+    auto vector = VmVector<C, N>::load(&R(1)); \
+    vector.lanes[pc[3] & (N - 1)] = C(R(2).M); \
+    vector.store(&R(0)); \
+    pc += 4; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Shuffle##T) { \
+    const auto a = VmVector<C, N>::load(&R(1)); \
+    VmVector<C, N> vector; \
+    for (uint32_t i = 0; i < N; ++i) vector.lanes[i] = a.lanes[pc[2] >> 4 * i & (N - 1)]; \
+    vector.store(&R(0)); \
+    pc += 3; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Add##T) REG_VM_VECTOR_BINARY(T, C, N, C(W(a.lanes[i]) + W(b.lanes[i]))) \
+  VM_CASE(Sub##T) REG_VM_VECTOR_BINARY(T, C, N, C(W(a.lanes[i]) - W(b.lanes[i]))) \
+  VM_CASE(Mul##T) REG_VM_VECTOR_BINARY(T, C, N, C(W(a.lanes[i]) * W(b.lanes[i]))) \
+  VM_CASE(Neg##T) { \
+    auto vector = VmVector<C, N>::load(&R(1)); \
+    for (auto& lane : vector.lanes) lane = C(-W(lane)); \
+    vector.store(&R(0)); \
+    pc += 2; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Equal##T) REG_VM_VECTOR_BINARY(T, C, N, C(a.lanes[i] == b.lanes[i])) \
+  VM_CASE(Great##T) REG_VM_VECTOR_BINARY(T, C, N, C(a.lanes[i] > b.lanes[i])) \
+  VM_CASE(GreatOrEqual##T) REG_VM_VECTOR_BINARY(T, C, N, C(a.lanes[i] >= b.lanes[i])) \
+  VM_CASE(Less##T) REG_VM_VECTOR_BINARY(T, C, N, C(a.lanes[i] < b.lanes[i])) \
+  VM_CASE(LessOrEqual##T) REG_VM_VECTOR_BINARY(T, C, N, C(a.lanes[i] <= b.lanes[i]))
+
+namespace {
+
+// the Function of tasks spawned by RegVm code, a call in a RegVm of its own
+int32_t run_task(const void* context, uint32_t function, const uint64_t* args, int32_t& result) {
+  const auto& functions = *static_cast<const std::vector<RegFunctionCode>*>(context);
+  std::vector<VmSlot> slots(functions[function].params);
+  memcpy(slots.data(), args, slots.size() * sizeof(VmSlot));
+  RegVm vm(functions, 1 << 16, 1 << 12);
+  VmSlot value{0};
+  const auto status = vm.call(function, slots, value);
+  result = static_cast<int32_t>(value.i);
+  return static_cast<int32_t>(status);
+}
+
+}  // namespace
+
+VmStatus RegVm::call(uint32_t function_index, const std::vector<VmSlot>& args, VmSlot& result) {
+  auto& arena = RegionArena::current();
+  const auto depth = arena.depth();
+  VmStatus status;
+  if (m_profiler) {
+    status = m_tiering ? run<true, true>(function_index, args, result) : run<false, true>(function_index, args, result);
+  } else {
+    status = m_tiering ? run<true, false>(function_index, args, result) : run<false, false>(function_index, args, result);
+  }
+  // a failed run stops inside the regions it had entered
+  if (status != VmStatus::Ok) arena.leave_to(depth);
+  const auto tasks = static_cast<VmStatus>(TaskScheduler::join_all());
+  return status != VmStatus::Ok ? status : tasks;
+}
+
+void RegVm::record_sample(const RegFunctionCode* function, const uint32_t* pc, const Frame* frame) {
+  RegSampleFrame frames[Profiler::MaxDepth];
+  frames[0] = {static_cast<uint32_t>(function - m_functions.data()), static_cast<uint32_t>(pc - function->code)};
+  uint32_t depth = 1;
+  // callers are at the word before their return address, inside the call
+  while (frame != m_frames.get() && depth < Profiler::MaxDepth) {
+    --frame;
+    frames[depth++] = {static_cast<uint32_t>(frame->function - m_functions.data()),
+                       static_cast<uint32_t>(frame->return_pc - 1 - frame->function->code)};
+  }
+  m_profiler->record(frames, depth);
+}
+
+template <bool Tiered, bool Profiled>
+VmStatus RegVm::run(uint32_t function_index, const std::vector<VmSlot>& args, VmSlot& result) {
+  const auto* function = &m_functions[function_index];
+  VmSlot* const stack_end = m_stack.get() + m_stack_slots;
+  Frame* const frames_begin = m_frames.get();
+  Frame* const frames_end = frames_begin + m_max_frames;
+  Frame* frame = frames_begin;
+  VmSlot* base = m_stack.get();
+  uint64_t dispatches = 0;
+  m_dispatches = 0;
+  if (base + function->registers > stack_end) return VmStatus::StackOverflow;
+  std::copy(args.begin(), args.begin() + std::min<size_t>(args.size(), function->params), base);
+  std::fill(base + std::min<size_t>(args.size(), function->params), base + function->registers, VmSlot{0});
+  const uint32_t* code = function->code;
+  const uint32_t* pc = code;
+  if (Tiered) {
+    if (const auto entry = m_tiering->on_call(function_index)) {
+      JitContext context = m_tiering->context(stack_end, m_max_frames);
+      const auto status = static_cast<VmStatus>(entry(base, &context));
+      if (status == VmStatus::Ok && function->return_type != IrType::Void) result = base[0];
+      return status;
+    }
+  }
+
+#if VM_COMPUTED_GOTO
+#define VM_LABEL(name) &&op_##name,
+  static const void* const labels[] = { REG_BYTECODE_OPCODES(VM_LABEL) };
+#undef VM_LABEL
+  if (Profiled) {
+    m_take_sample = &&take_sample;
+    std::copy(std::begin(labels), std::end(labels), m_profiled_labels);
+    if (m_sample_requested.load(std::memory_order_relaxed)) request_sample();
+  }
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() \
+  do { \
+    ++dispatches; \
+    goto *(Profiled ? m_profiled_labels : labels)[*pc++]; \
+  } while (0)
+  VM_DISPATCH();
+
+  take_sample: {
+    // the instruction was not run yet
+    --pc;
+    --dispatches;
+    std::copy(std::begin(labels), std::end(labels), m_profiled_labels);
+    m_sample_requested.store(false, std::memory_order_relaxed);
+    record_sample(function, pc, frame);
+    VM_DISPATCH();
+  }
+#else
+#define VM_CASE(name) case RegOpcode::name:
+#define VM_DISPATCH() continue
+  for (;;) {
+    if (Profiled && m_sample_requested.load(std::memory_order_relaxed)) {
+      m_sample_requested.store(false, std::memory_order_relaxed);
+      record_sample(function, pc, frame);
+    }
+    ++dispatches;
+    switch (static_cast<RegOpcode>(*pc++)) {
+#endif
+
+  VM_CASE(Nop) { VM_DISPATCH(); }
+  VM_CASE(Move) { R(0) = R(1); pc += 2; VM_DISPATCH(); }
+  VM_CASE(Jump) { VM_JUMP(pc[0]); }
+  VM_CASE(JumpIfFalse) { if (R(0).i == 0) VM_JUMP(pc[1]); pc += 2; VM_DISPATCH(); }
+  VM_CASE(Call) {
+    const auto& callee = m_functions[pc[1]];
+    VmSlot* const callee_base = base + pc[2];
+    if (frame == frames_end || callee_base + callee.registers > stack_end) {
+      m_dispatches = dispatches;
+      return VmStatus::StackOverflow;
+    }
+    if (Tiered) {
+      if (const auto entry = m_tiering->on_call(pc[1])) {
+        JitContext context = m_tiering->context(stack_end, frames_end - frame);
+        const auto status = static_cast<VmStatus>(entry(callee_base, &context));
+        if (status != VmStatus::Ok) {
+          m_dispatches = dispatches;
+          return status;
+        }
+        if (callee.return_type != IrType::Void) R(0) = callee_base[0];
+        pc += 3;
+        VM_DISPATCH();
+      }
+    }
+    *frame++ = {function, pc + 3, base, pc[0]};
+    std::fill(callee_base + callee.params, callee_base + callee.registers, VmSlot{0});
+    function = &callee;
+    base = callee_base;
+    code = callee.code;
+    pc = code;
+    VM_DISPATCH();
+  }
+  VM_CASE(Return) {
+    const auto value = R(0);
+    if (frame == frames_begin) {
+      result = value;
+      m_dispatches = dispatches;
+      return VmStatus::Ok;
+    }
+    --frame;
+    function = frame->function;
+    pc = frame->return_pc;
+    base = frame->base;
+    code = function->code;
+    base[frame->dst] = value;
+    VM_DISPATCH();
+  }
+  VM_CASE(ReturnVoid) {
+    if (frame == frames_begin) {
+      m_dispatches = dispatches;
+      return VmStatus::Ok;
+    }
+    --frame;
+    function = frame->function;
+    pc = frame->return_pc;
+    base = frame->base;
+    code = function->code;
+    VM_DISPATCH();
+  }
+  VM_CASE(Counter) {
+    if (pc[0] < m_counter_count) ++m_counters[pc[0]];
+    pc += 1;
+    VM_DISPATCH();
+  }
+  VM_CASE(FrameAddress) { R(0).i = reinterpret_cast<intptr_t>(base + pc[1]); pc += 2; VM_DISPATCH(); }
+  VM_CASE(Subslice) {
+    // lengths are i32, indices of any sign compare as unsigned
+    const auto* slice = &R(1);
+    const uint64_t low = R(2).i;
+    const uint64_t high = R(3).i;
+    if (high > uint64_t(slice[1].i) || low > high) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; }
+    auto* dst = &R(0);
+    dst[0].i = slice[0].i + int64_t(low * pc[4]);
+    dst[1].i = int64_t(high - low);
+    pc += 5;
+    VM_DISPATCH();
+  }
+
+  VM_CASE(RegionEnter) { RegionArena::current().enter(); VM_DISPATCH(); }
+  VM_CASE(RegionLeave) { RegionArena::current().leave(); VM_DISPATCH(); }
+  VM_CASE(NewSlice) {
+    const int64_t n = static_cast<int32_t>(R(1).i);
+    if (n < 0 || n > RegionMaxBytes / pc[2]) { m_dispatches = dispatches; return VmStatus::IndexOutOfRange; }
+    auto* dst = &R(0);
+    dst[0].i = reinterpret_cast<intptr_t>(RegionArena::current().allocate(n * pc[2]));
+    dst[1].i = n;
+    pc += 3;
+    VM_DISPATCH();
+  }
+  VM_CASE(Spawn) {
+    uint64_t args[TaskMaxArgs];
+    const auto params = m_functions[pc[1]].params;
+    memcpy(args, &R(2), params * sizeof(VmSlot));
+    R(0).i = TaskScheduler::current().spawn(&run_task, &m_functions, pc[1], args, params);
+    pc += 3;
+    VM_DISPATCH();
+  }
+  VM_CASE(Join) {
+    int32_t value = 0;
+    const auto status = TaskScheduler::join(static_cast<int32_t>(R(1).i), value);
+    if (status != 0) {
+      m_dispatches = dispatches;
+      return status == TaskInvalidHandle ? VmStatus::InvalidTask : static_cast<VmStatus>(status);
+    }
+    R(0).i = value;
+    pc += 2;
+    VM_DISPATCH();
+  }
+
+  REG_VM_INT_OPS(I8, int8_t)
+  REG_VM_INT_OPS(I16, int16_t)
+  REG_VM_INT_OPS(I32, int32_t)
+  REG_VM_INT_OPS(U8, uint8_t)
+  REG_VM_INT_OPS(U16, uint16_t)
+  REG_VM_INT_OPS(U32, uint32_t)
+  VM_CASE(ConstF32) {
+    auto& dst = R(0);
+    dst.i = 0;
+    memcpy(&dst.f32, &pc[1], sizeof(float));
+    pc += 2;
+    VM_DISPATCH();
+  }
+  REG_VM_FLOAT_OPS(F32, float, f32)
+  VM_CASE(ConstF64) {
+    const uint64_t bits = pc[1] | uint64_t(pc[2]) << 32;
+    memcpy(&R(0).f64, &bits, sizeof(double));
+    pc += 3;
+    VM_DISPATCH();
+  }
+  REG_VM_FLOAT_OPS(F64, double, f64)
+  REG_VM_VECTOR_OPS(F32x4, float, 4, float, f32)
+  VM_CASE(DivF32x4) REG_VM_VECTOR_BINARY(F32x4, float, 4, a.lanes[i] / b.lanes[i])
+  REG_VM_VECTOR_OPS(F32x8, float, 8, float, f32)
+  VM_CASE(DivF32x8) REG_VM_VECTOR_BINARY(F32x8, float, 8, a.lanes[i] / b.lanes[i])
+  REG_VM_VECTOR_OPS(I32x4, int32_t, 4, uint32_t, i)
+  // the language has no i32x4 division, images may still contain one
+  VM_CASE(DivI32x4) {
+    m_dispatches = dispatches;
+    return VmStatus::InvalidOpcode;
+  }
+
+  back_edge: {
+    const auto entry = m_tiering->on_back_edge(function - m_functions.data(), pc - code);
+    if (!entry) VM_DISPATCH();
+    // on-stack replacement: compiled code continues the frame at the loop
+    // header and runs it to its return
+    JitContext context = m_tiering->context(stack_end, frames_end - frame);
+    const auto status = static_cast<VmStatus>(entry(base, &context));
+    if (status != VmStatus::Ok) {
+      m_dispatches = dispatches;
+      return status;
+    }
+    const bool has_value = function->return_type != IrType::Void;
+    const auto value = base[0];
+    if (frame == frames_begin) {
+      if (has_value) result = value;
+      m_dispatches = dispatches;
+      return VmStatus::Ok;
+    }
+    --frame;
+    function = frame->function;
+    pc = frame->return_pc;
+    base = frame->base;
+    code = function->code;
+    if (has_value) base[frame->dst] = value;
+    VM_DISPATCH();
+  }
+
+#if !VM_COMPUTED_GOTO
+      default:
+        m_dispatches = dispatches;
+        return VmStatus::InvalidOpcode;
+    }
+  }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+}
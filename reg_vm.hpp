@@ -0,0 +1,110 @@
+#ifndef REG_VM_HPP
+#define REG_VM_HPP
+
+#include "reg_bytecode.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Interpreter for the register bytecode of reg_bytecode.hpp. Frames of all
+// active calls share one preallocated slot array: a callee's frame starts
+// at the argument registers of its caller, so calls copy nothing. Dispatch
+// works like in Vm, and the number of dispatched instructions of the last
+// call is kept to compare instruction sets. With a TieredVm attached, calls
+// and loop back edges are counted and continue in compiled code once their
+// function is compiled; that loop is a separate instantiation, so plain
+// interpretation does not pay for it. Code is only read through pointers,
+// so it can run straight from a mapped RegImage; the module or image must
+// outlive the RegVm.
+//
+// With a Profiler attached, another instantiation dispatches through a
+// table in the RegVm instead of a constant one. request_sample() points
+// every entry at code recording the calls in progress, so the sample is
+// taken at the next dispatch, where the table is restored; between
+// samples running profiled costs nothing.
+//
+// Counter instructions, which RegCompiler emits for profile-guided
+// optimization, add to an array the caller provides; without one, or for
+// indices past its end, they do nothing.
+//
+// Regions are entered and allocate in the current RegionArena; a call that
+// fails leaves the regions it had entered. Spawned tasks run in a RegVm of
+// their own on the current TaskScheduler, and a call joins the tasks it
+// did not join before it returns.
+class TieredVm;
+class Profiler;
+
+// a call in progress: its function and the word offset it is at
+struct RegSampleFrame {
+  uint32_t function;
+  uint32_t offset;
+};
+
+class RegVm {
+public:
+  RegVm(const RegBytecodeModule& module, uint32_t stack_slots = 1 << 20, uint32_t max_frames = 1 << 16)
+    : RegVm(reg_function_code(module), stack_slots, max_frames) {}
+  RegVm(std::vector<RegFunctionCode> functions, uint32_t stack_slots = 1 << 20, uint32_t max_frames = 1 << 16)
+    : m_functions(std::move(functions)), m_stack(new VmSlot[stack_slots]), m_stack_slots(stack_slots),
+      m_frames(new Frame[max_frames]), m_max_frames(max_frames) {}
+  RegVm(const RegVm&) = delete;
+  RegVm(RegVm&&) = delete;
+  RegVm& operator=(const RegVm&) = delete;
+  RegVm& operator=(RegVm&&) = delete;
+
+  // result is left untouched for functions without a return value
+  VmStatus call(uint32_t function, const std::vector<VmSlot>& args, VmSlot& result);
+  uint64_t dispatches() const { return m_dispatches; }
+  void set_tiering(TieredVm* tiering) { m_tiering = tiering; }
+  void set_profiler(Profiler* profiler) { m_profiler = profiler; }
+  void set_counters(uint64_t* counters, uint32_t count) {
+    m_counters = counters;
+    m_counter_count = count;
+  }
+  // has the profiler record the calls in progress before the next
+  // instruction; safe in a signal handler interrupting the running thread
+  void request_sample() {
+    m_sample_requested.store(true, std::memory_order_relaxed);
+    if (m_take_sample) std::fill(std::begin(m_profiled_labels), std::end(m_profiled_labels), m_take_sample);
+  }
+
+private:
+  struct Frame {
+    const RegFunctionCode* function;
+    const uint32_t* return_pc;
+    VmSlot* base;
+    // caller register receiving the result
+    uint32_t dst;
+  };
+
+  std::vector<RegFunctionCode> m_functions;
+  // left uninitialized, calls clear the registers of their frames, and
+  // large arrays stay untouched pages until deep calls reach them
+  std::unique_ptr<VmSlot[]> m_stack;
+  uint32_t m_stack_slots;
+  std::unique_ptr<Frame[]> m_frames;
+  uint32_t m_max_frames;
+  uint64_t m_dispatches = 0;
+  TieredVm* m_tiering = nullptr;
+  Profiler* m_profiler = nullptr;
+  uint64_t* m_counters = nullptr;
+  uint32_t m_counter_count = 0;
+  // dispatch table of the profiled loop and the code taking samples; the
+  // switch loop polls the flag instead. Volatile keeps every entry read
+  // from memory, where the signal handler writes it.
+  const void* volatile m_profiled_labels[static_cast<uint32_t>(RegOpcode::Count)] = {};
+  const void* m_take_sample = nullptr;
+  std::atomic<bool> m_sample_requested{false};
+
+  template <bool Tiered, bool Profiled>
+  VmStatus run(uint32_t function, const std::vector<VmSlot>& args, VmSlot& result);
+  // hands the calls in progress to the profiler, innermost first
+  void record_sample(const RegFunctionCode* function, const uint32_t* pc, const Frame* frame);
+};
+
+#endif  // REG_VM_HPP
@@ -0,0 +1,447 @@
+#include "regalloc.hpp"
+#include "dominators.hpp"
+#include "liveness.hpp"
+#include <algorithm>
+
+static const uint32_t MaxPosition = std::numeric_limits<uint32_t>::max();
+
+bool LiveInterval::covers(uint32_t position) const {
+  for (const auto& range : ranges) {
+    if (position < range.start) return false;
+    if (position < range.end) return true;
+  }
+  return false;
+}
+
+uint32_t LiveInterval::next_use(uint32_t position) const {
+  const auto it = std::lower_bound(uses.begin(), uses.end(), position);
+  return it == uses.end() ? MaxPosition : *it;
+}
+
+uint32_t LiveInterval::next_intersection(const LiveInterval& other) const {
+  uint32_t i = 0;
+  uint32_t j = 0;
+  while (i < ranges.size() && j < other.ranges.size()) {
+    const auto& a = ranges[i];
+    const auto& b = other.ranges[j];
+    const auto start = std::max(a.start, b.start);
+    if (start < std::min(a.end, b.end)) return start;
+    if (a.end <= b.end) {
+      ++i;
+    } else {
+      ++j;
+    }
+  }
+  return MaxPosition;
+}
+
+static const X86Reg* allocation_order(X86RegClass reg_class, uint32_t& count) {
+  if (reg_class == X86RegClass::Xmm) {
+    count = sizeof(X86XmmAllocationOrder) / sizeof(X86XmmAllocationOrder[0]);
+    return X86XmmAllocationOrder;
+  }
+  count = sizeof(X86GprAllocationOrder) / sizeof(X86GprAllocationOrder[0]);
+  return X86GprAllocationOrder;
+}
+
+RegAllocStats LinearScan::run() {
+  DominatorTree tree(m_function);
+  Liveness liveness(m_function, tree);
+  number_positions(tree);
+  build_intervals(liveness);
+  allocate();
+  resolve(liveness);
+  return m_stats;
+}
+
+void LinearScan::number_positions(const DominatorTree& tree) {
+  m_order = tree.reverse_post_order();
+  m_positions.assign(m_function.instrs.size(), UndefinedPosition);
+  m_block_from.assign(m_function.blocks.size(), UndefinedPosition);
+  m_block_to.assign(m_function.blocks.size(), UndefinedPosition);
+  uint32_t position = 0;
+  for (auto block : m_order) {
+    // the label position, phis and live-in values start here
+    m_block_from[block] = position;
+    position += 2;
+    for (auto index : m_function.blocks[block].instrs) {
+      m_positions[index] = position;
+      position += 2;
+    }
+    m_block_to[block] = position;
+  }
+  m_block_starts.assign(position + 1, false);
+  for (auto block : m_order) m_block_starts[m_block_from[block]] = true;
+}
+
+uint32_t LinearScan::interval_of(IrValueIndex value) {
+  if (m_value_intervals[value] != UndefinedIrValueIndex) return m_value_intervals[value];
+  const uint32_t index = m_intervals.size();
+  m_intervals.emplace_back();
+  auto& interval = m_intervals.back();
+  interval.value = value;
+  const auto type = m_function.instrs[value].type;
+  interval.reg_class = ir_is_float(type) || ir_is_vector(type) ? X86RegClass::Xmm : X86RegClass::Gpr;
+  m_value_intervals[value] = index;
+  return index;
+}
+
+// blocks and instructions are visited backwards, so a new range either
+// overlaps the earliest one built so far or lies before it
+void LinearScan::add_range(LiveInterval& interval, uint32_t start, uint32_t end) {
+  auto& ranges = interval.ranges;
+  if (!ranges.empty() && ranges.back().start <= end) {
+    ranges.back().start = std::min(ranges.back().start, start);
+    ranges.back().end = std::max(ranges.back().end, end);
+    return;
+  }
+  ranges.push_back({start, end});
+}
+
+void LinearScan::build_intervals(const Liveness& liveness) {
+  const auto& instrs = m_function.instrs;
+  m_value_intervals.assign(instrs.size(), UndefinedIrValueIndex);
+  for (uint32_t reg = 0; reg < X86RegCount; ++reg) {
+    m_fixed[reg].reg = static_cast<X86Reg>(reg);
+    m_fixed[reg].reg_class = x86_reg_class(m_fixed[reg].reg);
+    m_fixed[reg].fixed = true;
+  }
+
+  for (auto it = m_order.rbegin(); it != m_order.rend(); ++it) {
+    const auto block = *it;
+    const auto from = m_block_from[block];
+    const auto to = m_block_to[block];
+    for (auto value : liveness.live_out(block)) add_range(m_intervals[interval_of(value)], from, to);
+
+    const auto& block_instrs = m_function.blocks[block].instrs;
+    for (auto instr_it = block_instrs.rbegin(); instr_it != block_instrs.rend(); ++instr_it) {
+      const auto index = *instr_it;
+      const auto& instr = instrs[index];
+      const auto position = m_positions[index];
+      if (instr.is_call()) {
+        for (uint32_t reg = 0; reg < X86RegCount; ++reg) {
+          if (x86_is_caller_saved(static_cast<X86Reg>(reg))) add_range(m_fixed[reg], position, position + 1);
+        }
+      }
+      if (instr.type != IrType::Void) {
+        // a call result appears after the clobbers, parameters arrive in
+        // their registers before the first instruction
+        auto def = position;
+        if (instr.kind == IrInstr::Kind::Phi || instr.kind == IrInstr::Kind::Param) def = from;
+        if (instr.is_call()) def = position + 1;
+        auto& ranges = m_intervals[interval_of(index)].ranges;
+        if (ranges.empty() || ranges.back().start >= to) {
+          ranges.push_back({def, def + 1});
+        } else {
+          ranges.back().start = def;
+        }
+      }
+      // phi operands are live-out of the predecessors
+      if (instr.kind == IrInstr::Kind::Phi) continue;
+      for (auto operand : instr.operands) {
+        auto& interval = m_intervals[interval_of(operand)];
+        add_range(interval, from, position);
+        interval.uses.emplace_back(position);
+      }
+    }
+  }
+
+  for (auto& interval : m_intervals) {
+    std::reverse(interval.ranges.begin(), interval.ranges.end());
+    std::reverse(interval.uses.begin(), interval.uses.end());
+  }
+  for (auto& interval : m_fixed) std::reverse(interval.ranges.begin(), interval.ranges.end());
+
+  m_stats.intervals = m_intervals.size();
+  m_pieces.assign(instrs.size(), {});
+  m_spill_slots.assign(instrs.size(), UndefinedSpillSlot);
+  for (uint32_t index = 0; index < m_intervals.size(); ++index) m_pieces[m_intervals[index].value] = {index};
+}
+
+void LinearScan::push_unhandled(uint32_t interval) {
+  m_unhandled.emplace_back(interval);
+  std::push_heap(m_unhandled.begin(), m_unhandled.end(), [this](uint32_t a, uint32_t b) {
+    return m_intervals[a].start() > m_intervals[b].start();
+  });
+}
+
+uint32_t LinearScan::pop_unhandled() {
+  std::pop_heap(m_unhandled.begin(), m_unhandled.end(), [this](uint32_t a, uint32_t b) {
+    return m_intervals[a].start() > m_intervals[b].start();
+  });
+  const auto interval = m_unhandled.back();
+  m_unhandled.pop_back();
+  return interval;
+}
+
+void LinearScan::allocate() {
+  for (uint32_t index = 0; index < m_intervals.size(); ++index) push_unhandled(index);
+  while (!m_unhandled.empty()) {
+    const auto current = pop_unhandled();
+    const auto position = m_intervals[current].start();
+
+    std::vector<uint32_t> still_active;
+    for (auto interval : m_active) {
+      const auto& it = m_intervals[interval];
+      if (it.end() <= position) continue;
+      if (it.covers(position)) {
+        still_active.emplace_back(interval);
+      } else {
+        m_inactive.emplace_back(interval);
+      }
+    }
+    m_active.swap(still_active);
+    m_inactive.erase(
+      std::remove_if(m_inactive.begin(), m_inactive.end(), [&](uint32_t interval) {
+        const auto& it = m_intervals[interval];
+        if (it.end() <= position) return true;
+        if (!it.covers(position)) return false;
+        m_active.emplace_back(interval);
+        return true;
+      }),
+      m_inactive.end());
+
+    if (!try_allocate_free_reg(current)) allocate_blocked_reg(current);
+    const auto reg = m_intervals[current].reg;
+    if (reg == X86Reg::None) continue;
+    m_active.emplace_back(current);
+    m_used_registers |= uint32_t(1) << static_cast<uint8_t>(reg);
+  }
+}
+
+bool LinearScan::try_allocate_free_reg(uint32_t current) {
+  uint32_t free_until[X86RegCount];
+  std::fill(free_until, free_until + X86RegCount, MaxPosition);
+  const auto& cur = m_intervals[current];
+  for (auto interval : m_active) free_until[static_cast<uint8_t>(m_intervals[interval].reg)] = 0;
+  for (auto interval : m_inactive) {
+    const auto& it = m_intervals[interval];
+    auto& until = free_until[static_cast<uint8_t>(it.reg)];
+    until = std::min(until, it.next_intersection(cur));
+  }
+
+  uint32_t count = 0;
+  const auto* order = allocation_order(cur.reg_class, count);
+  auto best = X86Reg::None;
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto reg = static_cast<uint8_t>(order[i]);
+    free_until[reg] = std::min(free_until[reg], m_fixed[reg].next_intersection(cur));
+    if (best == X86Reg::None || free_until[reg] > free_until[static_cast<uint8_t>(best)]) best = order[i];
+  }
+  // the first register in order that stays free for the whole interval
+  for (uint32_t i = 0; i < count; ++i) {
+    if (free_until[static_cast<uint8_t>(order[i])] >= cur.end()) {
+      best = order[i];
+      break;
+    }
+  }
+
+  const auto until = free_until[static_cast<uint8_t>(best)];
+  if (until <= cur.start()) return false;
+  m_intervals[current].reg = best;
+  if (until < m_intervals[current].end()) push_unhandled(split(current, until));
+  return true;
+}
+
+// where the piece of a spilled interval that is reloaded for a use starts.
+// An operand whose interval ends at an instruction is expired there, so a
+// piece starting at the instruction could get its register while it is
+// still read. Starting in the gap before the instruction keeps them apart.
+static uint32_t reload_position(const LiveInterval& interval, uint32_t use) {
+  return use - 1 > interval.start() ? use - 1 : use;
+}
+
+void LinearScan::allocate_blocked_reg(uint32_t current) {
+  uint32_t use_pos[X86RegCount];
+  uint32_t block_pos[X86RegCount];
+  std::fill(use_pos, use_pos + X86RegCount, MaxPosition);
+  std::fill(block_pos, block_pos + X86RegCount, MaxPosition);
+  const auto start = m_intervals[current].start();
+  for (auto interval : m_active) {
+    const auto& it = m_intervals[interval];
+    auto& pos = use_pos[static_cast<uint8_t>(it.reg)];
+    pos = std::min(pos, it.next_use(start));
+  }
+  for (auto interval : m_inactive) {
+    const auto& it = m_intervals[interval];
+    if (it.next_intersection(m_intervals[current]) == MaxPosition) continue;
+    auto& pos = use_pos[static_cast<uint8_t>(it.reg)];
+    pos = std::min(pos, it.next_use(start));
+  }
+
+  uint32_t count = 0;
+  const auto* order = allocation_order(m_intervals[current].reg_class, count);
+  auto best = order[0];
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto reg = static_cast<uint8_t>(order[i]);
+    const auto blocked = m_fixed[reg].next_intersection(m_intervals[current]);
+    block_pos[reg] = std::min(block_pos[reg], blocked);
+    use_pos[reg] = std::min(use_pos[reg], blocked);
+    if (use_pos[reg] > use_pos[static_cast<uint8_t>(best)]) best = order[i];
+  }
+  const auto reg = static_cast<uint8_t>(best);
+
+  const auto first_use = m_intervals[current].next_use(start);
+  if (first_use >= m_intervals[current].end()) {
+    spill(current);
+    return;
+  }
+  if (use_pos[reg] < first_use) {
+    // every register is needed earlier than the current interval needs one
+    push_unhandled(split(current, reload_position(m_intervals[current], first_use)));
+    spill(current);
+    return;
+  }
+  if (block_pos[reg] <= start) {
+    split_and_spill(current, start);
+    return;
+  }
+
+  m_intervals[current].reg = best;
+  if (block_pos[reg] < m_intervals[current].end()) push_unhandled(split(current, block_pos[reg]));
+
+  const auto evict = [&](std::vector<uint32_t>& list, bool check_intersection) {
+    list.erase(
+      std::remove_if(list.begin(), list.end(), [&](uint32_t interval) {
+        if (m_intervals[interval].reg != best) return false;
+        if (check_intersection && m_intervals[interval].next_intersection(m_intervals[current]) == MaxPosition) return false;
+        split_and_spill(interval, start);
+        return true;
+      }),
+      list.end());
+  };
+  evict(m_active, false);
+  evict(m_inactive, true);
+}
+
+uint32_t LinearScan::split(uint32_t interval, uint32_t position) {
+  LiveInterval child;
+  {
+    auto& parent = m_intervals[interval];
+    child.value = parent.value;
+    child.reg_class = parent.reg_class;
+    auto& ranges = parent.ranges;
+    auto range = std::find_if(ranges.begin(), ranges.end(), [position](const LiveRange& r) { return r.end > position; });
+    if (range != ranges.end() && range->start < position) {
+      child.ranges.push_back({position, range->end});
+      range->end = position;
+      ++range;
+    }
+    child.ranges.insert(child.ranges.end(), range, ranges.end());
+    ranges.erase(range, ranges.end());
+    auto use = std::lower_bound(parent.uses.begin(), parent.uses.end(), position);
+    child.uses.assign(use, parent.uses.end());
+    parent.uses.erase(use, parent.uses.end());
+  }
+  const uint32_t index = m_intervals.size();
+  m_intervals.emplace_back(std::move(child));
+  auto& pieces = m_pieces[m_intervals[index].value];
+  const auto child_start = m_intervals[index].start();
+  pieces.insert(
+    std::upper_bound(pieces.begin(), pieces.end(), child_start,
+      [this](uint32_t pos, uint32_t piece) { return pos < m_intervals[piece].start(); }),
+    index);
+  ++m_stats.splits;
+  return index;
+}
+
+void LinearScan::spill(uint32_t interval) {
+  auto& it = m_intervals[interval];
+  it.reg = X86Reg::None;
+  auto& slot = m_spill_slots[it.value];
+  if (slot == UndefinedSpillSlot) {
+    // vectors take several slots, the last one has the lowest address and
+    // is 16 byte aligned when the spill area is
+    const auto size = ir_type_size(m_function.instrs[it.value].type);
+    if (size > 8) {
+      m_stats.spill_slots = (m_stats.spill_slots + size / 8 + 1) / 2 * 2;
+      slot = m_stats.spill_slots - 1;
+    } else {
+      slot = m_stats.spill_slots++;
+    }
+  }
+  ++m_stats.spilled_intervals;
+}
+
+// the part from position on lives in memory until its next use, operands
+// read at position itself come from the spill slot
+void LinearScan::split_and_spill(uint32_t interval, uint32_t position) {
+  auto piece = interval;
+  if (position > m_intervals[interval].start()) piece = split(interval, position);
+  const auto next = m_intervals[piece].next_use(m_intervals[piece].start() + 1);
+  if (next != MaxPosition && next < m_intervals[piece].end()) {
+    push_unhandled(split(piece, reload_position(m_intervals[piece], next)));
+  }
+  spill(piece);
+}
+
+RegAllocLocation LinearScan::piece_location(uint32_t piece) const {
+  RegAllocLocation location;
+  location.reg = m_intervals[piece].reg;
+  if (location.reg == X86Reg::None) location.spill_slot = m_spill_slots[m_intervals[piece].value];
+  return location;
+}
+
+RegAllocLocation LinearScan::location(IrValueIndex value, uint32_t position) const {
+  if (m_value_intervals[value] == UndefinedIrValueIndex) return {};
+  const auto& pieces = m_pieces[value];
+  for (auto piece : pieces) {
+    if (m_intervals[piece].covers(position)) return piece_location(piece);
+  }
+  // the last use of a range ends at the reading instruction
+  for (auto piece : pieces) {
+    for (const auto& range : m_intervals[piece].ranges) {
+      if (range.end == position) return piece_location(piece);
+    }
+  }
+  return {};
+}
+
+void LinearScan::resolve(const Liveness& liveness) {
+  for (const auto& pieces : m_pieces) {
+    for (uint32_t i = 1; i < pieces.size(); ++i) {
+      const auto& piece = m_intervals[pieces[i]];
+      const auto start = piece.start();
+      if (m_block_starts[start]) continue;
+      RegAllocMove move;
+      move.position = start;
+      move.value = piece.value;
+      move.from = location(piece.value, start - 1);
+      move.to = piece_location(pieces[i]);
+      if (move.from != move.to) add_move(move);
+    }
+  }
+
+  for (auto block : m_order) {
+    auto succs = m_function.blocks[block].succs;
+    std::sort(succs.begin(), succs.end());
+    succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+    const auto end = m_block_to[block] - 1;
+    for (auto succ : succs) {
+      RegAllocMove move;
+      move.from_block = block;
+      move.to_block = succ;
+      for (auto value : liveness.live_in(succ)) {
+        move.value = value;
+        move.from = location(value, end);
+        move.to = location(value, m_block_from[succ]);
+        if (move.from != move.to) add_move(move);
+      }
+      const auto& preds = m_function.blocks[succ].preds;
+      const auto pred = std::find(preds.begin(), preds.end(), block) - preds.begin();
+      for (auto index : m_function.blocks[succ].instrs) {
+        const auto& instr = m_function.instrs[index];
+        if (instr.kind != IrInstr::Kind::Phi) break;
+        move.value = index;
+        move.from = location(instr.operands[pred], end);
+        move.to = location(index, m_block_from[succ]);
+        if (move.from != move.to) add_move(move);
+      }
+    }
+  }
+}
+
+void LinearScan::add_move(RegAllocMove move) {
+  m_moves.emplace_back(move);
+  ++m_stats.moves;
+}
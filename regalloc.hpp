@@ -0,0 +1,142 @@
+#ifndef REGALLOC_HPP
+#define REGALLOC_HPP
+
+#include "ir.hpp"
+#include "x86_64.hpp"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class DominatorTree;
+class Liveness;
+
+static const uint32_t UndefinedPosition = std::numeric_limits<uint32_t>::max();
+static const uint32_t UndefinedSpillSlot = std::numeric_limits<uint32_t>::max();
+
+// half open [start, end) range of positions
+struct LiveRange {
+  uint32_t start;
+  uint32_t end;
+};
+
+struct LiveInterval {
+  IrValueIndex value = UndefinedIrValueIndex;
+  X86RegClass reg_class = X86RegClass::Gpr;
+  // sorted and disjoint, the gaps between them are lifetime holes
+  std::vector<LiveRange> ranges;
+  // sorted positions of the instructions reading the value
+  std::vector<uint32_t> uses;
+  // X86Reg::None for a piece living in the spill slot of its value
+  X86Reg reg = X86Reg::None;
+  // fixed intervals block a register around calls and have no value
+  bool fixed = false;
+
+  uint32_t start() const { return ranges.front().start; }
+  uint32_t end() const { return ranges.back().end; }
+  bool covers(uint32_t position) const;
+  // the first use at or after position
+  uint32_t next_use(uint32_t position) const;
+  // the first position covered by both intervals
+  uint32_t next_intersection(const LiveInterval& other) const;
+};
+
+struct RegAllocLocation {
+  X86Reg reg = X86Reg::None;
+  uint32_t spill_slot = UndefinedSpillSlot;
+
+  bool is_register() const { return reg != X86Reg::None; }
+  bool operator==(const RegAllocLocation& other) const { return reg == other.reg && spill_slot == other.spill_slot; }
+  bool operator!=(const RegAllocLocation& other) const { return !(*this == other); }
+};
+
+// A copy the code generator has to emit. Moves with a position go right
+// before the instruction at that position, moves on an edge run when control
+// passes from from_block to to_block; the moves of one edge are parallel.
+struct RegAllocMove {
+  uint32_t position = UndefinedPosition;
+  IrBlockIndex from_block = UndefinedIrBlockIndex;
+  IrBlockIndex to_block = UndefinedIrBlockIndex;
+  IrValueIndex value = UndefinedIrValueIndex;
+  RegAllocLocation from;
+  RegAllocLocation to;
+};
+
+struct RegAllocStats {
+  uint32_t intervals = 0;
+  uint32_t splits = 0;
+  uint32_t spilled_intervals = 0;
+  uint32_t spill_slots = 0;
+  uint32_t moves = 0;
+};
+
+// Linear scan register allocation for x86-64 following Wimmer, Franz
+// "Linear Scan Register Allocation on SSA Form". Blocks are laid out in
+// reverse post-order, every block starts with a label position followed by
+// one even position per instruction. Intervals are built from the block
+// liveness in one backward pass and keep their lifetime holes, so a register
+// can be shared by values whose ranges interleave. When no register is free
+// for a whole interval it is split: the part up to the next blocked position
+// keeps the register, the interval with the farthest next use is spilled up
+// to its next use, and the remaining pieces go back to the worklist. Uses
+// ending at a position do not conflict with a definition there, so operands
+// and results may share a register. Calls block all caller saved registers.
+class LinearScan {
+public:
+  LinearScan(const IrFunction& function) : m_function(function) {}
+  LinearScan(const LinearScan&) = delete;
+  LinearScan(LinearScan&&) = delete;
+  LinearScan& operator=(const LinearScan&) = delete;
+  LinearScan& operator=(LinearScan&&) = delete;
+
+  RegAllocStats run();
+
+  uint32_t position(IrValueIndex instr) const { return m_positions[instr]; }
+  uint32_t block_from(IrBlockIndex block) const { return m_block_from[block]; }
+  uint32_t block_to(IrBlockIndex block) const { return m_block_to[block]; }
+  // where the value is when the instruction at position executes
+  RegAllocLocation location(IrValueIndex value, uint32_t position) const;
+  const std::vector<RegAllocMove>& moves() const { return m_moves; }
+  const std::vector<LiveInterval>& intervals() const { return m_intervals; }
+  // bit set of every X86Reg assigned to some interval
+  uint32_t used_registers() const { return m_used_registers; }
+
+private:
+  const IrFunction& m_function;
+  RegAllocStats m_stats;
+  // reachable blocks in layout order
+  std::vector<IrBlockIndex> m_order;
+  std::vector<uint32_t> m_positions;
+  std::vector<uint32_t> m_block_from;
+  std::vector<uint32_t> m_block_to;
+  std::vector<bool> m_block_starts;
+  std::vector<LiveInterval> m_intervals;
+  // the first interval of each value, UndefinedIrValueIndex if it has none
+  std::vector<uint32_t> m_value_intervals;
+  // split pieces of each value ordered by start, the first piece included
+  std::vector<std::vector<uint32_t>> m_pieces;
+  std::vector<uint32_t> m_spill_slots;
+  LiveInterval m_fixed[X86RegCount];
+  std::vector<uint32_t> m_unhandled;
+  std::vector<uint32_t> m_active;
+  std::vector<uint32_t> m_inactive;
+  std::vector<RegAllocMove> m_moves;
+  uint32_t m_used_registers = 0;
+
+  void number_positions(const DominatorTree& tree);
+  void build_intervals(const Liveness& liveness);
+  uint32_t interval_of(IrValueIndex value);
+  void add_range(LiveInterval& interval, uint32_t start, uint32_t end);
+  void allocate();
+  void push_unhandled(uint32_t interval);
+  uint32_t pop_unhandled();
+  bool try_allocate_free_reg(uint32_t current);
+  void allocate_blocked_reg(uint32_t current);
+  uint32_t split(uint32_t interval, uint32_t position);
+  void spill(uint32_t interval);
+  void split_and_spill(uint32_t interval, uint32_t position);
+  void resolve(const Liveness& liveness);
+  RegAllocLocation piece_location(uint32_t piece) const;
+  void add_move(RegAllocMove move);
+};
+
+#endif  // REGALLOC_HPP
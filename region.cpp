@@ -0,0 +1,94 @@
+#include "region.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+RegionArena::~RegionArena() {
+  while (m_block) {
+    auto* previous = m_block->previous;
+    std::free(m_block);
+    m_block = previous;
+  }
+  for (auto* block : m_spares) std::free(block);
+}
+
+namespace {
+
+thread_local RegionArena* t_current = nullptr;
+
+}  // namespace
+
+RegionArena& RegionArena::current() {
+  static thread_local RegionArena arena;
+  return t_current ? *t_current : arena;
+}
+
+void RegionArena::set_current(RegionArena* arena) {
+  t_current = arena;
+}
+
+void RegionArena::enter() {
+  m_marks.push_back({m_block, m_top});
+}
+
+void RegionArena::leave() {
+  const auto mark = m_marks.back();
+  m_marks.pop_back();
+  while (m_block != mark.block) {
+    auto* previous = m_block->previous;
+    release(m_block);
+    m_block = previous;
+  }
+  m_top = mark.top;
+  m_end = m_block ? reinterpret_cast<uint8_t*>(m_block + 1) + m_block->size : nullptr;
+}
+
+void RegionArena::leave_to(uint32_t depth) {
+  while (m_marks.size() > depth) leave();
+}
+
+void* RegionArena::allocate_block(size_t size) {
+  Block* block = nullptr;
+  if (size <= BlockSize && !m_spares.empty()) {
+    block = m_spares.back();
+    m_spares.pop_back();
+    ++m_stats.reused_blocks;
+  } else {
+    const size_t block_size = std::max(size, BlockSize);
+    block = static_cast<Block*>(std::malloc(sizeof(Block) + block_size));
+    // like new, running out of memory ends the program
+    if (!block) std::abort();
+    block->size = block_size;
+    m_held_bytes += block_size;
+    m_stats.peak_bytes = std::max(m_stats.peak_bytes, m_held_bytes);
+    ++m_stats.blocks;
+  }
+  // the rest of the current block is left unused until it is given back
+  block->previous = m_block;
+  m_block = block;
+  auto* memory = reinterpret_cast<uint8_t*>(block + 1);
+  m_top = memory + size;
+  m_end = memory + block->size;
+  memset(memory, 0, size);
+  return memory;
+}
+
+void RegionArena::release(Block* block) {
+  if (block->size == BlockSize && m_spares.size() < MaxSpareBlocks) {
+    m_spares.emplace_back(block);
+    return;
+  }
+  m_held_bytes -= block->size;
+  std::free(block);
+}
+
+void region_enter() {
+  RegionArena::current().enter();
+}
+
+void region_leave() {
+  RegionArena::current().leave();
+}
+
+void* region_allocate(int32_t bytes) {
+  return RegionArena::current().allocate(bytes);
+}
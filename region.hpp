@@ -0,0 +1,101 @@
+#ifndef REGION_HPP
+#define REGION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// largest single allocation of a region, in bytes
+static const uint32_t RegionMaxBytes = 1u << 30;
+
+struct RegionStats {
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  // blocks taken from malloc, the rest were spares of earlier regions
+  uint64_t blocks = 0;
+  uint64_t reused_blocks = 0;
+  // bytes of blocks held at once, spares included
+  uint64_t peak_bytes = 0;
+};
+
+// Bump pointer allocator behind the region statement. Every thread and
+// every task has its own arena, a chain of blocks: entering a region
+// remembers the block and the position in it, allocating moves the
+// position up, and leaving gives back every block taken since the region
+// was entered and resets the position, which frees all the region
+// allocated at once.
+// Allocations are zeroed and 8 byte aligned. An allocation that does not
+// fit the rest of the block starts a new one, of its own size if it is
+// larger than BlockSize. Blocks given back are kept as spares for the
+// next region, up to MaxSpareBlocks of them. Regions nest and are left in
+// the reverse order they were entered.
+class RegionArena {
+public:
+  static constexpr size_t BlockSize = 64 * 1024;
+  static constexpr uint32_t MaxSpareBlocks = 16;
+
+  RegionArena() = default;
+  RegionArena(const RegionArena&) = delete;
+  RegionArena(RegionArena&&) = delete;
+  RegionArena& operator=(const RegionArena&) = delete;
+  RegionArena& operator=(RegionArena&&) = delete;
+  ~RegionArena();
+
+  // the arena of the running task, else of the calling thread
+  static RegionArena& current();
+  // makes arena the current one of the calling thread, nullptr for its own
+  static void set_current(RegionArena* arena);
+
+  void enter();
+  void leave();
+  // leaves the regions entered after depth regions were open, for code
+  // that stops while inside some
+  void leave_to(uint32_t depth);
+  uint32_t depth() const { return m_marks.size(); }
+
+  // bytes is at most RegionMaxBytes
+  void* allocate(uint32_t bytes) {
+    const size_t size = (static_cast<size_t>(bytes) + 7) & ~static_cast<size_t>(7);
+    ++m_stats.allocations;
+    m_stats.bytes += bytes;
+    if (static_cast<size_t>(m_end - m_top) < size) return allocate_block(size);
+    void* memory = m_top;
+    m_top += size;
+    memset(memory, 0, size);
+    return memory;
+  }
+
+  const RegionStats& stats() const { return m_stats; }
+
+private:
+  // the usable bytes follow the header
+  struct Block {
+    Block* previous;
+    size_t size;
+  };
+  struct Mark {
+    Block* block;
+    uint8_t* top;
+  };
+
+  // the block being allocated from and the free part of it
+  Block* m_block = nullptr;
+  uint8_t* m_top = nullptr;
+  uint8_t* m_end = nullptr;
+  std::vector<Mark> m_marks;
+  std::vector<Block*> m_spares;
+  uint64_t m_held_bytes = 0;
+  RegionStats m_stats;
+
+  void* allocate_block(size_t size);
+  void release(Block* block);
+};
+
+// Entry points for compiled code, System V functions on the current
+// arena.
+void region_enter();
+void region_leave();
+void* region_allocate(int32_t bytes);
+
+#endif  // REGION_HPP
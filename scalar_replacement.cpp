@@ -0,0 +1,249 @@
+#include "scalar_replacement.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+// the field of a load or store that is not replaced
+const uint32_t NoField = ~0u;
+// the offset of an address indexed by something other than a constant
+const uint32_t UnknownOffset = ~0u;
+
+bool is_address(IrInstr::Kind kind) {
+  return kind == IrInstr::Kind::FieldAddr || kind == IrInstr::Kind::ElementAddr;
+}
+
+}  // namespace
+
+ScalarReplacementStats ScalarReplacement::run() {
+  ScalarReplacementStats stats;
+  auto& instrs = m_function.instrs;
+  const uint32_t instr_count = instrs.size();
+  for (const auto& block : m_function.blocks) {
+    for (auto index : block.instrs) stats.slots += instrs[index].kind == IrInstr::Kind::StackSlot;
+  }
+  if (!stats.slots) return stats;
+
+  find_addresses();
+  auto escaped = find_escapes();
+  find_fields(escaped);
+  std::vector<bool> replaced(instr_count, false);
+  for (const auto& block : m_function.blocks) {
+    for (auto index : block.instrs) {
+      if (instrs[index].kind != IrInstr::Kind::StackSlot || escaped[index]) continue;
+      replaced[index] = true;
+      ++stats.replaced;
+    }
+  }
+  if (!stats.replaced) return stats;
+  stats.fields = m_fields.size();
+
+  // every field is zero where its slot is created
+  std::unordered_map<IrValueIndex, std::vector<uint32_t>> fields_of;
+  for (uint32_t field = 0; field < m_fields.size(); ++field) {
+    auto& f = m_fields[field];
+    const auto block = instrs[f.slot].block;
+    f.zero = m_function.create_const(block, IrConst::make_zero(f.type));
+    auto& block_instrs = m_function.blocks[block].instrs;
+    block_instrs.pop_back();
+    block_instrs.insert(std::find(block_instrs.begin(), block_instrs.end(), f.slot) + 1, f.zero);
+    fields_of[f.slot].emplace_back(field);
+  }
+
+  const uint32_t count = m_fields.size();
+  const uint32_t block_count = m_function.blocks.size();
+  m_entry_values.assign(block_count * count, UndefinedIrValueIndex);
+  m_end_values.assign(block_count * count, UndefinedIrValueIndex);
+  for (IrBlockIndex block = 0; block < block_count; ++block) {
+    for (auto index : m_function.blocks[block].instrs) {
+      const auto& instr = instrs[index];
+      if (instr.kind == IrInstr::Kind::StackSlot && replaced[index]) {
+        for (auto field : fields_of[index]) m_end_values[block * count + field] = m_fields[field].zero;
+      } else if (instr.kind == IrInstr::Kind::Store && index < instr_count && m_field_of[index] != NoField) {
+        m_end_values[block * count + m_field_of[index]] = instr.operands[1];
+      }
+    }
+  }
+
+  // loads take the value their field has at that point, phis created on
+  // the way get appended to instrs
+  std::vector<IrValueIndex> map(instr_count, UndefinedIrValueIndex);
+  std::vector<IrValueIndex> current(count);
+  for (IrBlockIndex block = 0; block < block_count; ++block) {
+    std::fill(current.begin(), current.end(), UndefinedIrValueIndex);
+    for (uint32_t i = 0; i < m_function.blocks[block].instrs.size(); ++i) {
+      const auto index = m_function.blocks[block].instrs[i];
+      if (index >= instr_count) continue;
+      const auto kind = instrs[index].kind;
+      if (kind == IrInstr::Kind::StackSlot && replaced[index]) {
+        for (auto field : fields_of[index]) current[field] = m_fields[field].zero;
+        continue;
+      }
+      if (kind != IrInstr::Kind::Load && kind != IrInstr::Kind::Store) continue;
+      const auto field = m_field_of[index];
+      if (field == NoField) continue;
+      if (kind == IrInstr::Kind::Store) {
+        current[field] = instrs[index].operands[1];
+        ++stats.stores_removed;
+        continue;
+      }
+      if (current[field] == UndefinedIrValueIndex) current[field] = value_at_entry(field, block);
+      map[index] = current[field];
+      ++stats.loads_removed;
+    }
+  }
+
+  // the slots go with their addresses, loads and stores
+  m_function.replace_uses(map);
+  for (auto& block : m_function.blocks) {
+    for (auto index : block.instrs) {
+      if (index >= instr_count) continue;
+      auto& instr = instrs[index];
+      const auto slot = m_slot_of[index];
+      const bool accesses = instr.kind == IrInstr::Kind::Load || instr.kind == IrInstr::Kind::Store;
+      if (accesses ? m_field_of[index] == NoField : slot == UndefinedIrValueIndex || !replaced[slot]) continue;
+      instr.kind = IrInstr::Kind::None;
+      instr.block = UndefinedIrBlockIndex;
+      instr.operands.clear();
+    }
+    block.instrs.erase(
+      std::remove_if(block.instrs.begin(), block.instrs.end(),
+        [&](IrValueIndex index) { return instrs[index].kind == IrInstr::Kind::None; }),
+      block.instrs.end());
+  }
+  m_function.remove_trivial_phis();
+  return stats;
+}
+
+void ScalarReplacement::find_addresses() {
+  const auto& instrs = m_function.instrs;
+  m_slot_of.assign(instrs.size(), UndefinedIrValueIndex);
+  m_offset_of.assign(instrs.size(), 0);
+  // blocks are not in dominance order, so repeat until the slots settle
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto& block : m_function.blocks) {
+      for (auto index : block.instrs) {
+        const auto& instr = instrs[index];
+        auto slot = UndefinedIrValueIndex;
+        uint32_t offset = 0;
+        if (instr.kind == IrInstr::Kind::StackSlot) {
+          slot = index;
+        } else if (is_address(instr.kind) && m_slot_of[instr.operands[0]] != UndefinedIrValueIndex) {
+          slot = m_slot_of[instr.operands[0]];
+          const int64_t base = m_offset_of[instr.operands[0]];
+          const auto& element = instrs[instr.operands.size() > 1 ? instr.operands[1] : index];
+          int64_t at = -1;
+          if (instr.kind == IrInstr::Kind::FieldAddr) {
+            at = base + instr.index;
+          } else if (element.kind == IrInstr::Kind::Const && element.type == IrType::I32) {
+            at = base + element.constant.i * instr.index;
+          }
+          offset = base == UnknownOffset || at < 0 || at >= UnknownOffset ? UnknownOffset : at;
+        }
+        if (slot == m_slot_of[index] && offset == m_offset_of[index]) continue;
+        m_slot_of[index] = slot;
+        m_offset_of[index] = offset;
+        changed = true;
+      }
+    }
+  }
+}
+
+std::vector<bool> ScalarReplacement::find_escapes() const {
+  const auto& instrs = m_function.instrs;
+  std::vector<bool> escaped(instrs.size(), false);
+  for (const auto& block : m_function.blocks) {
+    for (auto index : block.instrs) {
+      const auto& instr = instrs[index];
+      for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+        const auto slot = m_slot_of[instr.operands[i]];
+        if (slot == UndefinedIrValueIndex) continue;
+        const bool accesses = i == 0 && (is_address(instr.kind) || instr.kind == IrInstr::Kind::Load ||
+                                          instr.kind == IrInstr::Kind::Store);
+        if (!accesses) escaped[slot] = true;
+      }
+    }
+  }
+  return escaped;
+}
+
+void ScalarReplacement::find_fields(std::vector<bool>& escaped) {
+  const auto& instrs = m_function.instrs;
+  m_fields.clear();
+  m_field_of.assign(instrs.size(), NoField);
+  std::unordered_map<uint64_t, uint32_t> field_at;
+  for (const auto& block : m_function.blocks) {
+    for (auto index : block.instrs) {
+      const auto& instr = instrs[index];
+      if (instr.kind != IrInstr::Kind::Load && instr.kind != IrInstr::Kind::Store) continue;
+      const auto address = instr.operands[0];
+      const auto slot = m_slot_of[address];
+      if (slot == UndefinedIrValueIndex || escaped[slot]) continue;
+      const auto type = instr.kind == IrInstr::Kind::Load ? instr.type : instrs[instr.operands[1]].type;
+      const uint64_t offset = m_offset_of[address];
+      if (offset + ir_type_size(type) > instrs[slot].index) {
+        escaped[slot] = true;
+        continue;
+      }
+      const auto [it, inserted] = field_at.emplace(static_cast<uint64_t>(slot) << 32 | offset, m_fields.size());
+      if (inserted) {
+        m_fields.push_back({slot, static_cast<uint32_t>(offset), type});
+      } else if (m_fields[it->second].type != type) {
+        escaped[slot] = true;
+      }
+      m_field_of[index] = it->second;
+    }
+  }
+
+  // fields of one slot must not overlap
+  std::vector<uint32_t> order(m_fields.size());
+  for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return m_fields[a].slot != m_fields[b].slot ? m_fields[a].slot < m_fields[b].slot
+                                                : m_fields[a].offset < m_fields[b].offset;
+  });
+  for (uint32_t i = 1; i < order.size(); ++i) {
+    const auto& prev = m_fields[order[i - 1]];
+    const auto& field = m_fields[order[i]];
+    if (prev.slot == field.slot && prev.offset + ir_type_size(prev.type) > field.offset) escaped[field.slot] = true;
+  }
+
+  // only the fields of slots that are replaced stay
+  std::vector<uint32_t> renumber(m_fields.size(), NoField);
+  std::vector<Field> kept;
+  for (uint32_t field = 0; field < m_fields.size(); ++field) {
+    if (escaped[m_fields[field].slot]) continue;
+    renumber[field] = kept.size();
+    kept.emplace_back(m_fields[field]);
+  }
+  m_fields = std::move(kept);
+  for (auto& field : m_field_of) {
+    if (field != NoField) field = renumber[field];
+  }
+}
+
+IrValueIndex ScalarReplacement::value_at_entry(uint32_t field, IrBlockIndex block) {
+  const auto key = block * m_fields.size() + field;
+  if (m_entry_values[key] != UndefinedIrValueIndex) return m_entry_values[key];
+  const auto preds = m_function.blocks[block].preds;
+  IrValueIndex value = m_fields[field].zero;
+  if (preds.size() == 1) {
+    value = value_at_end(field, preds[0]);
+  } else if (!preds.empty()) {
+    // set before the operands, loops come back to it
+    value = m_function.create_phi(block, m_fields[field].type);
+    m_entry_values[key] = value;
+    std::vector<IrValueIndex> operands;
+    for (auto pred : preds) operands.emplace_back(value_at_end(field, pred));
+    m_function.instrs[value].operands = std::move(operands);
+  }
+  m_entry_values[key] = value;
+  return value;
+}
+
+IrValueIndex ScalarReplacement::value_at_end(uint32_t field, IrBlockIndex block) {
+  const auto value = m_end_values[block * m_fields.size() + field];
+  return value != UndefinedIrValueIndex ? value : value_at_entry(field, block);
+}
@@ -0,0 +1,71 @@
+#ifndef SCALAR_REPLACEMENT_HPP
+#define SCALAR_REPLACEMENT_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+struct ScalarReplacementStats {
+  uint32_t slots = 0;
+  // slots that were replaced by values of their fields
+  uint32_t replaced = 0;
+  uint32_t fields = 0;
+  uint32_t loads_removed = 0;
+  uint32_t stores_removed = 0;
+};
+
+// Escape analysis and scalar replacement of aggregates. A StackSlot
+// escapes if an address derived from it is used for anything but a Load
+// or Store at it: passed to a call, stored, merged by a phi or indexed by
+// something other than a constant. The slots that do not escape and whose
+// loads and stores do not partly overlap, fields of a union, have each
+// field turned into SSA values like Lowering does for variables: a load
+// takes the value last stored to its field, through phis where blocks
+// meet, or zero before any store, which is how the slot starts. The
+// slot, its addresses, loads and stores are removed, so struct locals of
+// a function and those of the functions inlined into it live in
+// registers. Runs after Inliner, which turns the struct parameters of
+// inlined calls into addresses of the caller's slots, and after Sccp,
+// which makes constant array indices constants.
+class ScalarReplacement {
+public:
+  ScalarReplacement(IrFunction& function) : m_function(function) {}
+  ScalarReplacement(const ScalarReplacement&) = delete;
+  ScalarReplacement(ScalarReplacement&&) = delete;
+  ScalarReplacement& operator=(const ScalarReplacement&) = delete;
+  ScalarReplacement& operator=(ScalarReplacement&&) = delete;
+
+  ScalarReplacementStats run();
+
+private:
+  struct Field {
+    IrValueIndex slot;
+    uint32_t offset;
+    IrType type;
+    // the value of the field where the slot is created
+    IrValueIndex zero = UndefinedIrValueIndex;
+  };
+
+  IrFunction& m_function;
+  // the slot an address is derived from and its byte offset into it
+  std::vector<IrValueIndex> m_slot_of;
+  std::vector<uint32_t> m_offset_of;
+  std::vector<Field> m_fields;
+  // the field a load or store of a replaced slot accesses
+  std::vector<uint32_t> m_field_of;
+  // values of the fields when blocks start and end, block * fields + field,
+  // UndefinedIrValueIndex where not known yet or not set in the block
+  std::vector<IrValueIndex> m_entry_values;
+  std::vector<IrValueIndex> m_end_values;
+
+  void find_addresses();
+  // whether each instruction is a slot that escapes
+  std::vector<bool> find_escapes() const;
+  // fields of the slots that do not escape, slots whose accesses overlap
+  // are marked as escaping
+  void find_fields(std::vector<bool>& escaped);
+  IrValueIndex value_at_entry(uint32_t field, IrBlockIndex block);
+  IrValueIndex value_at_end(uint32_t field, IrBlockIndex block);
+};
+
+#endif  // SCALAR_REPLACEMENT_HPP
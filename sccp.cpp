@@ -0,0 +1,204 @@
+#include "sccp.hpp"
+
+SccpStats Sccp::run() {
+  const auto& blocks = m_function.blocks;
+  const auto& instrs = m_function.instrs;
+
+  m_cells.assign(instrs.size(), Cell{});
+  m_users.assign(instrs.size(), {});
+  m_block_executable.assign(blocks.size(), false);
+  m_edge_executable.assign(blocks.size(), {});
+  for (IrBlockIndex block = 0; block < blocks.size(); ++block) {
+    m_edge_executable[block].assign(blocks[block].preds.size(), false);
+    for (auto index : blocks[block].instrs) {
+      for (auto operand : instrs[index].operands) m_users[operand].emplace_back(index);
+    }
+  }
+
+  if (blocks.empty()) return {};
+  m_block_executable[0] = true;
+  for (auto index : blocks[0].instrs) visit(index);
+
+  while (!m_cfg_worklist.empty() || !m_ssa_worklist.empty()) {
+    while (!m_cfg_worklist.empty()) {
+      const auto [from, to] = m_cfg_worklist.back();
+      m_cfg_worklist.pop_back();
+      if (!m_block_executable[to]) {
+        m_block_executable[to] = true;
+        for (auto index : blocks[to].instrs) visit(index);
+      } else {
+        for (auto index : blocks[to].instrs) {
+          if (instrs[index].kind != IrInstr::Kind::Phi) break;
+          visit_phi(index);
+        }
+      }
+    }
+    while (!m_ssa_worklist.empty()) {
+      const auto value = m_ssa_worklist.back();
+      m_ssa_worklist.pop_back();
+      for (auto user : m_users[value]) {
+        if (m_block_executable[instrs[user].block]) visit(user);
+      }
+    }
+  }
+  return rewrite();
+}
+
+void Sccp::mark_edge(IrBlockIndex from, IrBlockIndex to) {
+  const auto& preds = m_function.blocks[to].preds;
+  bool newly_executable = false;
+  for (uint32_t i = 0; i < preds.size(); ++i) {
+    if (preds[i] == from && !m_edge_executable[to][i]) {
+      m_edge_executable[to][i] = true;
+      newly_executable = true;
+    }
+  }
+  if (newly_executable) m_cfg_worklist.emplace_back(from, to);
+}
+
+void Sccp::visit(IrValueIndex index) {
+  const auto& instr = m_function.instrs[index];
+  switch (instr.kind) {
+    case IrInstr::Kind::Const:
+      set_const(index, instr.constant);
+      return;
+    case IrInstr::Kind::Param:
+      set_bottom(index);
+      return;
+    case IrInstr::Kind::Phi:
+      visit_phi(index);
+      return;
+    case IrInstr::Kind::Jump:
+    case IrInstr::Kind::Branch:
+    case IrInstr::Kind::Return:
+      visit_terminator(index);
+      return;
+    default:
+      break;
+  }
+  // calls take any number of operands, ir_fold at most two
+  if (instr.kind != IrInstr::Kind::Neg && !instr.is_binary()) {
+    set_bottom(index);
+    return;
+  }
+
+  IrConst operands[2];
+  for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+    const auto& cell = m_cells[instr.operands[i]];
+    if (cell.state == Cell::State::Bottom) {
+      set_bottom(index);
+      return;
+    }
+    if (cell.state == Cell::State::Top) return;
+    operands[i] = cell.value;
+  }
+
+  IrConst result;
+  if (ir_fold(instr.kind, instr.type, operands[0], operands[1], result)) {
+    set_const(index, result);
+  } else {
+    set_bottom(index);
+  }
+}
+
+void Sccp::visit_phi(IrValueIndex index) {
+  const auto& instr = m_function.instrs[index];
+  const auto& executable = m_edge_executable[instr.block];
+  bool has_value = false;
+  IrConst value;
+  for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+    if (!executable[i]) continue;
+    const auto& cell = m_cells[instr.operands[i]];
+    if (cell.state == Cell::State::Top) continue;
+    if (cell.state == Cell::State::Bottom || (has_value && cell.value != value)) {
+      set_bottom(index);
+      return;
+    }
+    has_value = true;
+    value = cell.value;
+  }
+  if (has_value) set_const(index, value);
+}
+
+void Sccp::visit_terminator(IrValueIndex index) {
+  const auto& instr = m_function.instrs[index];
+  switch (instr.kind) {
+    case IrInstr::Kind::Jump:
+      mark_edge(instr.block, instr.targets[0]);
+      break;
+    case IrInstr::Kind::Branch: {
+      const auto& cell = m_cells[instr.operands[0]];
+      if (cell.state == Cell::State::Const) {
+        mark_edge(instr.block, instr.targets[cell.value.i != 0 ? 0 : 1]);
+      } else if (cell.state == Cell::State::Bottom) {
+        mark_edge(instr.block, instr.targets[0]);
+        mark_edge(instr.block, instr.targets[1]);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void Sccp::set_const(IrValueIndex index, const IrConst& value) {
+  auto& cell = m_cells[index];
+  if (cell.state != Cell::State::Top) return;
+  cell.state = Cell::State::Const;
+  cell.value = value;
+  m_ssa_worklist.emplace_back(index);
+}
+
+void Sccp::set_bottom(IrValueIndex index) {
+  auto& cell = m_cells[index];
+  if (cell.state == Cell::State::Bottom) return;
+  cell.state = Cell::State::Bottom;
+  m_ssa_worklist.emplace_back(index);
+}
+
+SccpStats Sccp::rewrite() {
+  SccpStats stats;
+  stats.instrs_before = m_function.instr_count();
+  auto& instrs = m_function.instrs;
+
+  for (IrBlockIndex block = 0; block < m_function.blocks.size(); ++block) {
+    if (!m_block_executable[block]) continue;
+
+    for (auto index : m_function.blocks[block].instrs) {
+      auto& instr = instrs[index];
+      if (instr.kind == IrInstr::Kind::Const || instr.is_terminator()) continue;
+      if (m_cells[index].state != Cell::State::Const) continue;
+      instr.kind = IrInstr::Kind::Const;
+      instr.operands.clear();
+      instr.constant = m_cells[index].value;
+      ++stats.values_folded;
+    }
+    auto& block_instrs = m_function.blocks[block].instrs;
+    std::stable_partition(block_instrs.begin(), block_instrs.end(),
+      [&instrs](IrValueIndex index) { return instrs[index].kind == IrInstr::Kind::Phi; });
+
+    const auto terminator = m_function.terminator(block);
+    if (terminator == UndefinedIrValueIndex) continue;
+    auto& instr = instrs[terminator];
+    if (instr.kind != IrInstr::Kind::Branch) continue;
+    const auto& cell = m_cells[instr.operands[0]];
+    if (cell.state != Cell::State::Const) continue;
+
+    const auto taken = instr.targets[cell.value.i != 0 ? 0 : 1];
+    const auto not_taken = instr.targets[cell.value.i != 0 ? 1 : 0];
+    instr.kind = IrInstr::Kind::Jump;
+    instr.operands.clear();
+    instr.targets[0] = taken;
+    instr.targets[1] = UndefinedIrBlockIndex;
+    // with both targets equal this drops the duplicated edge
+    m_function.remove_edge(block, not_taken);
+    ++stats.branches_folded;
+  }
+
+  const auto block_count = m_function.blocks.size();
+  m_function.remove_blocks(m_block_executable);
+  stats.blocks_removed = block_count - m_function.blocks.size();
+  m_function.remove_trivial_phis();
+  stats.instrs_after = m_function.instr_count();
+  return stats;
+}
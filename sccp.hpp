@@ -0,0 +1,55 @@
+#ifndef SCCP_HPP
+#define SCCP_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct SccpStats {
+  uint32_t values_folded = 0;
+  uint32_t branches_folded = 0;
+  uint32_t blocks_removed = 0;
+  uint32_t instrs_before = 0;
+  uint32_t instrs_after = 0;
+};
+
+// Sparse conditional constant propagation (Wegman, Zadeck). Constants are
+// propagated only along edges found executable, so conditions that are known
+// at compile time both fold and prune the blocks they guard.
+class Sccp {
+public:
+  Sccp(IrFunction& function) : m_function(function) {}
+  Sccp(const Sccp&) = delete;
+  Sccp(Sccp&&) = delete;
+  Sccp& operator=(const Sccp&) = delete;
+  Sccp& operator=(Sccp&&) = delete;
+
+  SccpStats run();
+
+private:
+  struct Cell {
+    enum class State { Top, Const, Bottom };
+    State state = State::Top;
+    IrConst value;
+  };
+
+  IrFunction& m_function;
+  std::vector<Cell> m_cells;
+  std::vector<std::vector<IrValueIndex>> m_users;
+  std::vector<bool> m_block_executable;
+  // indexed like IrBlock::preds of the target block
+  std::vector<std::vector<bool>> m_edge_executable;
+  std::vector<std::pair<IrBlockIndex, IrBlockIndex>> m_cfg_worklist;
+  std::vector<IrValueIndex> m_ssa_worklist;
+
+  void mark_edge(IrBlockIndex from, IrBlockIndex to);
+  void visit(IrValueIndex index);
+  void visit_phi(IrValueIndex index);
+  void visit_terminator(IrValueIndex index);
+  void set_const(IrValueIndex index, const IrConst& value);
+  void set_bottom(IrValueIndex index);
+  SccpStats rewrite();
+};
+
+#endif  // SCCP_HPP
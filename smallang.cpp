@@ -1,16 +1,377 @@
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 #include "lexer.hpp"
 #include "ast.hpp"
+#include "parser.hpp"
+#include "ast_dce.hpp"
+#include "lowering.hpp"
+#include "optimize.hpp"
+#include "execution_profile.hpp"
+#include "native_module.hpp"
+#include "codegen.hpp"
+#include "elf_writer.hpp"
+#include "c_backend.hpp"
+#include "reg_compiler.hpp"
+#include "reg_image.hpp"
+#include "reg_vm.hpp"
+#include "tiered.hpp"
+#include "profiler.hpp"
+#include "task.hpp"
+
+// drops the functions, structs and locals main does not need, before
+// anything is compiled
+static void remove_unused_declarations(Ast& ast, IdCache& id_cache, AstNodeIndex global_scope) {
+  const auto* globals = ast[global_scope].scope.dict;
+  const auto main = globals ? globals->find(id_cache.get("main")) : UndefinedAstNodeIndex;
+  if (main == UndefinedAstNodeIndex || ast[main].kind != AstNode::Kind::Function) return;
+  AstDce(ast).run(global_scope, {main});
+}
+
+// index of the function called name, the number of functions if there is
+// none
+static uint32_t find_function(const IrModule& module, IdIndex name) {
+  uint32_t index = 0;
+  while (index < module.functions.size() && module.functions[index].name != name) ++index;
+  return index;
+}
+
+// parses, lowers and optimizes the program for the native backend. A
+// profile of the same source guides inlining, unrolling and block layout.
+// Why each loop was or was not vectorized can be reported to stderr.
+// Functions main does not reach are dropped; without a main every function
+// is kept. False with a message on errors.
+static bool lower_program(const char* path, const std::string& source, const char* profile_use,
+                          bool vectorize_report, IrModule& module, IdCache& id_cache) {
+  ExecutionProfile profile;
+  bool profiled = false;
+  if (profile_use) {
+    std::ifstream profile_in(profile_use);
+    std::string error;
+    if (!profile_in) {
+      std::cerr << profile_use << ": cannot open" << std::endl;
+    } else if (!profile.read(profile_in, error)) {
+      std::cerr << profile_use << ": " << error << std::endl;
+    } else if (profile.source_hash != reg_image_hash(source.data(), source.size())) {
+      std::cerr << profile_use << ": profile of another source, ignored" << std::endl;
+    } else {
+      profiled = true;
+    }
+  }
+
+  std::istringstream in(source);
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  Parser parser(lexer, ast, id_cache);
+  if (!parser.parse()) {
+    std::cerr << path << ": " << parser.error() << std::endl;
+    return false;
+  }
+  remove_unused_declarations(ast, id_cache, parser.global_scope());
+
+  if (profiled) {
+    Lowering(ast, module, profile, id_cache).lower_module(parser.global_scope());
+  } else {
+    Lowering(ast, module).lower_module(parser.global_scope());
+  }
+  OptimizeOptions options;
+  options.root = id_cache.get("main");
+  if (vectorize_report) {
+    options.vectorize_report = &std::cerr;
+    options.id_cache = &id_cache;
+  }
+  optimize_module(module, options);
+  return true;
+}
+
+// compiles the program into memory and calls its main, whose result
+// becomes the exit status. Tasks main spawned and did not join are joined
+// before the program ends.
+static int run(const char* path, const std::string& source, const char* profile_use, bool vectorize_report) {
+  IrModule module;
+  IdCache id_cache;
+  if (!lower_program(path, source, profile_use, vectorize_report, module, id_cache)) return -1;
+  const uint32_t main_index = find_function(module, id_cache.get("main"));
+  if (main_index == module.functions.size() || !module.functions[main_index].params.empty()) {
+    std::cerr << path << ": no 'fun main()'" << std::endl;
+    return -1;
+  }
+  if (ir_is_vector(module.functions[main_index].return_type)) {
+    std::cerr << path << ": 'main' cannot return a vector" << std::endl;
+    return -1;
+  }
+  NativeModule native(module);
+  if (!native.load()) {
+    std::cerr << path << ": cannot compile to native code on this machine" << std::endl;
+    return -1;
+  }
+  const auto* entry = native.entry(main_index);
+  int32_t result = 0;
+  if (module.functions[main_index].return_type == IrType::Void) {
+    reinterpret_cast<void (*)()>(const_cast<void*>(entry))();
+  } else {
+    result = reinterpret_cast<int32_t (*)()>(const_cast<void*>(entry))();
+  }
+  TaskScheduler::join_all();
+  return result;
+}
+
+// compiles the program like run() and writes it as a relocatable object
+// for the system linker instead of calling it. Code that calls the runtime
+// (regions, spawn and join) only runs in the compiling process, so it
+// cannot be written.
+static int compile_object(const char* path, const std::string& source, const char* object, const char* profile_use,
+                          bool vectorize_report) {
+  IrModule module;
+  IdCache id_cache;
+  if (!lower_program(path, source, profile_use, vectorize_report, module, id_cache)) return -1;
+  X86CodeGen codegen(module);
+  X86Code code;
+  if (!codegen.compile_module(code)) {
+    std::cerr << path << ": cannot compile to native code on this machine" << std::endl;
+    return -1;
+  }
+  if (code.calls_runtime) {
+    std::cerr << path << ": regions and tasks need the runtime, which an object file cannot link" << std::endl;
+    return -1;
+  }
+  if (!ElfWriter(module, id_cache).write_file(code, object)) {
+    std::cerr << object << ": cannot write" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+// translates the program into C, for any C compiler to build. Programs
+// using what has no translation are refused and nothing is left at out.
+static int emit_c(const char* path, const std::string& source, const char* out) {
+  std::istringstream in(source);
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  if (!parser.parse()) {
+    std::cerr << path << ": " << parser.error() << std::endl;
+    return -1;
+  }
+  remove_unused_declarations(ast, id_cache, parser.global_scope());
+  std::ofstream file(out);
+  if (!file) {
+    std::cerr << out << ": cannot write" << std::endl;
+    return -1;
+  }
+  bool translated = false;
+  {
+    CBackend backend(ast, id_cache, file);
+    translated = backend.emit_module(parser.global_scope());
+  }
+  file.close();
+  if (!translated) {
+    std::remove(out);
+    std::cerr << path << ": arrays, slices, vectors, new, spawn, join and regions cannot be translated to C"
+              << std::endl;
+    return -1;
+  }
+  if (!file) {
+    std::remove(out);
+    std::cerr << out << ": cannot write" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+// interprets the program's register bytecode. With a cache directory,
+// the bytecode of a source seen before is mapped from the image named
+// after the hash of the source instead of being compiled again. Profiling
+// writes folded stacks of the run to a file, generating a profile adds the
+// counts of the run to the profile file, or starts one if it is missing or
+// of another source. Both always compile, since images keep neither line
+// tables nor counters. Tiered execution moves hot functions to the baseline
+// Jit as they run; it always compiles too, and cannot be profiled.
+static int interpret(const char* path, const std::string& source, const char* cache, const char* profile,
+                     const char* profile_generate, bool tiered) {
+  const uint64_t hash = reg_image_hash(source.data(), source.size());
+  std::string image_path;
+  RegImage image;
+  if (cache) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.slbc", static_cast<unsigned long long>(hash));
+    image_path = std::string(cache) + name;
+  }
+
+  RegBytecodeModule module;
+  IdCache id_cache;
+  std::vector<RegFunctionCode> functions;
+  uint32_t main_index = UndefinedRegImageFunction;
+  if (cache && !profile && !profile_generate && image.map(image_path, hash)) {
+    functions = image.functions();
+    main_index = image.find("main");
+  } else {
+    std::istringstream in(source);
+    Lexer::Tokens tokens;
+    Lexer lexer(in, tokens);
+    Ast ast;
+    Parser parser(lexer, ast, id_cache);
+    if (!parser.parse()) {
+      std::cerr << path << ": " << parser.error() << std::endl;
+      return -1;
+    }
+    remove_unused_declarations(ast, id_cache, parser.global_scope());
+    RegCompiler::Options options;
+    options.lines = &parser.lines();
+    options.counters = profile_generate != nullptr;
+    RegCompiler(ast, module, options).compile_module(parser.global_scope());
+    if (cache && !profile_generate && !RegImageWriter(module, id_cache).write_file(hash, image_path)) {
+      std::cerr << image_path << ": cannot write" << std::endl;
+    }
+    functions = reg_function_code(module);
+    const auto main_name = id_cache.get("main");
+    for (uint32_t index = 0; index < module.functions.size(); ++index) {
+      if (module.functions[index].name == main_name) main_index = index;
+    }
+  }
+  if (main_index == UndefinedRegImageFunction || functions[main_index].params != 0) {
+    std::cerr << path << ": no 'fun main()'" << std::endl;
+    return -1;
+  }
+  if (ir_is_vector(functions[main_index].return_type)) {
+    std::cerr << path << ": 'main' cannot return a vector" << std::endl;
+    return -1;
+  }
+
+  const auto return_type = functions[main_index].return_type;
+  std::vector<uint64_t> counters(module.counters.size(), 0);
+  VmSlot result{0};
+  VmStatus status = VmStatus::Ok;
+  if (tiered) {
+    TieredVm vm(module);
+    status = vm.call(main_index, {}, result);
+  } else {
+    RegVm vm(std::move(functions));
+    vm.set_counters(counters.data(), counters.size());
+    std::unique_ptr<Profiler> profiler;
+    if (profile) {
+      profiler = std::make_unique<Profiler>();
+      if (!profiler->start(vm)) std::cerr << path << ": cannot start the profiler" << std::endl;
+    }
+    status = vm.call(main_index, {}, result);
+    if (profiler) {
+      profiler->stop();
+      std::ofstream out(profile);
+      profiler->write_folded(out, module, id_cache);
+      if (!out) std::cerr << profile << ": cannot write" << std::endl;
+    }
+  }
+  if (profile_generate) {
+    ExecutionProfile counts;
+    std::string error;
+    std::ifstream previous(profile_generate);
+    if (!previous || !counts.read(previous, error) || counts.source_hash != hash) {
+      counts = ExecutionProfile();
+      counts.source_hash = hash;
+    }
+    counts.add(module, id_cache, counters.data());
+    std::ofstream out(profile_generate);
+    counts.write(out);
+    if (!out) std::cerr << profile_generate << ": cannot write" << std::endl;
+  }
+  if (status != VmStatus::Ok) {
+    std::cerr << path << ": "
+              << (status == VmStatus::DivisionByZero ? "division by zero"
+                  : status == VmStatus::StackOverflow ? "stack overflow"
+                  : status == VmStatus::IndexOutOfRange ? "index out of range"
+                  : status == VmStatus::InvalidTask ? "invalid task" : "invalid opcode")
+              << std::endl;
+    return -1;
+  }
+  return return_type == IrType::Void ? 0 : static_cast<int32_t>(result.i);
+}
 
 int main(int argc, char* argv[]) {
-  std::cout << sizeof(AstNode) << std::endl;
-  if (argc <= 1) {
-    std::cerr << "no input file" << std::endl;
+  bool run_program = false;
+  bool interpret_program = false;
+  bool tiered = false;
+  const char* cache = nullptr;
+  const char* profile = nullptr;
+  const char* profile_generate = nullptr;
+  const char* profile_use = nullptr;
+  bool vectorize_report = false;
+  const char* object = nullptr;
+  const char* c_out = nullptr;
+  const char* workers = nullptr;
+  const char* path = nullptr;
+  for (int arg = 1; arg < argc; ++arg) {
+    if (!strcmp(argv[arg], "--run")) {
+      run_program = true;
+    } else if (!strcmp(argv[arg], "--interpret")) {
+      interpret_program = true;
+    } else if (!strcmp(argv[arg], "--tiered")) {
+      tiered = true;
+    } else if (!strcmp(argv[arg], "--cache") && arg + 1 < argc) {
+      cache = argv[++arg];
+    } else if (!strcmp(argv[arg], "--profile") && arg + 1 < argc) {
+      profile = argv[++arg];
+    } else if (!strcmp(argv[arg], "--profile-generate") && arg + 1 < argc) {
+      profile_generate = argv[++arg];
+    } else if (!strcmp(argv[arg], "--profile-use") && arg + 1 < argc) {
+      profile_use = argv[++arg];
+    } else if (!strcmp(argv[arg], "--vectorize-report")) {
+      vectorize_report = true;
+    } else if (!strcmp(argv[arg], "-c") && arg + 1 < argc) {
+      object = argv[++arg];
+    } else if (!strcmp(argv[arg], "--emit-c") && arg + 1 < argc) {
+      c_out = argv[++arg];
+    } else if (!strcmp(argv[arg], "--workers") && arg + 1 < argc) {
+      workers = argv[++arg];
+    } else if (!path) {
+      path = argv[arg];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (!path || run_program + interpret_program + (object != nullptr) + (c_out != nullptr) > 1 ||
+      ((cache || profile || profile_generate) && !interpret_program) ||
+      (tiered && (!interpret_program || cache || profile || profile_generate)) ||
+      ((profile_use || vectorize_report) && !run_program && !object) ||
+      (workers && !run_program && !interpret_program)) {
+    std::cerr << "usage: smallang [[--run | -c out.o] [--profile-use file] [--vectorize-report] | --interpret "
+                 "[--tiered | [--cache dir] [--profile out] [--profile-generate file]] | --emit-c out.c] "
+                 "[--workers n] file"
+              << std::endl;
+    return -1;
+  }
+  if (workers) {
+    // threads that run spawned tasks, one per hardware thread by default
+    TaskScheduler::Options options;
+    options.workers = static_cast<uint32_t>(strtoul(workers, nullptr, 10));
+    TaskScheduler::set_global_options(options);
+  }
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << path << ": cannot open" << std::endl;
     return -1;
   }
-  std::ifstream in(argv[1]);
+  if (run_program || interpret_program || object || c_out) {
+    in.seekg(0, std::ios::end);
+    std::string source(in.tellg(), '\0');
+    in.seekg(0);
+    in.read(source.data(), source.size());
+    if (run_program) return run(path, source, profile_use, vectorize_report);
+    if (object) return compile_object(path, source, object, profile_use, vectorize_report);
+    if (c_out) return emit_c(path, source, c_out);
+    return interpret(path, source, cache, profile, profile_generate, tiered);
+  }
+
+  std::cout << sizeof(AstNode) << std::endl;
   Lexer::Tokens tokens;
   Lexer lexer(in, tokens);
 
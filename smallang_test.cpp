@@ -1,4 +1,9 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <sstream>
 
 #include "lexer.hpp"
@@ -6,6 +11,39 @@
 #include "parser.hpp"
 #include "ast.hpp"
 #include "id_cache.hpp"
+#include "ir.hpp"
+#include "lowering.hpp"
+#include "sccp.hpp"
+#include "dominators.hpp"
+#include "gvn.hpp"
+#include "loops.hpp"
+#include "licm.hpp"
+#include "inliner.hpp"
+#include "ast_dce.hpp"
+#include "dce.hpp"
+#include "liveness.hpp"
+#include "regalloc.hpp"
+#include "bytecode_compiler.hpp"
+#include "vm.hpp"
+#include "reg_compiler.hpp"
+#include "reg_vm.hpp"
+#include "jit.hpp"
+#include "tiered.hpp"
+#include "codegen.hpp"
+#include "elf_writer.hpp"
+#include "c_backend.hpp"
+#include "executable_memory.hpp"
+#include "native_module.hpp"
+#include "reg_image.hpp"
+#include "profiler.hpp"
+#include "execution_profile.hpp"
+#include "unroll.hpp"
+#include "bounds_check.hpp"
+#include "vectorize.hpp"
+#include "scalar_replacement.hpp"
+#include "optimize.hpp"
+#include "region.hpp"
+#include "task.hpp"
 
 TEST(IdCache, Simple) {
   IdCache id_cache;
@@ -203,6 +241,2699 @@ TEST(Parser, Simple) {
   parser.parse();
 }
 
+static AstNodeIndex make_i32_literal(Ast& ast, int32_t value) {
+  auto idx = ast.create(AstNode::Kind::I32Literal);
+  ast[idx].i32_literal.value.type = ast.create(AstNode::Kind::I32Type);
+  ast[idx].i32_literal.literal_value = value;
+  return idx;
+}
+
+static AstNodeIndex make_local(Ast& ast, IdCache& id_cache, const char* name) {
+  auto idx = ast.create(AstNode::Kind::LocalVariable);
+  ast[idx].local_variable.value.type = ast.create(AstNode::Kind::I32Type);
+  ast[idx].local_variable.name = id_cache.get(name);
+  return idx;
+}
+
+static AstNodeIndex make_binary(Ast& ast, AstNode::Kind kind, AstNodeIndex left, AstNodeIndex right) {
+  auto idx = ast.create(kind);
+  ast[idx].add_expr.left = left;
+  ast[idx].add_expr.right = right;
+  return idx;
+}
+
+static AstNodeIndex make_stmt(Ast& ast, AstNode::Kind kind, AstNodeIndex expr) {
+  auto idx = ast.create(kind);
+  ast[idx].expr_stmt.expr = expr;
+  return idx;
+}
+
+static AstNodeIndex make_var_decl(Ast& ast, AstNodeIndex variable, AstNodeIndex init_expr) {
+  auto idx = ast.create(AstNode::Kind::VariableDeclStmt);
+  ast[idx].variable_decl_stmt.variable = variable;
+  ast[idx].variable_decl_stmt.init_expr = init_expr;
+  return idx;
+}
+
+static AstNodeIndex make_block(Ast& ast, std::initializer_list<AstNodeIndex> stmts) {
+  auto idx = ast.create(AstNode::Kind::BlockStmt);
+  for (auto stmt : stmts) ast[idx].block_stmt.add_stmt(stmt);
+  return idx;
+}
+
+static AstNodeIndex make_function(Ast& ast, IdCache& id_cache, const char* name, 
+    std::initializer_list<AstNodeIndex> params, AstNodeIndex body) {
+  auto fun_type_idx = ast.create(AstNode::Kind::FunTypeWithNamedParams);
+  auto function_idx = ast.create(AstNode::Kind::Function);
+  auto& function = ast[function_idx].function;
+  function.scope.name = id_cache.get(name);
+  function.function_type_with_named_params = fun_type_idx;
+  function.block_stmt = body;
+  ast[fun_type_idx].fun_type_with_named_params.fun_type.return_type = ast.create(AstNode::Kind::I32Type);
+  for (auto param : params) {
+    const auto param_name = ast[param].local_variable.name;
+    ast[fun_type_idx].fun_type_with_named_params.fun_type.add_param_type(ast[param].local_variable.value.type);
+    ast[fun_type_idx].fun_type_with_named_params.add_name(param_name);
+    ast[function_idx].function.scope.add_node(param, param_name);
+  }
+  return function_idx;
+}
+
+TEST(Lowering, WhileLoop) {
+  Ast ast;
+  IdCache id_cache;
+  // fun count(n: i32) -> i32 { var i = 0; while (i < n) i = i + 1; return i; }
+  auto n = make_local(ast, id_cache, "n");
+  auto i = make_local(ast, id_cache, "i");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, n);
+  auto assign = make_binary(ast, AstNode::Kind::AssignExpr, i, 
+    make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1)));
+  ast[loop].while_stmt.stmt = make_stmt(ast, AstNode::Kind::ExprStmt, assign);
+  auto body = make_block(ast, {
+    make_var_decl(ast, i, make_i32_literal(ast, 0)), 
+    loop, 
+    make_stmt(ast, AstNode::Kind::ReturnStmt, i)});
+
+  IrModule module;
+  Lowering lowering(ast, module);
+  auto& function = lowering.lower_function(make_function(ast, id_cache, "count", {n}, body));
+
+  ASSERT_EQ(function.params.size(), 1);
+  ASSERT_EQ(function.blocks.size(), 4);
+  auto& header = function.blocks[1];
+  ASSERT_EQ(header.preds.size(), 2);
+  ASSERT_EQ(function.phi_count(1), 1);
+  auto& phi = function.instrs[header.instrs[0]];
+  EXPECT_EQ(phi.type, IrType::I32);
+  ASSERT_EQ(phi.operands.size(), 2);
+  EXPECT_EQ(function.instrs[phi.operands[0]].kind, IrInstr::Kind::Const);
+  EXPECT_EQ(function.instrs[phi.operands[1]].kind, IrInstr::Kind::Add);
+
+  Sccp sccp(function);
+  auto stats = sccp.run();
+  EXPECT_EQ(stats.branches_folded, 0);
+  EXPECT_EQ(stats.blocks_removed, 0);
+  EXPECT_EQ(stats.instrs_before, stats.instrs_after);
+}
+
+TEST(Sccp, FoldsBranches) {
+  Ast ast;
+  IdCache id_cache;
+  // fun f() -> i32 { var x = 10; var y = 0; 
+  //   if (x > 5) y = x + 1; else y = 2; 
+  //   while (y < 0) y = y + 1; 
+  //   return y; }
+  auto x = make_local(ast, id_cache, "x");
+  auto y = make_local(ast, id_cache, "y");
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::GreatExpr, x, make_i32_literal(ast, 5));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ExprStmt, 
+    make_binary(ast, AstNode::Kind::AssignExpr, y, 
+      make_binary(ast, AstNode::Kind::AddExpr, x, make_i32_literal(ast, 1))));
+  ast[if_else].if_else_stmt.else_stmt = make_stmt(ast, AstNode::Kind::ExprStmt, 
+    make_binary(ast, AstNode::Kind::AssignExpr, y, make_i32_literal(ast, 2)));
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, y, make_i32_literal(ast, 0));
+  ast[loop].while_stmt.stmt = make_stmt(ast, AstNode::Kind::ExprStmt, 
+    make_binary(ast, AstNode::Kind::AssignExpr, y, 
+      make_binary(ast, AstNode::Kind::AddExpr, y, make_i32_literal(ast, 1))));
+  auto body = make_block(ast, {
+    make_var_decl(ast, x, make_i32_literal(ast, 10)), 
+    make_var_decl(ast, y, make_i32_literal(ast, 0)), 
+    if_else,
+    loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, y)});
+
+  IrModule module;
+  Lowering lowering(ast, module);
+  auto& function = lowering.lower_function(make_function(ast, id_cache, "f", {}, body));
+  ASSERT_EQ(function.blocks.size(), 7);
+
+  Sccp sccp(function);
+  auto stats = sccp.run();
+  EXPECT_EQ(stats.branches_folded, 2);
+  EXPECT_EQ(stats.blocks_removed, 2);
+  EXPECT_LT(stats.instrs_after, stats.instrs_before);
+
+  auto ret = function.terminator(function.blocks.size() - 1);
+  ASSERT_NE(ret, UndefinedIrValueIndex);
+  ASSERT_EQ(function.instrs[ret].kind, IrInstr::Kind::Return);
+  auto& value = function.instrs[function.instrs[ret].operands[0]];
+  ASSERT_EQ(value.kind, IrInstr::Kind::Const);
+  EXPECT_EQ(value.constant, IrConst::make_int(IrType::I32, 11));
+}
+
+TEST(Sccp, CallsWithConstantArguments) {
+  std::istringstream in(R"(
+    fun f(a: i32, b: i32, c: i32, d: i32) -> i32 {
+      if (a == 0) { return b + c + d; }
+      return f(a - 1, b, c, d);
+    }
+    fun main() -> i32 { return f(3, 4, 5, 6); }
+  )");
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+
+  IrModule module;
+  Lowering(ast, module).lower_module(parser.global_scope());
+  uint32_t main_index = 0;
+  while (module.functions[main_index].name != id_cache.get("main")) ++main_index;
+  for (auto& function : module.functions) Sccp(function).run();
+  // the call is not folded, its constant arguments stay
+  const auto& main_function = module.functions[main_index];
+  const auto ret = main_function.terminator(0);
+  ASSERT_NE(ret, UndefinedIrValueIndex);
+  const auto& call = main_function.instrs[main_function.instrs[ret].operands[0]];
+  ASSERT_EQ(call.kind, IrInstr::Kind::Call);
+  ASSERT_EQ(call.operands.size(), 4u);
+  for (auto operand : call.operands) EXPECT_EQ(main_function.instrs[operand].kind, IrInstr::Kind::Const);
+
+  NativeModule native(module);
+  ASSERT_TRUE(native.load());
+  auto main = reinterpret_cast<int32_t (*)()>(const_cast<void*>(native.entry(main_index)));
+  EXPECT_EQ(main(), 15);
+}
+
+TEST(Ir, Fold) {
+  IrConst result;
+  ASSERT_TRUE(ir_fold(IrInstr::Kind::Add, IrType::I8, 
+    IrConst::make_int(IrType::I8, 127), IrConst::make_int(IrType::I8, 1), result));
+  EXPECT_EQ(result.i, -128);
+  ASSERT_TRUE(ir_fold(IrInstr::Kind::Mul, IrType::U16, 
+    IrConst::make_int(IrType::U16, 300), IrConst::make_int(IrType::U16, 300), result));
+  EXPECT_EQ(result.i, (300 * 300) & 0xffff);
+  ASSERT_TRUE(ir_fold(IrInstr::Kind::Less, IrType::Bool, 
+    IrConst::make_int(IrType::U32, -1), IrConst::make_int(IrType::U32, 1), result));
+  EXPECT_EQ(result.i, 0);
+  ASSERT_TRUE(ir_fold(IrInstr::Kind::Div, IrType::F32, 
+    IrConst::make_float(IrType::F32, 1.0), IrConst::make_float(IrType::F32, 3.0), result));
+  EXPECT_EQ(result.f, static_cast<float>(1.0f / 3.0f));
+  EXPECT_FALSE(ir_fold(IrInstr::Kind::Div, IrType::I32, 
+    IrConst::make_int(IrType::I32, 1), IrConst::make_int(IrType::I32, 0), result));
+}
+
+TEST(Dominators, Diamond) {
+  IrFunction function;
+  auto entry = function.create_block();
+  auto then_block = function.create_block();
+  auto else_block = function.create_block();
+  auto join = function.create_block();
+  auto cond = function.create_const(entry, IrConst::make_int(IrType::Bool, 1));
+  function.create_branch(entry, cond, then_block, else_block);
+  function.create_jump(then_block, join);
+  function.create_jump(else_block, join);
+  function.create_return(join);
+
+  DominatorTree tree(function);
+  EXPECT_EQ(tree.idom(then_block), entry);
+  EXPECT_EQ(tree.idom(else_block), entry);
+  EXPECT_EQ(tree.idom(join), entry);
+  EXPECT_TRUE(tree.dominates(entry, join));
+  EXPECT_FALSE(tree.dominates(then_block, join));
+  EXPECT_EQ(tree.reverse_post_order().front(), entry);
+  EXPECT_EQ(tree.reverse_post_order().size(), 4);
+}
+
+TEST(Gvn, Redundancies) {
+  IrFunction function;
+  auto entry = function.create_block();
+  auto then_block = function.create_block();
+  auto else_block = function.create_block();
+  auto a = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  auto b = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  function.instrs[b].index = 1;
+  auto x = function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, a, b);
+  auto y = function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, b, a);
+  auto less = function.create_binary(entry, IrInstr::Kind::Less, IrType::Bool, a, b);
+  auto great = function.create_binary(entry, IrInstr::Kind::Great, IrType::Bool, b, a);
+  auto both = function.create_binary(entry, IrInstr::Kind::Equal, IrType::Bool, less, great);
+  function.create_branch(entry, both, then_block, else_block);
+  auto then_mul = function.create_binary(then_block, IrInstr::Kind::Mul, IrType::I32, x, y);
+  auto then_add = function.create_binary(then_block, IrInstr::Kind::Add, IrType::I32, a, b);
+  auto then_sum = function.create_binary(then_block, IrInstr::Kind::Add, IrType::I32, then_mul, then_add);
+  function.create_return(then_block, then_sum);
+  auto else_mul = function.create_binary(else_block, IrInstr::Kind::Mul, IrType::I32, y, x);
+  function.create_return(else_block, else_mul);
+
+  Gvn gvn(function);
+  auto stats = gvn.run();
+  // y, great and then_add are redundant, else_mul is not dominated by then_mul
+  EXPECT_EQ(stats.redundant_removed, 3);
+  EXPECT_EQ(function.instrs[both].operands[0], less);
+  EXPECT_EQ(function.instrs[both].operands[1], less);
+  EXPECT_EQ(function.instrs[then_sum].operands[0], x);
+  EXPECT_EQ(function.instrs[then_sum].operands[1], then_mul);
+  EXPECT_EQ(function.instrs[else_mul].kind, IrInstr::Kind::Mul);
+  EXPECT_EQ(function.instrs[else_mul].operands[0], x);
+  EXPECT_EQ(function.instrs[else_mul].operands[1], x);
+}
+
+TEST(Gvn, LargeFunction) {
+  IrFunction function;
+  auto entry = function.create_block();
+  auto a = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  auto acc = function.create_const(entry, IrConst::make_int(IrType::I32, 0));
+  const uint32_t count = 50000;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto sum = function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, a, a);
+    acc = function.create_binary(entry, IrInstr::Kind::Mul, IrType::I32, acc, sum);
+  }
+  function.create_return(entry, acc);
+
+  Gvn gvn(function);
+  auto stats = gvn.run();
+  EXPECT_EQ(stats.redundant_removed, count - 1);
+  EXPECT_EQ(function.instr_count(), count + 4);
+}
+
+TEST(Licm, HoistAndStrengthReduce) {
+  Ast ast;
+  IdCache id_cache;
+  // struct P { x: i32; y: i32 }
+  // fun f(n: i32) -> i32 { 
+  //   var p: P; var i = 0; 
+  //   while (i < n) { p.x = p.x + i * 4; i = i + 1; } 
+  //   return p.x; }
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  uint32_t offset = 0;
+  for (auto name : {"x", "y"}) {
+    auto field = ast.create(AstNode::Kind::StructField);
+    ast[field].struct_field.value.type = ast.create(AstNode::Kind::I32Type);
+    ast[field].struct_field.name = id_cache.get(name);
+    ast[field].struct_field.offset = offset;
+    offset += 4;
+    ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  }
+  auto x_field = ast[struct_idx].scope.dict->find(id_cache.get("x"));
+  auto p = ast.create(AstNode::Kind::LocalVariable);
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto make_field_expr = [&]() {
+    auto idx = ast.create(AstNode::Kind::FieldExpr);
+    ast[idx].field_expr.expr = p;
+    ast[idx].field_expr.field = x_field;
+    return idx;
+  };
+
+  auto n = make_local(ast, id_cache, "n");
+  auto i = make_local(ast, id_cache, "i");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, n);
+  ast[loop].while_stmt.stmt = make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, make_field_expr(),
+      make_binary(ast, AstNode::Kind::AddExpr, make_field_expr(), 
+        make_binary(ast, AstNode::Kind::MulExpr, i, make_i32_literal(ast, 4))))),
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, i, 
+      make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1))))});
+  auto body = make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, i, make_i32_literal(ast, 0)), 
+    loop, 
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_field_expr())});
+
+  IrModule module;
+  Lowering lowering(ast, module);
+  auto& function = lowering.lower_function(make_function(ast, id_cache, "f", {n}, body));
+  Gvn gvn(function);
+  gvn.run();
+  Licm licm(function);
+  auto stats = licm.run();
+  EXPECT_EQ(stats.loops, 1);
+  EXPECT_EQ(stats.strength_reduced, 1);
+  EXPECT_GE(stats.hoisted, 3);
+
+  DominatorTree tree(function);
+  LoopInfo loop_info(function, tree);
+  ASSERT_EQ(loop_info.loops().size(), 1);
+  const auto& ir_loop = loop_info.loops()[0];
+  EXPECT_EQ(ir_loop.preheader, 0);
+  for (auto block : ir_loop.blocks) {
+    for (auto index : function.blocks[block].instrs) {
+      EXPECT_NE(function.instrs[index].kind, IrInstr::Kind::Mul);
+      EXPECT_NE(function.instrs[index].kind, IrInstr::Kind::FieldAddr);
+    }
+  }
+  EXPECT_EQ(function.phi_count(ir_loop.header), 2);
+}
+
+static AstNodeIndex make_call(Ast& ast, AstNodeIndex function, std::initializer_list<AstNodeIndex> args) {
+  auto idx = ast.create(AstNode::Kind::CallExpr);
+  ast[idx].call_expr.function = function;
+  for (auto arg : args) ast[idx].call_expr.add_arg(arg);
+  return idx;
+}
+
+TEST(Inliner, BottomUp) {
+  Ast ast;
+  IdCache id_cache;
+  auto global_idx = ast.create(AstNode::Kind::GlobalScope);
+  // fun inc(x: i32) -> i32 { return x + 1; }
+  auto x = make_local(ast, id_cache, "x");
+  auto inc = make_function(ast, id_cache, "inc", {x}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr, x, make_i32_literal(ast, 1)))}));
+  // fun twice(y: i32) -> i32 { return inc(inc(y)); }
+  auto y = make_local(ast, id_cache, "y");
+  auto twice = make_function(ast, id_cache, "twice", {y}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_call(ast, inc, {make_call(ast, inc, {y})}))}));
+  // fun down(z: i32) -> i32 { if (z > 0) return down(z - 1); return twice(z); }
+  auto z = make_local(ast, id_cache, "z");
+  auto body = make_block(ast, {});
+  auto down = make_function(ast, id_cache, "down", {z}, body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::GreatExpr, z, make_i32_literal(ast, 0));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, 
+    make_call(ast, down, {make_binary(ast, AstNode::Kind::SubExpr, z, make_i32_literal(ast, 1))}));
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[body].block_stmt.add_stmt(if_else);
+  ast[body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_call(ast, twice, {z})));
+  for (auto function : {down, twice, inc}) {
+    ast[global_idx].global_scope.scope.add_node(function, ast[function].function.scope.name);
+  }
+
+  IrModule module;
+  Lowering lowering(ast, module);
+  lowering.lower_module(global_idx);
+  ASSERT_EQ(module.functions.size(), 3);
+
+  Inliner inliner(module);
+  const auto& decisions = inliner.run();
+  ASSERT_EQ(decisions.size(), 4);
+  // inc into twice twice, then twice into down, the recursive call stays
+  uint32_t inlined = 0;
+  uint32_t recursive = 0;
+  for (const auto& decision : decisions) {
+    if (decision.reason == InlineDecision::Reason::Inlined) ++inlined;
+    if (decision.reason == InlineDecision::Reason::Recursive) ++recursive;
+  }
+  EXPECT_EQ(inlined, 3);
+  EXPECT_EQ(recursive, 1);
+
+  auto count_calls = [](const IrFunction& function) {
+    uint32_t calls = 0;
+    for (const auto& block : function.blocks) {
+      for (auto index : block.instrs) calls += function.instrs[index].kind == IrInstr::Kind::Call;
+    }
+    return calls;
+  };
+  EXPECT_EQ(count_calls(module.functions[0]), 1);
+  EXPECT_EQ(count_calls(module.functions[1]), 0);
+
+  // twice(y) is straight line code (y + 1) + 1 once the inlined blocks are merged
+  IrFunction& twice_ir = module.functions[1];
+  Sccp sccp(twice_ir);
+  sccp.run();
+  IrValueIndex ret = UndefinedIrValueIndex;
+  for (IrBlockIndex block = 0; block < twice_ir.blocks.size(); ++block) {
+    auto terminator = twice_ir.terminator(block);
+    if (twice_ir.instrs[terminator].kind == IrInstr::Kind::Return) ret = terminator;
+  }
+  ASSERT_NE(ret, UndefinedIrValueIndex);
+  auto& outer = twice_ir.instrs[twice_ir.instrs[ret].operands[0]];
+  ASSERT_EQ(outer.kind, IrInstr::Kind::Add);
+  auto& inner = twice_ir.instrs[outer.operands[0]];
+  ASSERT_EQ(inner.kind, IrInstr::Kind::Add);
+  EXPECT_EQ(inner.operands[0], twice_ir.params[0]);
+
+  std::ostringstream report;
+  inliner.report(report, id_cache);
+  EXPECT_NE(report.str().find("down -> down"), std::string::npos);
+  EXPECT_NE(report.str().find("twice -> inc (4 instrs): inlined"), std::string::npos);
+}
+
+TEST(AstDce, UnusedDeclarations) {
+  Ast ast;
+  IdCache id_cache;
+  auto global_idx = ast.create(AstNode::Kind::GlobalScope);
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  auto field = ast.create(AstNode::Kind::StructField);
+  ast[field].struct_field.value.type = ast.create(AstNode::Kind::I32Type);
+  ast[field].struct_field.name = id_cache.get("f");
+  ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  ast[struct_idx].struc.scope.name = id_cache.get("P");
+
+  // fun unused() -> i32 { return 1; }
+  auto unused = make_function(ast, id_cache, "unused", {}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_i32_literal(ast, 1))}));
+  // fun used(a: i32) -> i32 { return a; }
+  auto a = make_local(ast, id_cache, "a");
+  auto used = make_function(ast, id_cache, "used", {a}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, a)}));
+  // fun main() -> i32 { var p: P; var x = 1; var y = used(2); x = y + 1; var z = x; return y; }
+  auto p = make_local(ast, id_cache, "p");
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto x = make_local(ast, id_cache, "x");
+  auto y = make_local(ast, id_cache, "y");
+  auto z = make_local(ast, id_cache, "z");
+  auto main_body = make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, x, make_i32_literal(ast, 1)),
+    make_var_decl(ast, y, make_call(ast, used, {make_i32_literal(ast, 2)})),
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, x,
+      make_binary(ast, AstNode::Kind::AddExpr, y, make_i32_literal(ast, 1)))),
+    make_var_decl(ast, z, x),
+    make_stmt(ast, AstNode::Kind::ReturnStmt, y)});
+  auto main = make_function(ast, id_cache, "main", {}, main_body);
+  for (auto node : {struct_idx, unused, used, main}) {
+    ast[global_idx].global_scope.scope.add_node(node);
+  }
+
+  AstDce dce(ast);
+  auto stats = dce.run(global_idx, {main});
+  EXPECT_EQ(stats.functions_removed, 1);
+  EXPECT_EQ(stats.structs_removed, 1);
+  EXPECT_EQ(stats.variables_removed, 3);
+  EXPECT_GT(stats.nodes_removed, 10);
+
+  auto& globals = ast[global_idx].scope.dict->get_nodes();
+  ASSERT_EQ(globals.size(), 2);
+  EXPECT_EQ(globals[0], used);
+  EXPECT_EQ(globals[1], main);
+  ASSERT_EQ(ast[main_body].block_stmt.stmts->size(), 2);
+  EXPECT_EQ(ast[(*ast[main_body].block_stmt.stmts)[0]].kind, AstNode::Kind::VariableDeclStmt);
+  EXPECT_EQ(ast[(*ast[main_body].block_stmt.stmts)[1]].kind, AstNode::Kind::ReturnStmt);
+}
+
+TEST(AstDce, KeepsCodeThatTraps) {
+  std::istringstream in(R"(
+    fun f(a: i32, b: i32, s: [i32]) -> i32 {
+      val quotient = a / b;
+      val element = s[99];
+      val tail = s[2:1];
+      val half = 1.0 / 2.0;
+      val sum = a + b;
+      return 0;
+    }
+    fun main() -> i32 {
+      var a: [i32; 4];
+      return f(1, 0, a);
+    }
+  )");
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+  const auto* globals = ast[parser.global_scope()].scope.dict;
+  const auto stats = AstDce(ast).run(parser.global_scope(), {globals->find(id_cache.get("main"))});
+  // half and sum
+  EXPECT_EQ(stats.variables_removed, 2);
+
+  RegBytecodeModule bytecode;
+  RegCompiler(ast, bytecode).compile_module(parser.global_scope());
+  uint32_t main_index = 0;
+  while (bytecode.functions[main_index].name != id_cache.get("main")) ++main_index;
+  RegVm vm(bytecode);
+  VmSlot result;
+  EXPECT_EQ(vm.call(main_index, {}, result), VmStatus::DivisionByZero);
+
+  IrModule module;
+  Lowering(ast, module).lower_module(parser.global_scope());
+  for (auto& function : module.functions) {
+    if (function.name != id_cache.get("f")) continue;
+    Dce::remove_dead_code(function);
+    uint32_t divisions = 0;
+    uint32_t bounds_checks = 0;
+    for (auto& block : function.blocks) {
+      for (auto index : block.instrs) {
+        divisions += function.instrs[index].kind == IrInstr::Kind::Div;
+        bounds_checks += function.instrs[index].kind == IrInstr::Kind::BoundsCheck;
+      }
+    }
+    EXPECT_EQ(divisions, 1u);
+    EXPECT_GE(bounds_checks, 2u);
+  }
+
+  // only integer divisions by constants that rule out a trap go
+  IrFunction function;
+  auto entry = function.create_block();
+  auto x = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  function.params.emplace_back(x);
+  auto minus_one = function.create_const(entry, IrConst::make_int(IrType::I32, -1));
+  auto two = function.create_const(entry, IrConst::make_int(IrType::I32, 2));
+  auto u_minus_one = function.create_const(entry, IrConst::make_int(IrType::U32, -1));
+  auto f = function.create_const(entry, IrConst::make_float(IrType::F64, 0.0));
+  auto by_param = function.create_binary(entry, IrInstr::Kind::Div, IrType::I32, two, x);
+  auto by_minus_one = function.create_binary(entry, IrInstr::Kind::Div, IrType::I32, x, minus_one);
+  auto by_two = function.create_binary(entry, IrInstr::Kind::Div, IrType::I32, x, two);
+  auto unsigned_by_max = function.create_binary(entry, IrInstr::Kind::Div, IrType::U32, x, u_minus_one);
+  auto by_zero_float = function.create_binary(entry, IrInstr::Kind::Div, IrType::F64, f, f);
+  function.create_return(entry, two);
+  Dce::remove_dead_code(function);
+  EXPECT_EQ(function.instrs[by_param].kind, IrInstr::Kind::Div);
+  EXPECT_EQ(function.instrs[by_minus_one].kind, IrInstr::Kind::Div);
+  EXPECT_EQ(function.instrs[by_two].kind, IrInstr::Kind::None);
+  EXPECT_EQ(function.instrs[unsigned_by_max].kind, IrInstr::Kind::None);
+  EXPECT_EQ(function.instrs[by_zero_float].kind, IrInstr::Kind::None);
+}
+
+TEST(Dce, DeadStoresAndFunctions) {
+  IrModule module;
+  module.functions.resize(3);
+  // function 1 is never called, function 0 calls function 2
+  for (auto& function : module.functions) {
+    function.return_type = IrType::I32;
+    auto entry = function.create_block();
+    auto value = function.create_const(entry, IrConst::make_int(IrType::I32, 7));
+    function.create_return(entry, value);
+  }
+  auto& main = module.functions[0];
+  main.blocks[0].instrs.pop_back();
+  auto slot = main.create(0, IrInstr::Kind::StackSlot, IrType::Ptr);
+  main.instrs[slot].index = 8;
+  auto field = main.create_unary(0, IrInstr::Kind::FieldAddr, IrType::Ptr, slot);
+  main.instrs[field].index = 4;
+  main.create_binary(0, IrInstr::Kind::Store, IrType::Void, field, 0);
+  auto unused = main.create_binary(0, IrInstr::Kind::Add, IrType::I32, 0, 0);
+  auto call = main.create(0, IrInstr::Kind::Call, IrType::I32);
+  main.instrs[call].index = 2;
+  main.create_return(0, call);
+
+  Dce dce(module);
+  auto stats = dce.run({0});
+  EXPECT_EQ(stats.functions_removed, 1);
+  EXPECT_EQ(stats.stores_removed, 1);
+  // slot, field address, the constant and the add
+  EXPECT_EQ(stats.instrs_removed, 4);
+  ASSERT_EQ(module.functions.size(), 2);
+  EXPECT_EQ(module.functions[0].instrs[call].index, 1);
+  EXPECT_EQ(module.functions[0].instrs[unused].kind, IrInstr::Kind::None);
+  EXPECT_EQ(module.functions[0].instr_count(), 2);
+}
+
+TEST(Liveness, Loop) {
+  IrFunction function;
+  auto entry = function.create_block();
+  auto header = function.create_block();
+  auto body = function.create_block();
+  auto exit = function.create_block();
+  auto n = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  auto zero = function.create_const(entry, IrConst::make_int(IrType::I32, 0));
+  function.create_jump(entry, header);
+  auto i = function.create_phi(header, IrType::I32);
+  auto cond = function.create_binary(header, IrInstr::Kind::Less, IrType::Bool, i, n);
+  function.create_branch(header, cond, body, exit);
+  auto one = function.create_const(body, IrConst::make_int(IrType::I32, 1));
+  auto next = function.create_binary(body, IrInstr::Kind::Add, IrType::I32, i, one);
+  function.create_jump(body, header);
+  function.instrs[i].operands = {zero, next};
+  function.create_return(exit, i);
+
+  DominatorTree tree(function);
+  for (uint64_t dense_limit : {Liveness::DefaultDenseLimit, uint64_t(0)}) {
+    Liveness liveness(function, tree, dense_limit);
+    EXPECT_EQ(liveness.stats().sparse, dense_limit == 0);
+    EXPECT_EQ(liveness.live_out(entry), std::vector<IrValueIndex>({n, zero}));
+    EXPECT_EQ(liveness.live_in(header), std::vector<IrValueIndex>({n}));
+    EXPECT_EQ(liveness.live_out(header), std::vector<IrValueIndex>({n, i}));
+    EXPECT_EQ(liveness.live_in(body), std::vector<IrValueIndex>({n, i}));
+    EXPECT_EQ(liveness.live_out(body), std::vector<IrValueIndex>({n, next}));
+    EXPECT_EQ(liveness.live_in(exit), std::vector<IrValueIndex>({i}));
+    EXPECT_TRUE(liveness.is_live_out(body, next));
+    EXPECT_FALSE(liveness.is_live_in(header, i));
+    EXPECT_FALSE(liveness.is_live_in(body, cond));
+    EXPECT_GE(liveness.stats().iterations, 2);
+  }
+}
+
+// no two values share a register at any position and every operand can be
+// found when its instruction executes
+static void expect_valid_allocation(const IrFunction& function, const LinearScan& scan) {
+  const auto& intervals = scan.intervals();
+  for (uint32_t i = 0; i < intervals.size(); ++i) {
+    if (intervals[i].reg == X86Reg::None) continue;
+    for (uint32_t j = i + 1; j < intervals.size(); ++j) {
+      if (intervals[j].reg != intervals[i].reg) continue;
+      EXPECT_EQ(intervals[i].next_intersection(intervals[j]), UndefinedPosition)
+        << "values " << intervals[i].value << " and " << intervals[j].value << " in " << x86_reg_name(intervals[i].reg);
+    }
+  }
+  for (const auto& block : function.blocks) {
+    for (auto index : block.instrs) {
+      const auto& instr = function.instrs[index];
+      const auto position = scan.position(index);
+      if (instr.kind == IrInstr::Kind::Call) {
+        for (const auto& interval : intervals) {
+          if (interval.reg == X86Reg::None || !x86_is_caller_saved(interval.reg)) continue;
+          EXPECT_FALSE(interval.covers(position));
+        }
+      }
+      if (instr.kind == IrInstr::Kind::Phi) continue;
+      for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+        const auto location = scan.location(instr.operands[i], position);
+        EXPECT_TRUE(location.is_register() || location.spill_slot != UndefinedSpillSlot);
+        // operands read together need registers of their own
+        for (uint32_t j = 0; j < i; ++j) {
+          if (instr.operands[j] == instr.operands[i] || !location.is_register()) continue;
+          EXPECT_NE(scan.location(instr.operands[j], position), location)
+            << "values " << instr.operands[j] << " and " << instr.operands[i] << " read at " << position;
+        }
+      }
+    }
+  }
+}
+
+TEST(LinearScan, Loop) {
+  IrFunction function;
+  auto entry = function.create_block();
+  auto header = function.create_block();
+  auto body = function.create_block();
+  auto exit = function.create_block();
+  auto n = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+  auto zero = function.create_const(entry, IrConst::make_int(IrType::I32, 0));
+  function.create_jump(entry, header);
+  auto i = function.create_phi(header, IrType::I32);
+  auto cond = function.create_binary(header, IrInstr::Kind::Less, IrType::Bool, i, n);
+  function.create_branch(header, cond, body, exit);
+  auto one = function.create_const(body, IrConst::make_int(IrType::I32, 1));
+  auto next = function.create_binary(body, IrInstr::Kind::Add, IrType::I32, i, one);
+  function.create_jump(body, header);
+  function.instrs[i].operands = {zero, next};
+  function.create_return(exit, i);
+
+  LinearScan scan(function);
+  const auto stats = scan.run();
+  EXPECT_EQ(stats.intervals, 6);
+  EXPECT_EQ(stats.spill_slots, 0);
+  expect_valid_allocation(function, scan);
+  const auto position = scan.position(cond);
+  EXPECT_TRUE(scan.location(n, position).is_register());
+  EXPECT_NE(scan.location(n, position), scan.location(i, position));
+  // the loop carried value flows through the phi's register
+  for (const auto& move : scan.moves()) EXPECT_NE(move.value, n);
+}
+
+TEST(LinearScan, SpillsUnderPressure) {
+  IrFunction function;
+  auto entry = function.create_block();
+  std::vector<IrValueIndex> params;
+  for (uint32_t i = 0; i < 20; ++i) {
+    params.emplace_back(function.create(entry, IrInstr::Kind::Param, IrType::I32));
+    function.instrs[params.back()].index = i;
+  }
+  auto call = function.create(entry, IrInstr::Kind::Call, IrType::I32);
+  function.instrs[call].operands = {params[0]};
+  auto sum = call;
+  for (auto param : params) sum = function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, sum, param);
+  function.create_return(entry, sum);
+
+  LinearScan scan(function);
+  const auto stats = scan.run();
+  EXPECT_GT(stats.spill_slots, 0);
+  EXPECT_GT(stats.splits, 0);
+  expect_valid_allocation(function, scan);
+  // values live across the call end up in callee saved registers
+  const auto after = scan.position(call) + 2;
+  for (uint32_t i = 1; i < params.size(); ++i) {
+    const auto location = scan.location(params[i], after);
+    EXPECT_FALSE(location.is_register() && x86_is_caller_saved(location.reg));
+  }
+  EXPECT_EQ(scan.used_registers() & (1u << static_cast<uint8_t>(X86GprScratch)), 0);
+}
+
+TEST(Vm, RecursionAndLoops) {
+  Ast ast;
+  IdCache id_cache;
+  // fun fib(n: i32) -> i32 { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  auto n = make_local(ast, id_cache, "n");
+  auto fib_body = make_block(ast, {});
+  auto fib = make_function(ast, id_cache, "fib", {n}, fib_body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, n, make_i32_literal(ast, 2));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, n);
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[fib_body].block_stmt.add_stmt(if_else);
+  ast[fib_body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 1))}),
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 2))}))));
+  // fun sum(m: i32) -> i32 { var i = 0; var s = 0; while (i < m) { s = s + i; i = i + 1; } return s; }
+  auto m = make_local(ast, id_cache, "m");
+  auto i = make_local(ast, id_cache, "i");
+  auto sum = make_local(ast, id_cache, "s");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, m);
+  ast[loop].while_stmt.stmt = make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, sum,
+      make_binary(ast, AstNode::Kind::AddExpr, sum, i))),
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, i,
+      make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1))))});
+  auto sum_function = make_function(ast, id_cache, "sum", {m}, make_block(ast, {
+    make_var_decl(ast, i, make_i32_literal(ast, 0)),
+    make_var_decl(ast, sum, make_i32_literal(ast, 0)),
+    loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, sum)}));
+  // fun quotient(d: i32) -> i32 { return 10 / d; }
+  auto d = make_local(ast, id_cache, "d");
+  auto quotient = make_function(ast, id_cache, "quotient", {d}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::DivExpr, make_i32_literal(ast, 10), d))}));
+
+  BytecodeModule module;
+  BytecodeCompiler compiler(ast, module);
+  const auto fib_index = compiler.function_index(fib);
+  compiler.compile_function(fib);
+  EXPECT_EQ(module.functions[fib_index].locals, 1);
+  EXPECT_EQ(module.functions[fib_index].max_stack, 3);
+  const auto sum_index = compiler.function_index(sum_function);
+  compiler.compile_function(sum_function);
+  EXPECT_EQ(module.functions[sum_index].locals, 3);
+  const auto quotient_index = compiler.function_index(quotient);
+  compiler.compile_function(quotient);
+
+  Vm vm(module);
+  VmSlot result;
+  ASSERT_EQ(vm.call(fib_index, {VmSlot{20}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 6765);
+  ASSERT_EQ(vm.call(sum_index, {VmSlot{100}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 4950);
+  ASSERT_EQ(vm.call(quotient_index, {VmSlot{3}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 3);
+  EXPECT_EQ(vm.call(quotient_index, {VmSlot{0}}, result), VmStatus::DivisionByZero);
+
+  Vm small_vm(module, 16);
+  EXPECT_EQ(small_vm.call(fib_index, {VmSlot{20}}, result), VmStatus::StackOverflow);
+}
+
+TEST(Vm, StructFieldsAndWidths) {
+  Ast ast;
+  IdCache id_cache;
+  // struct P { x: i32; y: i8 }
+  // fun f() -> i32 { var p: P; var b: u8 = 250; p.x = 300; p.y = p.x; b = b + 10; return p.x + p.y + b; }
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  uint32_t offset = 0;
+  for (auto [name, kind] : {std::pair{"x", AstNode::Kind::I32Type}, std::pair{"y", AstNode::Kind::I8Type}}) {
+    auto field = ast.create(AstNode::Kind::StructField);
+    ast[field].struct_field.value.type = ast.create(kind);
+    ast[field].struct_field.name = id_cache.get(name);
+    ast[field].struct_field.offset = offset;
+    offset += 4;
+    ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  }
+  auto p = ast.create(AstNode::Kind::LocalVariable);
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto field_expr = [&](const char* name) {
+    auto idx = ast.create(AstNode::Kind::FieldExpr);
+    ast[idx].field_expr.expr = p;
+    ast[idx].field_expr.field = ast[struct_idx].scope.dict->find(id_cache.get(name));
+    return idx;
+  };
+  auto b = make_local(ast, id_cache, "b");
+  ast[ast[b].local_variable.value.type].kind = AstNode::Kind::U8Type;
+  auto u8_literal = [&](uint8_t value) {
+    auto idx = ast.create(AstNode::Kind::U8Literal);
+    ast[idx].u8_literal.literal_value = value;
+    return idx;
+  };
+  auto assign = [&](AstNodeIndex left, AstNodeIndex right) {
+    return make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, left, right));
+  };
+  auto function = make_function(ast, id_cache, "f", {}, make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, b, u8_literal(250)),
+    assign(field_expr("x"), make_i32_literal(ast, 300)),
+    assign(field_expr("y"), field_expr("x")),
+    assign(b, make_binary(ast, AstNode::Kind::AddExpr, b, u8_literal(10))),
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+      make_binary(ast, AstNode::Kind::AddExpr, field_expr("x"), field_expr("y")), b))}));
+
+  BytecodeModule module;
+  BytecodeCompiler compiler(ast, module);
+  const auto& bytecode = compiler.compile_function(function);
+  // the struct takes one slot, b the next one
+  EXPECT_EQ(bytecode.locals, 2);
+  EXPECT_EQ(static_cast<Opcode>(bytecode.code[0]), Opcode::ConstU8);
+
+  Vm vm(module);
+  VmSlot result;
+  ASSERT_EQ(vm.call(0, {}, result), VmStatus::Ok);
+  // 300 + int8_t(300) + uint8_t(260)
+  EXPECT_EQ(result.i, 300 + 44 + 4);
+}
+
+TEST(RegVm, SuperinstructionsCutDispatches) {
+  Ast ast;
+  IdCache id_cache;
+  // fun fib(n: i32) -> i32 { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  auto n = make_local(ast, id_cache, "n");
+  auto fib_body = make_block(ast, {});
+  auto fib = make_function(ast, id_cache, "fib", {n}, fib_body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, n, make_i32_literal(ast, 2));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, n);
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[fib_body].block_stmt.add_stmt(if_else);
+  ast[fib_body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 1))}),
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 2))}))));
+  // fun sum(m: i32) -> i32 { var i = 0; var s = 0; while (i < m) { s = s + i; i = i + 1; } return s; }
+  auto m = make_local(ast, id_cache, "m");
+  auto i = make_local(ast, id_cache, "i");
+  auto sum = make_local(ast, id_cache, "s");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, m);
+  ast[loop].while_stmt.stmt = make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, sum,
+      make_binary(ast, AstNode::Kind::AddExpr, sum, i))),
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, i,
+      make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1))))});
+  auto sum_function = make_function(ast, id_cache, "sum", {m}, make_block(ast, {
+    make_var_decl(ast, i, make_i32_literal(ast, 0)),
+    make_var_decl(ast, sum, make_i32_literal(ast, 0)),
+    loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, sum)}));
+  // fun countdown(k: i32) -> i32 { var c = 0; while (k > 0) { k = k - 3; c = c + 1; } return c + k * 10; }
+  auto k = make_local(ast, id_cache, "k");
+  auto c = make_local(ast, id_cache, "c");
+  auto countdown_loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[countdown_loop].while_stmt.expr = make_binary(ast, AstNode::Kind::GreatExpr, k, make_i32_literal(ast, 0));
+  ast[countdown_loop].while_stmt.stmt = make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, k,
+      make_binary(ast, AstNode::Kind::SubExpr, k, make_i32_literal(ast, 3)))),
+    make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, c,
+      make_binary(ast, AstNode::Kind::AddExpr, c, make_i32_literal(ast, 1))))});
+  auto countdown = make_function(ast, id_cache, "countdown", {k}, make_block(ast, {
+    make_var_decl(ast, c, make_i32_literal(ast, 0)),
+    countdown_loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr, c,
+      make_binary(ast, AstNode::Kind::MulExpr, k, make_i32_literal(ast, 10))))}));
+
+  uint64_t dispatches[2][3];
+  for (bool superinstructions : {false, true}) {
+    RegBytecodeModule module;
+    RegCompiler compiler(ast, module, RegCompiler::Options{superinstructions});
+    const auto fib_index = compiler.function_index(fib);
+    const auto sum_index = compiler.function_index(sum_function);
+    const auto countdown_index = compiler.function_index(countdown);
+    compiler.compile_function(fib);
+    compiler.compile_function(sum_function);
+    compiler.compile_function(countdown);
+
+    RegVm vm(module);
+    VmSlot result;
+    ASSERT_EQ(vm.call(fib_index, {VmSlot{20}}, result), VmStatus::Ok);
+    EXPECT_EQ(result.i, 6765);
+    dispatches[superinstructions][0] = vm.dispatches();
+    ASSERT_EQ(vm.call(sum_index, {VmSlot{100}}, result), VmStatus::Ok);
+    EXPECT_EQ(result.i, 4950);
+    dispatches[superinstructions][1] = vm.dispatches();
+    ASSERT_EQ(vm.call(sum_index, {VmSlot{0}}, result), VmStatus::Ok);
+    EXPECT_EQ(result.i, 0);
+    ASSERT_EQ(vm.call(countdown_index, {VmSlot{10}}, result), VmStatus::Ok);
+    EXPECT_EQ(result.i, 4 - 20);
+    dispatches[superinstructions][2] = vm.dispatches();
+
+    RegVm small_vm(module, 16);
+    EXPECT_EQ(small_vm.call(fib_index, {VmSlot{20}}, result), VmStatus::StackOverflow);
+  }
+  EXPECT_LT(dispatches[1][0], dispatches[0][0]);
+  // the loop body shrinks from add, increment, compare, branch and jump
+  // to add and increment-compare-branch
+  EXPECT_LT(dispatches[1][1] * 2, dispatches[0][1]);
+  EXPECT_LT(dispatches[1][2], dispatches[0][2]);
+}
+
+TEST(RegVm, StructFieldsAndWidths) {
+  Ast ast;
+  IdCache id_cache;
+  // struct P { x: i32; y: i8 }
+  // fun f() -> i32 { var p: P; var b: u8 = 250; p.x = 300; p.y = p.x; b = b + 10; return p.x + p.y + b; }
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  uint32_t offset = 0;
+  for (auto [name, kind] : {std::pair{"x", AstNode::Kind::I32Type}, std::pair{"y", AstNode::Kind::I8Type}}) {
+    auto field = ast.create(AstNode::Kind::StructField);
+    ast[field].struct_field.value.type = ast.create(kind);
+    ast[field].struct_field.name = id_cache.get(name);
+    ast[field].struct_field.offset = offset;
+    offset += 4;
+    ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  }
+  auto p = ast.create(AstNode::Kind::LocalVariable);
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto field_expr = [&](const char* name) {
+    auto idx = ast.create(AstNode::Kind::FieldExpr);
+    ast[idx].field_expr.expr = p;
+    ast[idx].field_expr.field = ast[struct_idx].scope.dict->find(id_cache.get(name));
+    return idx;
+  };
+  auto b = make_local(ast, id_cache, "b");
+  ast[ast[b].local_variable.value.type].kind = AstNode::Kind::U8Type;
+  auto u8_literal = [&](uint8_t value) {
+    auto idx = ast.create(AstNode::Kind::U8Literal);
+    ast[idx].u8_literal.literal_value = value;
+    return idx;
+  };
+  auto assign = [&](AstNodeIndex left, AstNodeIndex right) {
+    return make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, left, right));
+  };
+  auto function = make_function(ast, id_cache, "f", {}, make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, b, u8_literal(250)),
+    assign(field_expr("x"), make_i32_literal(ast, 300)),
+    assign(field_expr("y"), field_expr("x")),
+    assign(b, make_binary(ast, AstNode::Kind::AddExpr, b, u8_literal(10))),
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+      make_binary(ast, AstNode::Kind::AddExpr, field_expr("x"), field_expr("y")), b))}));
+
+  RegBytecodeModule module;
+  RegCompiler compiler(ast, module);
+  const auto& bytecode = compiler.compile_function(function);
+  // the struct takes one slot, b the next one
+  EXPECT_EQ(static_cast<RegOpcode>(bytecode.code[0]), RegOpcode::ConstU8);
+  EXPECT_EQ(bytecode.code[1], 1);
+  EXPECT_NE(std::find(bytecode.code.begin(), bytecode.code.end(), static_cast<uint32_t>(RegOpcode::AddFieldI32)),
+    bytecode.code.end());
+
+  RegVm vm(module);
+  VmSlot result;
+  ASSERT_EQ(vm.call(0, {}, result), VmStatus::Ok);
+  // 300 + int8_t(300) + uint8_t(260)
+  EXPECT_EQ(result.i, 300 + 44 + 4);
+}
+
+static VmSlot make_slot(IrType type, int64_t value) {
+  VmSlot slot{0};
+  if (type == IrType::F32) {
+    slot.f32 = value + 0.25f;
+  } else if (type == IrType::F64) {
+    slot.f64 = value + 0.25;
+  } else {
+    slot.i = IrConst::make_int(type, value).i;
+  }
+  return slot;
+}
+
+TEST(Jit, MatchesRegVmOnEveryTypedOp) {
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  const IrType types[] = {IrType::I8, IrType::I16, IrType::I32, IrType::U8, IrType::U16, IrType::U32, IrType::F32, IrType::F64};
+  const RegTypedOp binary_ops[] = {RegTypedOp::Add, RegTypedOp::Sub, RegTypedOp::Mul, RegTypedOp::Div,
+    RegTypedOp::Equal, RegTypedOp::Great, RegTypedOp::GreatOrEqual, RegTypedOp::Less, RegTypedOp::LessOrEqual};
+  const RegTypedOp jump_ops[] = {RegTypedOp::JumpUnlessEqual, RegTypedOp::JumpUnlessGreat,
+    RegTypedOp::JumpUnlessGreatOrEqual, RegTypedOp::JumpUnlessLess, RegTypedOp::JumpUnlessLessOrEqual};
+
+  // every function takes a and b in r0 and r1 and returns r2
+  RegBytecodeModule module;
+  std::vector<std::pair<IrType, bool>> functions;
+  auto add_function = [&](IrType type, bool is_loop) -> RegBytecodeFunction& {
+    module.functions.emplace_back();
+    auto& function = module.functions.back();
+    function.return_type = type;
+    function.params = 2;
+    function.registers = 4;
+    functions.emplace_back(type, is_loop);
+    return function;
+  };
+  for (auto type : types) {
+    for (auto op : binary_ops) {
+      add_function(type, false).emit(reg_typed_opcode(op, type), {2, 0, 1});
+    }
+    add_function(type, false).emit(reg_typed_opcode(RegTypedOp::Neg, type), {2, 0});
+    add_function(type, false).emit(reg_typed_opcode(RegTypedOp::AddImm, type), {2, 0, static_cast<uint32_t>(-7)});
+    {
+      auto& function = add_function(type, false);
+      function.emit(reg_typed_opcode(RegTypedOp::StoreField, type), {24, 1});
+      function.emit(reg_typed_opcode(RegTypedOp::AddField, type), {2, 0, 24});
+    }
+    {
+      auto& function = add_function(type, false);
+      function.emit(reg_typed_opcode(RegTypedOp::StoreField, type), {25, 0});
+      function.emit(reg_typed_opcode(RegTypedOp::LoadField, type), {2, 25});
+    }
+    for (auto op : jump_ops) {
+      // r2 = 1; if (!(a op b)) goto end; r2 = 2; end:
+      auto& function = add_function(type, false);
+      function.return_type = IrType::I32;
+      function.emit(RegOpcode::ConstI32, {2, 1});
+      function.emit(reg_typed_opcode(op, type), {0, 1, 10});
+      function.emit(RegOpcode::ConstI32, {2, 2});
+    }
+    {
+      // do a += 3 while a < b; r2 = a
+      auto& function = add_function(type, true);
+      function.emit(reg_typed_opcode(RegTypedOp::IncrementLessJump, type), {0, 3, 1, 0});
+      function.emit(RegOpcode::Move, {2, 0});
+    }
+  }
+  for (auto& function : module.functions) function.emit(RegOpcode::Return, {2});
+
+  RegVm vm(module);
+  Jit jit(module);
+  const int64_t values[] = {0, 1, -1, 7, -128, 127, 300, -70000, INT32_MAX};
+  const int64_t loop_values[] = {0, 5, 100, 127};
+  for (uint32_t index = 0; index < module.functions.size(); ++index) {
+    ASSERT_TRUE(jit.compile(index));
+    const auto [type, is_loop] = functions[index];
+    for (auto a : is_loop ? std::vector<int64_t>(std::begin(loop_values), std::end(loop_values))
+                          : std::vector<int64_t>(std::begin(values), std::end(values))) {
+      for (auto b : is_loop ? std::vector<int64_t>(std::begin(loop_values), std::end(loop_values))
+                            : std::vector<int64_t>(std::begin(values), std::end(values))) {
+        const std::vector<VmSlot> args{make_slot(type, a), make_slot(type, b)};
+        VmSlot expected{0}, actual{0};
+        const auto expected_status = vm.call(index, args, expected);
+        ASSERT_EQ(jit.call(index, args, actual), expected_status) << reg_opcode_name(
+          static_cast<RegOpcode>(module.functions[index].code[0])) << " " << a << " " << b;
+        EXPECT_EQ(actual.i, expected.i) << reg_opcode_name(static_cast<RegOpcode>(module.functions[index].code[0]))
+          << " " << a << " " << b;
+      }
+    }
+  }
+  EXPECT_EQ(jit.stats().functions, module.functions.size());
+}
+
+TEST(Jit, CallsAndErrors) {
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  Ast ast;
+  IdCache id_cache;
+  // fun fib(n: i32) -> i32 { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  auto n = make_local(ast, id_cache, "n");
+  auto fib_body = make_block(ast, {});
+  auto fib = make_function(ast, id_cache, "fib", {n}, fib_body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, n, make_i32_literal(ast, 2));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, n);
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[fib_body].block_stmt.add_stmt(if_else);
+  ast[fib_body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 1))}),
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 2))}))));
+  // fun quotient(d: i32) -> i32 { return 10 / d; }
+  // fun twice(e: i32) -> i32 { return quotient(e) + quotient(e); }
+  auto d = make_local(ast, id_cache, "d");
+  auto quotient = make_function(ast, id_cache, "quotient", {d}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::DivExpr, make_i32_literal(ast, 10), d))}));
+  auto e = make_local(ast, id_cache, "e");
+  auto twice = make_function(ast, id_cache, "twice", {e}, make_block(ast, {
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+      make_call(ast, quotient, {e}), make_call(ast, quotient, {e})))}));
+
+  RegBytecodeModule module;
+  RegCompiler compiler(ast, module);
+  const auto fib_index = compiler.function_index(fib);
+  const auto twice_index = compiler.function_index(twice);
+  compiler.compile_function(fib);
+  compiler.compile_function(quotient);
+  compiler.compile_function(twice);
+
+  Jit jit(module);
+  ASSERT_TRUE(jit.compile(twice_index));
+  // callees are compiled with their callers
+  EXPECT_TRUE(jit.is_compiled(compiler.function_index(quotient)));
+  EXPECT_FALSE(jit.is_compiled(fib_index));
+  ASSERT_TRUE(jit.compile(fib_index));
+  VmSlot result;
+  ASSERT_EQ(jit.call(fib_index, {VmSlot{20}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 6765);
+  ASSERT_EQ(jit.call(twice_index, {VmSlot{3}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 6);
+  EXPECT_EQ(jit.call(twice_index, {VmSlot{0}}, result), VmStatus::DivisionByZero);
+
+  Jit small_jit(module, 16);
+  ASSERT_TRUE(small_jit.compile(fib_index));
+  EXPECT_EQ(small_jit.call(fib_index, {VmSlot{20}}, result), VmStatus::StackOverflow);
+  Jit shallow_jit(module, 1 << 20, 4);
+  ASSERT_TRUE(shallow_jit.compile(fib_index));
+  EXPECT_EQ(shallow_jit.call(fib_index, {VmSlot{20}}, result), VmStatus::StackOverflow);
+  ASSERT_EQ(shallow_jit.call(fib_index, {VmSlot{4}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 3);
+}
+TEST(TieredVm, PromotesHotCodeAndReplacesLoops) {
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  // fun sum(n: i32) -> i32 { s = 0; i = 0; do { s += i; i += 1; } while (i < n); return s; }
+  RegBytecodeModule module;
+  module.functions.emplace_back();
+  auto& sum = module.functions.back();
+  sum.return_type = IrType::I32;
+  sum.params = 1;
+  sum.registers = 3;
+  sum.emit(RegOpcode::ConstI32, {1, 0});
+  sum.emit(RegOpcode::ConstI32, {2, 0});
+  sum.emit(RegOpcode::AddI32, {1, 1, 2});
+  sum.emit(RegOpcode::IncrementLessJumpI32, {2, 1, 0, 6});
+  sum.emit(RegOpcode::Return, {1});
+  // fun outer(n: i32) -> i32 { return sum(n) + 1; }
+  module.functions.emplace_back();
+  auto& outer = module.functions.back();
+  outer.return_type = IrType::I32;
+  outer.params = 1;
+  outer.registers = 5;
+  outer.emit(RegOpcode::Move, {2, 0});
+  outer.emit(RegOpcode::Call, {1, 0, 2});
+  outer.emit(RegOpcode::AddImmI32, {1, 1, 1});
+  outer.emit(RegOpcode::Return, {1});
+
+  RegVm vm(module);
+  VmSlot expected;
+  VmSlot result;
+  {
+    // the loop is compiled after 100 iterations and the frame moves into
+    // compiled code at the next one
+    TieredVm tiered(module, {1000, 100, false});
+    ASSERT_EQ(tiered.call(0, {VmSlot{100000}}, result), VmStatus::Ok);
+    ASSERT_EQ(vm.call(0, {VmSlot{100000}}, expected), VmStatus::Ok);
+    EXPECT_EQ(result.i, expected.i);
+    EXPECT_TRUE(tiered.is_compiled(0));
+    EXPECT_FALSE(tiered.is_compiled(1));
+    EXPECT_EQ(tiered.stats().osr_entries, 1);
+  }
+  {
+    // outer is compiled on its third call, sum is already compiled as its
+    // callee when outer's frame calls it
+    TieredVm tiered(module, {3, 1 << 30, false});
+    for (int32_t n = 1; n <= 5; ++n) {
+      ASSERT_EQ(tiered.call(1, {VmSlot{n}}, result), VmStatus::Ok);
+      ASSERT_EQ(vm.call(1, {VmSlot{n}}, expected), VmStatus::Ok);
+      EXPECT_EQ(result.i, expected.i);
+      EXPECT_EQ(tiered.is_compiled(1), n >= 3);
+      EXPECT_EQ(tiered.is_compiled(0), n >= 3);
+    }
+    const auto stats = tiered.stats();
+    EXPECT_EQ(stats.requests, 1);
+    EXPECT_EQ(stats.failures, 0);
+    EXPECT_EQ(stats.jit.functions, 2);
+    EXPECT_EQ(stats.compiled_calls, 3);
+  }
+  {
+    // compiled in the background, results agree whenever code is switched
+    TieredVm tiered(module, {2, 1000});
+    for (int32_t n = 1; n <= 200000; n *= 3) {
+      ASSERT_EQ(tiered.call(1, {VmSlot{n}}, result), VmStatus::Ok);
+      ASSERT_EQ(vm.call(1, {VmSlot{n}}, expected), VmStatus::Ok);
+      EXPECT_EQ(result.i, expected.i);
+    }
+    tiered.wait();
+    EXPECT_TRUE(tiered.is_compiled(0));
+    EXPECT_TRUE(tiered.is_compiled(1));
+    ASSERT_EQ(tiered.call(1, {VmSlot{12345}}, result), VmStatus::Ok);
+    ASSERT_EQ(vm.call(1, {VmSlot{12345}}, expected), VmStatus::Ok);
+    EXPECT_EQ(result.i, expected.i);
+    EXPECT_EQ(tiered.stats().failures, 0);
+  }
+}
+
+
+TEST(X86CodeGen, MatchesFoldOnEveryOp) {
+  const IrType types[] = {IrType::I8, IrType::I16, IrType::I32, IrType::U8, IrType::U16, IrType::U32, IrType::F32, IrType::F64};
+  const IrInstr::Kind kinds[] = {IrInstr::Kind::Add, IrInstr::Kind::Sub, IrInstr::Kind::Mul, IrInstr::Kind::Div,
+    IrInstr::Kind::Neg, IrInstr::Kind::Equal, IrInstr::Kind::Great, IrInstr::Kind::GreatOrEqual,
+    IrInstr::Kind::Less, IrInstr::Kind::LessOrEqual};
+  const int64_t values[] = {0, 1, -1, 7, -128, 127, 300, -70000, INT32_MAX};
+  auto make_const = [](IrType type, int64_t value) {
+    return ir_is_float(type) ? IrConst::make_float(type, value + 0.25) : IrConst::make_int(type, value);
+  };
+
+  // f(a, b) = a op b, g(a) = a op 7 with the constant folded, and for
+  // compares h(a, b) = a op b ? 1 : 2 through a fused branch
+  struct Case {
+    IrInstr::Kind kind;
+    IrType type;
+    uint32_t shape;
+  };
+  IrModule module;
+  std::vector<Case> cases;
+  for (auto type : types) {
+    for (auto kind : kinds) {
+      const bool compare = IrInstr::is_compare(kind);
+      for (uint32_t shape = 0; shape < (compare ? 3u : 2u); ++shape) {
+        module.functions.emplace_back();
+        auto& function = module.functions.back();
+        const auto result_type = compare ? IrType::Bool : type;
+        function.return_type = shape == 2 ? IrType::I32 : result_type;
+        auto entry = function.create_block();
+        auto a = function.create(entry, IrInstr::Kind::Param, type);
+        function.params.emplace_back(a);
+        auto b = function.create_const(entry, make_const(type, 7));
+        if (shape != 1) {
+          b = function.create(entry, IrInstr::Kind::Param, type);
+          function.instrs[b].index = 1;
+          function.params.emplace_back(b);
+        }
+        auto value = kind == IrInstr::Kind::Neg ? function.create_unary(entry, kind, result_type, a)
+                                                : function.create_binary(entry, kind, result_type, a, b);
+        if (shape == 2) {
+          auto then_block = function.create_block();
+          auto else_block = function.create_block();
+          function.create_branch(entry, value, then_block, else_block);
+          function.create_return(then_block, function.create_const(then_block, IrConst::make_int(IrType::I32, 1)));
+          function.create_return(else_block, function.create_const(else_block, IrConst::make_int(IrType::I32, 2)));
+        } else {
+          function.create_return(entry, value);
+        }
+        cases.push_back({kind, type, shape});
+      }
+    }
+  }
+
+  X86CodeGen codegen(module);
+  X86Code code;
+  ASSERT_TRUE(codegen.compile_module(code));
+  EXPECT_EQ(codegen.stats().functions, module.functions.size());
+  EXPECT_GT(codegen.stats().folded_operands, 0);
+  EXPECT_EQ(codegen.stats().fused_branches, 5 * 8 - 2);
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  ExecutableMemory memory;
+  const auto* base = memory.install(code.bytes.data(), code.bytes.size());
+  ASSERT_NE(base, nullptr);
+
+  for (uint32_t index = 0; index < cases.size(); ++index) {
+    const auto [kind, type, shape] = cases[index];
+    const void* entry = base + code.entries[index];
+    for (auto x : values) {
+      for (auto y : values) {
+        const auto a = make_const(type, x);
+        const auto b = make_const(type, shape == 1 ? 7 : y);
+        IrConst expected;
+        const auto result_type = IrInstr::is_compare(kind) ? IrType::Bool : type;
+        if (!ir_fold(kind, result_type, a, b, expected)) continue;
+        int64_t actual = 0;
+        if (type == IrType::F32) {
+          if (shape == 1) {
+            actual = reinterpret_cast<int64_t (*)(float)>(entry)(a.f);
+          } else {
+            actual = reinterpret_cast<int64_t (*)(float, float)>(entry)(a.f, b.f);
+          }
+        } else if (type == IrType::F64) {
+          if (shape == 1) {
+            actual = reinterpret_cast<int64_t (*)(double)>(entry)(a.f);
+          } else {
+            actual = reinterpret_cast<int64_t (*)(double, double)>(entry)(a.f, b.f);
+          }
+        } else if (shape == 1) {
+          actual = reinterpret_cast<int64_t (*)(int64_t)>(entry)(a.i);
+        } else {
+          actual = reinterpret_cast<int64_t (*)(int64_t, int64_t)>(entry)(a.i, b.i);
+        }
+        if (ir_is_float(result_type)) {
+          // the result is in xmm0, read it back through the same signature
+          double f = 0.0;
+          if (type == IrType::F32) {
+            f = shape == 1 ? reinterpret_cast<float (*)(float)>(entry)(a.f)
+                           : reinterpret_cast<float (*)(float, float)>(entry)(a.f, b.f);
+            EXPECT_EQ(static_cast<float>(f), static_cast<float>(expected.f)) << index << " " << x << " " << y;
+          } else {
+            f = shape == 1 ? reinterpret_cast<double (*)(double)>(entry)(a.f)
+                           : reinterpret_cast<double (*)(double, double)>(entry)(a.f, b.f);
+            EXPECT_EQ(f, expected.f) << index << " " << x << " " << y;
+          }
+        } else if (shape == 2) {
+          EXPECT_EQ(static_cast<int32_t>(actual), expected.i ? 1 : 2) << index << " " << x << " " << y;
+        } else {
+          EXPECT_EQ(IrConst::make_int(result_type, static_cast<int32_t>(actual)).i, expected.i)
+            << index << " " << x << " " << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(X86CodeGen, LoweredProgramsCallsAndSpills) {
+  Ast ast;
+  IdCache id_cache;
+  auto global_idx = ast.create(AstNode::Kind::GlobalScope);
+  // fun fib(n: i32) -> i32 { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  auto n = make_local(ast, id_cache, "n");
+  auto fib_body = make_block(ast, {});
+  auto fib = make_function(ast, id_cache, "fib", {n}, fib_body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, n, make_i32_literal(ast, 2));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, n);
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[fib_body].block_stmt.add_stmt(if_else);
+  ast[fib_body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 1))}),
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 2))}))));
+  // struct P { x: i32; y: i32 }
+  // fun walk(m: i32) -> i32 { var p: P; var i = 0; p.x = 0; p.y = 1;
+  //   while (i < m) { p.x = p.x + p.y * 3; p.y = p.y + i / 2; i = i + 1; } return p.x; }
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  uint32_t offset = 0;
+  for (auto name : {"x", "y"}) {
+    auto field = ast.create(AstNode::Kind::StructField);
+    ast[field].struct_field.value.type = ast.create(AstNode::Kind::I32Type);
+    ast[field].struct_field.name = id_cache.get(name);
+    ast[field].struct_field.offset = offset;
+    offset += 4;
+    ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  }
+  auto p = ast.create(AstNode::Kind::LocalVariable);
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto field_expr = [&](const char* name) {
+    auto idx = ast.create(AstNode::Kind::FieldExpr);
+    ast[idx].field_expr.expr = p;
+    ast[idx].field_expr.field = ast[struct_idx].scope.dict->find(id_cache.get(name));
+    return idx;
+  };
+  auto assign = [&](AstNodeIndex left, AstNodeIndex right) {
+    return make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, left, right));
+  };
+  auto m = make_local(ast, id_cache, "m");
+  auto i = make_local(ast, id_cache, "i");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, m);
+  ast[loop].while_stmt.stmt = make_block(ast, {
+    assign(field_expr("x"), make_binary(ast, AstNode::Kind::AddExpr, field_expr("x"),
+      make_binary(ast, AstNode::Kind::MulExpr, field_expr("y"), make_i32_literal(ast, 3)))),
+    assign(field_expr("y"), make_binary(ast, AstNode::Kind::AddExpr, field_expr("y"),
+      make_binary(ast, AstNode::Kind::DivExpr, i, make_i32_literal(ast, 2)))),
+    assign(i, make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1)))});
+  auto walk = make_function(ast, id_cache, "walk", {m}, make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, i, make_i32_literal(ast, 0)),
+    assign(field_expr("x"), make_i32_literal(ast, 0)),
+    assign(field_expr("y"), make_i32_literal(ast, 1)),
+    loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, field_expr("x"))}));
+  for (auto function : {fib, walk}) {
+    ast[global_idx].global_scope.scope.add_node(function, ast[function].function.scope.name);
+  }
+
+  IrModule module;
+  Lowering lowering(ast, module);
+  lowering.lower_module(global_idx);
+  ASSERT_EQ(module.functions.size(), 2);
+  for (auto& function : module.functions) {
+    Sccp(function).run();
+    Gvn(function).run();
+    Licm(function).run();
+  }
+
+  // wide(a0..a9) = a0 * 1 + a1 * 2 + .. + a9 * 10 takes four arguments on
+  // the stack; spread(x) calls it with x + k and keeps all of them alive
+  // across the call, which forces callee saved registers and spills
+  const uint32_t wide = module.functions.size();
+  {
+    module.functions.emplace_back();
+    auto& function = module.functions.back();
+    function.return_type = IrType::I32;
+    auto entry = function.create_block();
+    IrValueIndex sum = function.create_const(entry, IrConst::make_int(IrType::I32, 0));
+    for (uint32_t k = 0; k < 10; ++k) {
+      auto param = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+      function.instrs[param].index = k;
+      function.params.emplace_back(param);
+      auto scaled = function.create_binary(entry, IrInstr::Kind::Mul, IrType::I32, param,
+        function.create_const(entry, IrConst::make_int(IrType::I32, k + 1)));
+      sum = function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, sum, scaled);
+    }
+    function.create_return(entry, sum);
+  }
+  const uint32_t spread = module.functions.size();
+  {
+    module.functions.emplace_back();
+    auto& function = module.functions.back();
+    function.return_type = IrType::I32;
+    auto entry = function.create_block();
+    auto x = function.create(entry, IrInstr::Kind::Param, IrType::I32);
+    function.params.emplace_back(x);
+    std::vector<IrValueIndex> args;
+    for (uint32_t k = 0; k < 20; ++k) {
+      args.emplace_back(function.create_binary(entry, IrInstr::Kind::Add, IrType::I32, x,
+        function.create_const(entry, IrConst::make_int(IrType::I32, k))));
+    }
+    auto call = function.create(entry, IrInstr::Kind::Call, IrType::I32);
+    function.instrs[call].operands.assign(args.begin(), args.begin() + 10);
+    function.instrs[call].index = wide;
+    IrValueIndex sum = call;
+    for (auto arg : args) sum = function.create_binary(entry, IrInstr::Kind::Sub, IrType::I32, sum, arg);
+    function.create_return(entry, sum);
+  }
+
+  X86CodeGen codegen(module);
+  X86Code code;
+  ASSERT_TRUE(codegen.compile_module(code));
+  EXPECT_GT(codegen.stats().spill_slots, 0);
+  EXPECT_GE(codegen.stats().fused_branches, 2);
+  ASSERT_EQ(code.calls.size(), 3);
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  ExecutableMemory memory;
+  const auto* base = memory.install(code.bytes.data(), code.bytes.size());
+  ASSERT_NE(base, nullptr);
+
+  using Unary = int32_t (*)(int32_t);
+  EXPECT_EQ(reinterpret_cast<Unary>(base + code.entries[0])(20), 6765);
+  auto walk_reference = [](int32_t count) {
+    int32_t x = 0, y = 1;
+    for (int32_t k = 0; k < count; ++k) {
+      x += y * 3;
+      y += k / 2;
+    }
+    return x;
+  };
+  for (int32_t count : {0, 1, 10, 1000}) {
+    EXPECT_EQ(reinterpret_cast<Unary>(base + code.entries[1])(count), walk_reference(count)) << count;
+  }
+  for (int32_t x : {0, 5, -1000}) {
+    int32_t expected = 0;
+    for (int32_t k = 0; k < 10; ++k) expected += (x + k) * (k + 1);
+    for (int32_t k = 0; k < 20; ++k) expected -= x + k;
+    EXPECT_EQ(reinterpret_cast<Unary>(base + code.entries[spread])(x), expected) << x;
+  }
+}
+
+TEST(ElfWriter, ObjectLinksWithSystemLinker) {
+  // twice(x) = x * 2, quad(x) = twice(twice(x)), half(x: f64) = x * 0.5
+  // reads a pool constant and bump(x) = ext(x) + 1 calls ext, which is
+  // declared but left to the C side
+  IdCache id_cache;
+  IrModule module;
+  auto unary = [&](const char* name, IrType type) -> IrFunction& {
+    module.functions.emplace_back();
+    auto& function = module.functions.back();
+    function.name = id_cache.get(name);
+    function.return_type = type;
+    auto entry = function.create_block();
+    auto param = function.create(entry, IrInstr::Kind::Param, type);
+    function.params.emplace_back(param);
+    return function;
+  };
+  auto call = [](IrFunction& function, uint32_t callee, IrValueIndex arg) {
+    auto index = function.create(0, IrInstr::Kind::Call, IrType::I32);
+    function.instrs[index].operands.emplace_back(arg);
+    function.instrs[index].index = callee;
+    return index;
+  };
+  {
+    auto& twice = unary("twice", IrType::I32);
+    twice.create_return(0, twice.create_binary(0, IrInstr::Kind::Mul, IrType::I32, twice.params[0],
+      twice.create_const(0, IrConst::make_int(IrType::I32, 2))));
+  }
+  {
+    auto& quad = unary("quad", IrType::I32);
+    quad.create_return(0, call(quad, 0, call(quad, 0, quad.params[0])));
+  }
+  {
+    auto& half = unary("half", IrType::F64);
+    half.create_return(0, half.create_binary(0, IrInstr::Kind::Mul, IrType::F64, half.params[0],
+      half.create_const(0, IrConst::make_float(IrType::F64, 0.5))));
+  }
+  unary("ext", IrType::I32);
+  {
+    auto& bump = unary("bump", IrType::I32);
+    bump.create_return(0, bump.create_binary(0, IrInstr::Kind::Add, IrType::I32, call(bump, 3, bump.params[0]),
+      bump.create_const(0, IrConst::make_int(IrType::I32, 1))));
+  }
+
+  X86CodeGen codegen(module);
+  X86Code code;
+  for (uint32_t function : {0, 1, 2, 4}) ASSERT_TRUE(codegen.compile(function, code));
+  EXPECT_FALSE(code.link());
+  ASSERT_EQ(code.calls.size(), 3);
+
+  std::vector<uint8_t> object(3, 0xff);
+  ElfWriter writer(module, id_cache);
+  ASSERT_TRUE(writer.write(code, object));
+  object.erase(object.begin(), object.begin() + 3);
+  auto read = [&](uint64_t offset, uint32_t size) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < size; ++i) value |= static_cast<uint64_t>(object[offset + i]) << (8 * i);
+    return value;
+  };
+  ASSERT_EQ(std::memcmp(object.data(), "\x7f" "ELF\x02\x01\x01", 7), 0);
+  EXPECT_EQ(read(16, 2), 1);
+  EXPECT_EQ(read(18, 2), 62);
+  const auto headers = read(40, 8);
+  const auto section_count = read(60, 2);
+  ASSERT_EQ(headers + section_count * 64, object.size());
+  auto section = [&](uint32_t index, uint32_t field, uint32_t size) { return read(headers + index * 64 + field, size); };
+  const auto names = section(read(62, 2), 24, 8);
+  uint32_t text = 0, rela = 0, symtab = 0;
+  for (uint32_t index = 1; index < section_count; ++index) {
+    const char* name = reinterpret_cast<const char*>(object.data() + names + section(index, 0, 4));
+    if (!std::strcmp(name, ".text")) text = index;
+    if (!std::strcmp(name, ".rela.text")) rela = index;
+    if (!std::strcmp(name, ".symtab")) symtab = index;
+  }
+  ASSERT_TRUE(text && rela && symtab);
+  EXPECT_EQ(section(text, 32, 8), code.bytes.size());
+  EXPECT_EQ(std::memcmp(object.data() + section(text, 24, 8), code.bytes.data(), code.bytes.size()), 0);
+  EXPECT_EQ(section(rela, 32, 8), 3 * 24);
+  EXPECT_EQ(section(rela, 44, 4), text);
+  const auto strings = section(section(symtab, 40, 4), 24, 8);
+  std::vector<std::string> defined, undefined;
+  for (uint64_t symbol = section(symtab, 44, 4); symbol < section(symtab, 32, 8) / 24; ++symbol) {
+    const auto offset = section(symtab, 24, 8) + symbol * 24;
+    std::string name(reinterpret_cast<const char*>(object.data() + strings + read(offset, 4)));
+    (read(offset + 6, 2) == text ? defined : undefined).emplace_back(name);
+  }
+  EXPECT_EQ(defined, (std::vector<std::string>{"twice", "quad", "half", "bump"}));
+  EXPECT_EQ(undefined, std::vector<std::string>{"ext"});
+
+  if (!JIT_SUPPORTED || std::system("cc --version > /dev/null 2>&1") != 0) GTEST_SKIP();
+  const auto dir = ::testing::TempDir();
+  ASSERT_TRUE(writer.write_file(code, (dir + "smallang_elf.o").c_str()));
+  std::ofstream(dir + "smallang_elf_main.c") <<
+    "int twice(int); int quad(int); double half(double); int bump(int);\n"
+    "int ext(int x) { return x * 100; }\n"
+    "int main(void) {\n"
+    "  if (twice(21) != 42 || quad(-3) != -12 || half(5.0) != 2.5 || bump(7) != 701) return 1;\n"
+    "  return 0;\n"
+    "}\n";
+  const auto command = "cc -o " + dir + "smallang_elf " + dir + "smallang_elf_main.c " + dir + "smallang_elf.o && " +
+                       dir + "smallang_elf";
+  EXPECT_EQ(std::system(command.c_str()), 0);
+  for (auto name : {"smallang_elf.o", "smallang_elf_main.c", "smallang_elf"}) std::remove((dir + name).c_str());
+}
+
+TEST(CBackend, TranslationCompilesAndRuns) {
+  Ast ast;
+  IdCache id_cache;
+  auto global_idx = ast.create(AstNode::Kind::GlobalScope);
+  // fun fib(n: i32) -> i32 { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  auto n = make_local(ast, id_cache, "n");
+  auto fib_body = make_block(ast, {});
+  auto fib = make_function(ast, id_cache, "fib", {n}, fib_body);
+  auto if_else = ast.create(AstNode::Kind::IfElseStmt);
+  ast[if_else].if_else_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, n, make_i32_literal(ast, 2));
+  ast[if_else].if_else_stmt.stmt = make_stmt(ast, AstNode::Kind::ReturnStmt, n);
+  ast[if_else].if_else_stmt.else_stmt = UndefinedAstNodeIndex;
+  ast[fib_body].block_stmt.add_stmt(if_else);
+  ast[fib_body].block_stmt.add_stmt(make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr,
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 1))}),
+    make_call(ast, fib, {make_binary(ast, AstNode::Kind::SubExpr, n, make_i32_literal(ast, 2))}))));
+  // struct P { x: i32 @0; tag: u8 @4; w: f64 @8 }
+  // fun walk(m: i32) -> i32 { var p: P; var i = 0; p.x = 1;
+  //   while (i < m) { p.x = p.x * 3 + i; p.w = p.w + 0.5; i = i + 1; } return p.x + p.w; }
+  auto struct_idx = ast.create(AstNode::Kind::Struct);
+  ast[struct_idx].struc.scope.name = id_cache.get("P");
+  auto add_field = [&](const char* name, AstNode::Kind type, uint32_t offset) {
+    auto field = ast.create(AstNode::Kind::StructField);
+    ast[field].struct_field.value.type = ast.create(type);
+    ast[field].struct_field.name = id_cache.get(name);
+    ast[field].struct_field.offset = offset;
+    ast[struct_idx].struc.scope.add_node(field, ast[field].struct_field.name);
+  };
+  add_field("w", AstNode::Kind::F64Type, 8);
+  add_field("x", AstNode::Kind::I32Type, 0);
+  add_field("tag", AstNode::Kind::U8Type, 4);
+  auto p = ast.create(AstNode::Kind::LocalVariable);
+  ast[p].local_variable.name = id_cache.get("p");
+  ast[p].local_variable.value.type = ast.create(AstNode::Kind::StructType);
+  ast[ast[p].local_variable.value.type].struct_type.struct_scope = struct_idx;
+  auto field_expr = [&](const char* name) {
+    auto idx = ast.create(AstNode::Kind::FieldExpr);
+    ast[idx].field_expr.expr = p;
+    ast[idx].field_expr.field = ast[struct_idx].scope.dict->find(id_cache.get(name));
+    return idx;
+  };
+  auto assign = [&](AstNodeIndex left, AstNodeIndex right) {
+    return make_stmt(ast, AstNode::Kind::ExprStmt, make_binary(ast, AstNode::Kind::AssignExpr, left, right));
+  };
+  auto half = ast.create(AstNode::Kind::F64Literal);
+  ast[half].f64_literal.literal_value = 0.5;
+  auto m = make_local(ast, id_cache, "m");
+  auto i = make_local(ast, id_cache, "i");
+  auto loop = ast.create(AstNode::Kind::WhileStmt);
+  ast[loop].while_stmt.expr = make_binary(ast, AstNode::Kind::LessExpr, i, m);
+  ast[loop].while_stmt.stmt = make_block(ast, {
+    assign(field_expr("x"), make_binary(ast, AstNode::Kind::AddExpr,
+      make_binary(ast, AstNode::Kind::MulExpr, field_expr("x"), make_i32_literal(ast, 3)), i)),
+    assign(field_expr("w"), make_binary(ast, AstNode::Kind::AddExpr, field_expr("w"), half)),
+    assign(i, make_binary(ast, AstNode::Kind::AddExpr, i, make_i32_literal(ast, 1)))});
+  auto walk = make_function(ast, id_cache, "walk", {m}, make_block(ast, {
+    make_var_decl(ast, p, UndefinedAstNodeIndex),
+    make_var_decl(ast, i, make_i32_literal(ast, 0)),
+    assign(field_expr("x"), make_i32_literal(ast, 1)),
+    loop,
+    make_stmt(ast, AstNode::Kind::ReturnStmt, make_binary(ast, AstNode::Kind::AddExpr, field_expr("x"), field_expr("w")))}));
+  // fun narrow(x: i32) -> i32 { var b: i8 = x; b = -(b * b) / 3; return b; }
+  auto x = make_local(ast, id_cache, "x");
+  auto b = make_local(ast, id_cache, "b");
+  ast[ast[b].local_variable.value.type].kind = AstNode::Kind::I8Type;
+  auto neg = ast.create(AstNode::Kind::NegExpr);
+  ast[neg].neg_expr.expr = make_binary(ast, AstNode::Kind::MulExpr, b, b);
+  auto narrow = make_function(ast, id_cache, "narrow", {x}, make_block(ast, {
+    make_var_decl(ast, b, x),
+    assign(b, make_binary(ast, AstNode::Kind::DivExpr, neg, make_i32_literal(ast, 3))),
+    make_stmt(ast, AstNode::Kind::ReturnStmt, b)}));
+  for (auto function : {fib, walk, narrow}) {
+    ast[global_idx].global_scope.scope.add_node(function, ast[function].function.scope.name);
+  }
+
+  std::stringstream out;
+  {
+    CBackend backend(ast, id_cache, out);
+    EXPECT_TRUE(backend.emit_module(global_idx));
+  }
+  const auto source = out.str();
+  EXPECT_NE(source.find("struct P {\n  int32_t x;\n  uint8_t tag;\n  uint8_t sl_pad5[3];\n  double w;\n};"),
+            std::string::npos) << source;
+  EXPECT_NE(source.find("_Static_assert(offsetof(struct P, w) == 8"), std::string::npos);
+  EXPECT_NE(source.find("int32_t fib(int32_t n);"), std::string::npos);
+  EXPECT_NE(source.find("int8_t b = ((int8_t)x);"), std::string::npos) << source;
+
+  if (std::system("cc --version > /dev/null 2>&1") != 0) GTEST_SKIP();
+  auto walk_reference = [](int32_t count) {
+    int32_t px = 1;
+    double pw = 0;
+    for (int32_t k = 0; k < count; ++k) {
+      px = static_cast<int32_t>(static_cast<uint32_t>(px) * 3u + static_cast<uint32_t>(k));
+      pw += 0.5;
+    }
+    return static_cast<int32_t>(px + pw);
+  };
+  auto narrow_reference = [](int32_t value) {
+    const auto b = static_cast<int8_t>(value);
+    return static_cast<int8_t>(static_cast<int8_t>(-static_cast<int8_t>(b * b)) / 3);
+  };
+  const auto dir = ::testing::TempDir();
+  std::ofstream main_file(dir + "smallang_c_main.c");
+  main_file << source << "\nint main(void) {\n  if (fib(20) != 6765) return 1;\n";
+  for (int32_t count : {0, 7, 30}) {
+    main_file << "  if (walk(" << count << ") != " << walk_reference(count) << ") return 2;\n";
+  }
+  for (int32_t value : {0, 11, 16, 127, -128, 300}) {
+    main_file << "  if (narrow(" << value << ") != " << int32_t{narrow_reference(value)} << ") return 3;\n";
+  }
+  main_file << "  return 0;\n}\n";
+  main_file.close();
+  const auto command = "cc -std=c11 -O2 -Wall -Werror -o " + dir + "smallang_c " + dir + "smallang_c_main.c && " +
+                       dir + "smallang_c";
+  EXPECT_EQ(std::system(command.c_str()), 0) << source;
+  for (auto name : {"smallang_c_main.c", "smallang_c"}) std::remove((dir + name).c_str());
+}
+
+TEST(CBackend, RefusesNodesWithoutTranslation) {
+  auto translates = [](const char* source) {
+    std::istringstream in(source);
+    Lexer::Tokens tokens;
+    Lexer lexer(in, tokens);
+    Ast ast;
+    IdCache id_cache;
+    Parser parser(lexer, ast, id_cache);
+    EXPECT_TRUE(parser.parse()) << parser.error();
+    std::stringstream out;
+    CBackend backend(ast, id_cache, out);
+    return backend.emit_module(parser.global_scope());
+  };
+  EXPECT_TRUE(translates("fun main() -> i32 { var x = 2; return x * 3; }"));
+  EXPECT_FALSE(translates("fun main() -> i32 { var a: [i32; 4]; a[1] = 3; return a[1]; }"));
+  EXPECT_FALSE(translates("fun length(s: [i32]) -> i32 { return s.len; }"));
+  EXPECT_FALSE(translates("fun main() -> f32 { val v = f32x4(1.0, 2.0, 3.0, 4.0); return v[2]; }"));
+  EXPECT_FALSE(translates("fun main() -> i32 { region { val s = new [i32; 3]; } return 0; }"));
+  EXPECT_FALSE(translates("fun one() -> i32 { return 1; } fun main() -> i32 { val t = spawn one(); return join(t); }"));
+}
+
+// a program expect_backends_agree compiled, for tests that look into it
+struct OptimizedProgram {
+  IdCache id_cache;
+  IrModule module;
+  OptimizeStats stats;
+
+  // index of the function called name in module
+  uint32_t function(const char* name) {
+    uint32_t index = 0;
+    while (index < module.functions.size() && module.functions[index].name != id_cache.get(name)) ++index;
+    return index;
+  }
+};
+
+// calls the function called name of source without arguments in RegVm
+static VmStatus call_in_reg_vm(const char* source, const char* name, VmSlot& result) {
+  std::istringstream in(source);
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  if (!parser.parse()) {
+    ADD_FAILURE() << parser.error();
+    return VmStatus::InvalidOpcode;
+  }
+  RegBytecodeModule bytecode;
+  RegCompiler(ast, bytecode).compile_module(parser.global_scope());
+  uint32_t index = 0;
+  while (index < bytecode.functions.size() && bytecode.functions[index].name != id_cache.get(name)) ++index;
+  if (index == bytecode.functions.size()) {
+    ADD_FAILURE() << "no function " << name;
+    return VmStatus::InvalidOpcode;
+  }
+  RegVm vm(bytecode);
+  return vm.call(index, {}, result);
+}
+
+// calls the function called name of source, which returns an i32 and
+// takes no arguments, in RegVm and from a NativeModule of the module
+// optimize_module made with every function kept, and expects the same
+// result from both, which is returned. Register allocation is checked on
+// every optimized function.
+static int32_t expect_backends_agree(const char* source, const char* name, OptimizedProgram* program = nullptr) {
+  VmSlot expected{0};
+  EXPECT_EQ(call_in_reg_vm(source, name, expected), VmStatus::Ok) << name;
+
+  OptimizedProgram local;
+  auto& optimized = program ? *program : local;
+  std::istringstream in(source);
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  Parser parser(lexer, ast, optimized.id_cache);
+  if (!parser.parse()) return static_cast<int32_t>(expected.i);
+  Lowering(ast, optimized.module).lower_module(parser.global_scope());
+  optimized.stats = optimize_module(optimized.module);
+  for (auto& function : optimized.module.functions) {
+    LinearScan scan(function);
+    scan.run();
+    expect_valid_allocation(function, scan);
+  }
+  NativeModule native(optimized.module);
+  const auto* entry = native.load() ? native.entry(optimized.function(name)) : nullptr;
+  if (!entry) {
+    ADD_FAILURE() << "no native code for " << name;
+  } else {
+    EXPECT_EQ(reinterpret_cast<int32_t (*)()>(const_cast<void*>(entry))(), static_cast<int32_t>(expected.i)) << name;
+  }
+  return static_cast<int32_t>(expected.i);
+}
+
+TEST(NativeModule, ProgramsRunFromOneModule) {
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  const char* source = R"(
+    struct P { x: i32; tag: u8; w: f64; }
+    struct Q { p: P; n: i16; }
+
+    fun fib(n: i32) -> i32 {
+      if (n < 2) return n;
+      return fib(n - 1) + fib(n - 2);
+    }
+    // calls a function declared further down
+    fun walk(m: i32) -> i32 {
+      var q: Q;
+      var i = 0;
+      q.p.x = 1;
+      while (i < m) {
+        q.p.x = q.p.x * 3 + i;
+        q.p.w = q.p.w + 0.5;
+        i = i + 1;
+      }
+      return q.p.x + twice(-m);
+    }
+    fun twice(k: i32) -> i32 { return k * 2; }
+    fun main() -> i32 {
+      val f = fib(20);
+      if (f == 6765) return walk(5); else return -1;
+    }
+  )";
+  OptimizedProgram program;
+  // x goes 1, 3, 10, 32, 99, 301 and twice(-5) is -10
+  EXPECT_EQ(expect_backends_agree(source, "main", &program), 291);
+
+  NativeModule native(program.module);
+  ASSERT_TRUE(native.load());
+  EXPECT_EQ(native.entry(static_cast<uint32_t>(program.module.functions.size())), nullptr);
+  using Fun1 = int32_t (*)(int32_t);
+  auto fib = reinterpret_cast<Fun1>(const_cast<void*>(native.entry(program.function("fib"))));
+  auto walk = reinterpret_cast<Fun1>(const_cast<void*>(native.entry(program.function("walk"))));
+  EXPECT_EQ(fib(25), 75025);
+  EXPECT_EQ(walk(0), 1);
+  EXPECT_EQ(walk(5), 291);
+}
+
+TEST(X86CodeGen, VectorsMatchRegVm) {
+  if (!JIT_SUPPORTED || !__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("sse4.1")) GTEST_SKIP();
+  // the interpreter runs lane by lane
+  const char* source = R"(
+    fun sum8(v: f32x8) -> f32 {
+      return v[0] + v[1] * 2.0 + v[2] * 3.0 + v[3] * 4.0 + v[4] * 5.0 + v[5] * 6.0 + v[6] * 7.0 + v[7] * 8.0;
+    }
+
+    fun sum4(v: f32x4) -> f32 {
+      return v[0] + v[1] + v[2] + v[3];
+    }
+
+    fun isum(v: i32x4) -> i32 {
+      return v[0] + v[1] + v[2] + v[3];
+    }
+
+    fun wide(a: f32x8, b: f32x8) -> f32x8 {
+      var c = a * b - a / b;
+      c[5] = a[2];
+      c[0] = 3.0;
+      return shuffle(c, 7, 6, 5, 4, 3, 2, 1, 0) + -c;
+    }
+
+    fun cmp(a: i32x4, b: i32x4) -> i32 {
+      return isum(a == b) + 2 * isum(a > b) + 4 * isum(a >= b) + 8 * isum(a < b) + 16 * isum(a <= b);
+    }
+
+    fun fcmp(a: f32x8, b: f32x8) -> f32 {
+      return sum8(a == b) + 2.0 * sum8(a > b) + 4.0 * sum8(a >= b) + 8.0 * sum8(a < b) + 16.0 * sum8(a <= b);
+    }
+
+    fun main() -> i32 {
+      var acc = f32x8(0.5);
+      var x = f32x8(1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0);
+      var k = i32x4(0);
+      var z: f32x4;
+      var n = 0;
+      while (n < 20) {
+        acc = acc * 0.5 + wide(x, acc + 3.0) * 0.125;
+        if (n - n / 2 * 2 == 0) x[6] = acc[1]; else x[1] = acc[2] / 64.0;
+        k = k + i32x4(n, -n, n * 3, 1);
+        k[2] = n;
+        z = z + shuffle(f32x4(acc[0], acc[3], acc[6], 1.0), 3, 3, 0, 1);
+        n = n + 1;
+      }
+      val a = i32x4(1, 5, -3, 7);
+      val b = i32x4(1, 2, 4, 7);
+      val f = f32x8(1.0, 5.0, -3.0, 7.0, 2.0, 2.0, 0.0, 9.0);
+      val g = f32x8(1.0, 2.0, 4.0, 7.0, 3.0, 2.0, -1.0, 8.0);
+      var s = sum8(acc) / 1000.0 + sum4(z) + fcmp(f, g);
+      var t = 0;
+      while (s > 1.0) {
+        s = s - 1.0;
+        t = t + 1;
+      }
+      return cmp(a, b) + isum(k) + isum(-k * k) / 100 + t;
+    }
+    fun compares() -> i32 { return cmp(i32x4(1, 5, -3, 7), i32x4(1, 2, 4, 7)); }
+  )";
+  // lanes hold: == 1 0 0 1, > 0 1 0 0, >= 1 1 0 1, < 0 0 1 0, <= 1 0 1 1
+  EXPECT_EQ(expect_backends_agree(source, "compares"), 2 + 2 * 1 + 4 * 3 + 8 * 1 + 16 * 3);
+  expect_backends_agree(source, "main");
+}
+
+TEST(BoundsCheckElimination, ArraysMatchAcrossBackends) {
+  const char* source = R"(
+    fun sum(s: [i32]) -> i32 {
+      var total = 0;
+      var i = 0;
+      while (i < s.len) {
+        total = total + s[i];
+        i = i + 1;
+      }
+      return total;
+    }
+    fun scale(s: [f64], k: f64) {
+      var i = 0;
+      while (i < s.len) {
+        s[i] = s[i] * k;
+        i = i + 1;
+      }
+    }
+    fun at(s: [i32], i: i32) -> i32 { return s[i]; }
+    fun main() -> i32 {
+      var a: [i32; 16];
+      var f: [f64; 4];
+      var i = 0;
+      while (i < 16) {
+        a[i] = i * i;
+        i = i + 1;
+      }
+      f[0] = 1.5;
+      f[3] = 2.0;
+      scale(f, 4.0);
+      val middle = a[4:12];
+      val inner: [i32] = middle[1:middle.len - 1];
+      var odd = 0;
+      i = 1;
+      while (i < a.len) {
+        odd = odd + a[i] - a[i - 1];
+        i = i + 2;
+      }
+      var g = 0;
+      if (f[0] + f[3] + f[2] == 14.0) g = 14;
+      return sum(a) + sum(middle) * 1000 + inner.len * 100 + at(inner, 0) + odd + g;
+    }
+    fun outside() -> i32 {
+      var a: [i32; 4];
+      return at(a[1:3], 2);
+    }
+  )";
+  VmSlot result;
+  EXPECT_EQ(call_in_reg_vm(source, "outside", result), VmStatus::IndexOutOfRange);
+  OptimizedProgram program;
+  // 1240 + 1000 * 492 + 100 * 6 + 25 + 120 + 14
+  EXPECT_EQ(expect_backends_agree(source, "main", &program), 493999);
+  // the loops over s.len and a.len, and the constant f indices need no checks
+  BoundsCheckStats stats;
+  for (const auto& function : program.stats.functions) {
+    stats.checks += function.bounds_checks.checks;
+    stats.removed += function.bounds_checks.removed;
+  }
+  EXPECT_GT(stats.removed, 0u);
+  EXPECT_LT(stats.removed, stats.checks);
+}
+
+TEST(X86CodeGen, SpilledArrayIndicesMatchRegVm) {
+  std::istringstream in(R"(
+    fun clamp(v: i32, n: i32) -> i32 {
+      var x = v;
+      if (x < 0) x = 0 - x;
+      while (x >= n) x = x - n;
+      return x;
+    }
+    fun f1(seed: i32) -> i32 {
+      var arr: [i32; 6];
+      var v3 = seed;
+      var a = seed * 3;
+      var b = seed * 5;
+      var c = seed * 7;
+      var d = seed * 11;
+      var e = seed * 13;
+      var g = seed * 17;
+      var h = seed * 19;
+      var k = seed * 23;
+      var m = seed * 29;
+      var n = seed * 31;
+      var p = seed * 37;
+      var i = 0;
+      while (i < 20) {
+        arr[1] = (v3 / -1) + arr[clamp(v3, 6)];
+        var j = 0;
+        while (j < 3) {
+          a = a + b; b = b + c; c = c + d; d = d + e; e = e + g; g = g + h;
+          h = h + k; k = k + m; m = m + n; n = n + p; p = p + a;
+          arr[j] = arr[j] + j + v3;
+          j = j + 1;
+        }
+        v3 = v3 - 7;
+        i = i + 1;
+      }
+      return arr[0] + arr[1] + arr[2] + a + b + c + d + e + g + h + k + m + n + p;
+    }
+  )");
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+
+  RegBytecodeModule bytecode;
+  RegCompiler(ast, bytecode).compile_module(parser.global_scope());
+  uint32_t bytecode_index = 0;
+  while (bytecode.functions[bytecode_index].name != id_cache.get("f1")) ++bytecode_index;
+
+  IrModule module;
+  Lowering(ast, module).lower_module(parser.global_scope());
+  optimize_module(module);
+  uint32_t native_index = 0;
+  while (module.functions[native_index].name != id_cache.get("f1")) ++native_index;
+  LinearScan scan(module.functions[native_index]);
+  EXPECT_GT(scan.run().spilled_intervals, 0u);
+  NativeModule native(module);
+  ASSERT_TRUE(native.load());
+  using Fun1 = int32_t (*)(int32_t);
+  auto f1 = reinterpret_cast<Fun1>(const_cast<void*>(native.entry(native_index)));
+  for (int32_t seed : {5, -3, 40}) {
+    RegVm vm(bytecode);
+    VmSlot result;
+    ASSERT_EQ(vm.call(bytecode_index, {VmSlot{seed}}, result), VmStatus::Ok);
+    EXPECT_EQ(f1(seed), static_cast<int32_t>(result.i)) << seed;
+  }
+}
+
+TEST(Vectorizer, LoopsMatchAcrossBackends) {
+  const char* source = R"(
+    fun sum(s: [i32]) -> i32 {
+      var total = 0;
+      var i = 0;
+      while (i < s.len) {
+        total = total + s[i];
+        i = i + 1;
+      }
+      return total;
+    }
+    fun axpy(y: [f64], x: [f64], a: f64) {
+      var i = 0;
+      while (i < y.len) {
+        y[i] = y[i] + a * x[i];
+        i = i + 1;
+      }
+    }
+    fun scale(s: [f32], k: f32) {
+      var i = 0;
+      while (i < s.len) {
+        s[i] = -s[i] * k;
+        i = i + 1;
+      }
+    }
+    fun fsum(s: [f32]) -> f32 {
+      var total: f32 = 0.0;
+      var i = 0;
+      while (i < s.len) {
+        total = total + s[i];
+        i = i + 1;
+      }
+      return total;
+    }
+    fun iota(s: [i32]) {
+      var i = 0;
+      while (i < s.len) {
+        s[i] = i;
+        i = i + 1;
+      }
+    }
+    fun main() -> i32 {
+      var a: [i32; 37];
+      var x: [f64; 37];
+      var y: [f64; 37];
+      var f: [f32; 11];
+      iota(a);
+      var i = 0;
+      while (i < 37) {
+        x[i] = 1.5;
+        y[i] = 2.0;
+        i = i + 1;
+      }
+      axpy(y, x, 2.0);
+      axpy(y[1:37], y[0:36], 1.0);
+      i = 0;
+      while (i < f.len) {
+        f[i] = 0.5;
+        i = i + 1;
+      }
+      scale(f[1:11], 4.0);
+      var r = sum(a) + sum(a[3:6]);
+      if (y[0] == 5.0) if (y[36] == 185.0) r = r + 1000;
+      if (fsum(f) == -19.5) r = r + 2000;
+      return r;
+    }
+  )";
+  OptimizedProgram program;
+  // 666 + 12 + 1000 + 2000, the overlapping axpy accumulates along y so
+  // must run scalar
+  EXPECT_EQ(expect_backends_agree(source, "main", &program), 3678);
+
+  using Reason = VectorizeDecision::Reason;
+  const auto max_bytes = native_vector_bytes();
+  for (const auto& function : program.stats.functions) {
+    const auto& decisions = function.vectorize;
+    auto is = [&](const char* name) { return function.name == program.id_cache.get(name); };
+    if (is("main")) {
+      auto has = [&](Reason reason) {
+        return std::any_of(decisions.begin(), decisions.end(), [&](const auto& decision) { return decision.reason == reason; });
+      };
+      EXPECT_TRUE(has(Reason::CounterUse));
+      EXPECT_TRUE(has(Reason::FloatReduction));
+      EXPECT_EQ(has(Reason::Vectorized), max_bytes != 0);
+    } else {
+      ASSERT_EQ(decisions.size(), 1u);
+      const auto& decision = decisions[0];
+      if (is("fsum")) {
+        EXPECT_EQ(decision.reason, Reason::FloatReduction);
+      } else if (is("iota")) {
+        EXPECT_EQ(decision.reason, Reason::CounterUse);
+      } else if (max_bytes == 0 || (is("axpy") && max_bytes < 32)) {
+        EXPECT_EQ(decision.reason, Reason::NoVectors);
+      } else {
+        EXPECT_EQ(decision.reason, Reason::Vectorized);
+        const IrType type = is("sum") ? IrType::I32x4
+                          : is("axpy") ? IrType::F64x4
+                          : max_bytes == 32 ? IrType::F32x8 : IrType::F32x4;
+        EXPECT_EQ(decision.type, type);
+      }
+    }
+  }
+}
+
+TEST(ScalarReplacement, StructsBecomeValuesUnlessTheyEscape) {
+  const char* source = R"(
+    struct V { x: f64; y: f64; }
+    struct Body { p: V; v: V; n: i32; }
+    fun bounces(steps: i32) -> i32 {
+      var b: Body;
+      b.p.y = 10.0;
+      b.v.x = 1.0;
+      var i = 0;
+      while (i < steps) {
+        b.p.x = b.p.x + b.v.x * 0.01;
+        b.p.y = b.p.y + b.v.y * 0.01;
+        b.v.y = b.v.y - 0.098;
+        if (b.p.y < 0.0) {
+          b.p.y = -b.p.y;
+          b.v.y = -b.v.y * 0.5;
+          b.n = b.n + 1;
+        }
+        i = i + 1;
+      }
+      if (b.p.x > 9.9) b.n = b.n + 100;
+      return b.n;
+    }
+    fun sum(s: [i32]) -> i32 {
+      var total = 0;
+      var i = 0;
+      while (i < s.len) {
+        total = total + s[i];
+        i = i + 1;
+      }
+      return total;
+    }
+    fun tables(k: i32) -> i32 {
+      var fixed: [i32; 3];
+      var indexed: [i32; 3];
+      var passed: [i32; 3];
+      fixed[0] = 4;
+      fixed[2] = fixed[0] * 3;
+      indexed[k] = 7;
+      passed[1] = 5;
+      return fixed[1] + fixed[2] + indexed[k] + indexed[0] + sum(passed);
+    }
+    fun main() -> i32 { return bounces(1000) * 1000 + tables(2); }
+  )";
+  OptimizedProgram program;
+  const auto result = expect_backends_agree(source, "main", &program);
+  // 12 + 7 + 5 from the tables and a body that bounced and went past 9.9
+  EXPECT_EQ(result % 1000, 24);
+  EXPECT_GT(result, 100000);
+
+  const auto* bounces = program.stats.find(program.id_cache.get("bounces"));
+  ASSERT_NE(bounces, nullptr);
+  EXPECT_EQ(bounces->scalar_replacement.slots, 1u);
+  EXPECT_EQ(bounces->scalar_replacement.replaced, 1u);
+  EXPECT_EQ(bounces->scalar_replacement.fields, 5u);
+  // only fixed, indexed takes k and the inlined sum its loop counter
+  const auto* tables = program.stats.find(program.id_cache.get("tables"));
+  ASSERT_NE(tables, nullptr);
+  EXPECT_EQ(tables->scalar_replacement.slots, 3u);
+  EXPECT_EQ(tables->scalar_replacement.replaced, 1u);
+  EXPECT_EQ(tables->scalar_replacement.fields, 3u);
+  const auto& function = program.module.functions[program.function("bounces")];
+  for (const auto& block : function.blocks) {
+    for (auto index : block.instrs) {
+      const auto kind = function.instrs[index].kind;
+      EXPECT_TRUE(kind != IrInstr::Kind::Load && kind != IrInstr::Kind::Store && kind != IrInstr::Kind::StackSlot);
+    }
+  }
+}
+
+TEST(RegionArena, RegionsFreeTheirAllocationsTogether) {
+  const char* source = R"(
+    fun fill(s: [i32], v: i32) {
+      var i = 0;
+      while (i < s.len) {
+        s[i] = v + i;
+        i = i + 1;
+      }
+    }
+    fun sum(n: i32) -> i32 {
+      region {
+        val a = new [i32; n];
+        fill(a, 3);
+        var t = 0;
+        var i = 0;
+        while (i < a.len) {
+          t = t + a[i];
+          i = i + 1;
+        }
+        return t;
+      }
+    }
+    fun main() -> i32 {
+      var total = 0;
+      var k = 0;
+      while (k < 100) {
+        region {
+          val name = new [u8; 16];
+          name[3] = 7;
+          region {
+            val c = new [i32; 20000];
+            c[19999] = k;
+            total = total + c[19999] + c[5] + new [i32; 5][2];
+          }
+          total = total + sum(k);
+        }
+        k = k + 1;
+      }
+      return total;
+    }
+    fun too_large() -> i32 {
+      region {
+        val a = new [f64; 200000000];
+        return a.len;
+      }
+    }
+  )";
+  auto& arena = RegionArena::current();
+  VmSlot result;
+  EXPECT_EQ(call_in_reg_vm(source, "too_large", result), VmStatus::IndexOutOfRange);
+  EXPECT_EQ(arena.depth(), 0u);
+  const auto allocations = arena.stats().allocations;
+  OptimizedProgram program;
+  // the sums of 3 + i below k and the k stored in c
+  EXPECT_EQ(expect_backends_agree(source, "main", &program), 176550 + 4950);
+  // 400 in each backend
+  EXPECT_EQ(arena.stats().allocations - allocations, 800u);
+  EXPECT_EQ(arena.depth(), 0u);
+  X86Code code;
+  ASSERT_TRUE(X86CodeGen(program.module).compile_module(code));
+  EXPECT_TRUE(code.calls_runtime);
+  std::vector<uint8_t> object;
+  EXPECT_FALSE(ElfWriter(program.module, program.id_cache).write(code, object));
+
+  // leaving gives the blocks back, small ones stay for the next region
+  const auto blocks = arena.stats().blocks;
+  arena.enter();
+  auto* small = static_cast<uint8_t*>(arena.allocate(100));
+  arena.enter();
+  arena.allocate(3 * RegionArena::BlockSize);
+  for (uint32_t i = 0; i < 100; ++i) arena.allocate(RegionArena::BlockSize / 4);
+  arena.leave();
+  auto* next = static_cast<uint8_t*>(arena.allocate(8));
+  EXPECT_EQ(next, small + 104);
+  EXPECT_EQ(next[0], 0);
+  arena.leave();
+  arena.enter();
+  for (uint32_t i = 0; i < 100; ++i) arena.allocate(RegionArena::BlockSize / 4);
+  arena.leave();
+  EXPECT_EQ(arena.depth(), 0u);
+  EXPECT_LE(arena.stats().blocks - blocks, 1u + 1u + RegionArena::MaxSpareBlocks + 25u);
+  EXPECT_GT(arena.stats().reused_blocks, 0u);
+}
+
+TEST(TaskScheduler, SpawnedTasksMatchAcrossBackends) {
+  const char* source = R"(
+    fun fib(n: i32) -> i32 {
+      if (n < 2) return n;
+      if (n < 10) return fib(n - 1) + fib(n - 2);
+      val a = spawn fib(n - 1);
+      val b = spawn fib(n - 2);
+      return join(a) + join(b);
+    }
+    fun fill(n: i32, x: f64, k: u8) -> i32 {
+      region {
+        val s = new [i32; n];
+        s[n - 1] = n;
+        if (x > 0.5) {
+          if (k == 2) return s[n - 1] + 2;
+        }
+        return 0;
+      }
+    }
+    fun touch(n: i32) {
+      region {
+        val s = new [u8; n];
+      }
+    }
+    fun main() -> i32 {
+      var total = fib(20);
+      var i = 1;
+      while (i < 50) {
+        spawn touch(i);
+        total = total + join(spawn fill(i, 1.0, 2));
+        i = i + 1;
+      }
+      return total;
+    }
+    fun divide(n: i32) -> i32 {
+      return 100 / n;
+    }
+    fun failing() -> i32 {
+      val t = spawn divide(0);
+      return join(t);
+    }
+    fun twice() -> i32 {
+      val t = spawn divide(5);
+      return join(t) + join(t);
+    }
+  )";
+  // tasks allocate in arenas of their own
+  auto& arena = RegionArena::current();
+  const auto allocations = arena.stats().allocations;
+  // fib(20) and the n + 2 of every fill
+  EXPECT_EQ(expect_backends_agree(source, "main"), 6765 + 1323);
+  VmSlot result;
+  EXPECT_EQ(call_in_reg_vm(source, "failing", result), VmStatus::DivisionByZero);
+  EXPECT_EQ(call_in_reg_vm(source, "twice", result), VmStatus::InvalidTask);
+  EXPECT_EQ(TaskScheduler::join_all(), 0);
+  EXPECT_EQ(arena.stats().allocations, allocations);
+  EXPECT_EQ(arena.depth(), 0u);
+}
+
+TEST(TaskScheduler, ForkJoinStealsAndReusesStacks) {
+  struct Fib {
+    static int32_t run(const void* context, uint32_t, const uint64_t* args, int32_t& result) {
+      const int32_t n = static_cast<int32_t>(args[0]);
+      if (n < 2) {
+        result = n;
+        return 0;
+      }
+      auto& scheduler = *static_cast<TaskScheduler*>(const_cast<void*>(context));
+      EXPECT_EQ(&TaskScheduler::current(), &scheduler);
+      const uint64_t left = n - 1;
+      const uint64_t right = n - 2;
+      const auto a = scheduler.spawn(&run, context, 0, &left, 1);
+      const auto b = scheduler.spawn(&run, context, 0, &right, 1);
+      int32_t x = 0;
+      int32_t y = 0;
+      // joined in either order
+      if (TaskScheduler::join(b, y) != 0 || TaskScheduler::join(a, x) != 0) return 1;
+      result = x + y;
+      // tasks already joined are no handles
+      return TaskScheduler::join(a, x) == TaskInvalidHandle ? 0 : 1;
+    }
+  };
+
+  TaskScheduler::Options options;
+  options.workers = 4;
+  options.stack_size = 64 * 1024;
+  TaskScheduler scheduler(options);
+  EXPECT_EQ(scheduler.workers(), 4u);
+  std::vector<int32_t> handles;
+  for (uint64_t n = 0; n < 18; ++n) handles.emplace_back(scheduler.spawn(&Fib::run, &scheduler, 0, &n, 1));
+  int32_t fib[2] = {0, 1};
+  for (uint32_t n = 0; n < 18; ++n) {
+    int32_t result = -1;
+    EXPECT_EQ(TaskScheduler::join(handles[n], result), 0);
+    EXPECT_EQ(result, n < 2 ? fib[n] : fib[0] + fib[1]);
+    if (n >= 2) {
+      fib[0] = fib[1];
+      fib[1] = result;
+    }
+  }
+  int32_t result;
+  EXPECT_EQ(TaskScheduler::join(handles[3], result), TaskInvalidHandle);
+  EXPECT_EQ(TaskScheduler::join(-1, result), TaskInvalidHandle);
+  EXPECT_EQ(TaskScheduler::join_all(), 0);
+
+  const auto stats = scheduler.stats();
+  EXPECT_EQ(stats.spawned, stats.completed);
+  EXPECT_GT(stats.spawned, 10000u);
+  // every task runs once and switches back once per join that waited
+  EXPECT_GE(stats.switches, stats.completed);
+  EXPECT_LT(stats.stacks, stats.completed / 10);
+}
+
+TEST(Parser, ReportsErrorsWithLines) {
+  auto error_of = [](const char* source) {
+    std::istringstream in(source);
+    Lexer::Tokens tokens;
+    Lexer lexer(in, tokens);
+    Ast ast;
+    IdCache id_cache;
+    Parser parser(lexer, ast, id_cache);
+    EXPECT_FALSE(parser.parse()) << source;
+    return parser.error();
+  };
+  EXPECT_EQ(error_of("fun f() -> i32 {\n  return y;\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f() -> i32 {\n  var x = 1\n  return x;\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun f() {\n  val x = 1;\n\n  x = 2;\n}").substr(0, 7), "line 4:");
+  EXPECT_EQ(error_of("fun f(a: i32) -> i32 { return a; }\nfun g() -> i32 { return f(1, 2); }").substr(0, 7),
+            "line 2:");
+  EXPECT_EQ(error_of("fun f() -> i32 {\n  return 1.5;\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f() -> i32 { return g(); }").substr(0, 7), "line 1:");
+  EXPECT_EQ(error_of("fun f(a: i32) {\n  if (a) return;\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f(a: i32x4) -> i32x4 {\n  return a / a;\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f(a: f32x4) -> f32 {\n  return a[4];\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f() -> i32 {\n  var a: [i32; 4];\n  return a[1.0];\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun f(a: [i32]) {\n  val b: [i32] = a;\n  b = a;\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun f() {\n  var a: [i32; 0];\n}").substr(0, 7), "line 2:");
+  EXPECT_EQ(error_of("fun f(a: [i32; 4]) {\n}").substr(0, 7), "line 1:");
+  EXPECT_EQ(error_of("fun f() {\n  region {}\n  val a = new [i32; 2];\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun f() {\n  region {\n    val a = new [i32; 1.5];\n  }\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun g() -> f32 { return 1.0; }\nfun f() {\n  spawn g();\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun g(a: [i32]) {}\nfun f(a: [i32]) {\n  spawn g(a);\n}").substr(0, 7), "line 3:");
+  EXPECT_EQ(error_of("fun f(a: f64, b: f32x4, c: f32x4, d: f32x4, e: f32x4,\n"
+                     "      f: f32x4, g: f32x4, h: f32x4, i: i32, k: f32x4) {}").substr(0, 7), "line 2:");
+}
+
+TEST(RegImage, RunsMappedBytecodeAndRejectsStaleImages) {
+  const std::string source = R"(
+    struct P { x: i32; w: f64; }
+    fun fib(n: i32) -> i32 {
+      if (n < 2) return n;
+      return fib(n - 1) + fib(n - 2);
+    }
+    fun walk(m: i32) -> i32 {
+      var p: P;
+      var i = 0;
+      while (i < m) { p.x = p.x * 3 + i; p.w = p.w + 0.5; i = i + 1; }
+      return p.x;
+    }
+    fun main() -> i32 { return fib(15) + walk(6); }
+  )";
+  std::istringstream in(source);
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+  RegBytecodeModule module;
+  RegCompiler(ast, module).compile_module(parser.global_scope());
+
+  const uint64_t hash = reg_image_hash(source.data(), source.size());
+  EXPECT_NE(hash, reg_image_hash(source.data(), source.size() - 1));
+  const auto path = ::testing::TempDir() + "smallang_image.slbc";
+  ASSERT_TRUE(RegImageWriter(module, id_cache).write_file(hash, path));
+  RegImage image;
+  ASSERT_TRUE(image.map(path, hash));
+  ASSERT_EQ(image.functions().size(), module.functions.size());
+  EXPECT_EQ(image.find("mai"), UndefinedRegImageFunction);
+  const auto main_index = image.find("main");
+  ASSERT_NE(main_index, UndefinedRegImageFunction);
+  EXPECT_EQ(id_cache.get(module.functions[main_index].name).str, std::string("main"));
+
+  RegVm module_vm(module);
+  RegVm image_vm(image.functions());
+  VmSlot expected{0};
+  VmSlot result{0};
+  ASSERT_EQ(module_vm.call(main_index, {}, expected), VmStatus::Ok);
+  ASSERT_EQ(image_vm.call(main_index, {}, result), VmStatus::Ok);
+  // fib(15) is 610, x goes 0, 1, 5, 18, 58, 179
+  EXPECT_EQ(expected.i, 610 + 179);
+  EXPECT_EQ(result.i, expected.i);
+  const auto fib_index = image.find("fib");
+  ASSERT_EQ(image_vm.call(fib_index, {VmSlot{20}}, result), VmStatus::Ok);
+  EXPECT_EQ(result.i, 6765);
+
+  // another source, a damaged image and one cut short are all refused
+  RegImage other;
+  EXPECT_FALSE(other.map(path, hash + 1));
+  EXPECT_FALSE(other.map(path + ".missing", hash));
+  std::vector<uint8_t> bytes;
+  RegImageWriter(module, id_cache).write(hash, bytes);
+  EXPECT_TRUE(other.use(bytes.data(), bytes.size(), hash));
+  EXPECT_FALSE(other.use(bytes.data(), bytes.size() - 4, hash));
+  bytes[bytes.size() / 2] ^= 1;
+  EXPECT_FALSE(other.use(bytes.data(), bytes.size(), hash));
+  EXPECT_TRUE(other.functions().empty());
+  std::remove(path.c_str());
+}
+
+TEST(Profiler, SamplesFoldStacksByLine) {
+  std::istringstream in(
+    "fun spin(m: i32) -> i32 {\n"
+    "  var i = 0;\n"
+    "  var s = 0;\n"
+    "  while (i < m) {\n"
+    "    s = s + i * 3;\n"
+    "    i = i + 1;\n"
+    "  }\n"
+    "  return s;\n"
+    "}\n"
+    "fun main() -> i32 {\n"
+    "  return spin(200000);\n"
+    "}\n");
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+  RegBytecodeModule module;
+  RegCompiler::Options options;
+  options.lines = &parser.lines();
+  RegCompiler(ast, module, options).compile_module(parser.global_scope());
+  uint32_t main_index = 0;
+  while (module.functions[main_index].name != id_cache.get("main")) ++main_index;
+  EXPECT_EQ(module.functions[main_index].line(0), 11u);
+
+  // a sample requested before the call is taken at its first instruction
+  RegVm vm(module);
+  VmSlot result;
+  {
+    Profiler profiler;
+    vm.set_profiler(&profiler);
+    vm.request_sample();
+    ASSERT_EQ(vm.call(main_index, {}, result), VmStatus::Ok);
+    vm.set_profiler(nullptr);
+    EXPECT_EQ(profiler.samples(), 1u);
+    std::ostringstream out;
+    profiler.write_folded(out, module, id_cache);
+    EXPECT_EQ(out.str(), "main:11 1\n");
+  }
+
+  // the timer samples a running program, which spends its time in spin
+  Profiler profiler(ProfilerOptions{5000});
+  ASSERT_TRUE(profiler.start(vm));
+  Profiler other;
+  EXPECT_FALSE(other.start(vm));
+  for (int run = 0; run < 1000 && profiler.samples() < 5; ++run) {
+    ASSERT_EQ(vm.call(main_index, {}, result), VmStatus::Ok);
+  }
+  profiler.stop();
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < 200000; ++i) sum += i * 3;
+  EXPECT_EQ(result.i, int32_t(sum));
+  EXPECT_GE(profiler.samples(), 5u);
+  EXPECT_EQ(profiler.dropped(), 0u);
+  std::ostringstream out;
+  profiler.write_folded(out, module, id_cache);
+  std::istringstream folded(out.str());
+  std::string stack;
+  uint64_t count, total = 0, in_spin = 0;
+  while (folded >> stack >> count) {
+    EXPECT_TRUE(stack == "main:11" || stack.rfind("main:11;spin:", 0) == 0) << stack;
+    in_spin += stack != "main:11" ? count : 0;
+    total += count;
+  }
+  EXPECT_EQ(total, profiler.samples());
+  EXPECT_GT(in_spin, 0u);
+}
+
+TEST(ExecutionProfile, GuidesInliningAndUnrolling) {
+  if (!JIT_SUPPORTED) GTEST_SKIP();
+  std::istringstream in(R"(
+    fun mix(x: i32, k: i32) -> i32 {
+      var h = x * 31 + k;
+      h = h * 7 + 13;
+      h = h - x / 3;
+      h = h * 5 + k * 3;
+      h = h + h / 17;
+      h = h * 9 - 1;
+      h = h + x / 5;
+      h = h * 3 + k;
+      h = h - h / 11;
+      h = h + 29;
+      if (h < 0) h = 0 - h;
+      return h / 64;
+    }
+    fun rare(x: i32) -> i32 {
+      var r = x;
+      var j = 0;
+      while (j < 10) {
+        r = r * 3 + j;
+        j = j + 1;
+      }
+      return r;
+    }
+    fun main() -> i32 {
+      var s = 0;
+      var i = 0;
+      while (i < 3000) {
+        var k = 0;
+        var t = 0;
+        while (k < 8) {
+          t = t + k * i;
+          k = k + 1;
+        }
+        if (i == 5000) s = s + rare(i); else s = s + mix(i, t);
+        i = i + 1;
+      }
+      return s;
+    }
+  )");
+  Lexer::Tokens tokens;
+  Lexer lexer(in, tokens);
+  Ast ast;
+  IdCache id_cache;
+  Parser parser(lexer, ast, id_cache);
+  ASSERT_TRUE(parser.parse()) << parser.error();
+
+  // a run of the counted bytecode
+  RegBytecodeModule bytecode;
+  RegCompiler::Options options;
+  options.counters = true;
+  RegCompiler(ast, bytecode, options).compile_module(parser.global_scope());
+  uint32_t main_index = 0;
+  while (bytecode.functions[main_index].name != id_cache.get("main")) ++main_index;
+  std::vector<uint64_t> counters(bytecode.counters.size(), 0);
+  RegVm vm(bytecode);
+  vm.set_counters(counters.data(), counters.size());
+  VmSlot result;
+  ASSERT_EQ(vm.call(main_index, {}, result), VmStatus::Ok);
+  ExecutionProfile profile;
+  profile.add(bytecode, id_cache, counters.data());
+  const auto* main_profile = profile.find(id_cache.get(id_cache.get("main")));
+  ASSERT_NE(main_profile, nullptr);
+  EXPECT_EQ(main_profile->calls, 1u);
+  ASSERT_EQ(main_profile->loops.size(), 2u);
+  EXPECT_EQ(main_profile->loops[0].iterations, 3000u);
+  EXPECT_EQ(main_profile->loops[1].runs, 3000u);
+  EXPECT_EQ(main_profile->loops[1].iterations, 24000u);
+  ASSERT_EQ(main_profile->branches.size(), 1u);
+  EXPECT_EQ(main_profile->branches[0].runs, 3000u);
+  EXPECT_EQ(main_profile->branches[0].taken, 0u);
+  EXPECT_EQ(profile.functions["mix"].calls, 3000u);
+
+  // profiles survive their file and add up
+  std::ostringstream written;
+  profile.write(written);
+  ExecutionProfile read;
+  std::string error;
+  std::istringstream written_in(written.str());
+  ASSERT_TRUE(read.read(written_in, error)) << error;
+  read.add(bytecode, id_cache, counters.data());
+  EXPECT_EQ(read.functions["mix"].calls, 6000u);
+  std::istringstream malformed("smallang-profile 1 0\nfunction main 1\nloop main 0 1\n");
+  EXPECT_FALSE(read.read(malformed, error));
+  EXPECT_EQ(error, "line 3: malformed site record");
+  EXPECT_TRUE(read.functions.empty());
+
+  auto compile = [&](IrModule& module, bool profiled) {
+    if (profiled) {
+      Lowering(ast, module, profile, id_cache).lower_module(parser.global_scope());
+    } else {
+      Lowering(ast, module).lower_module(parser.global_scope());
+    }
+    Inliner inliner(module);
+    auto decisions = inliner.run();
+    uint32_t unrolled = 0;
+    for (auto& function : module.functions) {
+      unrolled += Unroller(function).run().loops;
+      Sccp(function).run();
+      Gvn(function).run();
+      Licm(function).run();
+      Dce::remove_dead_code(function);
+      LinearScan scan(function);
+      scan.run();
+      expect_valid_allocation(function, scan);
+    }
+    return std::make_pair(decisions, unrolled);
+  };
+  auto index_of = [&](const IrModule& module, const char* name) {
+    uint32_t index = 0;
+    while (index < module.functions.size() && module.functions[index].name != id_cache.get(name)) ++index;
+    return index;
+  };
+  auto reason_of = [&](const IrModule& module, const std::vector<InlineDecision>& decisions, const char* callee) {
+    for (const auto& decision : decisions) {
+      if (decision.callee == index_of(module, callee)) return decision.reason;
+    }
+    return InlineDecision::Reason::Declaration;
+  };
+
+  // without a profile mix is too large and no loop is unrolled
+  IrModule plain;
+  const auto [plain_decisions, plain_unrolled] = compile(plain, false);
+  EXPECT_EQ(reason_of(plain, plain_decisions, "mix"), InlineDecision::Reason::TooLarge);
+  EXPECT_EQ(reason_of(plain, plain_decisions, "rare"), InlineDecision::Reason::Inlined);
+  EXPECT_EQ(plain_unrolled, 0u);
+
+  // the hot call inlines mix, the call that never ran keeps rare out and
+  // the inner loop of eight iterations is unrolled
+  IrModule profiled;
+  const auto [profiled_decisions, profiled_unrolled] = compile(profiled, true);
+  EXPECT_EQ(reason_of(profiled, profiled_decisions, "mix"), InlineDecision::Reason::Inlined);
+  EXPECT_EQ(reason_of(profiled, profiled_decisions, "rare"), InlineDecision::Reason::Cold);
+  EXPECT_GE(profiled_unrolled, 1u);
+
+  using Fun0 = int32_t (*)();
+  for (const auto* module : {&plain, &profiled}) {
+    NativeModule native(*module);
+    ASSERT_TRUE(native.load());
+    auto main = reinterpret_cast<Fun0>(const_cast<void*>(native.entry(index_of(*module, "main"))));
+    EXPECT_EQ(main(), result.i);
+  }
+}
+
 int main(int argc, char* argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,530 @@
+#include "task.hpp"
+#include "region.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define TASK_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define TASK_ASAN 1
+#endif
+#endif
+#ifndef TASK_ASAN
+#define TASK_ASAN 0
+#endif
+#if TASK_ASAN
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+// smallang_task_switch(save, load) saves the callee saved registers and
+// the control words on the stack, stores the stack pointer to *save and
+// continues where load was saved. A new task's stack is laid out like a
+// saved one whose return address is smallang_task_start, which calls r13
+// with r12.
+asm(R"(
+  .text
+  .globl smallang_task_switch
+  .type smallang_task_switch, @function
+smallang_task_switch:
+  pushq %rbp
+  pushq %rbx
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  subq $8, %rsp
+  stmxcsr (%rsp)
+  fnstcw 4(%rsp)
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  ldmxcsr (%rsp)
+  fldcw 4(%rsp)
+  addq $8, %rsp
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %rbx
+  popq %rbp
+  ret
+  .size smallang_task_switch, .-smallang_task_switch
+
+  .globl smallang_task_start
+  .type smallang_task_start, @function
+smallang_task_start:
+  movq %r12, %rdi
+  callq *%r13
+  ud2
+  .size smallang_task_start, .-smallang_task_start
+)");
+
+extern "C" void smallang_task_switch(void** save, void* load);
+extern "C" void smallang_task_start();
+
+struct Task {
+  TaskScheduler* scheduler;
+  TaskScheduler::Function function;
+  const void* context;
+  uint32_t function_index;
+  uint64_t args[TaskMaxArgs];
+  int32_t result = 0;
+  int32_t error = 0;
+  // mapped when the task first runs, given back when it ends
+  uint8_t* stack = nullptr;
+  // saved while the task is switched out
+  void* sp = nullptr;
+  RegionArena arena;
+  // handles index the tasks spawned, joined ones are nullptr
+  std::vector<Task*> children;
+  // the child a task waits for when it switches back to its worker
+  Task* joining = nullptr;
+  bool finished = false;
+  // the task joining this one, WaitingThread or Ended
+  std::atomic<Task*> waiter{nullptr};
+};
+
+struct TaskWorker {
+  TaskScheduler* scheduler;
+  TaskDeque deque;
+  std::thread thread;
+  // the worker's own stack pointer while one of its tasks runs
+  void* sp = nullptr;
+  Task* running = nullptr;
+  std::vector<uint8_t*> stacks;
+  uint32_t random;
+  // bounds of the thread's stack, for the address sanitizer
+  const void* stack_bottom = nullptr;
+  size_t stack_size = 0;
+  // written by the worker only
+  std::atomic<uint64_t> spawned{0};
+  std::atomic<uint64_t> completed{0};
+  std::atomic<uint64_t> steals{0};
+  std::atomic<uint64_t> switches{0};
+  std::atomic<uint64_t> mapped{0};
+};
+
+namespace {
+
+Task* const WaitingThread = reinterpret_cast<Task*>(1);
+Task* const Ended = reinterpret_cast<Task*>(2);
+// stacks a worker keeps for the tasks it runs next
+const size_t MaxSpareStacks = 64;
+// times a worker without tasks yields and looks again before it sleeps
+const uint32_t SearchRounds = 32;
+
+thread_local TaskWorker* t_worker = nullptr;
+thread_local std::vector<Task*> t_children;
+
+// tasks move between threads while their functions run, so thread locals
+// are read through calls that are not merged across a context switch
+__attribute__((noinline)) TaskWorker* current_worker() {
+  TaskWorker* worker = t_worker;
+  asm volatile("" : "+r"(worker));
+  return worker;
+}
+
+__attribute__((noinline)) std::vector<Task*>& spawned_by_caller() {
+  auto* worker = current_worker();
+  if (worker && worker->running) return worker->running->children;
+  auto* children = &t_children;
+  asm volatile("" : "+r"(children));
+  return *children;
+}
+
+void add(std::atomic<uint64_t>& counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+size_t page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+// the guard page below the stack stays unmapped for reading and writing
+uint8_t* map_stack(size_t size) {
+  void* memory = mmap(nullptr, size + page_size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  // like new, running out of memory ends the program
+  if (memory == MAP_FAILED || mprotect(memory, page_size(), PROT_NONE) != 0) std::abort();
+  return static_cast<uint8_t*>(memory) + page_size();
+}
+
+void unmap_stack(uint8_t* stack, size_t size) {
+  munmap(stack - page_size(), size + page_size());
+}
+
+// an ending task gives its fake stack back to the address sanitizer
+void switch_context(void** save, void* load, const void* bottom, size_t size, bool ending) {
+#if TASK_ASAN
+  void* fake_stack = nullptr;
+  __sanitizer_start_switch_fiber(ending ? nullptr : &fake_stack, bottom, size);
+  smallang_task_switch(save, load);
+  __sanitizer_finish_switch_fiber(fake_stack, nullptr, nullptr);
+#else
+  (void)bottom;
+  (void)size;
+  (void)ending;
+  smallang_task_switch(save, load);
+#endif
+}
+
+int32_t run_native(const void* entry, uint32_t, const uint64_t* args, int32_t& result) {
+  result = reinterpret_cast<int32_t (*)(const uint64_t*)>(const_cast<void*>(entry))(args);
+  return 0;
+}
+
+TaskScheduler::Options& global_options() {
+  static TaskScheduler::Options options;
+  return options;
+}
+
+}  // namespace
+
+TaskDeque::TaskDeque() {
+  m_arrays.emplace_back(new Array(256));
+  m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+}
+
+void TaskDeque::push(Task* task) {
+  const auto bottom = m_bottom.load(std::memory_order_relaxed);
+  const auto top = m_top.load(std::memory_order_acquire);
+  auto* array = m_array.load(std::memory_order_relaxed);
+  if (bottom - top > array->capacity - 1) {
+    auto grown = std::make_unique<Array>(array->capacity * 2);
+    for (auto index = top; index < bottom; ++index) grown->put(index, array->get(index));
+    array = grown.get();
+    m_arrays.emplace_back(std::move(grown));
+    m_array.store(array, std::memory_order_release);
+  }
+  array->put(bottom, task);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+Task* TaskDeque::pop() {
+  const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+  auto* array = m_array.load(std::memory_order_relaxed);
+  m_bottom.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto top = m_top.load(std::memory_order_relaxed);
+  if (top > bottom) {
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Task* task = array->get(bottom);
+  if (top == bottom) {
+    // the last task, a thief may be taking it too
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      task = nullptr;
+    }
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+Task* TaskDeque::steal() {
+  for (;;) {
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) return nullptr;
+    Task* task = m_array.load(std::memory_order_acquire)->get(top);
+    if (m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return task;
+    }
+  }
+}
+
+TaskScheduler::TaskScheduler(const Options& options) : m_options(options) {
+  m_options.stack_size = (m_options.stack_size + page_size() - 1) / page_size() * page_size();
+  const uint32_t count = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+  for (uint32_t index = 0; index < count; ++index) {
+    m_workers.emplace_back(new TaskWorker);
+    m_workers.back()->scheduler = this;
+    m_workers.back()->random = index * 2654435761u + 1;
+  }
+  // every worker exists before any of them steals
+  for (auto& worker : m_workers) {
+    auto* w = worker.get();
+    w->thread = std::thread([this, w] { run_worker(*w); });
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(m_idle_mutex);
+    m_stopping = true;
+  }
+  m_idle.notify_all();
+  for (auto& worker : m_workers) {
+    worker->thread.join();
+    for (auto* stack : worker->stacks) unmap_stack(stack, m_options.stack_size);
+  }
+}
+
+TaskScheduler& TaskScheduler::global() {
+  static TaskScheduler scheduler(global_options());
+  return scheduler;
+}
+
+void TaskScheduler::set_global_options(const Options& options) {
+  global_options() = options;
+}
+
+TaskScheduler& TaskScheduler::current() {
+  auto* worker = current_worker();
+  return worker ? *worker->scheduler : global();
+}
+
+int32_t TaskScheduler::spawn(Function function, const void* context, uint32_t function_index, const uint64_t* args,
+                             uint32_t count) {
+  auto* task = new Task;
+  task->scheduler = this;
+  task->function = function;
+  task->context = context;
+  task->function_index = function_index;
+  std::copy(args, args + std::min(count, TaskMaxArgs), task->args);
+  auto& children = spawned_by_caller();
+  children.emplace_back(task);
+  auto* worker = current_worker();
+  if (worker && worker->scheduler == this) {
+    add(worker->spawned);
+  } else {
+    m_spawned.fetch_add(1, std::memory_order_relaxed);
+  }
+  push(task);
+  return children.size() - 1;
+}
+
+int32_t TaskScheduler::join(int32_t handle, int32_t& result) {
+  auto& children = spawned_by_caller();
+  if (handle < 0 || static_cast<size_t>(handle) >= children.size() || !children[handle]) return TaskInvalidHandle;
+  Task* child = children[handle];
+  children[handle] = nullptr;
+  if (child->waiter.load(std::memory_order_acquire) != Ended) {
+    auto* worker = current_worker();
+    if (worker && worker->running) {
+      // the worker registers the task as the waiter once it switched out,
+      // whoever ends the child puts it back on a deque
+      Task* self = worker->running;
+      self->joining = child;
+      suspend(self);
+    } else {
+      auto* scheduler = child->scheduler;
+      Task* expected = nullptr;
+      if (child->waiter.compare_exchange_strong(expected, WaitingThread, std::memory_order_acq_rel)) {
+        std::unique_lock<std::mutex> lock(scheduler->m_join_mutex);
+        scheduler->m_joined.wait(lock, [child] { return child->waiter.load(std::memory_order_acquire) == Ended; });
+      }
+    }
+  }
+  result = child->result;
+  const auto error = child->error;
+  delete child;
+  return error;
+}
+
+int32_t TaskScheduler::join_all() {
+  auto& children = spawned_by_caller();
+  int32_t first = 0;
+  for (size_t handle = 0; handle < children.size(); ++handle) {
+    if (!children[handle]) continue;
+    int32_t result;
+    const auto error = join(handle, result);
+    if (!first) first = error;
+  }
+  children.clear();
+  return first;
+}
+
+TaskSchedulerStats TaskScheduler::stats() const {
+  TaskSchedulerStats stats;
+  stats.spawned = m_spawned.load(std::memory_order_relaxed);
+  for (const auto& worker : m_workers) {
+    stats.spawned += worker->spawned.load(std::memory_order_relaxed);
+    stats.completed += worker->completed.load(std::memory_order_relaxed);
+    stats.steals += worker->steals.load(std::memory_order_relaxed);
+    stats.switches += worker->switches.load(std::memory_order_relaxed);
+    stats.stacks += worker->mapped.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void TaskScheduler::run_worker(TaskWorker& worker) {
+  t_worker = &worker;
+#if TASK_ASAN
+  pthread_attr_t attr;
+  void* stack = nullptr;
+  pthread_getattr_np(pthread_self(), &attr);
+  pthread_attr_getstack(&attr, &stack, &worker.stack_size);
+  pthread_attr_destroy(&attr);
+  worker.stack_bottom = stack;
+#endif
+  for (;;) {
+    // read before looking, so a push after the look keeps the worker awake
+    auto epoch = m_epoch.load(std::memory_order_seq_cst);
+    if (Task* task = find_task(worker)) {
+      resume(worker, task);
+      continue;
+    }
+    if (m_stopping.load(std::memory_order_relaxed)) break;
+    // keeps looking for a while first, pushes wake nobody while it does
+    m_searching.fetch_add(1, std::memory_order_seq_cst);
+    Task* task = nullptr;
+    for (uint32_t round = 0; round < SearchRounds && !task; ++round) {
+      std::this_thread::yield();
+      epoch = m_epoch.load(std::memory_order_seq_cst);
+      task = find_task(worker);
+    }
+    const auto searching = m_searching.fetch_sub(1, std::memory_order_seq_cst);
+    if (task) {
+      // there may be more, the last worker looking has another one look
+      if (searching == 1) notify();
+      resume(worker, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_idle_mutex);
+    m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+    m_idle.wait(lock, [&] { return m_epoch.load(std::memory_order_seq_cst) != epoch || m_stopping; });
+    m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+  }
+  t_worker = nullptr;
+}
+
+Task* TaskScheduler::find_task(TaskWorker& worker) {
+  if (Task* task = worker.deque.pop()) return task;
+  if (m_queued.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+    if (!m_queue.empty()) {
+      Task* task = m_queue.front();
+      m_queue.pop_front();
+      m_queued.fetch_sub(1, std::memory_order_relaxed);
+      return task;
+    }
+  }
+  const uint32_t count = m_workers.size();
+  worker.random = worker.random * 1664525 + 1013904223;
+  const uint32_t first = (worker.random >> 16) % count;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto& victim = *m_workers[(first + i) % count];
+    if (&victim == &worker) continue;
+    if (Task* task = victim.deque.steal()) {
+      add(worker.steals);
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void TaskScheduler::resume(TaskWorker& worker, Task* task) {
+  if (!task->stack) {
+    if (worker.stacks.empty()) {
+      task->stack = map_stack(m_options.stack_size);
+      add(worker.mapped);
+    } else {
+      task->stack = worker.stacks.back();
+      worker.stacks.pop_back();
+    }
+#if TASK_ASAN
+    // frames of the task that had the stack before never returned
+    __asan_unpoison_memory_region(task->stack, m_options.stack_size);
+#endif
+    // what smallang_task_switch pops: the control words, r15 .. rbp and
+    // the return address, which leaves the stack 16 byte aligned
+    auto* top = reinterpret_cast<uint64_t*>(task->stack + m_options.stack_size);
+    std::fill(top - 10, top, 0);
+    top[-3] = reinterpret_cast<uint64_t>(&smallang_task_start);
+    top[-6] = reinterpret_cast<uint64_t>(task);
+    top[-7] = reinterpret_cast<uint64_t>(&start_task);
+    top[-10] = 0x1f80 | uint64_t(0x037f) << 32;
+    task->sp = top - 10;
+  }
+
+  worker.running = task;
+  RegionArena::set_current(&task->arena);
+  add(worker.switches);
+  switch_context(&worker.sp, task->sp, task->stack, m_options.stack_size, false);
+  RegionArena::set_current(nullptr);
+  worker.running = nullptr;
+
+  if (task->finished) {
+    if (worker.stacks.size() < MaxSpareStacks) {
+      worker.stacks.emplace_back(task->stack);
+    } else {
+      unmap_stack(task->stack, m_options.stack_size);
+    }
+    task->stack = nullptr;
+    add(worker.completed);
+    // a joining thread may delete the task once it sees Ended, it is not
+    // touched after; tasks run on the scheduler that spawned them
+    Task* waiter = task->waiter.exchange(Ended, std::memory_order_acq_rel);
+    if (waiter == WaitingThread) {
+      std::lock_guard<std::mutex> lock(m_join_mutex);
+      m_joined.notify_all();
+    } else if (waiter) {
+      waiter->scheduler->push(waiter);
+    }
+  } else if (Task* child = task->joining) {
+    task->joining = nullptr;
+    Task* expected = nullptr;
+    if (!child->waiter.compare_exchange_strong(expected, task, std::memory_order_acq_rel)) push(task);
+  }
+}
+
+void TaskScheduler::push(Task* task) {
+  auto* worker = current_worker();
+  if (worker && worker->scheduler == this) {
+    worker->deque.push(task);
+  } else {
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+    m_queue.emplace_back(task);
+    m_queued.fetch_add(1, std::memory_order_release);
+  }
+  wake();
+}
+
+void TaskScheduler::wake() {
+  m_epoch.fetch_add(1, std::memory_order_seq_cst);
+  if (!m_searching.load(std::memory_order_seq_cst)) notify();
+}
+
+void TaskScheduler::notify() {
+  if (m_sleeping.load(std::memory_order_seq_cst)) {
+    std::lock_guard<std::mutex> lock(m_idle_mutex);
+    m_idle.notify_one();
+  }
+}
+
+void TaskScheduler::start_task(Task* task) {
+#if TASK_ASAN
+  __sanitizer_finish_switch_fiber(nullptr, nullptr, nullptr);
+#endif
+  task->error = task->function(task->context, task->function_index, task->args, task->result);
+  // the tasks it spawned end before it does
+  const auto error = join_all();
+  if (!task->error) task->error = error;
+  task->finished = true;
+  suspend(task);
+}
+
+void TaskScheduler::suspend(Task* task) {
+  auto* worker = current_worker();
+  switch_context(&task->sp, worker->sp, worker->stack_bottom, worker->stack_size, task->finished);
+}
+
+int32_t task_spawn(const void* entry, const uint64_t* args, int32_t count) {
+  return TaskScheduler::current().spawn(&run_native, entry, 0, args, count);
+}
+
+int32_t task_join(int32_t handle) {
+  int32_t result = 0;
+  // like a failed bounds check of compiled code
+  if (TaskScheduler::join(handle, result) != 0) __builtin_trap();
+  return result;
+}
@@ -0,0 +1,165 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// most arguments a spawned function takes, each passed in 8 bytes
+static const uint32_t TaskMaxArgs = 8;
+// what join returns for a handle the caller did not spawn or already joined
+static const int32_t TaskInvalidHandle = -1;
+
+struct Task;
+struct TaskWorker;
+
+// Chase-Lev work-stealing deque of tasks: its worker pushes and pops at
+// the bottom, other workers steal from the top. The array doubles when it
+// is full; replaced arrays are kept until the deque goes, since a thief
+// may still be reading one.
+class TaskDeque {
+public:
+  TaskDeque();
+  TaskDeque(const TaskDeque&) = delete;
+  TaskDeque(TaskDeque&&) = delete;
+  TaskDeque& operator=(const TaskDeque&) = delete;
+  TaskDeque& operator=(TaskDeque&&) = delete;
+
+  // owner only
+  void push(Task* task);
+  // owner only, nullptr when empty
+  Task* pop();
+  // any thread, nullptr when empty
+  Task* steal();
+
+private:
+  struct Array {
+    explicit Array(int64_t capacity) : capacity(capacity), slots(new std::atomic<Task*>[capacity]) {}
+    int64_t capacity;
+    std::unique_ptr<std::atomic<Task*>[]> slots;
+
+    Task* get(int64_t index) const { return slots[index & (capacity - 1)].load(std::memory_order_relaxed); }
+    void put(int64_t index, Task* task) { slots[index & (capacity - 1)].store(task, std::memory_order_relaxed); }
+  };
+
+  std::atomic<int64_t> m_top{0};
+  std::atomic<int64_t> m_bottom{0};
+  std::atomic<Array*> m_array;
+  std::vector<std::unique_ptr<Array>> m_arrays;
+};
+
+struct TaskSchedulerStats {
+  uint64_t spawned = 0;
+  uint64_t completed = 0;
+  // tasks a worker took from the deque of another
+  uint64_t steals = 0;
+  // switches from a worker to a task and back
+  uint64_t switches = 0;
+  // stacks mapped, the rest were reused
+  uint64_t stacks = 0;
+};
+
+// M:N scheduler of green threads. A task runs a function on a stack of its
+// own, mapped on first run and reserved, not committed: pages are only
+// backed once the task touches them, below them is a guard page, and
+// workers keep the stacks of finished tasks for the next ones. Each of
+// the workers, one OS thread per core by default, runs tasks from its own
+// TaskDeque, newest first, then from the queue tasks spawned outside of
+// workers go to, then steals the oldest of another worker's, and sleeps
+// when there is nothing to run for a while. Tasks spawned by a task go to
+// the deque of its worker. Joining a task that has not ended switches back to the
+// worker, which runs other tasks until the joined one ends and puts the
+// joining task back on its deque; threads that are not workers block.
+// Context switches save the callee saved registers and the SSE and x87
+// control words of the System V ABI.
+//
+// Handles are the positions of tasks among those their spawner spawned,
+// a task or a thread outside of tasks, and only the spawner joins them,
+// once. A task ends after the tasks it spawned and did not join, so their
+// spawner outlives them; join_all does the same for threads. Every task
+// has a RegionArena, which is the current arena while it runs.
+class TaskScheduler {
+public:
+  struct Options {
+    // 0 for one per hardware thread
+    uint32_t workers = 0;
+    // reserved bytes of every stack, a multiple of the page size
+    size_t stack_size = 1 << 20;
+  };
+
+  // runs a task with its arguments and sets its result; returns 0 or an
+  // error that the join of the task returns
+  using Function = int32_t (*)(const void* context, uint32_t function, const uint64_t* args, int32_t& result);
+
+  explicit TaskScheduler(const Options& options);
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler(TaskScheduler&&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(TaskScheduler&&) = delete;
+  // stops the workers; every task must have been joined
+  ~TaskScheduler();
+
+  // started on first use with the options last given to set_global_options
+  static TaskScheduler& global();
+  static void set_global_options(const Options& options);
+  // the scheduler of the running task, else the global one
+  static TaskScheduler& current();
+
+  // starts function(context, function_index, args) as a task of the caller
+  // and returns its handle; count is at most TaskMaxArgs
+  int32_t spawn(Function function, const void* context, uint32_t function_index, const uint64_t* args,
+                uint32_t count);
+  // waits for the task, 0 with its result, its error or TaskInvalidHandle
+  static int32_t join(int32_t handle, int32_t& result);
+  // joins every task the caller spawned and did not join, 0 or the first
+  // error; tasks do this when they end
+  static int32_t join_all();
+
+  uint32_t workers() const { return m_workers.size(); }
+  TaskSchedulerStats stats() const;
+
+private:
+  Options m_options;
+  std::vector<std::unique_ptr<TaskWorker>> m_workers;
+  // tasks spawned by threads that are not workers of this scheduler
+  std::mutex m_queue_mutex;
+  std::deque<Task*> m_queue;
+  std::atomic<uint32_t> m_queued{0};
+  // sleeping workers wait for the epoch to change, every push changes it
+  std::mutex m_idle_mutex;
+  std::condition_variable m_idle;
+  std::atomic<uint64_t> m_epoch{0};
+  std::atomic<uint32_t> m_sleeping{0};
+  // workers looking for tasks before they sleep
+  std::atomic<uint32_t> m_searching{0};
+  std::atomic<bool> m_stopping{false};
+  // threads that are not workers wait here for the tasks they join
+  std::mutex m_join_mutex;
+  std::condition_variable m_joined;
+  // tasks spawned outside of workers, workers count their own
+  std::atomic<uint64_t> m_spawned{0};
+
+  void run_worker(TaskWorker& worker);
+  Task* find_task(TaskWorker& worker);
+  void resume(TaskWorker& worker, Task* task);
+  void push(Task* task);
+  // wakes a sleeping worker unless one is looking for tasks anyway
+  void wake();
+  void notify();
+  static void start_task(Task* task);
+  // switches from the running task back to its worker
+  static void suspend(Task* task);
+};
+
+// Entry points for compiled code, System V functions on the scheduler of
+// the running task. entry takes the arguments and returns the result of
+// the task; joining something that is not a task of the caller traps.
+int32_t task_spawn(const void* entry, const uint64_t* args, int32_t count);
+int32_t task_join(int32_t handle);
+
+#endif  // TASK_HPP
@@ -0,0 +1,87 @@
+#include "tiered.hpp"
+
+// the Jit only compiles; its own stack is never used, compiled code runs on
+// the frames of m_vm
+TieredVm::TieredVm(const RegBytecodeModule& module, const TieredOptions& options, uint32_t stack_slots,
+                   uint32_t max_frames)
+  : m_module(module), m_options(options), m_jit(module, 0, max_frames, options.background),
+    m_vm(module, stack_slots, max_frames), m_calls(module.functions.size(), 0),
+    m_back_edges(module.functions.size(), 0), m_requested(module.functions.size(), false),
+    m_published(new std::atomic<JitEntry>[module.functions.size()]) {
+  for (size_t function = 0; function < module.functions.size(); ++function) m_published[function] = nullptr;
+  m_vm.set_tiering(this);
+  if (m_options.background) m_worker = std::thread([this] { work(); });
+}
+
+TieredVm::~TieredVm() {
+  if (!m_worker.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_worker.join();
+}
+
+void TieredVm::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [this] { return m_queue.empty() && !m_compiling; });
+}
+
+TieredStats TieredVm::stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  TieredStats stats;
+  stats.requests = m_requests;
+  stats.failures = m_failures;
+  stats.compiled_calls = m_compiled_calls;
+  stats.osr_entries = m_osr_entries;
+  stats.jit = m_jit_stats;
+  return stats;
+}
+
+void TieredVm::request(uint32_t function) {
+  if (m_requested[function]) return;
+  m_requested[function] = true;
+  if (!m_options.background) {
+    compile(function);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.emplace_back(function);
+  }
+  m_wake.notify_one();
+}
+
+void TieredVm::compile(uint32_t function) {
+  // a function may have been compiled as the callee of an earlier request
+  const bool compiled = m_published[function].load(std::memory_order_relaxed) || m_jit.compile(function);
+  // the Jit installs every function it compiles on pages of its own, so
+  // they can be published as soon as they are complete
+  for (uint32_t index = 0; index < m_module.functions.size(); ++index) {
+    if (m_jit.is_compiled(index) && !m_published[index].load(std::memory_order_relaxed)) {
+      m_published[index].store(reinterpret_cast<JitEntry>(const_cast<void*>(m_jit.entries()[index])),
+                               std::memory_order_release);
+    }
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_requests;
+  m_failures += !compiled;
+  m_jit_stats = m_jit.stats();
+}
+
+void TieredVm::work() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+    if (m_stop) return;
+    const auto function = m_queue.back();
+    m_queue.pop_back();
+    m_compiling = true;
+    lock.unlock();
+    compile(function);
+    lock.lock();
+    m_compiling = false;
+    if (m_queue.empty()) m_idle.notify_all();
+  }
+}
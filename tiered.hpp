@@ -0,0 +1,122 @@
+#ifndef TIERED_HPP
+#define TIERED_HPP
+
+#include "jit.hpp"
+#include "reg_bytecode.hpp"
+#include "reg_vm.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TieredOptions {
+  // calls of a function before it is compiled
+  uint32_t call_threshold = 1000;
+  // loop iterations of a function before it is compiled
+  uint32_t back_edge_threshold = 10000;
+  // compile on a thread of its own instead of stopping the interpreter
+  bool background = true;
+};
+
+struct TieredStats {
+  // functions handed to the compiler and how many of them failed
+  uint32_t requests = 0;
+  uint32_t failures = 0;
+  // calls from interpreted into compiled code and frames moved into
+  // compiled code at a loop header
+  uint64_t compiled_calls = 0;
+  uint64_t osr_entries = 0;
+  JitStats jit;
+};
+
+// Runs register bytecode in RegVm first and moves hot functions to the
+// baseline Jit. Calls and loop back edges are counted per function; one
+// that reaches a threshold is queued for compilation, which happens on a
+// background thread while interpretation goes on. Compiled entries are
+// published with release stores, and the interpreter picks them up at its
+// next call of the function, or at the next back edge of a frame already
+// running it, through the loop header's on-stack replacement entry. The
+// interpreter and the Jit share RegVm's frames, so nothing is converted in
+// either direction; compiled code runs until its frame returns.
+//
+// Functions the Jit cannot translate stay interpreted and are not retried.
+class TieredVm {
+public:
+  TieredVm(const RegBytecodeModule& module, const TieredOptions& options = {}, uint32_t stack_slots = 1 << 20,
+           uint32_t max_frames = 1 << 16);
+  TieredVm(const TieredVm&) = delete;
+  TieredVm(TieredVm&&) = delete;
+  TieredVm& operator=(const TieredVm&) = delete;
+  TieredVm& operator=(TieredVm&&) = delete;
+  ~TieredVm();
+
+  // result is left untouched for functions without a return value
+  VmStatus call(uint32_t function, const std::vector<VmSlot>& args, VmSlot& result) {
+    return m_vm.call(function, args, result);
+  }
+  // blocks until every queued function is compiled
+  void wait();
+  bool is_compiled(uint32_t function) const { return m_published[function].load(std::memory_order_acquire); }
+  TieredStats stats();
+
+  // called by RegVm: the compiled entry of a function about to be called,
+  // nullptr to interpret it
+  JitEntry on_call(uint32_t function) {
+    if (const auto entry = m_published[function].load(std::memory_order_acquire)) {
+      ++m_compiled_calls;
+      return entry;
+    }
+    if (++m_calls[function] == m_options.call_threshold) request(function);
+    return nullptr;
+  }
+  // called by RegVm at a backward jump to target: the entry continuing the
+  // frame at that loop header, nullptr to keep interpreting
+  JitEntry on_back_edge(uint32_t function, uint32_t target) {
+    if (m_published[function].load(std::memory_order_acquire)) {
+      const auto entry = m_jit.osr_entry(function, target);
+      m_osr_entries += entry != nullptr;
+      return entry;
+    }
+    if (++m_back_edges[function] == m_options.back_edge_threshold) request(function);
+    return nullptr;
+  }
+  JitContext context(VmSlot* stack_end, uint64_t frames_left) const {
+    return JitContext{m_jit.entries(), stack_end, frames_left};
+  }
+
+private:
+  const RegBytecodeModule& m_module;
+  TieredOptions m_options;
+  Jit m_jit;
+  RegVm m_vm;
+  std::vector<uint32_t> m_calls;
+  std::vector<uint32_t> m_back_edges;
+  std::vector<bool> m_requested;
+  uint64_t m_compiled_calls = 0;
+  uint64_t m_osr_entries = 0;
+  // entries of compiled functions, nullptr until published
+  std::unique_ptr<std::atomic<JitEntry>[]> m_published;
+
+  // guards everything below; m_jit belongs to the worker while it runs
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  std::vector<uint32_t> m_queue;
+  bool m_compiling = false;
+  bool m_stop = false;
+  uint32_t m_requests = 0;
+  uint32_t m_failures = 0;
+  JitStats m_jit_stats;
+  std::thread m_worker;
+
+  void request(uint32_t function);
+  // compiles function, publishes everything the Jit installed for it
+  void compile(uint32_t function);
+  void work();
+};
+
+#endif  // TIERED_HPP
@@ -8,6 +8,14 @@ const Token::Keywords Token::s_keywords = {
   {"union", Token::Kind::Union}, 
   {"fun", Token::Kind::Fun}, 
   {"return", Token::Kind::Return}, 
+  {"if", Token::Kind::If},
+  {"else", Token::Kind::Else},
+  {"while", Token::Kind::While},
+  {"shuffle", Token::Kind::Shuffle},
+  {"region", Token::Kind::Region},
+  {"new", Token::Kind::New},
+  {"spawn", Token::Kind::Spawn},
+  {"join", Token::Kind::Join},
   {"i32", Token::Kind::I32},
   {"i16", Token::Kind::I16},
   {"i8", Token::Kind::I8},
@@ -16,4 +24,7 @@ const Token::Keywords Token::s_keywords = {
   {"u8", Token::Kind::U8},
   {"f32", Token::Kind::F32},
   {"f64", Token::Kind::F64},
+  {"f32x4", Token::Kind::F32x4},
+  {"f32x8", Token::Kind::F32x8},
+  {"i32x4", Token::Kind::I32x4},
 };
@@ -8,11 +8,11 @@
 class Token {
 public:
   enum class Kind {
-    None, Fun, Class, Struct, Union, Return, Var, Val,
-    Id, StringLiteral, I32Literal, 
-    LeftParen, RightParen, LeftBrace, RightBrace, 
+    None, Fun, Class, Struct, Union, Return, Var, Val, If, Else, While, Shuffle, Region, New, Spawn, Join,
+    Id, StringLiteral, I32Literal, F64Literal,
+    LeftParen, RightParen, LeftBrace, RightBrace, LeftBracket, RightBracket, Comma, Colon, Dot, Arrow,
     Add, Sub, Mul, Div, Assign, Equals, Great, Less, GreatOrEqual, LessOrEqual,
-    I32, I16, I8, U32, U16, U8, F32, F64,
+    I32, I16, I8, U32, U16, U8, F32, F64, F32x4, F32x8, I32x4,
     Eof, Semicolon, Unknown};
 
   Token(Kind kind) : m_kind(kind) {}
@@ -0,0 +1,208 @@
+#include "unroll.hpp"
+#include "dominators.hpp"
+#include "loops.hpp"
+
+UnrollStats Unroller::run() {
+  UnrollStats stats;
+  if (!m_function.profiled || m_function.blocks.empty()) return stats;
+
+  // unrolling changes the loops, so they are found again after each one;
+  // headers seen before are skipped, the copies are no loops of their own
+  std::vector<bool> seen;
+  bool unrolled = true;
+  while (unrolled) {
+    unrolled = false;
+    DominatorTree tree(m_function);
+    LoopInfo loop_info(m_function, tree);
+    const auto& loops = loop_info.loops();
+    seen.resize(m_function.blocks.size(), false);
+    for (LoopIndex index = 0; index < loops.size(); ++index) {
+      const auto& loop = loops[index];
+      if (seen[loop.header]) continue;
+      seen[loop.header] = true;
+      bool inner = true;
+      for (const auto& other : loops) inner = inner && other.parent != index;
+      if (!inner) continue;
+      IrBlockIndex exit = UndefinedIrBlockIndex;
+      const auto loop_factor = factor(loop, exit);
+      if (loop_factor < 2) continue;
+      unroll(loop, exit, loop_factor);
+      ++stats.loops;
+      stats.copies += loop_factor - 1;
+      unrolled = true;
+      break;
+    }
+  }
+  return stats;
+}
+
+uint32_t Unroller::factor(const Loop& loop, IrBlockIndex& exit) const {
+  const auto header = loop.header;
+  if (loop.latches.size() != 1 || loop.preheader == UndefinedIrBlockIndex ||
+      m_function.blocks[header].preds.size() != 2) {
+    return 1;
+  }
+  uint32_t size = 0;
+  exit = UndefinedIrBlockIndex;
+  for (auto block : loop.blocks) {
+    size += m_function.blocks[block].instrs.size();
+    for (auto succ : m_function.blocks[block].succs) {
+      if (loop.contains(succ)) continue;
+      if (block != header || exit != UndefinedIrBlockIndex) return 1;
+      exit = succ;
+    }
+  }
+  if (exit == UndefinedIrBlockIndex || m_function.blocks[exit].preds.size() != 1) return 1;
+
+  // the latch runs once per iteration, the header once more per entry
+  const auto iterations = m_function.blocks[loop.latches[0]].weight;
+  const auto header_weight = m_function.blocks[header].weight;
+  if (header_weight <= iterations) return 1;
+  const auto trips = iterations / (header_weight - iterations);
+  uint32_t result = 1;
+  while (result * 2 <= m_options.max_factor && result * 2 <= trips && size * result * 2 <= m_options.max_size) {
+    result *= 2;
+  }
+  return result;
+}
+
+void Unroller::unroll(const Loop& loop, IrBlockIndex exit, uint32_t factor) {
+  auto& function = m_function;
+  const auto header = loop.header;
+  const auto latch = loop.latches[0];
+  const auto& header_preds = function.blocks[header].preds;
+  const uint32_t latch_position = std::find(header_preds.begin(), header_preds.end(), latch) - header_preds.begin();
+  const uint32_t block_count = function.blocks.size();
+  const uint32_t instr_count = function.instrs.size();
+  auto in_loop = [&](IrValueIndex value) {
+    return value < instr_count && function.instrs[value].block != UndefinedIrBlockIndex &&
+           loop.contains(function.instrs[value].block);
+  };
+
+  // maps[copy][value] is the copy of a loop value, copy 0 is the loop
+  std::vector<std::vector<IrValueIndex>> maps(factor);
+  auto resolve = [&](uint32_t copy, IrValueIndex value) {
+    return copy == 0 || !in_loop(value) ? value : maps[copy][value];
+  };
+  std::vector<IrValueIndex> header_phis;
+  for (auto index : function.blocks[header].instrs) {
+    if (function.instrs[index].kind != IrInstr::Kind::Phi) break;
+    header_phis.emplace_back(index);
+  }
+
+  std::vector<std::vector<IrBlockIndex>> block_maps(factor, std::vector<IrBlockIndex>(block_count));
+  for (auto block : loop.blocks) {
+    function.blocks[block].weight /= factor;
+    block_maps[0][block] = block;
+    for (uint32_t copy = 1; copy < factor; ++copy) {
+      block_maps[copy][block] = function.create_block();
+      function.blocks[block_maps[copy][block]].weight = function.blocks[block].weight;
+    }
+  }
+  // the header a back edge of the copy continues in
+  auto next_header = [&](uint32_t copy) { return copy + 1 < factor ? block_maps[copy + 1][header] : header; };
+
+  for (uint32_t copy = 1; copy < factor; ++copy) {
+    auto& map = maps[copy];
+    map.assign(instr_count, UndefinedIrValueIndex);
+    // the copy's header continues with the values of the previous copy
+    for (auto phi : header_phis) map[phi] = resolve(copy - 1, function.instrs[phi].operands[latch_position]);
+
+    std::vector<IrValueIndex> cloned;
+    for (auto block : loop.blocks) {
+      const auto mapped_block = block_maps[copy][block];
+      for (auto index : function.blocks[block].instrs) {
+        if (block == header && function.instrs[index].kind == IrInstr::Kind::Phi) continue;
+        // the instruction vector may move while copying
+        const auto instr = function.instrs[index];
+        const auto clone = function.create(mapped_block, instr.kind, instr.type);
+        auto& clone_instr = function.instrs[clone];
+        clone_instr.operands = instr.operands;
+        clone_instr.constant = instr.constant;
+        clone_instr.index = instr.index;
+        for (uint32_t i = 0; i < 2; ++i) {
+          const auto target = instr.targets[i];
+          if (target == header) {
+            clone_instr.targets[i] = next_header(copy);
+          } else if (target != UndefinedIrBlockIndex && loop.contains(target)) {
+            clone_instr.targets[i] = block_maps[copy][target];
+          } else {
+            clone_instr.targets[i] = target;
+          }
+        }
+        map[index] = clone;
+        cloned.emplace_back(clone);
+      }
+    }
+    for (auto clone : cloned) {
+      for (auto& operand : function.instrs[clone].operands) operand = resolve(copy, operand);
+    }
+
+    for (auto block : loop.blocks) {
+      auto& mapped = function.blocks[block_maps[copy][block]];
+      if (block == header) {
+        mapped.preds = {block_maps[copy - 1][latch]};
+      } else {
+        for (auto pred : function.blocks[block].preds) mapped.preds.emplace_back(block_maps[copy][pred]);
+      }
+      for (auto succ : function.blocks[block].succs) {
+        if (succ == header) {
+          mapped.succs.emplace_back(next_header(copy));
+        } else if (loop.contains(succ)) {
+          mapped.succs.emplace_back(block_maps[copy][succ]);
+        } else {
+          // the exit, its phis take the values of this copy
+          mapped.succs.emplace_back(succ);
+          auto& exit_block = function.blocks[exit];
+          const auto position = std::find(exit_block.preds.begin(), exit_block.preds.end(), header) - exit_block.preds.begin();
+          exit_block.preds.emplace_back(block_maps[copy][block]);
+          for (auto index : exit_block.instrs) {
+            auto& instr = function.instrs[index];
+            if (instr.kind != IrInstr::Kind::Phi) break;
+            instr.operands.emplace_back(resolve(copy, instr.operands[position]));
+          }
+        }
+      }
+    }
+  }
+
+  // the loop's own latch goes on to the first copy, the last copy closes it
+  auto& latch_instr = function.instrs[function.terminator(latch)];
+  for (auto& target : latch_instr.targets) {
+    if (target == header) target = block_maps[1][header];
+  }
+  for (auto& succ : function.blocks[latch].succs) {
+    if (succ == header) succ = block_maps[1][header];
+  }
+  // copy 1's header already names the latch as its predecessor
+  for (auto phi : header_phis) {
+    auto& operand = function.instrs[phi].operands[latch_position];
+    operand = resolve(factor - 1, operand);
+  }
+  function.blocks[header].preds[latch_position] = block_maps[factor - 1][latch];
+
+  // values of the loop used after it now come from any of the copies
+  const uint32_t exit_phi_count = function.phi_count(exit);
+  std::vector<IrValueIndex> merged(instr_count, UndefinedIrValueIndex);
+  for (IrBlockIndex block = 0; block < block_count; ++block) {
+    if (loop.contains(block)) continue;
+    const auto instrs = function.blocks[block].instrs;
+    for (uint32_t position = 0; position < instrs.size(); ++position) {
+      if (block == exit && position < exit_phi_count) continue;
+      for (uint32_t i = 0; i < function.instrs[instrs[position]].operands.size(); ++i) {
+        const auto value = function.instrs[instrs[position]].operands[i];
+        if (!in_loop(value)) continue;
+        if (merged[value] == UndefinedIrValueIndex) {
+          const auto phi = function.create_phi(exit, function.instrs[value].type);
+          for (auto pred : function.blocks[exit].preds) {
+            uint32_t copy = 0;
+            while (block_maps[copy][header] != pred) ++copy;
+            function.instrs[phi].operands.emplace_back(resolve(copy, value));
+          }
+          merged[value] = phi;
+        }
+        function.instrs[instrs[position]].operands[i] = merged[value];
+      }
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef UNROLL_HPP
+#define UNROLL_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <vector>
+
+struct Loop;
+
+struct UnrollStats {
+  uint32_t loops = 0;
+  // copies of loop bodies added
+  uint32_t copies = 0;
+};
+
+// Unrolls hot inner loops of profiled functions. A loop that is left only
+// from its header, through an exit block of its own, and ran at least
+// `factor` iterations per entry in the profile gets factor - 1 copies of
+// its blocks chained behind its latch. Every copy still tests the exit
+// condition, so any trip count works, but the back edge is taken once per
+// factor iterations and later passes see consecutive iterations together.
+// Values of the loop used after it are merged by phis in the exit block.
+// The factor is the largest power of two up to `max_factor` that keeps
+// the unrolled loop within `max_size` instructions.
+class Unroller {
+public:
+  struct Options {
+    uint32_t max_factor = 4;
+    uint32_t max_size = 160;
+  };
+
+  Unroller(IrFunction& function) : m_function(function) {}
+  Unroller(IrFunction& function, Options options) : m_function(function), m_options(options) {}
+  Unroller(const Unroller&) = delete;
+  Unroller(Unroller&&) = delete;
+  Unroller& operator=(const Unroller&) = delete;
+  Unroller& operator=(Unroller&&) = delete;
+
+  UnrollStats run();
+
+private:
+  IrFunction& m_function;
+  Options m_options;
+
+  // the unroll factor, 1 to leave the loop alone
+  uint32_t factor(const Loop& loop, IrBlockIndex& exit) const;
+  void unroll(const Loop& loop, IrBlockIndex exit, uint32_t factor);
+};
+
+#endif  // UNROLL_HPP
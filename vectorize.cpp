@@ -0,0 +1,434 @@
+#include "vectorize.hpp"
+#include "dominators.hpp"
+#include "id_cache.hpp"
+#include "loops.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+const char* type_name(IrType type) {
+  switch (type) {
+    case IrType::I32: return "i32";
+    case IrType::F32: return "f32";
+    case IrType::F64: return "f64";
+    case IrType::I32x4: return "i32x4";
+    case IrType::F32x4: return "f32x4";
+    case IrType::F32x8: return "f32x8";
+    case IrType::F64x4: return "f64x4";
+    default: return "?";
+  }
+}
+
+}  // namespace
+
+const std::vector<VectorizeDecision>& Vectorizer::run() {
+  using Reason = VectorizeDecision::Reason;
+  m_decisions.clear();
+  if (m_function.blocks.empty()) return m_decisions;
+
+  // loops are only analyzed here, the vector copies go in front of them
+  // afterwards and leave the blocks of other loops alone
+  std::vector<Plan> plans;
+  {
+    DominatorTree tree(m_function);
+    LoopInfo loop_info(m_function, tree);
+    const auto& loops = loop_info.loops();
+    for (LoopIndex index = 0; index < loops.size(); ++index) {
+      bool inner = true;
+      for (const auto& other : loops) inner = inner && other.parent != index;
+      Plan plan;
+      VectorizeDecision decision{loops[index].header, Reason::NotInnermost};
+      if (inner) decision.reason = analyze(loops[index], plan);
+      decision.type = plan.vector != IrType::Void ? plan.vector : plan.element;
+      if (decision.reason == Reason::Vectorized) plans.emplace_back(std::move(plan));
+      m_decisions.emplace_back(decision);
+    }
+  }
+  std::sort(m_decisions.begin(), m_decisions.end(), [](const VectorizeDecision& a, const VectorizeDecision& b) {
+    return a.header < b.header;
+  });
+  for (const auto& plan : plans) vectorize(plan);
+  return m_decisions;
+}
+
+void Vectorizer::report(std::ostream& out, const IdCache& id_cache) const {
+  using Reason = VectorizeDecision::Reason;
+  const auto name = m_function.name == UndefinedIdIndex ? "<anonymous>" : id_cache.get(m_function.name).str;
+  for (uint32_t loop = 0; loop < m_decisions.size(); ++loop) {
+    const auto& decision = m_decisions[loop];
+    out << name << " loop " << loop + 1 << ": ";
+    switch (decision.reason) {
+      case Reason::Vectorized: out << "vectorized as " << type_name(decision.type); break;
+      case Reason::NotInnermost: out << "contains another loop"; break;
+      case Reason::Shape: out << "not a test of the counter and a single block body"; break;
+      case Reason::NotCountable: out << "no counter i < n stepping by 1"; break;
+      case Reason::CarriedValue: out << "a value is carried between iterations"; break;
+      case Reason::FloatReduction: out << "a float sum, vectors would reorder it"; break;
+      case Reason::Call: out << "calls a function"; break;
+      case Reason::Access: out << "memory not indexed by the counter"; break;
+      case Reason::CounterUse: out << "uses the counter as a value"; break;
+      case Reason::MixedTypes: out << "mixes element types"; break;
+      case Reason::Unsupported: out << "an operation without a vector form"; break;
+      case Reason::NoVectors: out << "no vectors of " << type_name(decision.type) << " on this machine"; break;
+      case Reason::TooManyChecks: out << "too many runtime checks"; break;
+    }
+    out << '\n';
+  }
+}
+
+VectorizeDecision::Reason Vectorizer::analyze(const Loop& loop, Plan& plan) const {
+  using Reason = VectorizeDecision::Reason;
+  using Kind = IrInstr::Kind;
+  const auto& instrs = m_function.instrs;
+  const auto& blocks = m_function.blocks;
+  if (loop.blocks.size() != 2 || loop.latches.size() != 1 || loop.preheader == UndefinedIrBlockIndex) {
+    return Reason::Shape;
+  }
+  plan.preheader = loop.preheader;
+  plan.header = loop.header;
+  plan.body = loop.blocks[1];
+  if (loop.latches[0] != plan.body || blocks[plan.body].preds.size() != 1 || blocks[plan.header].preds.size() != 2) {
+    return Reason::Shape;
+  }
+  const auto branch = m_function.terminator(plan.header);
+  const auto jump = m_function.terminator(plan.body);
+  if (branch == UndefinedIrValueIndex || instrs[branch].kind != Kind::Branch || jump == UndefinedIrValueIndex ||
+      instrs[jump].kind != Kind::Jump) {
+    return Reason::Shape;
+  }
+  const auto& branch_instr = instrs[branch];
+  if (branch_instr.targets[0] == branch_instr.targets[1]) return Reason::Shape;
+  const auto cond = branch_instr.operands[0];
+  for (auto index : blocks[plan.header].instrs) {
+    const auto kind = instrs[index].kind;
+    if (kind != Kind::Phi && kind != Kind::Const && index != cond && index != branch) return Reason::Shape;
+  }
+
+  // i < n, or the same from the other side or on the not taken edge
+  const auto& cond_instr = instrs[cond];
+  const bool taken = branch_instr.targets[0] == plan.body;
+  if ((cond_instr.kind == Kind::Less && taken) || (cond_instr.kind == Kind::GreatOrEqual && !taken)) {
+    plan.counter = cond_instr.operands[0];
+    plan.limit = cond_instr.operands[1];
+  } else if ((cond_instr.kind == Kind::Great && taken) || (cond_instr.kind == Kind::LessOrEqual && !taken)) {
+    plan.counter = cond_instr.operands[1];
+    plan.limit = cond_instr.operands[0];
+  } else {
+    return Reason::NotCountable;
+  }
+  const auto& counter = instrs[plan.counter];
+  if (counter.kind != Kind::Phi || counter.block != plan.header || counter.type != IrType::I32 ||
+      !is_invariant(loop, plan.limit)) {
+    return Reason::NotCountable;
+  }
+  const uint32_t latch = blocks[plan.header].preds[0] == plan.body ? 0 : 1;
+  plan.increment = counter.operands[latch];
+  const auto& increment = instrs[plan.increment];
+  const auto step = increment.kind == Kind::Add && increment.block == plan.body
+    ? increment.operands[increment.operands[0] == plan.counter ? 1 : 0] : UndefinedIrValueIndex;
+  if (step == UndefinedIrValueIndex || (increment.operands[0] != plan.counter && increment.operands[1] != plan.counter) ||
+      instrs[step].kind != Kind::Const || instrs[step].type != IrType::I32 || instrs[step].constant.i != 1) {
+    return Reason::NotCountable;
+  }
+
+  // every other phi must be a sum s = s + x
+  for (auto index : blocks[plan.header].instrs) {
+    const auto& phi = instrs[index];
+    if (phi.kind != Kind::Phi) break;
+    if (index == plan.counter) continue;
+    const auto next = phi.operands[latch];
+    const auto& add = instrs[next];
+    const bool sum = add.kind == Kind::Add && add.block == plan.body && add.operands[0] != add.operands[1] &&
+      (add.operands[0] == index || add.operands[1] == index);
+    if (!sum) return Reason::CarriedValue;
+    if (ir_is_float(phi.type)) {
+      plan.element = phi.type;
+      return Reason::FloatReduction;
+    }
+    if (phi.type != IrType::I32) return Reason::CarriedValue;
+    plan.sums.emplace_back(index, next);
+  }
+  return analyze_body(loop, plan);
+}
+
+VectorizeDecision::Reason Vectorizer::analyze_body(const Loop& loop, Plan& plan) const {
+  using Reason = VectorizeDecision::Reason;
+  using Kind = IrInstr::Kind;
+  const auto& instrs = m_function.instrs;
+  // the add of a sum phi, or UndefinedIrValueIndex
+  auto sum_of = [&plan](IrValueIndex phi) {
+    for (const auto& sum : plan.sums) {
+      if (sum.first == phi) return sum.second;
+    }
+    return UndefinedIrValueIndex;
+  };
+  auto is_sum = [&plan](IrValueIndex value) {
+    return std::any_of(plan.sums.begin(), plan.sums.end(),
+                       [value](const std::pair<IrValueIndex, IrValueIndex>& sum) { return sum.second == value; });
+  };
+  auto is_element = [&](IrValueIndex value) {
+    return instrs[value].kind == Kind::ElementAddr && instrs[value].block == plan.body;
+  };
+  if (!plan.sums.empty()) plan.element = IrType::I32;
+  bool mixed = false;
+  auto use_type = [&](IrType type) {
+    if (plan.element == IrType::Void) plan.element = type;
+    mixed = mixed || plan.element != type;
+  };
+
+  std::vector<IrValueIndex> bases;
+  std::vector<IrValueIndex> written;
+  for (auto index : m_function.blocks[plan.body].instrs) {
+    const auto& instr = instrs[index];
+    if (index == plan.increment || instr.kind == Kind::Jump || instr.kind == Kind::Const) continue;
+    for (uint32_t i = 0; i < instr.operands.size(); ++i) {
+      const auto operand = instr.operands[i];
+      // the counter only indexes, sums only add up, and element addresses
+      // are only loaded from and stored to
+      const bool index_operand = (instr.kind == Kind::ElementAddr && i == 1) || (instr.kind == Kind::BoundsCheck && i == 0);
+      if (operand == plan.counter && !index_operand) return Reason::CounterUse;
+      const auto sum = sum_of(operand);
+      if ((sum != UndefinedIrValueIndex && sum != index) || is_sum(operand)) return Reason::CarriedValue;
+      const bool address_operand = (instr.kind == Kind::Load || instr.kind == Kind::Store) && i == 0;
+      if (is_element(operand) && !address_operand) return Reason::Unsupported;
+    }
+    switch (instr.kind) {
+      case Kind::Call:
+        return Reason::Call;
+      case Kind::ElementAddr:
+        if (!is_invariant(loop, instr.operands[0]) || instr.operands[1] != plan.counter) return Reason::Access;
+        break;
+      case Kind::BoundsCheck:
+        if (instr.operands[0] != plan.counter || !is_invariant(loop, instr.operands[1])) return Reason::Access;
+        if (std::find(plan.lengths.begin(), plan.lengths.end(), instr.operands[1]) == plan.lengths.end()) {
+          plan.lengths.emplace_back(instr.operands[1]);
+        }
+        break;
+      case Kind::Load:
+      case Kind::Store: {
+        const auto address = instr.operands[0];
+        const auto type = instr.kind == Kind::Load ? instr.type : instrs[instr.operands[1]].type;
+        if (!is_element(address) || instrs[address].index != ir_type_size(type)) return Reason::Access;
+        use_type(type);
+        const auto base = instrs[address].operands[0];
+        if (std::find(bases.begin(), bases.end(), base) == bases.end()) bases.emplace_back(base);
+        if (instr.kind == Kind::Store && std::find(written.begin(), written.end(), base) == written.end()) {
+          written.emplace_back(base);
+        }
+        break;
+      }
+      case Kind::Neg:
+      case Kind::Add:
+      case Kind::Sub:
+      case Kind::Mul:
+      case Kind::Div:
+        if (instr.kind == Kind::Div && !ir_is_float(instr.type)) return Reason::Unsupported;
+        use_type(instr.type);
+        break;
+      default:
+        return Reason::Unsupported;
+    }
+  }
+  if (plan.element != IrType::I32 && plan.element != IrType::F32 && plan.element != IrType::F64) {
+    return Reason::Unsupported;
+  }
+  if (mixed) return Reason::MixedTypes;
+
+  if (plan.element == IrType::I32) {
+    plan.vector = m_options.max_bytes >= 16 ? IrType::I32x4 : IrType::Void;
+  } else if (plan.element == IrType::F32) {
+    plan.vector = m_options.max_bytes >= 32 ? IrType::F32x8 : m_options.max_bytes >= 16 ? IrType::F32x4 : IrType::Void;
+  } else {
+    plan.vector = m_options.max_bytes >= 32 ? IrType::F64x4 : IrType::Void;
+  }
+  if (plan.vector == IrType::Void) return Reason::NoVectors;
+
+  // written elements may overlap any others, unless both are stack slots
+  // of their own
+  for (auto target : written) {
+    for (auto base : bases) {
+      if (base == target) continue;
+      const auto pair = std::make_pair(base, target);
+      if (std::find(plan.overlaps.begin(), plan.overlaps.end(), pair) != plan.overlaps.end()) continue;
+      const auto target_slot = stack_slot_of(target);
+      const auto base_slot = stack_slot_of(base);
+      if (target_slot != UndefinedIrValueIndex && base_slot != UndefinedIrValueIndex && target_slot != base_slot) continue;
+      plan.overlaps.emplace_back(target, base);
+    }
+  }
+  if (plan.lengths.size() + plan.overlaps.size() > m_options.max_checks) return Reason::TooManyChecks;
+  return Reason::Vectorized;
+}
+
+// The preheader goes on to a chain of checks, each leaving for the merge
+// block when the vector copy cannot run. The copy steps its own counter
+// by lanes while i + lanes <= n, so n - (lanes - 1) cannot wrap as n >=
+// lanes, and adds its sums up lane by lane in vectors starting at zero.
+// The merge block takes the counter and sums to where the copy stopped,
+// or to where the loop started, and enters the original loop with them.
+void Vectorizer::vectorize(const Plan& plan) {
+  using Kind = IrInstr::Kind;
+  auto& function = m_function;
+  const uint32_t lanes = ir_vector_lanes(plan.vector);
+  const uint32_t outside = function.blocks[plan.header].preds[0] == plan.preheader ? 0 : 1;
+  const auto first = function.instrs[plan.counter].operands[outside];
+  const auto weight = function.blocks[plan.preheader].weight;
+  const auto vector_weight = function.blocks[plan.body].weight / lanes;
+  auto create_block = [&function](uint64_t block_weight) {
+    const auto block = function.create_block();
+    function.blocks[block].weight = block_weight;
+    return block;
+  };
+
+  const auto entry = create_block(weight);
+  const auto merge = create_block(weight);
+  // constants of the loop are copied to where they are used in front of it
+  auto hoisted = [&](IrValueIndex value, IrBlockIndex at) {
+    const auto block = function.instrs[value].block;
+    if (block != plan.header && block != plan.body) return value;
+    return function.create_const(at, function.instrs[value].constant);
+  };
+  const auto limit = hoisted(plan.limit, entry);
+  function.instrs[function.terminator(plan.preheader)].targets[0] = entry;
+  auto& preheader_succs = function.blocks[plan.preheader].succs;
+  std::replace(preheader_succs.begin(), preheader_succs.end(), plan.header, entry);
+  function.blocks[entry].preds.emplace_back(plan.preheader);
+
+  auto constant = [&function](IrBlockIndex block, int64_t value) {
+    return function.create_const(block, IrConst::make_int(IrType::I32, value));
+  };
+  auto compare = [&function](IrBlockIndex block, Kind kind, IrValueIndex left, IrValueIndex right) {
+    return function.create_binary(block, kind, IrType::Bool, left, right);
+  };
+  // leaves for the merge block if cond holds, the next check follows
+  auto check = [&](IrBlockIndex block, IrValueIndex cond) {
+    const auto next = create_block(weight);
+    function.create_branch(block, cond, merge, next);
+    return next;
+  };
+  const auto zero = function.create_const(entry, IrConst::make_zero(plan.vector));
+  auto block = check(entry, compare(entry, Kind::Less, limit, constant(entry, lanes)));
+  if (!plan.lengths.empty()) {
+    const auto& first_instr = function.instrs[first];
+    if (first_instr.kind != Kind::Const || first_instr.constant.i < 0) {
+      block = check(block, compare(block, Kind::Less, first, constant(block, 0)));
+    }
+    for (auto length : plan.lengths) block = check(block, compare(block, Kind::Great, limit, hoisted(length, block)));
+  }
+  const auto size = ir_type_size(plan.element);
+  auto end_of = [&](IrBlockIndex at, IrValueIndex base) {
+    const auto end = function.create_binary(at, Kind::ElementAddr, IrType::Ptr, base, limit);
+    function.instrs[end].index = size;
+    return end;
+  };
+  for (const auto& [target, base] : plan.overlaps) {
+    // base < target end and target < base end
+    const auto second = create_block(weight);
+    const auto next = create_block(weight);
+    function.create_branch(block, compare(block, Kind::Less, base, end_of(block, target)), second, next);
+    function.create_branch(second, compare(second, Kind::Less, target, end_of(second, base)), merge, next);
+    block = next;
+  }
+
+  const auto vector_preheader = block;
+  const auto vector_header = create_block(vector_weight);
+  const auto vector_body = create_block(vector_weight);
+  const auto last = function.create_binary(vector_preheader, Kind::Sub, IrType::I32, limit,
+                                           constant(vector_preheader, lanes - 1));
+  std::unordered_map<IrValueIndex, IrValueIndex> map;
+  auto operand = [&](IrValueIndex value) {
+    auto it = map.find(value);
+    if (it != map.end()) return it->second;
+    // invariants and constants of the body are splat in front of the copy
+    const auto splat = function.create_unary(vector_preheader, Kind::Splat, plan.vector, hoisted(value, vector_preheader));
+    map[value] = splat;
+    return splat;
+  };
+  function.create_jump(vector_preheader, vector_header);
+
+  const auto index = function.create_phi(vector_header, IrType::I32);
+  function.instrs[index].operands = {first, UndefinedIrValueIndex};
+  map[plan.counter] = index;
+  std::vector<IrValueIndex> vector_sums;
+  for (const auto& sum : plan.sums) {
+    const auto phi = function.create_phi(vector_header, plan.vector);
+    function.instrs[phi].operands = {zero, UndefinedIrValueIndex};
+    map[sum.first] = phi;
+    vector_sums.emplace_back(phi);
+  }
+  function.create_branch(vector_header, compare(vector_header, Kind::Less, index, last), vector_body, merge);
+
+  const auto body_instrs = function.blocks[plan.body].instrs;
+  for (auto value : body_instrs) {
+    // the instruction vector may move while copying
+    const auto instr = function.instrs[value];
+    if (value == plan.increment) continue;
+    switch (instr.kind) {
+      case Kind::Const:
+      case Kind::BoundsCheck:
+      case Kind::Jump:
+        break;
+      case Kind::ElementAddr: {
+        const auto element = function.create_binary(vector_body, Kind::ElementAddr, IrType::Ptr, instr.operands[0], index);
+        function.instrs[element].index = instr.index;
+        map[value] = element;
+        break;
+      }
+      case Kind::Load:
+        map[value] = function.create_unary(vector_body, Kind::Load, plan.vector, map[instr.operands[0]]);
+        break;
+      case Kind::Store:
+        function.create_binary(vector_body, Kind::Store, IrType::Void, map[instr.operands[0]], operand(instr.operands[1]));
+        break;
+      default: {
+        std::vector<IrValueIndex> operands;
+        for (auto source : instr.operands) operands.emplace_back(operand(source));
+        const auto copy = function.create(vector_body, instr.kind, plan.vector);
+        function.instrs[copy].operands = std::move(operands);
+        map[value] = copy;
+        break;
+      }
+    }
+  }
+  const auto next = function.create_binary(vector_body, Kind::Add, IrType::I32, index, constant(vector_body, lanes));
+  function.instrs[index].operands[1] = next;
+  for (uint32_t i = 0; i < plan.sums.size(); ++i) function.instrs[vector_sums[i]].operands[1] = map[plan.sums[i].second];
+  function.create_jump(vector_body, vector_header);
+
+  // the checks that failed enter the loop where it started
+  const auto merged = function.create_phi(merge, IrType::I32);
+  for (auto pred : function.blocks[merge].preds) function.instrs[merged].operands.emplace_back(pred == vector_header ? index : first);
+  function.instrs[plan.counter].operands[outside] = merged;
+  for (uint32_t i = 0; i < plan.sums.size(); ++i) {
+    const auto phi = function.create_phi(merge, plan.vector);
+    for (auto pred : function.blocks[merge].preds) {
+      function.instrs[phi].operands.emplace_back(pred == vector_header ? vector_sums[i] : zero);
+    }
+    auto total = function.instrs[plan.sums[i].first].operands[outside];
+    for (uint32_t lane = 0; lane < lanes; ++lane) {
+      const auto element = function.create_unary(merge, Kind::Lane, IrType::I32, phi);
+      function.instrs[element].index = lane;
+      total = function.create_binary(merge, Kind::Add, IrType::I32, total, element);
+    }
+    function.instrs[plan.sums[i].first].operands[outside] = total;
+  }
+  const auto jump = function.create(merge, Kind::Jump, IrType::Void);
+  function.instrs[jump].targets[0] = plan.header;
+  function.blocks[merge].succs.emplace_back(plan.header);
+  function.blocks[plan.header].preds[outside] = merge;
+}
+
+bool Vectorizer::is_invariant(const Loop& loop, IrValueIndex value) const {
+  const auto& instr = m_function.instrs[value];
+  return instr.kind == IrInstr::Kind::Const || instr.block == UndefinedIrBlockIndex || !loop.contains(instr.block);
+}
+
+IrValueIndex Vectorizer::stack_slot_of(IrValueIndex address) const {
+  while (true) {
+    const auto& instr = m_function.instrs[address];
+    if (instr.kind == IrInstr::Kind::StackSlot) return address;
+    if (instr.kind != IrInstr::Kind::FieldAddr && instr.kind != IrInstr::Kind::ElementAddr) return UndefinedIrValueIndex;
+    address = instr.operands[0];
+  }
+}
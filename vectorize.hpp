@@ -0,0 +1,91 @@
+#ifndef VECTORIZE_HPP
+#define VECTORIZE_HPP
+
+#include "ir.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class IdCache;
+struct Loop;
+
+struct VectorizeDecision {
+  enum class Reason {
+    Vectorized, NotInnermost, Shape, NotCountable, CarriedValue, FloatReduction,
+    Call, Access, CounterUse, MixedTypes, Unsupported, NoVectors, TooManyChecks,
+  };
+
+  // header of the loop before vectorizing
+  IrBlockIndex header;
+  Reason reason;
+  // the vector type of a vectorized loop, the element type if there are no
+  // vectors of it
+  IrType type = IrType::Void;
+};
+
+// Loop vectorizer for countable inner loops. A loop qualifies if it is a
+// header testing i < n, with n invariant, and a single block body ending
+// in i = i + 1 that only reads and writes elements at the counter,
+// s[i] and t[i], of one type among i32, f32 and f64, and computes on them
+// with + - * / and negation; i32 sums s = s + x may be carried between
+// iterations, float sums are not as that would reorder them. Such a loop
+// gets a vector copy in front of it that runs while lanes elements are
+// left, and the original loop finishes the rest as scalar epilogue. The
+// vector copy only runs behind runtime checks: n must reach the vector
+// width, bounds checks of the body must hold for all of 0 <= i < n, which
+// removes them from the copy, and slices that are written must not
+// overlap the others, unless both are arrays of their own. Every loop
+// gets a decision telling why it was or was not vectorized.
+class Vectorizer {
+public:
+  struct Options {
+    // widest vector in bytes: 0 for none, 16 with SSE4.1, 32 with AVX
+    uint32_t max_bytes = 32;
+    // runtime checks allowed in front of a loop
+    uint32_t max_checks = 8;
+  };
+
+  Vectorizer(IrFunction& function) : m_function(function) {}
+  Vectorizer(IrFunction& function, Options options) : m_function(function), m_options(options) {}
+  Vectorizer(const Vectorizer&) = delete;
+  Vectorizer(Vectorizer&&) = delete;
+  Vectorizer& operator=(const Vectorizer&) = delete;
+  Vectorizer& operator=(Vectorizer&&) = delete;
+
+  const std::vector<VectorizeDecision>& run();
+  const std::vector<VectorizeDecision>& decisions() const { return m_decisions; }
+  // one line per loop of the function, in the order of their headers
+  void report(std::ostream& out, const IdCache& id_cache) const;
+
+private:
+  // what the body of a qualifying loop does
+  struct Plan {
+    IrBlockIndex preheader;
+    IrBlockIndex header;
+    IrBlockIndex body;
+    IrValueIndex counter;
+    IrValueIndex increment;
+    IrValueIndex limit;
+    IrType element = IrType::Void;
+    IrType vector = IrType::Void;
+    // phis s and their s + x in the body
+    std::vector<std::pair<IrValueIndex, IrValueIndex>> sums;
+    // lengths of the bounds checks in the body
+    std::vector<IrValueIndex> lengths;
+    // pairs of element bases that may overlap, one of them written
+    std::vector<std::pair<IrValueIndex, IrValueIndex>> overlaps;
+  };
+
+  IrFunction& m_function;
+  Options m_options;
+  std::vector<VectorizeDecision> m_decisions;
+
+  VectorizeDecision::Reason analyze(const Loop& loop, Plan& plan) const;
+  VectorizeDecision::Reason analyze_body(const Loop& loop, Plan& plan) const;
+  void vectorize(const Plan& plan);
+  bool is_invariant(const Loop& loop, IrValueIndex value) const;
+  // the stack slot an address points into, if any
+  IrValueIndex stack_slot_of(IrValueIndex address) const;
+};
+
+#endif  // VECTORIZE_HPP
@@ -0,0 +1,165 @@
+#include "vm.hpp"
+#include <algorithm>
+
+#if defined(__GNUC__) && !defined(SMALLANG_VM_SWITCH)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// integer results are wrapped to the width through unsigned arithmetic
+#define VM_INT_OPS(T, C) \
+  VM_CASE(Const##T) { sp->i = C(read_immediate<int32_t>(pc)); ++sp; pc += 4; VM_DISPATCH(); } \
+  VM_CASE(Add##T) { --sp; sp[-1].i = C(uint64_t(sp[-1].i) + uint64_t(sp[0].i)); VM_DISPATCH(); } \
+  VM_CASE(Sub##T) { --sp; sp[-1].i = C(uint64_t(sp[-1].i) - uint64_t(sp[0].i)); VM_DISPATCH(); } \
+  VM_CASE(Mul##T) { --sp; sp[-1].i = C(uint64_t(sp[-1].i) * uint64_t(sp[0].i)); VM_DISPATCH(); } \
+  VM_CASE(Div##T) { \
+    --sp; \
+    if (sp[0].i == 0) return VmStatus::DivisionByZero; \
+    sp[-1].i = C(sp[-1].i / sp[0].i); \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(Neg##T) { sp[-1].i = C(0 - uint64_t(sp[-1].i)); VM_DISPATCH(); } \
+  VM_CASE(Equal##T) { --sp; sp[-1].i = sp[-1].i == sp[0].i; VM_DISPATCH(); } \
+  VM_CASE(Great##T) { --sp; sp[-1].i = sp[-1].i > sp[0].i; VM_DISPATCH(); } \
+  VM_CASE(GreatOrEqual##T) { --sp; sp[-1].i = sp[-1].i >= sp[0].i; VM_DISPATCH(); } \
+  VM_CASE(Less##T) { --sp; sp[-1].i = sp[-1].i < sp[0].i; VM_DISPATCH(); } \
+  VM_CASE(LessOrEqual##T) { --sp; sp[-1].i = sp[-1].i <= sp[0].i; VM_DISPATCH(); } \
+  VM_CASE(LoadField##T) { \
+    C value; \
+    memcpy(&value, reinterpret_cast<uint8_t*>(base) + read_immediate<uint32_t>(pc), sizeof(C)); \
+    (sp++)->i = value; \
+    pc += 4; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreField##T) { \
+    const C value = C((--sp)->i); \
+    memcpy(reinterpret_cast<uint8_t*>(base) + read_immediate<uint32_t>(pc), &value, sizeof(C)); \
+    pc += 4; \
+    VM_DISPATCH(); \
+  }
+
+#define VM_FLOAT_OPS(T, C, M) \
+  VM_CASE(Const##T) { sp->i = 0; sp->M = read_immediate<C>(pc); ++sp; pc += sizeof(C); VM_DISPATCH(); } \
+  VM_CASE(Add##T) { --sp; sp[-1].M = sp[-1].M + sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Sub##T) { --sp; sp[-1].M = sp[-1].M - sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Mul##T) { --sp; sp[-1].M = sp[-1].M * sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Div##T) { --sp; sp[-1].M = sp[-1].M / sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Neg##T) { sp[-1].M = -sp[-1].M; VM_DISPATCH(); } \
+  VM_CASE(Equal##T) { --sp; sp[-1].i = sp[-1].M == sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Great##T) { --sp; sp[-1].i = sp[-1].M > sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(GreatOrEqual##T) { --sp; sp[-1].i = sp[-1].M >= sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(Less##T) { --sp; sp[-1].i = sp[-1].M < sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(LessOrEqual##T) { --sp; sp[-1].i = sp[-1].M <= sp[0].M; VM_DISPATCH(); } \
+  VM_CASE(LoadField##T) { \
+    sp->i = 0; \
+    memcpy(&sp->M, reinterpret_cast<uint8_t*>(base) + read_immediate<uint32_t>(pc), sizeof(C)); \
+    ++sp; \
+    pc += 4; \
+    VM_DISPATCH(); \
+  } \
+  VM_CASE(StoreField##T) { \
+    --sp; \
+    memcpy(reinterpret_cast<uint8_t*>(base) + read_immediate<uint32_t>(pc), &sp->M, sizeof(C)); \
+    pc += 4; \
+    VM_DISPATCH(); \
+  }
+
+VmStatus Vm::call(uint32_t function_index, const std::vector<VmSlot>& args, VmSlot& result) {
+  const auto* function = &m_module.functions[function_index];
+  VmSlot* const stack_end = m_stack.data() + m_stack.size();
+  Frame* const frames_begin = m_frames.data();
+  Frame* const frames_end = frames_begin + m_frames.size();
+  Frame* frame = frames_begin;
+  VmSlot* base = m_stack.data();
+  if (base + function->locals + function->max_stack > stack_end) return VmStatus::StackOverflow;
+  std::copy(args.begin(), args.begin() + std::min<size_t>(args.size(), function->params), base);
+  std::fill(base + std::min<size_t>(args.size(), function->params), base + function->locals, VmSlot{0});
+  VmSlot* sp = base + function->locals;
+  const uint8_t* code = function->code.data();
+  const uint8_t* pc = code;
+
+#if VM_COMPUTED_GOTO
+#define VM_LABEL(name) &&op_##name,
+  static const void* const labels[] = { BYTECODE_OPCODES(VM_LABEL) };
+#undef VM_LABEL
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *labels[*pc++]
+  VM_DISPATCH();
+#else
+#define VM_CASE(name) case Opcode::name:
+#define VM_DISPATCH() continue
+  for (;;) {
+    switch (static_cast<Opcode>(*pc++)) {
+#endif
+
+  VM_CASE(Nop) { VM_DISPATCH(); }
+  VM_CASE(Pop) { --sp; VM_DISPATCH(); }
+  VM_CASE(Dup) { *sp = sp[-1]; ++sp; VM_DISPATCH(); }
+  VM_CASE(LoadLocal) { *sp++ = base[read_immediate<uint16_t>(pc)]; pc += 2; VM_DISPATCH(); }
+  VM_CASE(StoreLocal) { base[read_immediate<uint16_t>(pc)] = *--sp; pc += 2; VM_DISPATCH(); }
+  VM_CASE(Jump) { pc = code + read_immediate<uint32_t>(pc); VM_DISPATCH(); }
+  VM_CASE(JumpIfFalse) {
+    --sp;
+    pc = sp->i == 0 ? code + read_immediate<uint32_t>(pc) : pc + 4;
+    VM_DISPATCH();
+  }
+  VM_CASE(Call) {
+    const auto& callee = m_module.functions[read_immediate<uint32_t>(pc)];
+    pc += 4;
+    VmSlot* const callee_base = sp - callee.params;
+    if (frame == frames_end || callee_base + callee.locals + callee.max_stack > stack_end) return VmStatus::StackOverflow;
+    *frame++ = {function, pc, base};
+    std::fill(sp, callee_base + callee.locals, VmSlot{0});
+    function = &callee;
+    base = callee_base;
+    sp = base + callee.locals;
+    code = callee.code.data();
+    pc = code;
+    VM_DISPATCH();
+  }
+  VM_CASE(Return) {
+    const auto value = sp[-1];
+    if (frame == frames_begin) {
+      result = value;
+      return VmStatus::Ok;
+    }
+    // the arguments are consumed together with the callee frame
+    sp = base;
+    --frame;
+    function = frame->function;
+    pc = frame->return_pc;
+    base = frame->base;
+    code = function->code.data();
+    *sp++ = value;
+    VM_DISPATCH();
+  }
+  VM_CASE(ReturnVoid) {
+    if (frame == frames_begin) return VmStatus::Ok;
+    sp = base;
+    --frame;
+    function = frame->function;
+    pc = frame->return_pc;
+    base = frame->base;
+    code = function->code.data();
+    VM_DISPATCH();
+  }
+
+  VM_INT_OPS(I8, int8_t)
+  VM_INT_OPS(I16, int16_t)
+  VM_INT_OPS(I32, int32_t)
+  VM_INT_OPS(U8, uint8_t)
+  VM_INT_OPS(U16, uint16_t)
+  VM_INT_OPS(U32, uint32_t)
+  VM_FLOAT_OPS(F32, float, f32)
+  VM_FLOAT_OPS(F64, double, f64)
+
+#if !VM_COMPUTED_GOTO
+      default:
+        return VmStatus::InvalidOpcode;
+    }
+  }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+}
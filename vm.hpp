@@ -0,0 +1,48 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include "bytecode.hpp"
+#include <cstdint>
+#include <vector>
+
+// One operand stack or local slot. Integers are kept sign or zero extended
+// from their width, floats live in the member of their type.
+union VmSlot {
+  int64_t i;
+  float f32;
+  double f64;
+};
+
+enum class VmStatus { Ok, DivisionByZero, StackOverflow, InvalidOpcode, IndexOutOfRange, InvalidTask };
+
+// Interpreter for the stack bytecode of bytecode.hpp. Locals and operand
+// stacks of all active calls share one preallocated slot array: a callee's
+// frame starts at the arguments its caller pushed, followed by the other
+// locals and its operand stack, so calls copy nothing. The loop dispatches
+// with computed goto when the compiler supports labels as values and falls
+// back to a switch otherwise or when SMALLANG_VM_SWITCH is defined.
+class Vm {
+public:
+  Vm(const BytecodeModule& module, uint32_t stack_slots = 1 << 20, uint32_t max_frames = 1 << 16)
+    : m_module(module), m_stack(stack_slots), m_frames(max_frames) {}
+  Vm(const Vm&) = delete;
+  Vm(Vm&&) = delete;
+  Vm& operator=(const Vm&) = delete;
+  Vm& operator=(Vm&&) = delete;
+
+  // result is left untouched for functions without a return value
+  VmStatus call(uint32_t function, const std::vector<VmSlot>& args, VmSlot& result);
+
+private:
+  struct Frame {
+    const BytecodeFunction* function;
+    const uint8_t* return_pc;
+    VmSlot* base;
+  };
+
+  const BytecodeModule& m_module;
+  std::vector<VmSlot> m_stack;
+  std::vector<Frame> m_frames;
+};
+
+#endif  // VM_HPP
@@ -0,0 +1,70 @@
+#ifndef X86_64_HPP
+#define X86_64_HPP
+
+#include <cstdint>
+
+// x86-64 registers numbered by their encoding, xmm registers follow the
+// general purpose ones.
+enum class X86Reg : uint8_t {
+  Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  Xmm0, Xmm1, Xmm2, Xmm3, Xmm4, Xmm5, Xmm6, Xmm7,
+  Xmm8, Xmm9, Xmm10, Xmm11, Xmm12, Xmm13, Xmm14, Xmm15,
+  None = 0xff,
+};
+
+static const uint32_t X86RegCount = 32;
+
+enum class X86RegClass : uint8_t { Gpr, Xmm };
+
+inline uint8_t x86_encoding(X86Reg reg) { return static_cast<uint8_t>(reg) & 15; }
+
+inline X86RegClass x86_reg_class(X86Reg reg) {
+  return static_cast<uint8_t>(reg) >= static_cast<uint8_t>(X86Reg::Xmm0) ? X86RegClass::Xmm : X86RegClass::Gpr;
+}
+
+// registers a call may clobber under the System V ABI
+inline bool x86_is_caller_saved(X86Reg reg) {
+  switch (reg) {
+    case X86Reg::Rbx:
+    case X86Reg::Rsp:
+    case X86Reg::Rbp:
+    case X86Reg::R12:
+    case X86Reg::R13:
+    case X86Reg::R14:
+    case X86Reg::R15:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// r11 and xmm15 are kept free as scratch registers for spill code and
+// parallel moves; caller saved registers come first so that short lived
+// values do not force callee saved registers to be preserved
+static const X86Reg X86GprAllocationOrder[] = {
+  X86Reg::Rax, X86Reg::Rcx, X86Reg::Rdx, X86Reg::Rsi, X86Reg::Rdi,
+  X86Reg::R8, X86Reg::R9, X86Reg::R10,
+  X86Reg::Rbx, X86Reg::R12, X86Reg::R13, X86Reg::R14, X86Reg::R15,
+};
+
+static const X86Reg X86XmmAllocationOrder[] = {
+  X86Reg::Xmm0, X86Reg::Xmm1, X86Reg::Xmm2, X86Reg::Xmm3, X86Reg::Xmm4,
+  X86Reg::Xmm5, X86Reg::Xmm6, X86Reg::Xmm7, X86Reg::Xmm8, X86Reg::Xmm9,
+  X86Reg::Xmm10, X86Reg::Xmm11, X86Reg::Xmm12, X86Reg::Xmm13, X86Reg::Xmm14,
+};
+
+static const X86Reg X86GprScratch = X86Reg::R11;
+static const X86Reg X86XmmScratch = X86Reg::Xmm15;
+
+inline const char* x86_reg_name(X86Reg reg) {
+  static const char* names[X86RegCount] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+    "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+  };
+  return reg == X86Reg::None ? "none" : names[static_cast<uint8_t>(reg)];
+}
+
+#endif  // X86_64_HPP
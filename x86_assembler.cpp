@@ -0,0 +1,408 @@
+#include "x86_assembler.hpp"
+
+static const uint32_t UnboundLabel = UINT32_MAX;
+
+static bool is_xmm(X86Reg reg) { return x86_reg_class(reg) == X86RegClass::Xmm; }
+
+X86Label X86Assembler::new_label() {
+  m_labels.emplace_back(UnboundLabel);
+  return m_labels.size() - 1;
+}
+
+void X86Assembler::bind(X86Label label) { m_labels[label] = size(); }
+
+bool X86Assembler::finish() {
+  for (const auto& fixup : m_fixups) {
+    if (m_labels[fixup.label] == UnboundLabel) return false;
+    const int32_t rel = static_cast<int32_t>(m_labels[fixup.label]) + fixup.addend - static_cast<int32_t>(fixup.offset + 4);
+    for (uint32_t i = 0; i < 4; ++i) m_code[fixup.offset + i] = static_cast<uint8_t>(static_cast<uint32_t>(rel) >> (8 * i));
+  }
+  m_fixups.clear();
+  return true;
+}
+
+void X86Assembler::bytes(uint64_t value, uint32_t size) {
+  for (uint32_t i = 0; i < size; ++i) byte(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void X86Assembler::align(uint32_t alignment, uint8_t fill) {
+  while (size() % alignment) byte(fill);
+}
+
+void X86Assembler::rex(bool w, uint8_t reg, const X86Operand& rm, bool byte_regs) {
+  uint8_t bits = (w ? 8 : 0) | ((reg & 8) ? 4 : 0);
+  // spl, bpl, sil and dil need a rex prefix to not mean ah, ch, dh and bh
+  bool force = byte_regs && reg >= 4 && reg < 8;
+  if (rm.is_reg()) {
+    const auto b = x86_encoding(rm.reg);
+    bits |= (b & 8) ? 1 : 0;
+    force = force || (byte_regs && b >= 4 && b < 8 && !is_xmm(rm.reg));
+  } else if (rm.is_mem()) {
+    if (rm.mem.index != X86Reg::None && (x86_encoding(rm.mem.index) & 8)) bits |= 2;
+    if (rm.mem.base != X86Reg::None && (x86_encoding(rm.mem.base) & 8)) bits |= 1;
+  }
+  if (bits || force) byte(0x40 | bits);
+}
+
+void X86Assembler::modrm(uint8_t reg, const X86Operand& rm, uint32_t imm_size) {
+  reg &= 7;
+  if (rm.is_reg()) {
+    byte(0xc0 | (reg << 3) | (x86_encoding(rm.reg) & 7));
+    return;
+  }
+  const auto& mem = rm.mem;
+  if (mem.base == X86Reg::None) {
+    byte((reg << 3) | 5);
+    m_fixups.push_back({size(), mem.label, mem.disp - static_cast<int32_t>(imm_size)});
+    bytes(0, 4);
+    return;
+  }
+  const auto base = x86_encoding(mem.base) & 7;
+  // rbp and r13 have no form without displacement
+  uint8_t mod = 2;
+  if (mem.disp == 0 && base != 5) {
+    mod = 0;
+  } else if (x86_fits_int8(mem.disp)) {
+    mod = 1;
+  }
+  if (mem.index != X86Reg::None || base == 4) {
+    byte((mod << 6) | (reg << 3) | 4);
+    const uint8_t scale = mem.scale == 8 ? 3 : mem.scale == 4 ? 2 : mem.scale == 2 ? 1 : 0;
+    const uint8_t index = mem.index == X86Reg::None ? 4 : x86_encoding(mem.index) & 7;
+    byte((scale << 6) | (index << 3) | base);
+  } else {
+    byte((mod << 6) | (reg << 3) | base);
+  }
+  if (mod == 1) byte(static_cast<uint8_t>(mem.disp));
+  if (mod == 2) bytes(static_cast<uint32_t>(mem.disp), 4);
+}
+
+void X86Assembler::op(uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, uint8_t reg,
+                      const X86Operand& rm, uint32_t imm_size, bool byte_regs) {
+  if (prefix) byte(prefix);
+  rex(w, reg, rm, byte_regs);
+  for (auto b : opcode) byte(b);
+  modrm(reg, rm, imm_size);
+}
+
+void X86Assembler::rel32(X86Label label) {
+  m_fixups.push_back({size(), label, 0});
+  bytes(0, 4);
+}
+
+void X86Assembler::mov(uint32_t size, const X86Operand& dst, const X86Operand& src) {
+  if (dst.is_reg() && is_xmm(dst.reg)) {
+    if (src.is_reg() && is_xmm(src.reg)) {
+      // movaps copies the whole register and has the shortest encoding
+      simd(0, 0x0f, 0x28, false, x86_encoding(dst.reg), 0, src);
+    } else if (src.is_reg()) {
+      simd(0x66, 0x0f, 0x6e, size == 8, x86_encoding(dst.reg), 0, src);
+    } else {
+      simd(size == 8 ? 0xf2 : 0xf3, 0x0f, 0x10, false, x86_encoding(dst.reg), 0, src);
+    }
+    return;
+  }
+  if (src.is_reg() && is_xmm(src.reg)) {
+    if (dst.is_reg()) {
+      simd(0x66, 0x0f, 0x7e, size == 8, x86_encoding(src.reg), 0, dst);
+    } else {
+      simd(size == 8 ? 0xf2 : 0xf3, 0x0f, 0x11, false, x86_encoding(src.reg), 0, dst);
+    }
+    return;
+  }
+
+  const uint8_t prefix = size == 2 ? 0x66 : 0;
+  const bool w = size == 8;
+  if (src.is_imm()) {
+    if (dst.is_reg()) {
+      const auto encoding = x86_encoding(dst.reg);
+      if (size == 8 && !x86_fits_int32(src.imm) && (src.imm < 0 || src.imm > UINT32_MAX)) {
+        rex(true, 0, dst, false);
+        byte(0xb8 | (encoding & 7));
+        bytes(src.imm, 8);
+      } else if (size == 8 && x86_fits_int32(src.imm) && src.imm < 0) {
+        op(0, true, {0xc7}, 0, dst, 4);
+        bytes(src.imm, 4);
+      } else {
+        // 32 bit moves zero extend, which covers every smaller size
+        rex(false, 0, dst, false);
+        byte(0xb8 | (encoding & 7));
+        bytes(src.imm, 4);
+      }
+      return;
+    }
+    const uint32_t imm_size = size == 8 ? 4 : size;
+    op(prefix, w, {static_cast<uint8_t>(size == 1 ? 0xc6 : 0xc7)}, 0, dst, imm_size);
+    bytes(src.imm, imm_size);
+    return;
+  }
+  const uint8_t store = size == 1 ? 0x88 : 0x89;
+  if (src.is_reg()) {
+    op(prefix, w, {store}, x86_encoding(src.reg), dst, 0, size == 1);
+  } else {
+    op(prefix, w, {static_cast<uint8_t>(store + 2)}, x86_encoding(dst.reg), src, 0, size == 1);
+  }
+}
+
+void X86Assembler::extend(X86Reg dst, const X86Operand& src, uint32_t src_size, bool is_signed) {
+  const uint8_t opcode = (is_signed ? 0xbe : 0xb6) + (src_size == 2 ? 1 : 0);
+  op(0, false, {0x0f, opcode}, x86_encoding(dst), src, 0, src_size == 1);
+}
+
+void X86Assembler::extend32(X86Reg dst, const X86Operand& src) {
+  op(0, true, {0x63}, x86_encoding(dst), src);
+}
+
+void X86Assembler::lea(uint32_t size, X86Reg dst, const X86Mem& mem) {
+  op(0, size == 8, {0x8d}, x86_encoding(dst), X86Operand::make_mem(mem));
+}
+
+uint32_t X86Assembler::lea_rip(X86Reg dst) {
+  const auto reg = x86_encoding(dst);
+  byte(0x48 | ((reg & 8) ? 4 : 0));
+  byte(0x8d);
+  byte(0x05 | (reg & 7) << 3);
+  const auto offset = size();
+  bytes(0, 4);
+  return offset;
+}
+
+void X86Assembler::alu(X86Alu alu_op, uint32_t size, const X86Operand& dst, const X86Operand& src) {
+  const auto code = static_cast<uint8_t>(alu_op);
+  const bool w = size == 8;
+  const uint8_t prefix = size == 2 ? 0x66 : 0;
+  if (src.is_imm()) {
+    if (size == 1) {
+      op(prefix, w, {0x80}, code, dst, 1, true);
+      byte(static_cast<uint8_t>(src.imm));
+    } else if (x86_fits_int8(src.imm)) {
+      op(prefix, w, {0x83}, code, dst, 1);
+      byte(static_cast<uint8_t>(src.imm));
+    } else {
+      const uint32_t imm_size = size == 2 ? 2 : 4;
+      op(prefix, w, {0x81}, code, dst, imm_size);
+      bytes(src.imm, imm_size);
+    }
+    return;
+  }
+  const uint8_t base = code << 3;
+  if (src.is_reg()) {
+    op(prefix, w, {static_cast<uint8_t>(base | (size == 1 ? 0 : 1))}, x86_encoding(src.reg), dst, 0, size == 1);
+  } else {
+    op(prefix, w, {static_cast<uint8_t>(base | (size == 1 ? 2 : 3))}, x86_encoding(dst.reg), src, 0, size == 1);
+  }
+}
+
+void X86Assembler::test(uint32_t size, X86Reg a, X86Reg b) {
+  op(0, size == 8, {0x85}, x86_encoding(b), X86Operand::make_reg(a));
+}
+
+void X86Assembler::imul(uint32_t size, X86Reg dst, const X86Operand& src) {
+  op(0, size == 8, {0x0f, 0xaf}, x86_encoding(dst), src);
+}
+
+void X86Assembler::imul(uint32_t size, X86Reg dst, const X86Operand& src, int32_t imm) {
+  if (x86_fits_int8(imm)) {
+    op(0, size == 8, {0x6b}, x86_encoding(dst), src, 1);
+    byte(static_cast<uint8_t>(imm));
+  } else {
+    op(0, size == 8, {0x69}, x86_encoding(dst), src, 4);
+    bytes(static_cast<uint32_t>(imm), 4);
+  }
+}
+
+void X86Assembler::neg(uint32_t size, X86Reg reg) {
+  op(0, size == 8, {0xf7}, 3, X86Operand::make_reg(reg));
+}
+
+void X86Assembler::sign_extend_accumulator(uint32_t size) {
+  if (size == 8) byte(0x48);
+  byte(0x99);
+}
+
+void X86Assembler::div(uint32_t size, X86Reg divisor, bool is_signed) {
+  op(0, size == 8, {0xf7}, is_signed ? 7 : 6, X86Operand::make_reg(divisor));
+}
+
+void X86Assembler::push(const X86Operand& operand) {
+  if (operand.is_reg()) {
+    const auto encoding = x86_encoding(operand.reg);
+    if (encoding & 8) byte(0x41);
+    byte(0x50 | (encoding & 7));
+  } else if (operand.is_mem()) {
+    op(0, false, {0xff}, 6, operand);
+  } else {
+    // sign extended to 64 bits
+    byte(0x68);
+    bytes(operand.imm, 4);
+  }
+}
+
+void X86Assembler::pop(X86Reg reg) {
+  const auto encoding = x86_encoding(reg);
+  if (encoding & 8) byte(0x41);
+  byte(0x58 | (encoding & 7));
+}
+
+void X86Assembler::setcc(X86Condition condition, X86Reg reg) {
+  op(0, false, {0x0f, static_cast<uint8_t>(0x90 | static_cast<uint8_t>(condition))}, 0, X86Operand::make_reg(reg), 0, true);
+}
+
+void X86Assembler::jcc(X86Condition condition, X86Label label) {
+  byte(0x0f);
+  byte(0x80 | static_cast<uint8_t>(condition));
+  rel32(label);
+}
+
+void X86Assembler::jmp(X86Label label) {
+  byte(0xe9);
+  rel32(label);
+}
+
+uint32_t X86Assembler::call() {
+  byte(0xe8);
+  const auto offset = size();
+  bytes(0, 4);
+  return offset;
+}
+
+void X86Assembler::call(const X86Operand& target) {
+  op(0, false, {0xff}, 2, target);
+}
+
+void X86Assembler::sse(X86Sse sse_op, uint32_t size, X86Reg dst, const X86Operand& src) {
+  const auto reg = x86_encoding(dst);
+  simd(size == 8 ? 0xf2 : 0xf3, 0x0f, static_cast<uint8_t>(sse_op), false, reg, reg, src);
+}
+
+void X86Assembler::ucomis(uint32_t size, X86Reg a, const X86Operand& b) {
+  simd(size == 8 ? 0x66 : 0, 0x0f, 0x2e, false, x86_encoding(a), 0, b);
+}
+
+void X86Assembler::xorps(X86Reg dst, const X86Operand& src) {
+  simd(0, 0x0f, 0x57, false, x86_encoding(dst), x86_encoding(dst), src);
+}
+
+void X86Assembler::movups(const X86Operand& dst, const X86Operand& src, bool wide) {
+  if (dst.is_reg() && src.is_reg()) {
+    simd(0, 0x0f, 0x28, false, x86_encoding(dst.reg), 0, src, wide);
+  } else if (dst.is_reg()) {
+    simd(0, 0x0f, 0x10, false, x86_encoding(dst.reg), 0, src, wide);
+  } else {
+    simd(0, 0x0f, 0x11, false, x86_encoding(src.reg), 0, dst, wide);
+  }
+}
+
+void X86Assembler::packed(X86Packed packed_op, X86Reg dst, const X86Operand& src, bool wide) {
+  struct Encoding {
+    uint8_t prefix;
+    uint16_t map;
+    uint8_t opcode;
+  };
+  // indexed by X86Packed
+  static const Encoding encodings[] = {
+    {0, 0x0f, 0x58}, {0, 0x0f, 0x5c}, {0, 0x0f, 0x59}, {0, 0x0f, 0x5e},
+    {0, 0x0f, 0x54}, {0, 0x0f, 0x55}, {0, 0x0f, 0x57},
+    {0x66, 0x0f, 0x58}, {0x66, 0x0f, 0x5c}, {0x66, 0x0f, 0x59}, {0x66, 0x0f, 0x5e},
+    {0x66, 0x0f, 0xfe}, {0x66, 0x0f, 0xfa}, {0x66, 0x0f38, 0x40}, {0x66, 0x0f, 0xdb},
+    {0x66, 0x0f, 0xdf}, {0x66, 0x0f, 0xef}, {0x66, 0x0f, 0x76}, {0x66, 0x0f, 0x66},
+  };
+  const auto& encoding = encodings[static_cast<uint8_t>(packed_op)];
+  const auto reg = x86_encoding(dst);
+  simd(encoding.prefix, encoding.map, encoding.opcode, false, reg, reg, src, wide);
+}
+
+void X86Assembler::cmpps(X86PackedCompare predicate, X86Reg dst, const X86Operand& src, bool wide) {
+  simd(0, 0x0f, 0xc2, false, x86_encoding(dst), x86_encoding(dst), src, wide, 1);
+  byte(static_cast<uint8_t>(predicate));
+}
+
+void X86Assembler::pshufd(X86Reg dst, const X86Operand& src, uint8_t imm) {
+  simd(0x66, 0x0f, 0x70, false, x86_encoding(dst), 0, src, false, 1);
+  byte(imm);
+}
+
+void X86Assembler::shufps(X86Reg dst, const X86Operand& src, uint8_t imm, bool wide) {
+  simd(0, 0x0f, 0xc6, false, x86_encoding(dst), x86_encoding(dst), src, wide, 1);
+  byte(imm);
+}
+
+void X86Assembler::insertps(X86Reg dst, const X86Operand& src, uint8_t imm) {
+  simd(0x66, 0x0f3a, 0x21, false, x86_encoding(dst), x86_encoding(dst), src, false, 1);
+  byte(imm);
+}
+
+void X86Assembler::pinsrd(X86Reg dst, const X86Operand& src, uint8_t lane) {
+  simd(0x66, 0x0f3a, 0x22, false, x86_encoding(dst), x86_encoding(dst), src, false, 1);
+  byte(lane);
+}
+
+void X86Assembler::pextrd(const X86Operand& dst, X86Reg src, uint8_t lane) {
+  simd(0x66, 0x0f3a, 0x16, false, x86_encoding(src), 0, dst, false, 1);
+  byte(lane);
+}
+
+void X86Assembler::vblendps(X86Reg dst, X86Reg a, const X86Operand& b, uint8_t imm, bool wide) {
+  simd(0x66, 0x0f3a, 0x0c, false, x86_encoding(dst), x86_encoding(a), b, wide, 1);
+  byte(imm);
+}
+
+void X86Assembler::vinsertf128(X86Reg dst, X86Reg a, const X86Operand& src, uint8_t half) {
+  simd(0x66, 0x0f3a, 0x18, false, x86_encoding(dst), x86_encoding(a), src, true, 1);
+  byte(half);
+}
+
+void X86Assembler::vextractf128(const X86Operand& dst, X86Reg src, uint8_t half) {
+  simd(0x66, 0x0f3a, 0x19, false, x86_encoding(src), 0, dst, true, 1);
+  byte(half);
+}
+
+void X86Assembler::vbroadcastss(X86Reg dst, const X86Mem& src, bool wide) {
+  simd(0x66, 0x0f38, 0x18, false, x86_encoding(dst), 0, X86Operand::make_mem(src), wide);
+}
+
+void X86Assembler::vpermps(X86Reg dst, X86Reg indices, const X86Operand& src) {
+  simd(0x66, 0x0f38, 0x16, false, x86_encoding(dst), x86_encoding(indices), src, true);
+}
+
+void X86Assembler::vzeroupper() {
+  byte(0xc5);
+  byte(0xf8);
+  byte(0x77);
+}
+
+void X86Assembler::simd(uint8_t prefix, uint16_t map, uint8_t opcode, bool w, uint8_t reg, uint8_t a,
+                        const X86Operand& rm, bool wide, uint32_t imm_size) {
+  if (!m_vex) {
+    if (map == 0x0f) {
+      op(prefix, w, {0x0f, opcode}, reg, rm, imm_size);
+    } else {
+      op(prefix, w, {0x0f, static_cast<uint8_t>(map), opcode}, reg, rm, imm_size);
+    }
+    return;
+  }
+  // the legacy prefix and map become fields, register extension bits are
+  // stored inverted like the source register
+  const uint8_t pp = prefix == 0x66 ? 1 : prefix == 0xf3 ? 2 : prefix == 0xf2 ? 3 : 0;
+  const uint8_t mmmmm = map == 0x0f ? 1 : map == 0x0f38 ? 2 : 3;
+  bool x = false;
+  bool b = false;
+  if (rm.is_reg()) {
+    b = x86_encoding(rm.reg) & 8;
+  } else if (rm.is_mem()) {
+    x = rm.mem.index != X86Reg::None && (x86_encoding(rm.mem.index) & 8);
+    b = rm.mem.base != X86Reg::None && (x86_encoding(rm.mem.base) & 8);
+  }
+  const uint8_t r = (reg & 8) ? 0 : 0x80;
+  const uint8_t tail = static_cast<uint8_t>((~a & 15) << 3) | (wide ? 4 : 0) | pp;
+  if (mmmmm == 1 && !w && !x && !b) {
+    byte(0xc5);
+    byte(r | tail);
+  } else {
+    byte(0xc4);
+    byte(r | (x ? 0 : 0x40) | (b ? 0 : 0x20) | mmmmm);
+    byte((w ? 0x80 : 0) | tail);
+  }
+  byte(opcode);
+  modrm(reg, rm, imm_size);
+}
@@ -0,0 +1,208 @@
+#ifndef X86_ASSEMBLER_HPP
+#define X86_ASSEMBLER_HPP
+
+#include "x86_64.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// condition codes in their encoding order, cc ^ 1 is the negation
+enum class X86Condition : uint8_t {
+  Overflow, NoOverflow, Below, AboveOrEqual, Equal, NotEqual, BelowOrEqual, Above,
+  Sign, NoSign, Parity, NoParity, Less, GreaterOrEqual, LessOrEqual, Greater,
+};
+
+inline X86Condition x86_negate(X86Condition condition) {
+  return static_cast<X86Condition>(static_cast<uint8_t>(condition) ^ 1);
+}
+
+using X86Label = uint32_t;
+
+// [base + index * scale + disp], without a base the address is rip relative
+// to label + disp
+struct X86Mem {
+  X86Reg base = X86Reg::None;
+  X86Reg index = X86Reg::None;
+  uint8_t scale = 1;
+  int32_t disp = 0;
+  X86Label label = 0;
+
+  static X86Mem at(X86Reg base, int32_t disp = 0) {
+    X86Mem mem;
+    mem.base = base;
+    mem.disp = disp;
+    return mem;
+  }
+  static X86Mem rip(X86Label label, int32_t disp = 0) {
+    X86Mem mem;
+    mem.label = label;
+    mem.disp = disp;
+    return mem;
+  }
+};
+
+struct X86Operand {
+  enum class Kind : uint8_t { Reg, Mem, Imm };
+
+  Kind kind = Kind::Imm;
+  X86Reg reg = X86Reg::None;
+  X86Mem mem;
+  int64_t imm = 0;
+
+  static X86Operand make_reg(X86Reg reg) {
+    X86Operand operand;
+    operand.kind = Kind::Reg;
+    operand.reg = reg;
+    return operand;
+  }
+  static X86Operand make_mem(const X86Mem& mem) {
+    X86Operand operand;
+    operand.kind = Kind::Mem;
+    operand.mem = mem;
+    return operand;
+  }
+  static X86Operand make_imm(int64_t imm) {
+    X86Operand operand;
+    operand.imm = imm;
+    return operand;
+  }
+
+  bool is_reg() const { return kind == Kind::Reg; }
+  bool is_mem() const { return kind == Kind::Mem; }
+  bool is_imm() const { return kind == Kind::Imm; }
+  bool is(X86Reg other) const { return kind == Kind::Reg && reg == other; }
+};
+
+enum class X86Alu : uint8_t { Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7 };
+
+// scalar SSE arithmetic, the opcode byte after 0f
+enum class X86Sse : uint8_t { Add = 0x58, Mul = 0x59, Sub = 0x5c, Div = 0x5e };
+
+// packed single and double precision and doubleword operations of the
+// form dst = dst op src, see the encoding table in x86_assembler.cpp
+enum class X86Packed : uint8_t {
+  AddPs, SubPs, MulPs, DivPs, AndPs, AndNPs, XorPs, AddPd, SubPd, MulPd, DivPd,
+  PAddD, PSubD, PMulLD, PAnd, PAndN, PXor, PCmpEqD, PCmpGtD,
+};
+
+// cmpps predicates, false when an operand is NaN
+enum class X86PackedCompare : uint8_t { Equal = 0, Less = 1, LessOrEqual = 2 };
+
+inline bool x86_fits_int8(int64_t value) { return value >= INT8_MIN && value <= INT8_MAX; }
+inline bool x86_fits_int32(int64_t value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+// Encoder for the subset of x86-64 the code generator selects. Operand
+// sizes are given in bytes; 32 bit operations zero the upper half of their
+// destination. Jumps always take a rel32 and rip relative operands a
+// disp32, both are patched by finish() once every label is bound. With
+// VEX on, every xmm instruction is VEX encoded, which AVX needs for 32
+// byte ymm operations and to not pay for mixing them with legacy SSE;
+// wide operations are only available then. Packed memory operands must be
+// 16 byte aligned without VEX.
+class X86Assembler {
+public:
+  X86Assembler() = default;
+  X86Assembler(const X86Assembler&) = delete;
+  X86Assembler(X86Assembler&&) = delete;
+  X86Assembler& operator=(const X86Assembler&) = delete;
+  X86Assembler& operator=(X86Assembler&&) = delete;
+
+  const std::vector<uint8_t>& code() const { return m_code; }
+  uint32_t size() const { return m_code.size(); }
+
+  X86Label new_label();
+  void bind(X86Label label);
+  uint32_t label_offset(X86Label label) const { return m_labels[label]; }
+  // resolves jumps and rip relative operands, false if a label is unbound
+  bool finish();
+
+  void byte(uint8_t value) { m_code.emplace_back(value); }
+  void bytes(uint64_t value, uint32_t size);
+  void align(uint32_t alignment, uint8_t fill);
+
+  // mov of size bytes between a register, memory or an immediate; xmm
+  // registers take the low size bytes
+  void mov(uint32_t size, const X86Operand& dst, const X86Operand& src);
+  // movsx or movzx of a 1 or 2 byte source into a 32 bit register
+  void extend(X86Reg dst, const X86Operand& src, uint32_t src_size, bool is_signed);
+  // movsxd dst, src32
+  void extend32(X86Reg dst, const X86Operand& src);
+  void lea(uint32_t size, X86Reg dst, const X86Mem& mem);
+  // emits lea dst, [rip + rel32] and returns the offset of the displacement
+  uint32_t lea_rip(X86Reg dst);
+  void alu(X86Alu op, uint32_t size, const X86Operand& dst, const X86Operand& src);
+  void test(uint32_t size, X86Reg a, X86Reg b);
+  void imul(uint32_t size, X86Reg dst, const X86Operand& src);
+  void imul(uint32_t size, X86Reg dst, const X86Operand& src, int32_t imm);
+  void neg(uint32_t size, X86Reg reg);
+  // sign extends eax into edx or rax into rdx
+  void sign_extend_accumulator(uint32_t size);
+  void div(uint32_t size, X86Reg divisor, bool is_signed);
+  void push(const X86Operand& operand);
+  void pop(X86Reg reg);
+  void setcc(X86Condition condition, X86Reg reg);
+  void jcc(X86Condition condition, X86Label label);
+  void jmp(X86Label label);
+  // emits call rel32 and returns the offset of the displacement
+  uint32_t call();
+  // call through a register or memory operand
+  void call(const X86Operand& target);
+  void ret() { byte(0xc3); }
+  void ud2() { byte(0x0f); byte(0x0b); }
+
+  void set_vex(bool vex) { m_vex = vex; }
+  bool vex() const { return m_vex; }
+
+  // scalar SSE; size 4 is single, 8 double precision
+  void sse(X86Sse op, uint32_t size, X86Reg dst, const X86Operand& src);
+  void ucomis(uint32_t size, X86Reg a, const X86Operand& b);
+  void xorps(X86Reg dst, const X86Operand& src);
+
+  // packed SSE and AVX; wide operates on all 32 bytes of ymm registers
+  void movups(const X86Operand& dst, const X86Operand& src, bool wide = false);
+  void packed(X86Packed op, X86Reg dst, const X86Operand& src, bool wide = false);
+  void cmpps(X86PackedCompare predicate, X86Reg dst, const X86Operand& src, bool wide = false);
+  // dst lane i = src lane (imm >> 2 * i & 3) within each 16 bytes
+  void pshufd(X86Reg dst, const X86Operand& src, uint8_t imm);
+  void shufps(X86Reg dst, const X86Operand& src, uint8_t imm, bool wide = false);
+  // lane imm >> 6 of a register src or the 4 bytes at a memory src go to
+  // lane imm >> 4 & 3 of dst
+  void insertps(X86Reg dst, const X86Operand& src, uint8_t imm);
+  void pinsrd(X86Reg dst, const X86Operand& src, uint8_t lane);
+  void pextrd(const X86Operand& dst, X86Reg src, uint8_t lane);
+  // VEX only: dst = a with the lanes selected by imm taken from b
+  void vblendps(X86Reg dst, X86Reg a, const X86Operand& b, uint8_t imm, bool wide);
+  // VEX only: 16 byte halves of ymm registers
+  void vinsertf128(X86Reg dst, X86Reg a, const X86Operand& src, uint8_t half);
+  void vextractf128(const X86Operand& dst, X86Reg src, uint8_t half);
+  // VEX only: every lane of dst from a memory src, or lane i from lane
+  // indices[i] of src
+  void vbroadcastss(X86Reg dst, const X86Mem& src, bool wide);
+  void vpermps(X86Reg dst, X86Reg indices, const X86Operand& src);
+  void vzeroupper();
+
+private:
+  struct Fixup {
+    uint32_t offset;
+    X86Label label;
+    int32_t addend;
+  };
+
+  std::vector<uint8_t> m_code;
+  std::vector<uint32_t> m_labels;
+  std::vector<Fixup> m_fixups;
+  bool m_vex = false;
+
+  void rex(bool w, uint8_t reg, const X86Operand& rm, bool byte_regs);
+  void modrm(uint8_t reg, const X86Operand& rm, uint32_t imm_size);
+  // [prefix] [rex] opcode modrm, reg is an encoding or an opcode extension
+  void op(uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, uint8_t reg, const X86Operand& rm,
+          uint32_t imm_size = 0, bool byte_regs = false);
+  void rel32(X86Label label);
+  // an SSE instruction with legacy prefix 0, 66, f3 or f2 and opcode map
+  // 0f, 0f 38 or 0f 3a; VEX encoded with source a in vvvv, 0 for none
+  void simd(uint8_t prefix, uint16_t map, uint8_t opcode, bool w, uint8_t reg, uint8_t a, const X86Operand& rm,
+            bool wide = false, uint32_t imm_size = 0);
+};
+
+#endif  // X86_ASSEMBLER_HPP